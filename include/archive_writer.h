@@ -0,0 +1,201 @@
+#ifndef ARCHIVE_WRITER_H
+#define ARCHIVE_WRITER_H
+
+#include "gbzip.h"
+#include "string_pool.h"
+
+// ============================================================================
+// Sequential ZIP writer - emits local headers, entry data and the central
+// directory directly, so data that was already encoded by the compression
+// workers is stored as-is instead of being re-deflated by libzip.
+// ============================================================================
+
+// ZIP compression methods written by gbzip
+#define ARCHIVE_METHOD_STORE   0
+#define ARCHIVE_METHOD_DEFLATE 8
+#define ARCHIVE_METHOD_ZSTD    93
+
+// Output buffer size for the archive stream
+#define ARCHIVE_WRITE_BUFFER_SIZE (1024 * 1024)  // 1MB
+
+// archive_writer_add_existing() result when the named entry cannot supply the data
+#define ARCHIVE_NO_SOURCE (-1)
+
+// --compact rewrites an appended archive once this share of it is dead space
+#define ARCHIVE_COMPACT_THRESHOLD_PERCENT 25
+
+// Metadata for one entry whose data is already encoded with `method`
+typedef struct {
+    const char* name;            // Archive path (forward slashes, trailing / for directories)
+    uint16_t method;             // ARCHIVE_METHOD_*
+    uint32_t crc32;              // CRC-32 of the uncompressed data
+    uint64_t compressed_size;    // Bytes of encoded data following the local header
+    uint64_t uncompressed_size;
+    time_t mtime;
+    uint32_t mode;               // POSIX mode bits (0 = regular file / directory defaults)
+} archive_entry_info_t;
+
+// Central directory record kept in memory until the archive is closed.
+// Records read back from an existing archive keep the fields gbzip does not
+// write itself; `extra` and `comment` share the allocation of `name`.
+typedef struct {
+    char* name;
+    uint16_t version_made_by;    // 0 for entries written by gbzip
+    uint16_t version_needed;     // Lower bound kept from an existing archive
+    uint16_t flags;
+    uint16_t method;
+    uint16_t dos_time;
+    uint16_t dos_date;
+    uint32_t crc32;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    uint64_t local_header_offset;
+    uint64_t data_offset;        // Start of the entry data (0 for records read back)
+    uint16_t internal_attr;
+    uint32_t external_attr;
+    const unsigned char* extra;  // Extra fields other than Zip64 (which is rebuilt)
+    uint16_t extra_len;
+    const char* comment;
+    uint16_t comment_len;
+    bool removed;                // Superseded or deleted; left out of the central directory
+} archive_cdir_record_t;
+
+typedef struct {
+    FILE* file;
+    char* final_path;            // Archive path, replaced atomically on close
+    char* temp_path;             // Staging file written during the run (NULL when appending)
+    uint64_t offset;             // Current write position
+    bool failed;
+
+    // Stream mode: the archive goes to a stream the caller owns - stdout or
+    // a pipe - that is never seeked, so deferred entries end with a data
+    // descriptor instead of being patched
+    bool stream;
+
+    // Append mode: new entries go after the existing data of final_path,
+    // which is only ever truncated back to append_start on failure
+    bool append;
+    uint64_t append_start;
+    size_t existing_count;       // Leading records read from the existing archive
+    size_t removed_count;
+    size_t* name_index;          // Existing records by name (index + 1), built on first removal
+    size_t name_index_mask;
+
+    // Entry currently being written (between begin/end)
+    bool entry_open;
+    bool entry_deferred;         // CRC and sizes are patched in when the entry ends
+    bool entry_zip64;            // Local header reserved a Zip64 extra field
+    uint64_t entry_expected;
+    uint64_t entry_written;
+
+    archive_cdir_record_t* records;
+    size_t record_count;
+    size_t record_capacity;
+} archive_writer_t;
+
+// Open a staging file next to `path`; the archive only replaces `path` on close
+int archive_writer_open(archive_writer_t* writer, const char* path);
+
+// Write the archive straight to `stream` (stdout or a pipe), which must
+// not have been written to yet. Nothing is staged or moved: close writes
+// the central directory and flushes the stream without closing it, and a
+// failed run leaves a truncated archive behind. `display_name` names the
+// stream in error messages.
+int archive_writer_open_stream(archive_writer_t* writer, FILE* stream, const char* display_name);
+
+// Open the existing archive `path` in place: its central directory is read
+// back, new entries are written after the existing data, and close syncs
+// them to disk before it writes a fresh central directory at the end (and
+// syncs that too). Nothing already in the file is overwritten, and a failed
+// or aborted run truncates it back to its original size. A crash before
+// close returns leaves the old archive intact but followed by new data, so
+// readers that look for the directory at the end may not find it: cutting
+// the file back to just past the old end of central directory record
+// restores it, and zip -FF rebuilds a directory from the local headers.
+// Once the new directory is on disk, so is everything it points to.
+int archive_writer_open_append(archive_writer_t* writer, const char* path);
+
+// Drop every entry named `name` that was in the archive when it was opened
+// for appending; returns how many were removed. Their data stays in the file
+// as dead space until the archive is compacted.
+size_t archive_writer_remove(archive_writer_t* writer, const char* name);
+
+// Add an entry whose encoded data is copied from an entry that was in the
+// archive when it was opened for appending - removed ones included, since
+// their data is still in the file. The source is an entry named
+// `source_name` whose data starts at `data_offset` and whose method, CRC and
+// sizes are those in `info`; when there is none, nothing is written and
+// ARCHIVE_NO_SOURCE is returned.
+int archive_writer_add_existing(archive_writer_t* writer, const archive_entry_info_t* info,
+                                const char* source_name, uint64_t data_offset);
+
+// Streaming entry API: the local header is written from `info` up front,
+// followed by exactly info->compressed_size bytes of data
+int archive_writer_begin_entry(archive_writer_t* writer, const archive_entry_info_t* info);
+int archive_writer_write(archive_writer_t* writer, const void* data, size_t size);
+int archive_writer_end_entry(archive_writer_t* writer);
+
+// Deferred entries are for data encoded on the fly: info->uncompressed_size
+// is the expected input size, and the CRC and final sizes are patched into
+// the local header once the data has been written. In stream mode they are
+// written after the data in a data descriptor (general purpose bit 3) -
+// except that stored entries also give their expected sizes up front, so
+// readers that walk a stream can find their end, and must then match them.
+int archive_writer_begin_deferred_entry(archive_writer_t* writer, const archive_entry_info_t* info);
+int archive_writer_end_deferred_entry(archive_writer_t* writer, uint32_t crc32, uint64_t uncompressed_size);
+
+// Convenience wrappers for entries held entirely in memory
+int archive_writer_add(archive_writer_t* writer, const archive_entry_info_t* info, const void* data);
+int archive_writer_add_directory(archive_writer_t* writer, const char* name, time_t mtime);
+
+// Write the central directory (Zip64 when needed) and move the archive into place
+int archive_writer_close(archive_writer_t* writer);
+
+// Drop the staging file without touching an existing archive
+void archive_writer_abort(archive_writer_t* writer);
+
+// One entry of an archive index: what listing and selecting entries need,
+// without the extra fields and comments a central directory record keeps
+typedef struct {
+    const char* name;            // In the index's string pool
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    uint64_t local_header_offset;
+    uint32_t crc32;
+    uint16_t method;
+    uint16_t dos_time;           // Local time, as stored
+    uint16_t dos_date;
+} archive_index_entry_t;
+
+// Read-only table of an archive's central directory, in central directory
+// order - which is also the index order of libzip
+typedef struct {
+    archive_index_entry_t* entries;
+    size_t count;
+    string_pool_t names;
+} archive_index_t;
+
+// Read the central directory of the archive `path` into `index`
+int archive_index_load(archive_index_t* index, const char* path);
+void archive_index_free(archive_index_t* index);
+
+// Local header offset of every entry of the archive `path`, in central
+// directory order. Free *offsets with free().
+int archive_read_header_offsets(const char* path, uint64_t** offsets, size_t* count);
+
+// Start of the data of the entry whose local header is at `header_offset`
+// in `file`; false if there is no local header there
+bool archive_entry_data_offset(FILE* file, uint64_t header_offset, uint64_t* data_offset);
+
+// CRC-32 of `size` bytes of `file` from `offset`, read through the caller's
+// buffer; false if they cannot all be read
+bool archive_range_crc32(FILE* file, uint64_t offset, uint64_t size, unsigned char* buffer, size_t buffer_size,
+                         uint32_t* crc);
+
+// Rewrite `path` with only the entries its central directory references once
+// at least `threshold_percent` of the file is dead space (superseded entries
+// and old central directories left by appending). Entry data is copied
+// as-is. `reclaimed` receives the bytes saved, 0 when below the threshold.
+int archive_writer_compact(const char* path, unsigned int threshold_percent, uint64_t* reclaimed);
+
+#endif // ARCHIVE_WRITER_H
@@ -0,0 +1,54 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "gbzip.h"
+
+// ============================================================================
+// Batch mode (--batch) - many archives from one manifest in one process.
+// The manifest holds one JSON object per line, an archive and its inputs:
+//
+//   {"archive": "out/customer-1.zip", "inputs": ["data/customer-1", "terms.pdf"]}
+//
+// Blank lines and lines starting with # are skipped. Every archive is
+// written with the options given on the command line.
+//
+// All archives share one compression pool, one parse of the ignore file and
+// one memory budget. Several are written at once, each scanned, compressed
+// and finalized by a runner thread of its own while its compression units
+// go to the shared pool, so the units of small archives fill the workers a
+// large one leaves idle while it scans or finalizes. How many run at once
+// is bounded by the thread count and the open-file limit.
+// ============================================================================
+
+// One archive of the manifest
+typedef struct {
+    char* archive;
+    char** inputs;
+    int input_count;
+    size_t line;                // Manifest line, for messages
+} batch_job_t;
+
+typedef struct {
+    batch_job_t* jobs;
+    size_t count;
+} batch_manifest_t;
+
+// Parse one manifest line into `job`; returns false (and sets `error`) if it
+// is not an object with an "archive" string and a non-empty "inputs" array
+bool batch_parse_line(const char* line, batch_job_t* job, const char** error);
+void batch_job_free(batch_job_t* job);
+
+// Read a whole manifest; a malformed line or an archive named twice fails
+// it, reported on stderr
+int batch_manifest_load(batch_manifest_t* manifest, const char* path);
+void batch_manifest_free(batch_manifest_t* manifest);
+
+// Archives written at once for `job_count` jobs on `threads` workers, given
+// `open_files` descriptors
+int batch_concurrency(size_t job_count, int threads, size_t open_files);
+
+// Create every archive of opts->batch_file; returns EXIT_SUCCESS or the
+// status of the first archive that failed
+int run_batch(const options_t* opts);
+
+#endif // BATCH_H
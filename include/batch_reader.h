@@ -0,0 +1,50 @@
+#ifndef BATCH_READER_H
+#define BATCH_READER_H
+
+#include "gbzip.h"
+
+// ============================================================================
+// Batch reader - reads many small files whole with a handful of system
+// calls. On Linux 5.6+ each batch goes through an io_uring: the opens of up
+// to BATCH_READER_DEPTH files are submitted at once, then their statx calls,
+// their reads and their closes, so a batch costs four io_uring_enter calls
+// instead of four system calls per file and keeps that many requests in
+// flight on the device. Elsewhere, or where io_uring is unavailable
+// (disabled, blocked by seccomp, an older kernel), no reader is created and
+// the compression workers read each file themselves, which is the portable
+// fallback: the worker pool is the thread-pool reader.
+//
+// Nothing is fatal: a file that cannot be opened, is not a regular file, or
+// has grown past the caller's limit is simply not read, and the caller
+// opens it the usual way, which reports the error if there is one.
+// ============================================================================
+
+// Files in flight per batch. Each is an open descriptor until its batch is
+// closed, so the reader of every worker together stays well under the
+// usual 1024 open-file limit.
+#define BATCH_READER_DEPTH 32
+
+// One file to read whole
+typedef struct {
+    const char* path;
+    uint64_t max_size;          // Larger files are left to the caller
+
+    // Results
+    bool read;                  // Contents are in `data`
+    unsigned char* data;        // malloc'd contents (NULL for an empty file); the caller frees it
+    uint64_t size;
+    uint32_t mode;              // POSIX mode bits of the opened file
+} batch_read_t;
+
+typedef struct batch_reader batch_reader_t;
+
+// A reader with its own ring, for use by one thread at a time; NULL where
+// batched reads are not available
+batch_reader_t* batch_reader_create(void);
+void batch_reader_free(batch_reader_t* reader);
+
+// Read the files of `reads` (any number, BATCH_READER_DEPTH at a time);
+// returns how many were read
+size_t batch_reader_read(batch_reader_t* reader, batch_read_t* reads, size_t count);
+
+#endif // BATCH_READER_H
@@ -0,0 +1,19 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include "gbzip.h"
+
+// ============================================================================
+// CRC-32 (the ZIP / zlib polynomial) with the fastest kernel the CPU has:
+// carry-less multiply folding (PCLMULQDQ) on x86, the CRC32 instructions of
+// ARMv8 on AArch64, and libdeflate or zlib tables everywhere else. The
+// kernel is picked once, by CPUID or the kernel's hwcaps, on first use.
+// ============================================================================
+
+// Continue a CRC-32 (start with 0) over a buffer of any size
+uint32_t checksum_crc32(uint32_t crc, const void* data, size_t size);
+
+// Kernel checksum_crc32() runs on: "pclmul", "armv8-crc", "libdeflate" or "zlib"
+const char* checksum_crc32_kernel(void);
+
+#endif // CHECKSUM_H
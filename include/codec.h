@@ -0,0 +1,76 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include "gbzip.h"
+
+// ============================================================================
+// Codecs - the compression backends behind entry data. zlib is always built
+// and encodes input buffer by buffer; libdeflate (raw deflate, faster and
+// denser, whole buffers only) and Zstandard (ZIP method 93, fast to decode
+// but only readable by tools that know it) are compiled in when CMake finds
+// them (GBZIP_HAVE_LIBDEFLATE / GBZIP_HAVE_ZSTD).
+// ============================================================================
+
+// Name given to --codec ("zlib", "libdeflate", "zstd")
+const char* codec_name(codec_id_t codec);
+
+// Look up a codec by name; false for unknown names. Whether the codec was
+// built into this binary is a separate question, see codec_available().
+bool codec_from_name(const char* name, codec_id_t* codec);
+
+bool codec_available(codec_id_t codec);
+
+// Space-separated names of the codecs built into this binary
+const char* codec_available_names(void);
+
+// ZIP compression method of the codec's output
+uint16_t codec_method(codec_id_t codec);
+
+// Name of a ZIP compression method for messages: "store", "deflate", "zstd"
+// or "unknown"
+const char* codec_method_name(uint16_t method);
+
+// Worst-case output size for `input_size` bytes; 0 if the codec is not built
+size_t codec_bound(codec_id_t codec, size_t input_size);
+
+// Whole-buffer compressor with its state kept between calls, so a thread
+// can encode many files without setting the codec up again for each one.
+// `level` is gbzip's 1-9 scale, mapped onto the codec's own.
+typedef struct codec_encoder codec_encoder_t;
+
+codec_encoder_t* codec_encoder_create(codec_id_t codec, int level);
+void codec_encoder_free(codec_encoder_t* encoder);
+uint16_t codec_encoder_method(const codec_encoder_t* encoder);
+size_t codec_encoder_bound(const codec_encoder_t* encoder, size_t input_size);
+
+// Compress all of `input`. Fails when the output does not fit, which cannot
+// happen with output_capacity >= codec_bound().
+int codec_encode(codec_encoder_t* encoder, const void* input, size_t input_size,
+                 void* output, size_t output_capacity, size_t* output_size);
+
+// One-shot codec_encode() without a long-lived encoder
+int codec_compress(codec_id_t codec, int level, const void* input, size_t input_size,
+                   void* output, size_t output_capacity, size_t* output_size);
+
+// Streaming decoder for the data of one entry
+typedef struct codec_decoder codec_decoder_t;
+
+// Whether entry data of `method` can be decoded by a built codec
+bool codec_can_decode(uint16_t method);
+
+codec_decoder_t* codec_decoder_create(uint16_t method);
+void codec_decoder_free(codec_decoder_t* decoder);
+
+// Decode from *input (advancing it and *input_size past what was consumed)
+// into `output`, setting *produced. *finished tells whether the data so far
+// ends a complete stream with nothing left buffered. Returns -1 on corrupt
+// data. Once neither input is consumed nor output produced, the decoder
+// needs more input - or, if *finished, the data is complete.
+int codec_decode(codec_decoder_t* decoder, const unsigned char** input, size_t* input_size,
+                 unsigned char* output, size_t output_capacity, size_t* produced, bool* finished);
+
+// Continue a CRC-32 (start with 0) over a buffer of any size, on the
+// hardware kernel of checksum_crc32()
+uint32_t codec_crc32(uint32_t crc, const void* data, size_t size);
+
+#endif // CODEC_H
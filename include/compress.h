@@ -0,0 +1,78 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "gbzip.h"
+
+// ============================================================================
+// Compression primitives - raw deflate helpers shared by the archive writer
+// paths. Streamed files are deflated in independent blocks on different
+// threads, whose output is written back to back as one valid deflate stream.
+// ============================================================================
+
+// Block size used when splitting one file across threads
+#define COMPRESS_BLOCK_SIZE  (1024 * 1024)   // 1MB
+// Deflate history window; each block is primed with this much preceding data
+#define COMPRESS_WINDOW_SIZE (32 * 1024)     // 32KB
+
+// Incompressible data is stored instead of deflated. A sample of this many
+// leading bytes is trial-compressed when the file name gives no verdict, and
+// the data counts as incompressible unless deflate shrinks the sample to at
+// most COMPRESS_PROBE_MAX_PERCENT of its size.
+#define COMPRESS_PROBE_SIZE        (16 * 1024)        // 16KB
+#define COMPRESS_PROBE_MAX_PERCENT 97
+
+// Why an entry got the compression method it did
+typedef enum {
+    COMPRESS_DEFLATED,              // Deflated as requested
+    COMPRESS_STORED_LEVEL,          // Level 0, or nothing to compress
+    COMPRESS_STORED_EXTENSION,      // File name of an already-compressed format
+    COMPRESS_STORED_PROBE,          // The leading sample did not compress
+    COMPRESS_STORED_EXPANDED,       // Deflate output was no smaller than the data
+    COMPRESS_STORED_SCHEDULE        // Stored to keep to --target-mbps or --deadline
+} compress_decision_t;
+
+// Short name of a decision for structured output ("deflate", "extension", ...)
+const char* compress_decision_name(compress_decision_t decision);
+
+// Whether the extension of `path` is that of a format which is compressed
+// already (images, audio/video, archives); case-insensitive
+bool compress_is_compressed_format(const char* path);
+
+// Whether a sample of a file's leading bytes looks incompressible: its byte
+// entropy is near 8 bits and a fast deflate pass cannot shrink it enough
+bool compress_probe_incompressible(const unsigned char* sample, size_t size);
+
+// One independently compressible slice of a larger input
+typedef struct {
+    const unsigned char* input;
+    size_t input_size;
+    const unsigned char* dictionary;    // Tail of the previous block (NULL for the first)
+    size_t dictionary_size;
+    bool last;                          // Final block ends the stream (BFINAL)
+    int level;
+    codec_id_t codec;                   // CODEC_ZSTD blocks are independent frames;
+                                        // any other codec deflates through zlib
+
+    // Results, filled by compress_block(). A caller-supplied output buffer of
+    // output_capacity >= compress_block_bound(input_size) is used as-is;
+    // otherwise compress_block() allocates one.
+    unsigned char* output;
+    size_t output_capacity;
+    size_t output_size;
+    uint32_t crc32;
+    bool failed;
+} compress_block_t;
+
+// CRC-32 over a buffer of any size (zlib itself takes 32-bit lengths)
+uint32_t compress_crc32(const unsigned char* data, size_t size);
+
+// Worst-case compressed size of one block under any codec, including the
+// deflate sync flush marker
+size_t compress_block_bound(size_t input_size);
+
+// Deflate one block. Non-final blocks end with a sync flush so their output
+// is byte aligned and can be concatenated with the next block's output.
+// Zstandard blocks are compressed into one frame each instead.
+int compress_block(compress_block_t* block);
+
+#endif // COMPRESS_H
@@ -3,6 +3,8 @@
 
 #include "gbzip.h"
 #include "gbzip_zip.h"
+#include "string_pool.h"
+#include "fingerprint.h"
 
 // File change types
 typedef enum {
@@ -12,9 +14,9 @@ typedef enum {
     CHANGE_DELETED
 } change_type_t;
 
-// File change information
+// File change information; `path` is owned by the diff context
 typedef struct {
-    char path[PATH_MAX];
+    const char* path;
     change_type_t change_type;
     time_t old_mtime;
     time_t new_mtime;
@@ -27,6 +29,9 @@ typedef struct {
     file_change_t* changes;
     size_t change_count;
     size_t change_capacity;
+    string_pool_t paths;        // Storage for the changes' paths
+    fingerprint_cache_t* cache; // Sidecar fingerprint cache (NULL without --cache)
+    const zipignore_t* home_rules; // ~/.zipignore already parsed (NULL: read it)
     char* base_dir;
     char* zip_file;
 } diff_context_t;
@@ -34,7 +39,7 @@ typedef struct {
 // Function prototypes
 int diff_zip(const options_t* opts);
 int compare_with_existing_zip(const char* zip_file, const char* directory, diff_context_t* diff_ctx);
-int apply_changes_to_zip(const char* zip_file, const diff_context_t* diff_ctx, bool verbose);
+int apply_changes_to_zip(const char* zip_file, const diff_context_t* diff_ctx, const options_t* opts);
 
 // Internal helper functions
 int add_change(diff_context_t* diff_ctx, const char* path, change_type_t type, 
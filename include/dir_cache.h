@@ -0,0 +1,38 @@
+#ifndef DIR_CACHE_H
+#define DIR_CACHE_H
+
+#include "gbzip.h"
+
+// ============================================================================
+// Directory cache - the set of directories an extraction needs, collected
+// from the central directory so the whole skeleton is created once, parents
+// first, instead of re-stat'ing every ancestor for every file.
+// ============================================================================
+
+// Hash set of relative directory paths ('/'-separated, no trailing slash)
+typedef struct {
+    char** slots;               // Open addressing; NULL marks an empty slot
+    size_t capacity;            // Power of two
+    size_t count;
+} dir_cache_t;
+
+void dir_cache_init(dir_cache_t* cache);
+void dir_cache_free(dir_cache_t* cache);
+
+// Whether the first `len` bytes of `path` are in the set
+bool dir_cache_contains(const dir_cache_t* cache, const char* path, size_t len);
+
+// Add the first `len` bytes of `path`; returns 1 if added, 0 if already
+// present, -1 when out of memory
+int dir_cache_add(dir_cache_t* cache, const char* path, size_t len);
+
+// Add every directory an archive entry needs: the entry itself for names
+// ending in '/', otherwise its parent, plus all of their ancestors
+int dir_cache_add_entry(dir_cache_t* cache, const char* entry_name);
+
+// Create every directory in the set under `root` (which must exist), parents
+// before children. On POSIX each directory is made with mkdirat() relative
+// to its already-open parent, so no path is resolved more than once.
+int dir_cache_create_all(const dir_cache_t* cache, const char* root);
+
+#endif // DIR_CACHE_H
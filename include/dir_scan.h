@@ -0,0 +1,26 @@
+#ifndef DIR_SCAN_H
+#define DIR_SCAN_H
+
+#include "gbzip.h"
+#include "utils.h"
+
+// ============================================================================
+// Directory scanner - lists directories on a pool of threads (one fstatat()
+// per entry against the open directory, none when d_type rules the entry
+// out) while the callbacks run on the calling thread in a fixed order.
+// ============================================================================
+
+// Upper bound on scanner threads; listing is I/O bound, so this is about
+// keeping enough requests in flight on network filesystems
+#define DIR_SCAN_MAX_THREADS 16
+
+// Invoke `callback` for every regular file and directory under `root`, in
+// depth-first pre-order with the entries of each directory sorted by name,
+// so the order never depends on readdir() or thread timing. A directory's
+// callback runs before anything inside it; returning TRAVERSE_SKIP_SUBTREE
+// from it leaves the directory's contents unlisted. Any other result than
+// EXIT_SUCCESS from the callback, or a directory that cannot be read, stops
+// the scan and is returned.
+int dir_scan(const char* root, bool recursive, file_callback_t callback, void* user_data);
+
+#endif // DIR_SCAN_H
@@ -0,0 +1,26 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "gbzip.h"
+#include "libgbzip.h"
+
+// ============================================================================
+// The engine behind libgbzip.h as the gbzip command drives it. The command
+// creates an engine from its -I, --threads, --memory-limit and
+// --buffer-size, and runs create, update and extract on it like the public
+// calls do, with the engine's pool, parsed ignore rules and locking. It hands
+// over the full options_t of its command line, where the public calls fill
+// one from gbzip_options_t, and keeps the console for its output.
+// ============================================================================
+
+typedef int (*engine_operation_t)(const options_t* opts);
+
+// An engine set up from the command line's options
+gbzip_engine_t* engine_new_for_options(const options_t* opts);
+
+// Run `operation` with `opts` on the engine's pool and ignore rules. With
+// `console` the process-wide logging stays in effect; otherwise events go to
+// the engine's callback.
+int engine_run(gbzip_engine_t* engine, engine_operation_t operation, options_t* opts, bool console);
+
+#endif // ENGINE_H
@@ -0,0 +1,30 @@
+#ifndef ENTRY_SELECT_H
+#define ENTRY_SELECT_H
+
+#include "gbzip.h"
+#include "zipignore.h"
+
+// ============================================================================
+// Entry selection - the names given after the zipfile for -x and -l, matched
+// against archive paths by the zipignore pattern engine. A selector with
+// wildcards is a gitignore-style pattern ("*.conf" matches at any depth,
+// "etc/*.conf" from the root, "!" excludes, a trailing / selects a
+// directory); a plain name selects that path from the root of the archive
+// and everything below it.
+// ============================================================================
+
+typedef struct {
+    zipignore_t patterns;       // Selectors as patterns; "ignored" means selected
+    const char* const* names;   // Selectors as given
+    int count;                  // 0 selects every entry
+    bool literal;               // Every selector is a plain path that can be looked up by name
+} entry_select_t;
+
+// Compile `count` selectors; the strings must outlive the selection
+int entry_select_init(entry_select_t* select, const char* const* names, int count);
+void entry_select_free(entry_select_t* select);
+
+// Whether the entry named `name` (a '/'-separated archive path) is selected
+bool entry_select_match(const entry_select_t* select, const char* name);
+
+#endif // ENTRY_SELECT_H
@@ -0,0 +1,87 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include "gbzip.h"
+#include "string_pool.h"
+
+// ============================================================================
+// Fingerprint cache - a sidecar file next to an archive that remembers which
+// version of each file on disk an entry was made from, together with a hash
+// of its contents and where its compressed bytes are. Updates skip files
+// whose version is unchanged without reading them, recognise files that were
+// only touched by their contents, and copy content that is already in the
+// archive instead of compressing it again.
+// ============================================================================
+
+// Appended to the archive path to name its cache
+#define FINGERPRINT_CACHE_SUFFIX ".gbzcache"
+
+// One version of a file: as long as none of these change, neither have its
+// contents. Device and inode are 0 where the platform has none.
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_ns;
+} fingerprint_key_t;
+
+typedef struct {
+    const char* path;            // Archive path, in the cache's pool
+    fingerprint_key_t key;       // File the entry was last matched against
+    uint64_t hash;               // XXH64 of the contents, when hash_known
+    bool hash_known;             // False for entries archived before the cache saw their file
+    uint32_t crc32;
+    uint16_t method;
+    uint64_t compressed_size;
+    uint64_t data_offset;        // Start of the compressed bytes in the archive (0 = unknown)
+    bool seen;                   // Still in the archive; only these are saved
+} fingerprint_entry_t;
+
+typedef struct {
+    fingerprint_entry_t* entries;
+    size_t count;
+    size_t capacity;
+    size_t* path_index;          // Open addressing on path; slots hold index + 1
+    size_t path_index_mask;
+    size_t* content_index;       // Open addressing on hash, built on first lookup
+    size_t content_index_mask;
+    string_pool_t paths;
+} fingerprint_cache_t;
+
+void fingerprint_cache_init(fingerprint_cache_t* cache);
+void fingerprint_cache_free(fingerprint_cache_t* cache);
+
+// Load the cache of `archive_path`. A missing cache file leaves it empty;
+// so does a damaged or foreign one, after a warning, since the cache only
+// ever saves work.
+int fingerprint_cache_load(fingerprint_cache_t* cache, const char* archive_path);
+
+// Replace the cache file of `archive_path` with the entries marked seen
+int fingerprint_cache_save(const fingerprint_cache_t* cache, const char* archive_path);
+
+// The entry for an archive path, NULL if there is none. Pointers into the
+// cache stay valid until the next fingerprint_cache_put().
+fingerprint_entry_t* fingerprint_cache_find(const fingerprint_cache_t* cache, const char* path);
+
+// Find or add (cleared) the entry for an archive path; NULL when out of memory
+fingerprint_entry_t* fingerprint_cache_put(fingerprint_cache_t* cache, const char* path);
+
+// An entry whose compressed bytes hold exactly this content, NULL if none
+const fingerprint_entry_t* fingerprint_cache_find_content(fingerprint_cache_t* cache, uint64_t hash,
+                                                          uint64_t size, uint32_t crc32);
+
+// Forget where compressed bytes are, after the archive was rewritten
+void fingerprint_cache_clear_offsets(fingerprint_cache_t* cache);
+
+bool fingerprint_key_equal(const fingerprint_key_t* a, const fingerprint_key_t* b);
+
+// The current version of a file; `mode` (optional) receives its st_mode
+bool fingerprint_stat(const char* path, fingerprint_key_t* key, uint32_t* mode);
+
+// XXH64 and CRC-32 of a file's contents, read once
+int fingerprint_file(const char* path, uint64_t* hash, uint32_t* crc32);
+
+// XXH64 (seed 0) of a buffer
+uint64_t fingerprint_hash(const void* data, size_t size);
+
+#endif // FINGERPRINT_H
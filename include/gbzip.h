@@ -33,6 +33,13 @@
     #endif
 #endif
 
+// Storage of one copy per thread
+#ifdef _MSC_VER
+    #define THREAD_LOCAL __declspec(thread)
+#else
+    #define THREAD_LOCAL __thread
+#endif
+
 // Version information
 #define GBZIP_VERSION_MAJOR 1
 #define GBZIP_VERSION_MINOR 0
@@ -65,6 +72,27 @@ typedef enum {
     OP_VERSION
 } operation_t;
 
+// Compression backends, selected per run with --codec (see codec.h)
+typedef enum {
+    CODEC_ZLIB,             // Deflate through zlib (default, always built)
+    CODEC_LIBDEFLATE,       // Deflate through libdeflate
+    CODEC_ZSTD              // Zstandard, ZIP method 93
+} codec_id_t;
+
+// Order of the entries of a new archive, and so of the reads (--sort)
+typedef enum {
+    SORT_NAME,              // Directory tree order, names sorted (default)
+    SORT_INODE,             // Inode number, which follows creation on most local filesystems
+    SORT_DISK               // Where each file's data starts on disk (FIEMAP), else inode
+} sort_order_t;
+
+// What create_zip() wrote
+typedef struct {
+    size_t files;                   // Entries added
+    uint64_t bytes;                 // Input bytes
+    uint64_t archive_bytes;         // Size of the archive
+} archive_stats_t;
+
 // Program options
 typedef struct {
     operation_t operation;
@@ -81,15 +109,36 @@ typedef struct {
     bool junk_paths;
     bool store_only;
     bool compress_better;
+    bool always_deflate;            // Deflate even data that looks incompressible
     bool update_mode;
     bool test_mode;
     bool timestamp_mode;
     bool delete_mode;
     bool move_mode;
-    bool read_stdin;
+    bool read_stdin;                // -@: read the names of files to add from stdin
+    bool to_stdout;                 // Stream the archive to stdout (zipfile "-" or --stdout)
     bool diff_mode;
+    bool compact;                   // Rewrite an updated archive once it holds enough dead space
+    bool use_cache;                 // Keep a fingerprint cache next to an updated archive
     bool create_default_zipignore;
     int compression_level;
+    codec_id_t codec;               // Compression backend (--codec)
+    sort_order_t sort_order;        // Entry order when creating (--sort)
+    size_t buffer_size;             // Recycled read/compress buffer size (0 = default)
+    int num_threads;                // Worker threads (--threads, 0 = detect)
+    uint64_t memory_limit;          // Memory ceiling in bytes (--memory-limit, 0 = detect)
+    const char* metrics_file;       // Prometheus textfile of run metrics (--metrics)
+    const char* trace_file;         // Chrome trace of the run (--trace)
+    const char* batch_file;         // Manifest of archives to create (--batch)
+    double target_mbps;             // Input rate to pace the level to (--target-mbps, 0 = fixed level)
+    double deadline;                // Seconds the run should finish in (--deadline, 0 = none)
+    
+    // Set by an embedding engine (libgbzip.h) or the batch scheduler
+    // (batch.h), and unset for a single archive on the command line
+    struct thread_pool* pool;               // Compression pool to run on instead of starting one
+    const struct zipignore* ignore_rules;   // Ignore file or home patterns, already parsed
+    int memory_share;                       // Archives written at once, splitting the memory budget
+    archive_stats_t* stats;                 // Filled in by create_zip() when set
 } options_t;
 
 // Progress reporting
@@ -4,6 +4,7 @@
 #include <zip.h>
 #include "gbzip.h"
 #include "zipignore.h"
+#include "archive_writer.h"
 
 // ZIP context structure
 typedef struct {
@@ -14,26 +15,62 @@ typedef struct {
     bool verbose;
 } zip_context_t;
 
+// Compression thread pool. create_zip() and add_files_to_archive() start
+// one per run unless options_t.pool hands them one to share, as an embedding
+// engine does: its threads, read buffers and encoders then outlive the run.
+typedef struct thread_pool thread_pool_t;
+
+// A pool of `num_threads` workers (0 = resources_cpu_count()). Several runs
+// may submit to it at once, as --batch does, when they share the buffer size,
+// codec and incompressible-data detection; a run with other settings than
+// those in use compresses on a pool of its own. Each run owns its writer,
+// file list, pacer and count of outstanding units, and waits only for its
+// own units.
+thread_pool_t* zip_pool_create(int num_threads);
+void zip_pool_destroy(thread_pool_t* pool);
+
+// Set the pool up for runs with the settings of `opts` before any starts;
+// false if runs with other settings are using it
+bool zip_pool_configure(thread_pool_t* pool, const options_t* opts);
+
 // Function prototypes
 int create_zip(const options_t* opts);
 int extract_zip(const options_t* opts);
 int list_zip(const options_t* opts);
 
+// Check every entry of opts->zip_file against its central directory CRC-32
+// and size, on one thread per core, without writing anything. Each damaged
+// entry is reported; returns EXIT_ZIP_ERROR if there were any.
+int verify_zip(const options_t* opts);
+
 // Internal helper functions
-int add_file_to_zip(zip_context_t* ctx, const char* file_path, const char* archive_path);
-int add_directory_to_zip(zip_context_t* ctx, const char* dir_path, const char* base_path);
 int extract_file_from_zip(zip_context_t* ctx, zip_uint64_t index, const char* output_dir);
-int zip_close_with_progress(zip_t* archive, progress_t* progress, bool verbose, const char* output_filename);
 
-// ZIP file information
+// ZIP file information; the names live in the same allocation as the
+// entries, so free_zip_entries() releases both
 typedef struct {
-    char name[PATH_MAX];
+    const char* name;
     time_t mtime;
     off_t size;
+    uint32_t crc32;
     bool is_directory;
 } zip_entry_t;
 
 int get_zip_entries(const char* zip_file, zip_entry_t** entries, size_t* count);
+
+// A file on disk to be stored in an archive under `archive_path`
+typedef struct {
+    const char* file_path;
+    const char* archive_path;
+    off_t size;
+    time_t mtime;
+} zip_input_file_t;
+
+// Compress `files` into an archive that is already open, such as one opened
+// with archive_writer_open_append(), through the same pipeline as
+// create_zip(). The writer is left open for the caller to close or abort.
+int add_files_to_archive(archive_writer_t* writer, const zip_input_file_t* files, size_t count,
+                         const options_t* opts, size_t* added_count);
 void free_zip_entries(zip_entry_t* entries, size_t count);
 
 #endif // GBZIP_ZIP_H
\ No newline at end of file
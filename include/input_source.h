@@ -0,0 +1,70 @@
+#ifndef INPUT_SOURCE_H
+#define INPUT_SOURCE_H
+
+#include "gbzip.h"
+
+// ============================================================================
+// Input source - the contents of a file being archived, handed out window by
+// window. Regular files of at least INPUT_MAP_MIN_SIZE bytes are mapped
+// read-only (mmap with sequential read-ahead hints on POSIX, a file mapping
+// on Windows), so windows point straight into the page cache and nothing is
+// copied into a heap buffer. Pipes, special files, small files and mappings
+// that fail are read through the caller's buffer instead.
+//
+// Files read ahead of time (see batch_reader.h) are handed out from the
+// caller's memory the same way.
+//
+// A mapping covers the size the file had when it was opened. A file that is
+// truncated while it is being archived can fault on its missing pages, as
+// with any mapped input.
+// ============================================================================
+
+// Smaller files are read, which costs less than setting up a mapping
+#define INPUT_MAP_MIN_SIZE (1024 * 1024)
+
+typedef struct {
+    FILE* file;
+    const unsigned char* map;   // Whole file, or NULL when it is read
+    bool borrowed;              // `map` is the caller's memory, not a mapping
+    uint64_t size;              // Size when opened (the length of the mapping)
+    uint32_t mode;              // POSIX mode bits (0 if unknown)
+    uint64_t offset;            // Bytes handed out so far
+    uint64_t readahead;         // Bytes past each window to ask the kernel for
+    uint64_t prefetched;        // Mapped bytes before this were already asked for
+    uint64_t released;          // Mapped bytes before this were given back
+} input_source_t;
+
+// Open a file for reading, mapping it when it qualifies and `allow_map` is
+// set. Returns -1 if the file cannot be opened or examined.
+int input_source_open(input_source_t* src, const char* path, bool allow_map);
+void input_source_close(input_source_t* src);
+
+// A source over `size` bytes of file contents already in memory, which must
+// outlive it; `mode` is that of the file they were read from
+void input_source_open_memory(input_source_t* src, const unsigned char* data, uint64_t size, uint32_t mode);
+
+// Whether windows point into the whole file (a mapping, or memory)
+bool input_source_mapped(const input_source_t* src);
+
+// Next `max_size` bytes (fewer at the end of the file, none past it).
+// Mapped files return a pointer into the mapping, valid until the source is
+// closed; others are read into `buffer`, which must hold max_size bytes.
+// Returns NULL on a read error.
+const unsigned char* input_source_next(input_source_t* src, unsigned char* buffer, size_t max_size,
+                                       size_t* size);
+
+// Start again from the beginning of the file
+int input_source_rewind(input_source_t* src);
+
+// Tell the kernel the mapped bytes before `offset` will not be read again,
+// so resident memory stays at the windows in flight rather than the whole
+// file. The bytes remain readable. No-op for files that are read.
+void input_source_release(input_source_t* src, uint64_t offset);
+
+// Byte offset on its device where the data of the file at `path` starts,
+// for reading many files in the order they lie on disk. False where the
+// filesystem does not say (no FIEMAP: tmpfs, NFS, other platforms), for
+// empty files and for data not written out yet.
+bool input_source_disk_offset(const char* path, uint64_t* offset);
+
+#endif // INPUT_SOURCE_H
@@ -0,0 +1,115 @@
+#ifndef LIBGBZIP_H
+#define LIBGBZIP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ============================================================================
+// libgbzip - gbzip as a library. An engine owns what each run of the gbzip
+// command sets up and tears down: the compression thread pool with its
+// recycled read buffers and encoders, and the parsed ignore file. Create
+// one and run any number of operations on it; nothing is printed, progress
+// and diagnostics go to the engine's event callback.
+//
+// Engines are independent: operations of different engines run at once,
+// each on its own workers and with its own settings and callback. An
+// engine runs one operation at a time; calling it from several threads is
+// safe, the calls queue up. Use one engine per concurrent caller.
+// ============================================================================
+
+// Status codes, the same as the gbzip command's exit codes
+#define GBZIP_OK            0
+#define GBZIP_ERROR         1
+#define GBZIP_INVALID_ARGS  2
+#define GBZIP_FILE_ERROR    3
+#define GBZIP_ZIP_ERROR     4
+
+// Compression level meaning "store without compressing"
+#define GBZIP_LEVEL_STORE   (-1)
+
+typedef enum {
+    GBZIP_EVENT_INFO,
+    GBZIP_EVENT_FILE,           // An entry was added to the archive
+    GBZIP_EVENT_IGNORED,        // A file was left out by an ignore pattern
+    GBZIP_EVENT_PROGRESS,
+    GBZIP_EVENT_WARNING,
+    GBZIP_EVENT_ERROR,
+    GBZIP_EVENT_COMPLETE        // An archive was written
+} gbzip_event_type_t;
+
+// Strings are valid for the duration of the callback only
+typedef struct {
+    gbzip_event_type_t type;
+    const char* message;        // Text of info, warning and error events, else NULL
+    const char* path;           // Entry, file or archive the event is about
+    uint64_t bytes;             // Entry size, or bytes processed so far
+    size_t files_done;
+    size_t files_total;
+    double percent;             // Progress events
+} gbzip_event_t;
+
+// Called on the thread running the operation or on one of the engine's
+// workers, one call at a time
+typedef void (*gbzip_event_fn)(const gbzip_event_t* event, void* user_data);
+
+typedef enum {
+    GBZIP_CODEC_ZLIB,           // Deflate through zlib (always built)
+    GBZIP_CODEC_LIBDEFLATE,     // Deflate through libdeflate
+    GBZIP_CODEC_ZSTD            // Zstandard, ZIP method 93
+} gbzip_codec_t;
+
+// Engine settings. A zeroed struct (or NULL) uses the defaults.
+typedef struct {
+    int threads;                // Worker threads; 0: CPUs, affinity and cgroup quota
+    uint64_t memory_limit;      // Bytes; 0: detect
+    size_t buffer_size;         // Read/compress buffer per worker; 0: default
+    const char* ignore_file;    // Used instead of ~/.zipignore and the base .zipignore
+    gbzip_event_fn on_event;    // NULL: events are dropped
+    void* user_data;
+} gbzip_config_t;
+
+// Per-operation settings for gbzip_create() and gbzip_diff(). A zeroed
+// struct (or NULL) compresses at the default level with zlib.
+typedef struct {
+    int level;                  // 1-9, 0: default (6), GBZIP_LEVEL_STORE: no compression
+    gbzip_codec_t codec;
+    bool junk_paths;            // Store file names without their directories
+    bool no_recursion;          // Add directories without their contents
+    bool always_deflate;        // Compress even data that looks incompressible
+    bool compact;               // gbzip_diff(): rewrite the archive once it holds enough dead space
+    double target_mbps;         // > 0: pick levels up to `level` to compress this many MB/s of input
+    double deadline;            // > 0: the same, to finish within this many seconds
+} gbzip_options_t;
+
+typedef struct gbzip_engine gbzip_engine_t;
+
+// NULL if the engine could not be set up (out of memory, or no threads)
+gbzip_engine_t* gbzip_engine_new(const gbzip_config_t* config);
+void gbzip_engine_free(gbzip_engine_t* engine);
+
+// Write `archive` from the files and directories in `inputs` (the current
+// directory when `count` is 0), replacing it if it exists.
+// GBZIP_INVALID_ARGS if the codec is not built into this library.
+int gbzip_create(gbzip_engine_t* engine, const char* archive, const char* const* inputs, int count,
+                 const gbzip_options_t* options);
+
+// Extract `archive` into `directory`, or only the entries matching `names`
+// (exact names or wildcards) when `count` is not 0
+int gbzip_extract(gbzip_engine_t* engine, const char* archive, const char* directory,
+                  const char* const* names, int count);
+
+// Bring `archive` up to date with `directory`: add new and changed files,
+// remove deleted ones. Creates the archive if it does not exist.
+int gbzip_diff(gbzip_engine_t* engine, const char* archive, const char* directory,
+               const gbzip_options_t* options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBGBZIP_H
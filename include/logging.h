@@ -26,25 +26,66 @@ typedef enum {
     EVENT_WARNING
 } event_type_t;
 
+// One event handed to a log sink. Only the fields that apply to the event
+// are set; strings are valid for the duration of the call.
+typedef struct {
+    event_type_t event;
+    log_level_t level;
+    const char* message;        // Formatted text, without a trailing newline
+    const char* path;           // File or archive the event is about
+    uint64_t bytes;             // File size, or bytes processed so far
+    size_t files_done;
+    size_t files_total;
+    double percent;
+} log_record_t;
+
+// Receives every event instead of the console, regardless of quiet/verbose
+typedef void (*log_sink_t)(const log_record_t* record, void* user_data);
+
 // Logging configuration
 typedef struct {
     int verbose;
     int quiet;
     int structured;
     FILE* output_stream;
+    log_sink_t sink;            // NULL: print to output_stream/stderr
+    void* sink_data;
 } log_config_t;
 
 void init_logging(log_config_t* config);
 void log_event(event_type_t event, log_level_t level, const char* format, ...);
 void log_progress(const progress_t* progress, const char* phase, double percent, double speed, const char* speed_units);
 void log_file_operation(const char* operation, const char* file_path, size_t file_size);
+// How an entry was encoded: `method` is "store" or "deflate", `reason` a
+// compress_decision_name()
+void log_file_compression(const char* file_path, uint64_t file_size, uint64_t compressed_size,
+                          const char* method, const char* reason);
 void log_archive_info(const char* archive_path, size_t total_files, size_t total_bytes, double elapsed_time);
+// One archive of a --batch run: created (`status` EXIT_SUCCESS) or failed.
+// Printed even when quiet; the caller decides.
+void log_archive_result(size_t job, const char* archive_path, int status, const archive_stats_t* stats,
+                        double elapsed_time);
+// Structured COMPLETE event carrying the run metrics, for operations that
+// have no archive summary of their own (create reports them in that)
+void log_run_metrics(const char* operation);
 void log_error(const char* context, const char* error_message);
+// A diagnostic line for stderr (or the sink): errors and warnings raised
+// below the command layer
+void log_message(log_level_t level, const char* format, ...);
 
 const char* get_event_name(event_type_t event);
 const char* get_level_name(log_level_t level);
 const char* format_timestamp(void);
 
+// Process-wide configuration, set by init_logging()
 extern log_config_t g_log_config;
 
+// Configuration the calling thread logs with: its own, given with
+// log_config_use(), else g_log_config. An embedding engine's operation logs
+// to its own sink this way while others run; threads working for it adopt
+// the operation's configuration the same way.
+log_config_t* log_config_current(void);
+// NULL goes back to g_log_config
+void log_config_use(log_config_t* config);
+
 #endif // LOGGING_H
\ No newline at end of file
@@ -0,0 +1,97 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "gbzip.h"
+
+// ============================================================================
+// Run metrics - where the time of a run goes. Every thread counts into its
+// own slot (no atomics or locks on the hot path), and the slots are summed
+// once the run is over: wall time per phase, busy and idle time per worker,
+// work queue depth, bytes read and written, open/stat/read calls, and time
+// spent matching ignore patterns. Off unless enabled, in which case each
+// hook is a branch on a global flag.
+//
+// The totals are reported in the structured (-s) COMPLETE event, and can be
+// written as a Prometheus textfile (--metrics) or a Chrome trace (--trace,
+// chrome://tracing or Perfetto) with one span per work item.
+// ============================================================================
+
+typedef enum {
+    METRICS_PHASE_SCAN,         // Finding the files to add
+    METRICS_PHASE_COMPRESS,     // Compressing and writing entries
+    METRICS_PHASE_FINALIZE,     // Central directory and close
+    METRICS_PHASE_EXTRACT,
+    METRICS_PHASE_VERIFY,
+    METRICS_PHASE_COUNT
+} metrics_phase_t;
+
+typedef enum {
+    METRICS_BYTES_READ,         // Files read to add them, or entry data read to extract
+    METRICS_BYTES_WRITTEN,      // Archive bytes, or extracted file bytes, written
+    METRICS_OPEN_CALLS,         // Files and directories opened
+    METRICS_STAT_CALLS,
+    METRICS_READ_CALLS,         // Buffered reads (mapped input files need none)
+    METRICS_IGNORE_CHECKS,      // Paths matched against ignore patterns
+    METRICS_COUNTER_COUNT
+} metrics_counter_t;
+
+typedef enum {
+    METRICS_TIMER_BUSY,         // Working on an item
+    METRICS_TIMER_IDLE,         // Waiting for work, or for a result
+    METRICS_TIMER_IGNORE,       // Inside should_ignore()
+    METRICS_TIMER_COUNT
+} metrics_timer_t;
+
+// Spans kept per thread for --trace; later ones are counted and dropped
+#define METRICS_MAX_SPANS_PER_THREAD 100000
+
+// Compression levels 0 (store) to 9, for the adaptive level's histogram
+#define METRICS_LEVEL_COUNT 10
+
+extern bool g_metrics_enabled;
+
+// Turn collection on (and span recording with `trace`). The calling thread
+// becomes the "main" thread. Call before any other thread starts.
+void metrics_init(bool enabled, bool trace);
+void metrics_shutdown(void);
+
+// Name the calling thread's slot in reports, e.g. ("compress", 3). Threads
+// that never call this count under ("thread", n).
+void metrics_thread_begin(const char* role, int index);
+// The calling thread is about to exit: its slot stays in the reports, and
+// nothing it does from here on is counted
+void metrics_thread_end(void);
+
+void metrics_count(metrics_counter_t counter, uint64_t amount);
+
+// Time an interval on the calling thread: `start` comes from metrics_start()
+// (0 when disabled), and `span` names it in the trace (NULL records none).
+// A busy interval also counts one item.
+uint64_t metrics_start(void);
+void metrics_stop(metrics_timer_t timer, uint64_t start, const char* span);
+
+// Work items queued at the moment one more was submitted
+void metrics_sample_queue(size_t depth);
+
+// Phases are timed on the thread running the operation. Archives of a batch
+// run them at once: a phase then counts while any of them is in it.
+void metrics_phase_begin(metrics_phase_t phase);
+void metrics_phase_end(metrics_phase_t phase);
+
+// Adaptive level (--target-mbps, --deadline): what the run was asked for,
+// set once up front, and every unit or block the pacer timed, by the level
+// it chose, with the CPU time it took and the time spent waiting besides
+void metrics_set_pace(double target_mbps, double deadline);
+void metrics_count_level(int level, uint64_t input, uint64_t output, uint64_t cpu_ns, uint64_t wait_ns);
+
+// The totals as a JSON object, for the structured COMPLETE event
+void metrics_write_json(FILE* out);
+
+// Prometheus textfile (node_exporter textfile collector format), written
+// to a temporary file and renamed into place; `operation` labels the run
+int metrics_write_prometheus(const char* path, const char* operation);
+
+// Chrome trace event JSON
+int metrics_write_trace(const char* path);
+
+#endif // METRICS_H
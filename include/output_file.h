@@ -0,0 +1,36 @@
+#ifndef OUTPUT_FILE_H
+#define OUTPUT_FILE_H
+
+#include "gbzip.h"
+
+// ============================================================================
+// Output files - writing extracted entries. Files of a known size have their
+// space reserved before the first write, and stored entries can be copied
+// straight out of the archive by the kernel (copy_file_range, which shares
+// blocks on filesystems with reflinks such as XFS and btrfs, then sendfile)
+// instead of through a read buffer.
+// ============================================================================
+
+// Smaller files are written without reserving their space first
+#define OUTPUT_PREALLOCATE_MIN_SIZE (1024 * 1024)
+
+#if defined(__linux__)
+    #define OUTPUT_FILE_HAVE_COPY_RANGE
+#endif
+
+// Reserve `size` bytes for a file that is about to be written from the
+// start, so the filesystem can give it few, contiguous extents. The file
+// size itself only grows as data is written, so data that ends early does
+// not leave zeros behind. Best effort: filesystems that cannot reserve
+// space ahead are simply written to.
+void output_file_preallocate(FILE* file, uint64_t size);
+
+// Copy `size` bytes of `source`, starting at `offset`, to the current
+// position of `output` within the kernel. Returns false when the data could
+// not all be copied - the source ends early, an error, or the kernel cannot
+// copy between these files - with `output` cut back to where it was, so the
+// caller can copy the data itself. Always false where
+// OUTPUT_FILE_HAVE_COPY_RANGE is not defined.
+bool output_file_copy_range(FILE* output, FILE* source, uint64_t offset, uint64_t size);
+
+#endif // OUTPUT_FILE_H
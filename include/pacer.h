@@ -0,0 +1,70 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include "gbzip.h"
+
+// ============================================================================
+// Adaptive compression level (--target-mbps, --deadline). The workers report
+// every unit of files and every block they compress: the level, its input
+// and output, and the wall and CPU time it took on the thread. From that the
+// pacer learns how fast each level runs on this data and how well it
+// compresses, and how much of a worker's time goes to waiting on input
+// rather than compressing. Before each unit or block it picks the highest
+// level, up to the run's own (6 by default, 9 with -9), that the pool can run at
+// the rate the run needs, and stores data when even level 1 would fall
+// behind. A run bound by I/O keeps the highest level whose cost hides
+// behind the reads: compressing less would not make it any faster.
+// ============================================================================
+
+// Levels 0 (store) to 9
+#define PACER_LEVELS 10
+// How often the level is reconsidered; it rises one step at a time
+#define PACER_INTERVAL_MS 100
+// Capacity kept in hand over the rate needed
+#define PACER_HEADROOM 1.10
+// Share of a deadline kept back for the central directory and close
+#define PACER_DEADLINE_RESERVE 0.05
+
+typedef struct pacer pacer_t;
+
+// Time on the calling thread when an item started
+typedef struct {
+    double wall;
+    double cpu;
+} pacer_sample_t;
+
+// What the run was paced to, and what it got
+typedef struct {
+    double target_mbps;                 // --target-mbps, or total input over --deadline
+    double achieved_mbps;               // Input finished over the time since pacer_create()
+    double deadline;                    // Seconds, 0 without --deadline
+    bool io_bound;                      // Workers spent more time waiting on input than compressing
+    uint64_t level_input[PACER_LEVELS]; // Input bytes per level chosen
+    uint64_t level_output[PACER_LEVELS];
+} pacer_report_t;
+
+// Pace to `target_mbps` MB/s of input, or to finish `deadline` seconds from
+// now (one of them > 0), compressing at no more than `max_level`
+pacer_t* pacer_create(double target_mbps, double deadline, int max_level);
+void pacer_free(pacer_t* pacer);
+
+// The input is known: `total_bytes` over `threads` workers
+void pacer_begin(pacer_t* pacer, uint64_t total_bytes, int threads);
+
+// Level for the next unit or block; thread-safe
+int pacer_level(pacer_t* pacer);
+
+void pacer_sample(pacer_sample_t* sample);
+
+// `bytes` of input are finished, `input` of them compressed at `level` into
+// `output` since `start` (NULL when the item was not timed, e.g. stored by
+// the writer). Bytes stored for their file type are finished but not
+// compressed, and stay out of the model. Thread-safe; counted in the
+// metrics too.
+void pacer_record(pacer_t* pacer, int level, uint64_t bytes, uint64_t input, uint64_t output,
+                  const pacer_sample_t* start);
+
+// Summary of the run so far
+void pacer_report(pacer_t* pacer, pacer_report_t* report);
+
+#endif // PACER_H
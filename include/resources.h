@@ -0,0 +1,65 @@
+#ifndef RESOURCES_H
+#define RESOURCES_H
+
+#include "gbzip.h"
+
+// ============================================================================
+// Resource governor - how many threads and how much memory a run may use.
+// On Linux the CPU affinity mask and the cgroup (v1 or v2) CPU quota and
+// memory limit count as well as what the host has, so a pod with a 2-CPU
+// quota on a 64-core node runs 2 threads and sizes its buffers against its
+// own limit. --threads and --memory-limit override what is detected.
+// Memory pressure (PSI) is sampled during a run, and the in-flight budget
+// shrinks while the system or the cgroup is stalling on reclaim.
+// ============================================================================
+
+// Check memory pressure at most this often
+#define RESOURCES_PRESSURE_INTERVAL_MS 500
+// Share of time with a task stalled on memory (PSI "some avg10", percent)
+// above which the budget is halved, and below which it grows back
+#define RESOURCES_PRESSURE_HIGH 10.0
+#define RESOURCES_PRESSURE_LOW  2.0
+
+// Overrides from the command line; 0 keeps detection
+void resources_configure(int threads, uint64_t memory_limit);
+
+// The same overrides for the calling thread only, ahead of the process-wide
+// ones, so operations of several embedding engines can run at once;
+// resources_release_thread() drops them
+void resources_configure_thread(int threads, uint64_t memory_limit);
+void resources_release_thread(void);
+
+// Threads worth running: --threads, else the fewest of online CPUs, CPUs in
+// the affinity mask and the cgroup CPU quota (rounded up), at most 16
+int resources_cpu_count(void);
+
+// Bytes this process can still allocate without pushing the host or its
+// cgroup into reclaim (reclaimable page cache counts as free). Never more
+// than --memory-limit.
+uint64_t resources_available_memory(void);
+
+// --memory-limit in bytes, 0 when not given
+uint64_t resources_memory_limit(void);
+
+// Descriptors this process may have open at once (RLIMIT_NOFILE)
+size_t resources_open_file_limit(void);
+
+// PSI "some avg10" for memory, from the cgroup when it reports one, else
+// system-wide; negative where the kernel does not report pressure
+double resources_memory_pressure(void);
+
+// A memory budget that follows pressure: halved (down to `minimum`) while
+// pressure is high, doubled back toward `base` once it has eased
+typedef struct {
+    size_t base;
+    size_t minimum;
+    size_t current;
+    double next_check;          // Monotonic seconds
+} resources_budget_t;
+
+void resources_budget_init(resources_budget_t* budget, size_t base, size_t minimum);
+
+// The budget to use now, checking pressure when the interval has passed
+size_t resources_budget_update(resources_budget_t* budget);
+
+#endif // RESOURCES_H
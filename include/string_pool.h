@@ -0,0 +1,27 @@
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include "gbzip.h"
+
+// ============================================================================
+// String pool - NUL-terminated copies packed into large blocks that are only
+// released together, for tables holding many short paths that share one
+// lifetime. Pointers handed out stay valid until string_pool_free().
+// ============================================================================
+
+typedef struct string_pool_block string_pool_block_t;
+
+typedef struct {
+    string_pool_block_t* blocks;    // Newest first
+    size_t bytes;                   // Total bytes handed out, terminators included
+} string_pool_t;
+
+void string_pool_init(string_pool_t* pool);
+void string_pool_free(string_pool_t* pool);
+
+// Copy the first `len` bytes of `text` into the pool, NUL-terminated; NULL
+// when out of memory
+char* string_pool_strndup(string_pool_t* pool, const char* text, size_t len);
+char* string_pool_strdup(string_pool_t* pool, const char* text);
+
+#endif // STRING_POOL_H
@@ -7,8 +7,16 @@
 
 // ============================================================================
 // Terminal UI Module - Cross-platform TUI with colors, progress bars, and stats
+//
+// While a run is in progress one render thread draws the display at a fixed
+// frame rate. Workers only update counters (lock-free atomics) and never
+// write to the terminal, so neither the number of files nor the number of
+// threads changes how often the screen is drawn.
 // ============================================================================
 
+// Frames drawn per second by the render thread
+#define TUI_FRAME_RATE_HZ 10
+
 // ANSI Color codes
 #define TUI_RESET       "\033[0m"
 #define TUI_BOLD        "\033[1m"
@@ -99,6 +107,7 @@ typedef struct {
     size_t total_bytes;
     size_t processed_bytes;
     size_t compressed_bytes;    // Bytes after compression
+    size_t entry_bytes;         // Progress through the entry being streamed
     
     // Compression progress (for final write phase)
     double compression_percent;
@@ -116,9 +125,9 @@ typedef struct {
     // Per-thread progress tracking (for multi-threaded compression)
     #define MAX_THREAD_PROGRESS 16
     struct {
-        char filename[64];          // File being compressed by this thread
+        const char* filename;       // File being compressed by this thread
         size_t file_size;           // Size of file
-        double percent;             // Compression progress (0-100)
+        int percent;                // Compression progress (0-100)
         bool active;                // Whether thread is actively working
     } thread_progress[MAX_THREAD_PROGRESS];
     int active_thread_count;        // Number of threads with active work
@@ -157,9 +166,16 @@ extern tui_state_t g_tui;
 // Initialize the TUI system
 void tui_init(void);
 
-// Cleanup and restore terminal
+// Cleanup and restore terminal (stops the render thread first)
 void tui_cleanup(void);
 
+// Start drawing TUI_FRAME_RATE_HZ frames a second on a render thread. Until
+// tui_stop_render() nothing else may print to stdout.
+void tui_start_render(void);
+
+// Stop the render thread, then draw the final frame
+void tui_stop_render(void);
+
 // Check if terminal supports features
 bool tui_supports_colors(void);
 bool tui_supports_unicode(void);
@@ -192,19 +208,26 @@ void tui_show_compression_stats(size_t original, size_t compressed);
 // Show a spinner animation
 void tui_spinner(const char* message);
 
-// Show completion summary
+// Show completion summary (stops the render thread first)
 void tui_show_summary(void);
 
 // ============================================================================
-// Update Functions
+// Update Functions - safe to call from any thread; none of them draw
 // ============================================================================
 
 // Update current file being processed
 void tui_set_current_file(const char* filename);
 
-// Update progress
+// Count one finished file of `bytes_processed` bytes
 void tui_update_progress(size_t bytes_processed);
 
+// Files and bytes found so far (while scanning) or in total
+void tui_set_totals(size_t files, size_t bytes);
+
+// Bytes written so far of the entry being streamed, shown on top of the
+// finished files until its tui_update_progress() (which resets it)
+void tui_set_entry_progress(size_t bytes);
+
 // Update compression progress (0-100%)
 void tui_update_compression(double percent, double speed);
 
@@ -212,7 +235,8 @@ void tui_update_compression(double percent, double speed);
 void tui_update_large_file_progress(size_t current, size_t total, const char* filename, 
                                      size_t file_size, double percent);
 
-// Update per-thread compression progress
+// Update per-thread compression progress; `filename` is not copied and must
+// outlive the render thread
 void tui_update_thread_progress(int thread_id, const char* filename, size_t file_size, 
                                  double percent, bool active);
 
@@ -225,7 +249,7 @@ void tui_set_phase(int phase, const char* phase_name);
 // Update system stats
 void tui_update_system_stats(void);
 
-// Refresh the entire display
+// Draw one frame: the render thread's job while it runs
 void tui_refresh(void);
 
 // ============================================================================
@@ -18,6 +18,11 @@ char* trim_whitespace(char* str);
 char* join_path(const char* dir, const char* file);
 const char* get_filename(const char* path);
 const char* get_file_extension(const char* path);
+// Parse a byte count with optional K/M/G/T suffix (binary units), e.g. "4M"
+bool parse_size(const char* str, uint64_t* out);
+// Parse a positive duration in seconds with optional s/m/h suffix, e.g. "90",
+// "15m" or "1.5h"
+bool parse_duration(const char* str, double* seconds);
 
 // Security utilities
 bool is_safe_path(const char* path);
@@ -29,8 +34,14 @@ typedef struct {
     bool is_directory;
     time_t mtime;
     off_t size;
+    uint64_t device;            // 0 where the platform has none
+    uint64_t inode;
+    int64_t mtime_ns;           // Full-resolution mtime, where available
 } file_info_t;
 
+// Callback result for a directory: keep going, but don't descend into it
+#define TRAVERSE_SKIP_SUBTREE (-1)
+
 typedef int (*file_callback_t)(const file_info_t* info, void* user_data);
 int traverse_directory(const char* dir_path, bool recursive, file_callback_t callback, void* user_data);
 
@@ -3,34 +3,61 @@
 
 #include "gbzip.h"
 
-// Maximum number of ignore patterns
-#define MAX_IGNORE_PATTERNS 1000
+// Longest line read from a .zipignore file
 #define MAX_PATTERN_LENGTH 256
 #define MAX_RECURSION_DEPTH 100
-#define MAX_ZIPIGNORE_FILES 100  // Maximum number of nested .zipignore files
 
 // Ignore pattern structure
 typedef struct {
-    char pattern[MAX_PATTERN_LENGTH];
-    char scope_dir[PATH_MAX];  // Directory where this pattern applies (from which .zipignore)
+    const char* pattern;       // Stored in the zipignore arena
+    const char* scope_dir;     // Directory where this pattern applies (interned, shared per .zipignore)
     bool is_directory;         // Pattern ends with / (directory only)
     bool is_negation;          // Pattern starts with ! (negate previous match)
     bool is_anchored;          // Pattern starts with / or contains / (anchored to scope_dir)
 } ignore_pattern_t;
 
-// Zipignore context
-typedef struct {
-    ignore_pattern_t patterns[MAX_IGNORE_PATTERNS];
+// String arena, interned scopes and loaded-file set (defined in zipignore.c)
+typedef struct ignore_store ignore_store_t;
+
+// Index over the loaded patterns (defined in zipignore.c)
+typedef struct ignore_matcher ignore_matcher_t;
+
+// Zipignore context. A zeroed struct is an empty, valid context; everything
+// it allocates grows with what is loaded and is released by free_zipignore().
+typedef struct zipignore {
+    ignore_pattern_t* patterns;
     int pattern_count;
+    int pattern_capacity;
     char base_dir[PATH_MAX];
-    char loaded_files[MAX_ZIPIGNORE_FILES][PATH_MAX];  // Track loaded .zipignore files
-    int loaded_files_count;
+    int loaded_files_count;     // .zipignore files read so far
+    ignore_store_t* store;
+    ignore_matcher_t* matcher;  // Patterns that could not be indexed are checked one by one
 } zipignore_t;
 
 // Function prototypes
 int load_zipignore(zipignore_t* zi, const char* base_dir, const char* zipignore_file);
+
+// Parse the patterns load_zipignore() would read before any directory's own
+// .zipignore - `zipignore_file`, or ~/.zipignore when it is NULL - once, for
+// many runs. They are kept unscoped; load_zipignore_rules() scopes them.
+int parse_zipignore_rules(zipignore_t* rules, const char* zipignore_file);
+
+// load_zipignore() with the patterns parsed by parse_zipignore_rules()
+// instead of reading those files again; `zipignore_file` must be the same
+int load_zipignore_rules(zipignore_t* zi, const char* base_dir, const zipignore_t* rules,
+                         const char* zipignore_file);
+// Load `dir_path`/.zipignore if present; meant to be called once per
+// directory as a traversal enters it (a missing file costs one failed open)
 int load_nested_zipignore(zipignore_t* zi, const char* dir_path);
+
+// Append one already-parsed pattern scoped to `scope_dir`
+int zipignore_add_pattern(zipignore_t* zi, const char* scope_dir, const char* pattern,
+                          bool is_directory, bool is_negation, bool is_anchored);
 bool should_ignore(const zipignore_t* zi, const char* path);
+
+// Whether a negation pattern could re-include anything below `dir_path`.
+// When it cannot, an ignored directory's whole subtree can be skipped.
+bool zipignore_may_reinclude(const zipignore_t* zi, const char* dir_path);
 int create_default_zipignore(void);
 void free_zipignore(zipignore_t* zi);
 
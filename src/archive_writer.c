@@ -0,0 +1,1475 @@
+#include "archive_writer.h"
+#include "metrics.h"
+#include "logging.h"
+#include "codec.h"
+#include <errno.h>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/types.h>
+#else
+    #include <fcntl.h>
+#endif
+
+// ZIP record signatures
+#define SIG_LOCAL_HEADER       0x04034b50u
+#define SIG_CENTRAL_HEADER     0x02014b50u
+#define SIG_END_OF_CDIR        0x06054b50u
+#define SIG_ZIP64_END_OF_CDIR  0x06064b50u
+#define SIG_ZIP64_LOCATOR      0x07064b50u
+#define SIG_DATA_DESCRIPTOR    0x08074b50u
+
+#define ZIP64_EXTRA_ID         0x0001
+#define ZIP32_MAX              0xFFFFFFFFull
+#define ZIP16_MAX              0xFFFFu
+
+#define FLAG_DATA_DESCRIPTOR   0x0008  // General purpose bit 3
+#define FLAG_UTF8_NAME         0x0800  // General purpose bit 11
+
+// The end of central directory record, with its comment, sits in this many
+// bytes at the end of the file, preceded by the Zip64 locator
+#define EOCD_SEARCH_SIZE (22 + 0xFFFF + 20)
+
+// Copy buffer for compaction and reused entry data
+#define COMPACT_BUFFER_SIZE (1024 * 1024)
+
+// "Version made by" host byte
+#ifdef _WIN32
+    #define HOST_SYSTEM 0              // MS-DOS / FAT attributes
+#else
+    #define HOST_SYSTEM 3              // UNIX mode bits in the high word
+#endif
+
+#define DEFAULT_FILE_MODE 0100644
+#define DEFAULT_DIR_MODE  040755
+#define DOS_DIRECTORY_ATTR 0x10
+
+// ============================================================================
+// Little-endian encoding helpers
+// ============================================================================
+
+static unsigned char* put16(unsigned char* p, uint16_t v) {
+    p[0] = (unsigned char)(v & 0xFF);
+    p[1] = (unsigned char)(v >> 8);
+    return p + 2;
+}
+
+static unsigned char* put32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)(v & 0xFF);
+    p[1] = (unsigned char)((v >> 8) & 0xFF);
+    p[2] = (unsigned char)((v >> 16) & 0xFF);
+    p[3] = (unsigned char)(v >> 24);
+    return p + 4;
+}
+
+static unsigned char* put64(unsigned char* p, uint64_t v) {
+    p = put32(p, (uint32_t)(v & 0xFFFFFFFFu));
+    return put32(p, (uint32_t)(v >> 32));
+}
+
+static uint16_t get16(const unsigned char* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get64(const unsigned char* p) {
+    return (uint64_t)get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+// Convert a timestamp to MS-DOS date/time (local time, 2-second resolution)
+static void time_to_dos(time_t t, uint16_t* dos_time, uint16_t* dos_date) {
+    struct tm tm_buf;
+    struct tm* tm_info;
+#ifdef _WIN32
+    tm_info = (localtime_s(&tm_buf, &t) == 0) ? &tm_buf : NULL;
+#else
+    tm_info = localtime_r(&t, &tm_buf);
+#endif
+
+    if (!tm_info || tm_info->tm_year < 80) {
+        // DOS dates start at 1980-01-01
+        *dos_time = 0;
+        *dos_date = (1 << 5) | 1;
+        return;
+    }
+
+    int year = tm_info->tm_year - 80;
+    if (year > 127) year = 127;
+
+    *dos_date = (uint16_t)((year << 9) | ((tm_info->tm_mon + 1) << 5) | tm_info->tm_mday);
+    *dos_time = (uint16_t)((tm_info->tm_hour << 11) | (tm_info->tm_min << 5) | (tm_info->tm_sec / 2));
+}
+
+// Version needed to extract (APPNOTE 4.4.3): 2.0 for deflate, 4.5 for Zip64
+// extra fields, 6.3 for Zstandard
+static uint16_t version_needed_for(uint16_t method, bool zip64) {
+    if (method == ARCHIVE_METHOD_ZSTD) return 63;
+    if (zip64) return 45;
+    return method == ARCHIVE_METHOD_DEFLATE ? 20 : 10;
+}
+
+static bool name_needs_utf8_flag(const char* name) {
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+        if (*p >= 0x80) return true;
+    }
+    return false;
+}
+
+// ============================================================================
+// Low-level output
+// ============================================================================
+
+static int write_bytes(archive_writer_t* writer, const void* data, size_t size) {
+    if (writer->failed) return EXIT_ZIP_ERROR;
+    if (size == 0) return EXIT_SUCCESS;
+
+    if (fwrite(data, 1, size, writer->file) != size) {
+        log_message(LOG_ERROR, "Error writing archive '%s': %s\n", writer->final_path, strerror(errno));
+        writer->failed = true;
+        return EXIT_ZIP_ERROR;
+    }
+
+    writer->offset += size;
+    metrics_count(METRICS_BYTES_WRITTEN, size);
+    return EXIT_SUCCESS;
+}
+
+// 64-bit seeks on every platform
+static bool seek_file(FILE* file, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static bool get_file_length(FILE* file, uint64_t* length) {
+#ifdef _WIN32
+    if (_fseeki64(file, 0, SEEK_END) != 0) return false;
+    __int64 pos = _ftelli64(file);
+#else
+    if (fseeko(file, 0, SEEK_END) != 0) return false;
+    off_t pos = ftello(file);
+#endif
+    if (pos < 0) return false;
+    *length = (uint64_t)pos;
+    return true;
+}
+
+static bool read_at(FILE* file, uint64_t offset, void* buffer, size_t size) {
+    return seek_file(file, offset) && fread(buffer, 1, size, file) == size;
+}
+
+// Seek the staging file
+static int seek_to(archive_writer_t* writer, uint64_t offset) {
+    if (!seek_file(writer->file, offset)) {
+        log_message(LOG_ERROR, "Error writing archive '%s': %s\n", writer->final_path, strerror(errno));
+        writer->failed = true;
+        return EXIT_ZIP_ERROR;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Temp files of this process get increasing numbers; a batch opens several at once
+static unsigned long g_temp_serial;
+
+static char* make_temp_path(const char* path, FILE** out_file) {
+    size_t len = strlen(path) + 48;
+    char* temp_path = malloc(len);
+    if (!temp_path) return NULL;
+
+#ifndef _WIN32
+    // Created 0666 so the kernel applies the umask, as fopen would; querying
+    // the umask would mean setting it, for every thread of the process
+    int fd = -1;
+    for (int attempt = 0; attempt < 100 && fd < 0; attempt++) {
+        unsigned long serial = __atomic_fetch_add(&g_temp_serial, 1, __ATOMIC_RELAXED);
+        snprintf(temp_path, len, "%s.%lu.%lu.tmp", path, (unsigned long)getpid(), serial);
+        fd = open(temp_path, O_CREAT | O_EXCL | O_RDWR, 0666);
+        if (fd < 0 && errno != EEXIST) break;
+    }
+    if (fd < 0) {
+        free(temp_path);
+        return NULL;
+    }
+
+    *out_file = fdopen(fd, "wb");
+    if (!*out_file) {
+        close(fd);
+        unlink(temp_path);
+        free(temp_path);
+        return NULL;
+    }
+#else
+    snprintf(temp_path, len, "%s.%lu.tmp", path, (unsigned long)GetCurrentProcessId());
+    *out_file = fopen(temp_path, "wb");
+    if (!*out_file) {
+        free(temp_path);
+        return NULL;
+    }
+#endif
+
+    return temp_path;
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+int archive_writer_open(archive_writer_t* writer, const char* path) {
+    if (!writer || !path) {
+        return EXIT_INVALID_ARGS;
+    }
+
+    memset(writer, 0, sizeof(archive_writer_t));
+
+    writer->final_path = strdup(path);
+    if (!writer->final_path) {
+        return EXIT_FAILURE;
+    }
+
+    writer->temp_path = make_temp_path(path, &writer->file);
+    if (!writer->temp_path) {
+        log_message(LOG_ERROR, "Error creating ZIP file '%s': %s\n", path, strerror(errno));
+        free(writer->final_path);
+        writer->final_path = NULL;
+        return EXIT_ZIP_ERROR;
+    }
+
+    setvbuf(writer->file, NULL, _IOFBF, ARCHIVE_WRITE_BUFFER_SIZE);
+    return EXIT_SUCCESS;
+}
+
+int archive_writer_open_stream(archive_writer_t* writer, FILE* stream, const char* display_name) {
+    if (!writer || !stream || !display_name) {
+        return EXIT_INVALID_ARGS;
+    }
+
+    memset(writer, 0, sizeof(archive_writer_t));
+
+    writer->final_path = strdup(display_name);
+    if (!writer->final_path) {
+        return EXIT_FAILURE;
+    }
+
+#ifdef _WIN32
+    // Text mode would turn every 0x0A byte into CR LF
+    _setmode(_fileno(stream), _O_BINARY);
+#endif
+
+    writer->file = stream;
+    writer->stream = true;
+    setvbuf(writer->file, NULL, _IOFBF, ARCHIVE_WRITE_BUFFER_SIZE);
+    return EXIT_SUCCESS;
+}
+
+// Cleared slot for the next central directory record; record_count is only
+// advanced once the record is complete
+static archive_cdir_record_t* push_record(archive_writer_t* writer) {
+    if (writer->record_count >= writer->record_capacity) {
+        size_t new_capacity = writer->record_capacity ? writer->record_capacity * 2 : 256;
+        archive_cdir_record_t* records = realloc(writer->records, sizeof(archive_cdir_record_t) * new_capacity);
+        if (!records) {
+            log_message(LOG_ERROR, "Error: Out of memory writing archive\n");
+            return NULL;
+        }
+        writer->records = records;
+        writer->record_capacity = new_capacity;
+    }
+
+    archive_cdir_record_t* record = &writer->records[writer->record_count];
+    memset(record, 0, sizeof(archive_cdir_record_t));
+    return record;
+}
+
+static int begin_entry(archive_writer_t* writer, const archive_entry_info_t* info, bool deferred) {
+    if (!writer || !info || !info->name || writer->entry_open) {
+        return EXIT_INVALID_ARGS;
+    }
+    if (writer->failed) {
+        return EXIT_ZIP_ERROR;
+    }
+
+    size_t name_len = strlen(info->name);
+    if (name_len > ZIP16_MAX) {
+        log_message(LOG_ERROR, "Error: Archive path too long: %s\n", info->name);
+        return EXIT_ZIP_ERROR;
+    }
+
+    archive_cdir_record_t* record = push_record(writer);
+    if (!record) {
+        return EXIT_FAILURE;
+    }
+    record->name = strdup(info->name);
+    if (!record->name) {
+        return EXIT_FAILURE;
+    }
+
+    bool is_dir = name_len > 0 && info->name[name_len - 1] == '/';
+    uint32_t mode = info->mode ? info->mode : (is_dir ? DEFAULT_DIR_MODE : DEFAULT_FILE_MODE);
+
+    record->flags = name_needs_utf8_flag(info->name) ? FLAG_UTF8_NAME : 0;
+    record->method = info->method;
+    record->crc32 = info->crc32;
+    record->compressed_size = info->compressed_size;
+    record->uncompressed_size = info->uncompressed_size;
+    record->local_header_offset = writer->offset;
+    record->external_attr = (HOST_SYSTEM == 3 ? (mode & 0xFFFF) << 16 : 0) | (is_dir ? DOS_DIRECTORY_ATTR : 0);
+    time_to_dos(info->mtime, &record->dos_time, &record->dos_date);
+
+    // Local header carries both sizes in a Zip64 extra field when either overflows.
+    // Deferred entries don't know their compressed size yet, so reserve the
+    // extra field whenever worst-case expansion could overflow (Zstandard
+    // frames grow incompressible data by up to 1/256, deflate far less).
+    bool zip64;
+    if (deferred) {
+        unsigned shift = info->method == ARCHIVE_METHOD_ZSTD ? 7 : 10;
+        uint64_t worst_case = info->uncompressed_size + (info->uncompressed_size >> shift) + 1024;
+        zip64 = worst_case >= ZIP32_MAX;
+    } else {
+        zip64 = info->compressed_size >= ZIP32_MAX || info->uncompressed_size >= ZIP32_MAX;
+    }
+    uint16_t version_needed = version_needed_for(info->method, zip64);
+
+    // A stream cannot be patched: the CRC and sizes follow the data in a
+    // data descriptor, and the local header leaves them zero. Stored data
+    // has no end marker of its own, so its sizes are given up front.
+    uint64_t header_compressed = info->compressed_size;
+    uint64_t header_uncompressed = info->uncompressed_size;
+    bool descriptor = deferred && writer->stream;
+    if (descriptor) {
+        record->flags |= FLAG_DATA_DESCRIPTOR;
+        bool stored = info->method == ARCHIVE_METHOD_STORE;
+        header_compressed = stored ? info->uncompressed_size : 0;
+        header_uncompressed = stored ? info->uncompressed_size : 0;
+        if (version_needed < 20) version_needed = 20;
+    }
+
+    unsigned char header[30 + 20];
+    unsigned char* p = header;
+    p = put32(p, SIG_LOCAL_HEADER);
+    p = put16(p, version_needed);
+    p = put16(p, record->flags);
+    p = put16(p, record->method);
+    p = put16(p, record->dos_time);
+    p = put16(p, record->dos_date);
+    p = put32(p, descriptor ? 0 : record->crc32);
+    p = put32(p, zip64 ? (uint32_t)ZIP32_MAX : (uint32_t)header_compressed);
+    p = put32(p, zip64 ? (uint32_t)ZIP32_MAX : (uint32_t)header_uncompressed);
+    p = put16(p, (uint16_t)name_len);
+    p = put16(p, zip64 ? 20 : 0);
+
+    unsigned char* extra = p;
+    if (zip64) {
+        p = put16(p, ZIP64_EXTRA_ID);
+        p = put16(p, 16);
+        p = put64(p, header_uncompressed);
+        p = put64(p, header_compressed);
+    }
+
+    if (write_bytes(writer, header, (size_t)(extra - header)) != EXIT_SUCCESS ||
+        write_bytes(writer, info->name, name_len) != EXIT_SUCCESS ||
+        write_bytes(writer, extra, (size_t)(p - extra)) != EXIT_SUCCESS) {
+        free(record->name);
+        return EXIT_ZIP_ERROR;
+    }
+
+    record->data_offset = writer->offset;
+    writer->record_count++;
+    writer->entry_open = true;
+    writer->entry_deferred = deferred;
+    writer->entry_zip64 = zip64;
+    writer->entry_expected = deferred ? ((descriptor && info->method == ARCHIVE_METHOD_STORE)
+                                         ? info->uncompressed_size : UINT64_MAX)
+                                      : info->compressed_size;
+    writer->entry_written = 0;
+    return EXIT_SUCCESS;
+}
+
+int archive_writer_begin_entry(archive_writer_t* writer, const archive_entry_info_t* info) {
+    return begin_entry(writer, info, false);
+}
+
+int archive_writer_begin_deferred_entry(archive_writer_t* writer, const archive_entry_info_t* info) {
+    return begin_entry(writer, info, true);
+}
+
+int archive_writer_write(archive_writer_t* writer, const void* data, size_t size) {
+    if (!writer || !writer->entry_open || (!data && size > 0)) {
+        return EXIT_INVALID_ARGS;
+    }
+
+    if (writer->entry_written + size > writer->entry_expected) {
+        log_message(LOG_ERROR, "Error: Entry '%s' data exceeds its declared size\n",
+                       writer->records[writer->record_count - 1].name);
+        writer->failed = true;
+        return EXIT_ZIP_ERROR;
+    }
+
+    int result = write_bytes(writer, data, size);
+    if (result == EXIT_SUCCESS) {
+        writer->entry_written += size;
+    }
+    return result;
+}
+
+int archive_writer_end_entry(archive_writer_t* writer) {
+    if (!writer || !writer->entry_open || writer->entry_deferred) {
+        return EXIT_INVALID_ARGS;
+    }
+
+    writer->entry_open = false;
+    if (writer->entry_written != writer->entry_expected) {
+        log_message(LOG_ERROR, "Error: Entry '%s' is shorter than its declared size\n",
+                       writer->records[writer->record_count - 1].name);
+        writer->failed = true;
+        return EXIT_ZIP_ERROR;
+    }
+
+    return writer->failed ? EXIT_ZIP_ERROR : EXIT_SUCCESS;
+}
+
+// Data descriptor after a deferred entry in stream mode. Sizes are 8 bytes
+// when the local header carries a Zip64 extra field (APPNOTE 4.3.9.3).
+static int write_data_descriptor(archive_writer_t* writer, const archive_cdir_record_t* record) {
+    if (record->method == ARCHIVE_METHOD_STORE && writer->entry_written != writer->entry_expected) {
+        // Its local header already promised the expected size
+        log_message(LOG_ERROR, "Error: Entry '%s' changed size while being archived\n", record->name);
+        writer->failed = true;
+        return EXIT_ZIP_ERROR;
+    }
+
+    unsigned char descriptor[24];
+    unsigned char* p = put32(descriptor, SIG_DATA_DESCRIPTOR);
+    p = put32(p, record->crc32);
+    if (writer->entry_zip64) {
+        p = put64(p, record->compressed_size);
+        p = put64(p, record->uncompressed_size);
+    } else {
+        p = put32(p, (uint32_t)record->compressed_size);
+        p = put32(p, (uint32_t)record->uncompressed_size);
+    }
+    return write_bytes(writer, descriptor, (size_t)(p - descriptor));
+}
+
+int archive_writer_end_deferred_entry(archive_writer_t* writer, uint32_t crc32, uint64_t uncompressed_size) {
+    if (!writer || !writer->entry_open || !writer->entry_deferred) {
+        return EXIT_INVALID_ARGS;
+    }
+
+    writer->entry_open = false;
+    writer->entry_deferred = false;
+    if (writer->failed) {
+        return EXIT_ZIP_ERROR;
+    }
+
+    archive_cdir_record_t* record = &writer->records[writer->record_count - 1];
+    record->crc32 = crc32;
+    record->compressed_size = writer->entry_written;
+    record->uncompressed_size = uncompressed_size;
+
+    bool overflow = record->compressed_size >= ZIP32_MAX || record->uncompressed_size >= ZIP32_MAX;
+    if (overflow && !writer->entry_zip64) {
+        // The file grew past what the reserved header can describe
+        log_message(LOG_ERROR, "Error: Entry '%s' outgrew its local header\n", record->name);
+        writer->failed = true;
+        return EXIT_ZIP_ERROR;
+    }
+
+    if (writer->stream) {
+        return write_data_descriptor(writer, record);
+    }
+
+    // Patch CRC and sizes in the local header (offset 14), plus the Zip64
+    // extra that follows the name when one was reserved
+    unsigned char fields[12];
+    unsigned char* p = put32(fields, crc32);
+    p = put32(p, writer->entry_zip64 ? (uint32_t)ZIP32_MAX : (uint32_t)record->compressed_size);
+    put32(p, writer->entry_zip64 ? (uint32_t)ZIP32_MAX : (uint32_t)record->uncompressed_size);
+
+    uint64_t end_offset = writer->offset;
+    if (seek_to(writer, record->local_header_offset + 14) != EXIT_SUCCESS ||
+        fwrite(fields, 1, sizeof(fields), writer->file) != sizeof(fields)) {
+        writer->failed = true;
+        return EXIT_ZIP_ERROR;
+    }
+
+    if (writer->entry_zip64) {
+        unsigned char extra[16];
+        p = put64(extra, record->uncompressed_size);
+        put64(p, record->compressed_size);
+        uint64_t extra_offset = record->local_header_offset + 30 + strlen(record->name) + 4;
+        if (seek_to(writer, extra_offset) != EXIT_SUCCESS ||
+            fwrite(extra, 1, sizeof(extra), writer->file) != sizeof(extra)) {
+            writer->failed = true;
+            return EXIT_ZIP_ERROR;
+        }
+    }
+
+    return seek_to(writer, end_offset);
+}
+
+int archive_writer_add(archive_writer_t* writer, const archive_entry_info_t* info, const void* data) {
+    int result = archive_writer_begin_entry(writer, info);
+    if (result != EXIT_SUCCESS) return result;
+
+    result = archive_writer_write(writer, data, (size_t)info->compressed_size);
+    if (result != EXIT_SUCCESS) {
+        writer->entry_open = false;
+        return result;
+    }
+
+    return archive_writer_end_entry(writer);
+}
+
+int archive_writer_add_directory(archive_writer_t* writer, const char* name, time_t mtime) {
+    archive_entry_info_t info;
+    memset(&info, 0, sizeof(info));
+    info.name = name;
+    info.method = ARCHIVE_METHOD_STORE;
+    info.mtime = mtime;
+
+    // No data between the headers, so no buffer to hand to the writer
+    int result = archive_writer_begin_entry(writer, &info);
+    if (result != EXIT_SUCCESS) return result;
+    return archive_writer_end_entry(writer);
+}
+
+// Write one central directory header
+static int write_central_header(archive_writer_t* writer, const archive_cdir_record_t* record) {
+    bool big_uncomp = record->uncompressed_size >= ZIP32_MAX;
+    bool big_comp = record->compressed_size >= ZIP32_MAX;
+    bool big_offset = record->local_header_offset >= ZIP32_MAX;
+    uint16_t zip64_len = (uint16_t)((big_uncomp + big_comp + big_offset) * 8);
+
+    bool zip64 = zip64_len > 0;
+    uint16_t version_made_by = record->version_made_by ? record->version_made_by
+                                                       : (uint16_t)((HOST_SYSTEM << 8) | 45);
+    uint16_t version_needed = version_needed_for(record->method, zip64);
+    if (record->version_needed > version_needed) version_needed = record->version_needed;
+    size_t name_len = strlen(record->name);
+
+    size_t extra_len = (zip64 ? zip64_len + 4u : 0u) + record->extra_len;
+    if (extra_len > ZIP16_MAX) {
+        log_message(LOG_ERROR, "Error: Extra fields of '%s' are too long\n", record->name);
+        return EXIT_ZIP_ERROR;
+    }
+
+    unsigned char header[46 + 4 + 24];
+    unsigned char* p = header;
+    p = put32(p, SIG_CENTRAL_HEADER);
+    p = put16(p, version_made_by);
+    p = put16(p, version_needed);
+    p = put16(p, record->flags);
+    p = put16(p, record->method);
+    p = put16(p, record->dos_time);
+    p = put16(p, record->dos_date);
+    p = put32(p, record->crc32);
+    p = put32(p, big_comp ? (uint32_t)ZIP32_MAX : (uint32_t)record->compressed_size);
+    p = put32(p, big_uncomp ? (uint32_t)ZIP32_MAX : (uint32_t)record->uncompressed_size);
+    p = put16(p, (uint16_t)name_len);
+    p = put16(p, (uint16_t)extra_len);
+    p = put16(p, record->comment_len);
+    p = put16(p, 0);                               // Disk number start
+    p = put16(p, record->internal_attr);
+    p = put32(p, record->external_attr);
+    p = put32(p, big_offset ? (uint32_t)ZIP32_MAX : (uint32_t)record->local_header_offset);
+
+    // Zip64 extra holds only the overflowing fields, in this fixed order
+    unsigned char* extra = p;
+    if (zip64) {
+        p = put16(p, ZIP64_EXTRA_ID);
+        p = put16(p, zip64_len);
+        if (big_uncomp) p = put64(p, record->uncompressed_size);
+        if (big_comp) p = put64(p, record->compressed_size);
+        if (big_offset) p = put64(p, record->local_header_offset);
+    }
+
+    if (write_bytes(writer, header, (size_t)(extra - header)) != EXIT_SUCCESS ||
+        write_bytes(writer, record->name, name_len) != EXIT_SUCCESS ||
+        write_bytes(writer, extra, (size_t)(p - extra)) != EXIT_SUCCESS ||
+        write_bytes(writer, record->extra, record->extra_len) != EXIT_SUCCESS ||
+        write_bytes(writer, record->comment, record->comment_len) != EXIT_SUCCESS) {
+        return EXIT_ZIP_ERROR;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int write_end_of_central_directory(archive_writer_t* writer, uint64_t cdir_offset, uint64_t cdir_size) {
+    uint64_t count = writer->record_count - writer->removed_count;
+    bool zip64 = count >= ZIP16_MAX || cdir_offset >= ZIP32_MAX || cdir_size >= ZIP32_MAX;
+
+    unsigned char buffer[56 + 20 + 22];
+    unsigned char* p = buffer;
+
+    if (zip64) {
+        uint64_t zip64_eocd_offset = writer->offset;
+
+        // Zip64 end of central directory record
+        p = put32(p, SIG_ZIP64_END_OF_CDIR);
+        p = put64(p, 44);                          // Size of remaining record
+        p = put16(p, (uint16_t)((HOST_SYSTEM << 8) | 45));
+        p = put16(p, 45);
+        p = put32(p, 0);                           // This disk
+        p = put32(p, 0);                           // Disk with central directory
+        p = put64(p, count);
+        p = put64(p, count);
+        p = put64(p, cdir_size);
+        p = put64(p, cdir_offset);
+
+        // Zip64 end of central directory locator
+        p = put32(p, SIG_ZIP64_LOCATOR);
+        p = put32(p, 0);
+        p = put64(p, zip64_eocd_offset);
+        p = put32(p, 1);                           // Total disks
+    }
+
+    p = put32(p, SIG_END_OF_CDIR);
+    p = put16(p, 0);
+    p = put16(p, 0);
+    p = put16(p, count >= ZIP16_MAX ? (uint16_t)ZIP16_MAX : (uint16_t)count);
+    p = put16(p, count >= ZIP16_MAX ? (uint16_t)ZIP16_MAX : (uint16_t)count);
+    p = put32(p, cdir_size >= ZIP32_MAX ? (uint32_t)ZIP32_MAX : (uint32_t)cdir_size);
+    p = put32(p, cdir_offset >= ZIP32_MAX ? (uint32_t)ZIP32_MAX : (uint32_t)cdir_offset);
+    p = put16(p, 0);                               // Comment length
+
+    return write_bytes(writer, buffer, (size_t)(p - buffer));
+}
+
+static void free_records(archive_writer_t* writer) {
+    for (size_t i = 0; i < writer->record_count; i++) {
+        free(writer->records[i].name);
+    }
+    free(writer->records);
+    free(writer->name_index);
+    writer->records = NULL;
+    writer->record_count = 0;
+    writer->record_capacity = 0;
+    writer->existing_count = 0;
+    writer->removed_count = 0;
+    writer->name_index = NULL;
+}
+
+// Flush `file` through to the disk
+static bool sync_file(FILE* file) {
+    if (fflush(file) != 0) return false;
+#ifndef _WIN32
+    return fsync(fileno(file)) == 0;
+#else
+    return _commit(_fileno(file)) == 0;
+#endif
+}
+
+// Cut an archive that was appended to back to the size it was opened with
+static void restore_original(const archive_writer_t* writer) {
+#ifndef _WIN32
+    int ret = truncate(writer->final_path, (off_t)writer->append_start);
+#else
+    int ret = -1;
+    int fd = _open(writer->final_path, _O_WRONLY | _O_BINARY);
+    if (fd >= 0) {
+        ret = _chsize_s(fd, (__int64)writer->append_start) == 0 ? 0 : -1;
+        _close(fd);
+    }
+#endif
+    if (ret != 0) {
+        log_message(LOG_ERROR, "Error restoring archive '%s': %s\n", writer->final_path, strerror(errno));
+    }
+}
+
+int archive_writer_close(archive_writer_t* writer) {
+    if (!writer || !writer->file) {
+        return EXIT_INVALID_ARGS;
+    }
+
+    int result = writer->entry_open ? EXIT_ZIP_ERROR : EXIT_SUCCESS;
+
+    // Appending in place, the new entries reach the disk before a directory
+    // that points at them, and that directory before close returns
+    if (result == EXIT_SUCCESS && writer->append && !sync_file(writer->file)) {
+        log_message(LOG_ERROR, "Error writing archive '%s': %s\n", writer->final_path, strerror(errno));
+        result = EXIT_ZIP_ERROR;
+    }
+
+    uint64_t cdir_offset = writer->offset;
+    for (size_t i = 0; i < writer->record_count && result == EXIT_SUCCESS; i++) {
+        if (writer->records[i].removed) continue;
+        result = write_central_header(writer, &writer->records[i]);
+    }
+
+    if (result == EXIT_SUCCESS) {
+        result = write_end_of_central_directory(writer, cdir_offset, writer->offset - cdir_offset);
+    }
+    if (result == EXIT_SUCCESS && writer->append && !sync_file(writer->file)) {
+        log_message(LOG_ERROR, "Error writing archive '%s': %s\n", writer->final_path, strerror(errno));
+        result = EXIT_ZIP_ERROR;
+    }
+
+    // The caller owns a stream; it is only flushed
+    int flushed = writer->stream ? fflush(writer->file) : fclose(writer->file);
+    if (flushed != 0 && result == EXIT_SUCCESS) {
+        log_message(LOG_ERROR, "Error writing archive '%s': %s\n", writer->final_path, strerror(errno));
+        result = EXIT_ZIP_ERROR;
+    }
+    writer->file = NULL;
+
+    if (writer->stream) {
+        // Written in place as it went: nothing to move or undo
+    } else if (writer->append) {
+        // Appended in place: nothing to move, only to undo
+        if (result != EXIT_SUCCESS) {
+            restore_original(writer);
+        }
+    } else {
+        if (result == EXIT_SUCCESS) {
+#ifdef _WIN32
+            if (!MoveFileExA(writer->temp_path, writer->final_path, MOVEFILE_REPLACE_EXISTING)) {
+#else
+            if (rename(writer->temp_path, writer->final_path) != 0) {
+#endif
+                log_message(LOG_ERROR, "Error moving archive into place '%s': %s\n", writer->final_path, strerror(errno));
+                result = EXIT_ZIP_ERROR;
+            }
+        }
+
+        if (result != EXIT_SUCCESS) {
+            remove(writer->temp_path);
+        }
+    }
+
+    free_records(writer);
+    free(writer->temp_path);
+    free(writer->final_path);
+    writer->temp_path = NULL;
+    writer->final_path = NULL;
+
+    return result;
+}
+
+void archive_writer_abort(archive_writer_t* writer) {
+    if (!writer) return;
+
+    if (writer->file) {
+        if (writer->stream) {
+            fflush(writer->file);
+        } else {
+            fclose(writer->file);
+        }
+        writer->file = NULL;
+    }
+    if (writer->stream) {
+        // Whatever was written has already gone down the stream
+    } else if (writer->append && writer->final_path) {
+        restore_original(writer);
+    } else if (writer->temp_path) {
+        remove(writer->temp_path);
+    }
+
+    free_records(writer);
+    free(writer->temp_path);
+    free(writer->final_path);
+    writer->temp_path = NULL;
+    writer->final_path = NULL;
+}
+
+// ============================================================================
+// Existing archives - appending and compaction
+// ============================================================================
+
+static bool invalid_archive(const archive_writer_t* writer) {
+    log_message(LOG_ERROR, "Error: '%s' is not a valid ZIP archive\n", writer->final_path);
+    return false;
+}
+
+// Locate the central directory from the end of central directory record
+// (and its Zip64 counterpart). `directory_bytes` covers the central
+// directory through the end of the trailing records.
+static bool find_central_directory(archive_writer_t* writer, FILE* file, uint64_t file_size,
+                                   uint64_t* count, uint64_t* cdir_offset, uint64_t* cdir_size,
+                                   uint64_t* directory_bytes) {
+    size_t tail_len = file_size < EOCD_SEARCH_SIZE ? (size_t)file_size : EOCD_SEARCH_SIZE;
+    if (tail_len < 22) return invalid_archive(writer);
+
+    unsigned char* tail = malloc(tail_len);
+    if (!tail) return false;
+    uint64_t tail_offset = file_size - tail_len;
+    if (!read_at(file, tail_offset, tail, tail_len)) {
+        free(tail);
+        return invalid_archive(writer);
+    }
+
+    // Last signature whose comment fits in the file
+    const unsigned char* eocd = NULL;
+    for (size_t i = tail_len - 22 + 1; i-- > 0;) {
+        if (get32(tail + i) == SIG_END_OF_CDIR && i + 22 + get16(tail + i + 20) <= tail_len) {
+            eocd = tail + i;
+            break;
+        }
+    }
+    if (!eocd) {
+        free(tail);
+        return invalid_archive(writer);
+    }
+
+    uint64_t eocd_offset = tail_offset + (uint64_t)(eocd - tail);
+    uint64_t directory_end = eocd_offset + 22 + get16(eocd + 20);
+    uint32_t disk = get16(eocd + 4) | get16(eocd + 6);
+    *count = get16(eocd + 10);
+    *cdir_size = get32(eocd + 12);
+    *cdir_offset = get32(eocd + 16);
+    free(tail);
+
+    // Where the central directory has to end
+    uint64_t cdir_limit = eocd_offset;
+
+    if (*count == ZIP16_MAX || *cdir_size == ZIP32_MAX || *cdir_offset == ZIP32_MAX) {
+        unsigned char locator[20];
+        unsigned char record[56];
+        if (eocd_offset >= 20 && read_at(file, eocd_offset - 20, locator, sizeof(locator)) &&
+            get32(locator) == SIG_ZIP64_LOCATOR) {
+            uint64_t record_offset = get64(locator + 8);
+            if (!read_at(file, record_offset, record, sizeof(record)) ||
+                get32(record) != SIG_ZIP64_END_OF_CDIR) {
+                return invalid_archive(writer);
+            }
+            disk |= get32(record + 16) | get32(record + 20);
+            *count = get64(record + 32);
+            *cdir_size = get64(record + 40);
+            *cdir_offset = get64(record + 48);
+            cdir_limit = record_offset;
+        }
+    }
+
+    if (disk != 0) {
+        log_message(LOG_ERROR, "Error: Multi-disk archive '%s' is not supported\n", writer->final_path);
+        return false;
+    }
+    if (*cdir_offset > cdir_limit || *cdir_size > cdir_limit - *cdir_offset) {
+        return invalid_archive(writer);
+    }
+
+    *directory_bytes = directory_end - *cdir_offset;
+    return true;
+}
+
+// Read the whole central directory of `file` into a new buffer
+static int load_central_directory(archive_writer_t* writer, FILE* file, uint64_t file_size,
+                                  unsigned char** cdir, uint64_t* count, uint64_t* cdir_size,
+                                  uint64_t* directory_bytes) {
+    uint64_t cdir_offset = 0;
+    if (!find_central_directory(writer, file, file_size, count, &cdir_offset, cdir_size, directory_bytes)) {
+        return EXIT_ZIP_ERROR;
+    }
+    if (*cdir_size > SIZE_MAX || *count > *cdir_size / 46) {
+        invalid_archive(writer);
+        return EXIT_ZIP_ERROR;
+    }
+
+    *cdir = malloc(*cdir_size ? (size_t)*cdir_size : 1);
+    if (!*cdir) {
+        log_message(LOG_ERROR, "Error: Out of memory reading central directory\n");
+        return EXIT_FAILURE;
+    }
+    if (!read_at(file, cdir_offset, *cdir, (size_t)*cdir_size)) {
+        free(*cdir);
+        *cdir = NULL;
+        invalid_archive(writer);
+        return EXIT_ZIP_ERROR;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Whether a whole central directory header starts at `pos`
+static bool central_header_at(archive_writer_t* writer, const unsigned char* cdir, uint64_t cdir_size,
+                              size_t pos) {
+    const unsigned char* h = cdir + pos;
+    if (cdir_size - pos < 46 || get32(h) != SIG_CENTRAL_HEADER ||
+        cdir_size - pos - 46 < (uint64_t)get16(h + 28) + get16(h + 30) + get16(h + 32)) {
+        return invalid_archive(writer);
+    }
+    return true;
+}
+
+// Take the 64-bit values of the fields that overflowed from a Zip64 extra
+// field, which holds only those, in this fixed order
+static void read_zip64_extra(const unsigned char* z, uint16_t len, uint64_t* uncompressed_size,
+                             uint64_t* compressed_size, uint64_t* local_header_offset) {
+    const unsigned char* z_end = z + len;
+    if (*uncompressed_size == ZIP32_MAX && z + 8 <= z_end) {
+        *uncompressed_size = get64(z);
+        z += 8;
+    }
+    if (*compressed_size == ZIP32_MAX && z + 8 <= z_end) {
+        *compressed_size = get64(z);
+        z += 8;
+    }
+    if (*local_header_offset == ZIP32_MAX && z + 8 <= z_end) {
+        *local_header_offset = get64(z);
+    }
+}
+
+// Read every central directory header of `file` into writer->records
+static int read_central_directory(archive_writer_t* writer, FILE* file, uint64_t file_size,
+                                  uint64_t* directory_bytes) {
+    unsigned char* cdir = NULL;
+    uint64_t count = 0, cdir_size = 0;
+    int result = load_central_directory(writer, file, file_size, &cdir, &count, &cdir_size, directory_bytes);
+    if (result != EXIT_SUCCESS) {
+        return result;
+    }
+
+    size_t pos = 0;
+    for (uint64_t i = 0; i < count && result == EXIT_SUCCESS; i++) {
+        const unsigned char* h = cdir + pos;
+        if (!central_header_at(writer, cdir, cdir_size, pos)) {
+            result = EXIT_ZIP_ERROR;
+            break;
+        }
+
+        uint16_t name_len = get16(h + 28);
+        uint16_t extra_len = get16(h + 30);
+        uint16_t comment_len = get16(h + 32);
+
+        archive_cdir_record_t* record = push_record(writer);
+        char* block = record ? malloc((size_t)name_len + 1 + extra_len + comment_len) : NULL;
+        if (!block) {
+            result = EXIT_FAILURE;
+            break;
+        }
+
+        record->version_made_by = get16(h + 4);
+        record->version_needed = get16(h + 6);
+        record->flags = get16(h + 8);
+        record->method = get16(h + 10);
+        record->dos_time = get16(h + 12);
+        record->dos_date = get16(h + 14);
+        record->crc32 = get32(h + 16);
+        record->compressed_size = get32(h + 20);
+        record->uncompressed_size = get32(h + 24);
+        record->internal_attr = get16(h + 36);
+        record->external_attr = get32(h + 38);
+        record->local_header_offset = get32(h + 42);
+
+        memcpy(block, h + 46, name_len);
+        block[name_len] = '\0';
+        record->name = block;
+
+        // Keep every extra field but Zip64, whose values are taken here and
+        // re-encoded from the record when the directory is written again
+        const unsigned char* extra = h + 46 + name_len;
+        unsigned char* kept = (unsigned char*)block + name_len + 1;
+        size_t kept_len = 0;
+        for (size_t e = 0; e + 4 <= extra_len;) {
+            uint16_t id = get16(extra + e);
+            uint16_t len = get16(extra + e + 2);
+            if (e + 4 + len > extra_len) break;
+
+            if (id == ZIP64_EXTRA_ID) {
+                read_zip64_extra(extra + e + 4, len, &record->uncompressed_size, &record->compressed_size,
+                                 &record->local_header_offset);
+            } else {
+                memcpy(kept + kept_len, extra + e, 4u + len);
+                kept_len += 4u + len;
+            }
+            e += 4u + len;
+        }
+        record->extra = kept_len ? kept : NULL;
+        record->extra_len = (uint16_t)kept_len;
+
+        if (comment_len > 0) {
+            memcpy(kept + kept_len, extra + extra_len, comment_len);
+            record->comment = (const char*)kept + kept_len;
+            record->comment_len = comment_len;
+        }
+
+        writer->record_count++;
+        pos += 46u + name_len + extra_len + comment_len;
+    }
+
+    free(cdir);
+    return result;
+}
+
+int archive_writer_open_append(archive_writer_t* writer, const char* path) {
+    if (!writer || !path) {
+        return EXIT_INVALID_ARGS;
+    }
+
+    memset(writer, 0, sizeof(archive_writer_t));
+
+    writer->final_path = strdup(path);
+    if (!writer->final_path) {
+        return EXIT_FAILURE;
+    }
+
+    writer->file = fopen(path, "r+b");
+    if (!writer->file) {
+        log_message(LOG_ERROR, "Error opening ZIP file '%s': %s\n", path, strerror(errno));
+        free(writer->final_path);
+        writer->final_path = NULL;
+        return EXIT_ZIP_ERROR;
+    }
+    setvbuf(writer->file, NULL, _IOFBF, ARCHIVE_WRITE_BUFFER_SIZE);
+
+    uint64_t file_size = 0;
+    uint64_t directory_bytes = 0;
+    int result = get_file_length(writer->file, &file_size) ? EXIT_SUCCESS : EXIT_ZIP_ERROR;
+    if (result == EXIT_SUCCESS) {
+        result = read_central_directory(writer, writer->file, file_size, &directory_bytes);
+    }
+    if (result == EXIT_SUCCESS) {
+        result = seek_to(writer, file_size);
+    }
+
+    if (result != EXIT_SUCCESS) {
+        fclose(writer->file);
+        writer->file = NULL;
+        free_records(writer);
+        free(writer->final_path);
+        writer->final_path = NULL;
+        return result;
+    }
+
+    // The old central directory stays behind as dead space, so the archive
+    // is intact until the new one has been written
+    writer->append = true;
+    writer->append_start = file_size;
+    writer->offset = file_size;
+    writer->existing_count = writer->record_count;
+    return EXIT_SUCCESS;
+}
+
+int archive_index_load(archive_index_t* index, const char* path) {
+    memset(index, 0, sizeof(archive_index_t));
+    string_pool_init(&index->names);
+
+    archive_writer_t reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.final_path = (char*)path;    // For error messages only
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        log_message(LOG_ERROR, "Error opening ZIP file '%s': %s\n", path, strerror(errno));
+        return EXIT_ZIP_ERROR;
+    }
+
+    unsigned char* cdir = NULL;
+    uint64_t count = 0, cdir_size = 0, file_size = 0, directory_bytes = 0;
+    int result = get_file_length(file, &file_size) ? EXIT_SUCCESS : EXIT_ZIP_ERROR;
+    if (result == EXIT_SUCCESS) {
+        result = load_central_directory(&reader, file, file_size, &cdir, &count, &cdir_size, &directory_bytes);
+    }
+    fclose(file);
+    if (result != EXIT_SUCCESS) {
+        return result;
+    }
+
+    // `count` is bounded by the central directory size, which was read
+    index->entries = malloc(sizeof(archive_index_entry_t) * (count ? (size_t)count : 1));
+    if (!index->entries) {
+        log_message(LOG_ERROR, "Error: Out of memory reading central directory\n");
+        result = EXIT_FAILURE;
+    }
+
+    size_t pos = 0;
+    for (uint64_t i = 0; i < count && result == EXIT_SUCCESS; i++) {
+        const unsigned char* h = cdir + pos;
+        if (!central_header_at(&reader, cdir, cdir_size, pos)) {
+            result = EXIT_ZIP_ERROR;
+            break;
+        }
+
+        uint16_t name_len = get16(h + 28);
+        uint16_t extra_len = get16(h + 30);
+        uint16_t comment_len = get16(h + 32);
+
+        archive_index_entry_t* entry = &index->entries[index->count];
+        entry->name = string_pool_strndup(&index->names, (const char*)h + 46, name_len);
+        if (!entry->name) {
+            log_message(LOG_ERROR, "Error: Out of memory reading central directory\n");
+            result = EXIT_FAILURE;
+            break;
+        }
+        entry->method = get16(h + 10);
+        entry->dos_time = get16(h + 12);
+        entry->dos_date = get16(h + 14);
+        entry->crc32 = get32(h + 16);
+        entry->compressed_size = get32(h + 20);
+        entry->uncompressed_size = get32(h + 24);
+        entry->local_header_offset = get32(h + 42);
+
+        const unsigned char* extra = h + 46 + name_len;
+        for (size_t e = 0; e + 4 <= extra_len;) {
+            uint16_t len = get16(extra + e + 2);
+            if (e + 4 + len > extra_len) break;
+            if (get16(extra + e) == ZIP64_EXTRA_ID) {
+                read_zip64_extra(extra + e + 4, len, &entry->uncompressed_size, &entry->compressed_size,
+                                 &entry->local_header_offset);
+            }
+            e += 4u + len;
+        }
+
+        index->count++;
+        pos += 46u + name_len + extra_len + comment_len;
+    }
+
+    free(cdir);
+    if (result != EXIT_SUCCESS) {
+        archive_index_free(index);
+    }
+    return result;
+}
+
+void archive_index_free(archive_index_t* index) {
+    free(index->entries);
+    string_pool_free(&index->names);
+    index->entries = NULL;
+    index->count = 0;
+}
+
+int archive_read_header_offsets(const char* path, uint64_t** offsets, size_t* count) {
+    *offsets = NULL;
+    *count = 0;
+
+    archive_index_t index;
+    int result = archive_index_load(&index, path);
+    if (result != EXIT_SUCCESS) {
+        return result;
+    }
+
+    *offsets = malloc(sizeof(uint64_t) * (index.count ? index.count : 1));
+    if (*offsets) {
+        for (size_t i = 0; i < index.count; i++) {
+            (*offsets)[i] = index.entries[i].local_header_offset;
+        }
+        *count = index.count;
+    } else {
+        result = EXIT_FAILURE;
+    }
+
+    archive_index_free(&index);
+    return result;
+}
+
+bool archive_entry_data_offset(FILE* file, uint64_t header_offset, uint64_t* data_offset) {
+    unsigned char header[30];
+    if (!read_at(file, header_offset, header, sizeof(header)) || get32(header) != SIG_LOCAL_HEADER) {
+        return false;
+    }
+    *data_offset = header_offset + 30 + get16(header + 26) + get16(header + 28);
+    return true;
+}
+
+bool archive_range_crc32(FILE* file, uint64_t offset, uint64_t size, unsigned char* buffer, size_t buffer_size,
+                         uint32_t* crc) {
+    if (!seek_file(file, offset)) return false;
+    uint32_t value = 0;
+    while (size > 0) {
+        size_t chunk = size < buffer_size ? (size_t)size : buffer_size;
+        if (fread(buffer, 1, chunk, file) != chunk) return false;
+        value = codec_crc32(value, buffer, chunk);
+        size -= chunk;
+    }
+    *crc = value;
+    return true;
+}
+
+// 64-bit FNV-1a
+static uint64_t hash_name(const char* name) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool build_name_index(archive_writer_t* writer) {
+    size_t capacity = 16;
+    while (capacity < writer->existing_count * 2) capacity *= 2;
+
+    writer->name_index = calloc(capacity, sizeof(size_t));
+    if (!writer->name_index) return false;
+
+    writer->name_index_mask = capacity - 1;
+    for (size_t i = 0; i < writer->existing_count; i++) {
+        size_t j = (size_t)hash_name(writer->records[i].name) & writer->name_index_mask;
+        while (writer->name_index[j]) j = (j + 1) & writer->name_index_mask;
+        writer->name_index[j] = i + 1;
+    }
+    return true;
+}
+
+static size_t remove_record(archive_writer_t* writer, archive_cdir_record_t* record, const char* name) {
+    if (record->removed || strcmp(record->name, name) != 0) return 0;
+    record->removed = true;
+    writer->removed_count++;
+    return 1;
+}
+
+size_t archive_writer_remove(archive_writer_t* writer, const char* name) {
+    if (!writer || !name || !writer->append || writer->existing_count == 0) {
+        return 0;
+    }
+
+    size_t removed = 0;
+    if (!writer->name_index && !build_name_index(writer)) {
+        // Out of memory for the index: fall back to a scan
+        for (size_t i = 0; i < writer->existing_count; i++) {
+            removed += remove_record(writer, &writer->records[i], name);
+        }
+        return removed;
+    }
+
+    size_t mask = writer->name_index_mask;
+    for (size_t j = (size_t)hash_name(name) & mask; writer->name_index[j]; j = (j + 1) & mask) {
+        removed += remove_record(writer, &writer->records[writer->name_index[j] - 1], name);
+    }
+    return removed;
+}
+
+// Whether an existing record holds exactly the data described by `info`,
+// starting at `data_offset`
+static bool is_data_source(archive_writer_t* writer, const archive_cdir_record_t* record,
+                           const archive_entry_info_t* info, const char* name, uint64_t data_offset) {
+    if (strcmp(record->name, name) != 0 || record->method != info->method ||
+        record->crc32 != info->crc32 || record->compressed_size != info->compressed_size ||
+        record->uncompressed_size != info->uncompressed_size || (record->flags & 0x0001)) {
+        return false;
+    }
+    if (data_offset > writer->append_start || info->compressed_size > writer->append_start - data_offset) {
+        return false;
+    }
+
+    // The offset only counts if the local header really ends there
+    unsigned char header[30];
+    return read_at(writer->file, record->local_header_offset, header, sizeof(header)) &&
+           get32(header) == SIG_LOCAL_HEADER &&
+           record->local_header_offset + 30 + get16(header + 26) + get16(header + 28) == data_offset;
+}
+
+static const archive_cdir_record_t* find_data_source(archive_writer_t* writer, const archive_entry_info_t* info,
+                                                     const char* name, uint64_t data_offset) {
+    if (!writer->name_index && !build_name_index(writer)) {
+        for (size_t i = 0; i < writer->existing_count; i++) {
+            if (is_data_source(writer, &writer->records[i], info, name, data_offset)) return &writer->records[i];
+        }
+        return NULL;
+    }
+
+    size_t mask = writer->name_index_mask;
+    for (size_t j = (size_t)hash_name(name) & mask; writer->name_index[j]; j = (j + 1) & mask) {
+        const archive_cdir_record_t* record = &writer->records[writer->name_index[j] - 1];
+        if (is_data_source(writer, record, info, name, data_offset)) return record;
+    }
+    return NULL;
+}
+
+int archive_writer_add_existing(archive_writer_t* writer, const archive_entry_info_t* info,
+                                const char* source_name, uint64_t data_offset) {
+    if (!writer || !info || !source_name || writer->entry_open) {
+        return EXIT_INVALID_ARGS;
+    }
+    if (writer->failed) {
+        return EXIT_ZIP_ERROR;
+    }
+    if (!writer->append || writer->existing_count == 0) {
+        return ARCHIVE_NO_SOURCE;
+    }
+
+    // Reading moves the file position, so every write seeks back to the end
+    bool found = find_data_source(writer, info, source_name, data_offset) != NULL;
+    int result = seek_to(writer, writer->offset);
+    if (result != EXIT_SUCCESS || !found) {
+        return result != EXIT_SUCCESS ? result : ARCHIVE_NO_SOURCE;
+    }
+
+    unsigned char* buffer = malloc(COMPACT_BUFFER_SIZE);
+    if (!buffer) {
+        log_message(LOG_ERROR, "Error: Out of memory writing archive\n");
+        return EXIT_FAILURE;
+    }
+
+    result = begin_entry(writer, info, false);
+
+    uint64_t source = data_offset;
+    uint64_t left = info->compressed_size;
+    while (left > 0 && result == EXIT_SUCCESS) {
+        size_t chunk = left < COMPACT_BUFFER_SIZE ? (size_t)left : COMPACT_BUFFER_SIZE;
+        if (!read_at(writer->file, source, buffer, chunk)) {
+            log_message(LOG_ERROR, "Error reading archive '%s': %s\n", writer->final_path, strerror(errno));
+            writer->failed = true;
+            result = EXIT_ZIP_ERROR;
+            break;
+        }
+        result = seek_to(writer, writer->offset);
+        if (result == EXIT_SUCCESS) {
+            result = archive_writer_write(writer, buffer, chunk);
+        }
+        source += chunk;
+        left -= chunk;
+    }
+
+    if (result == EXIT_SUCCESS) {
+        result = archive_writer_end_entry(writer);
+    }
+
+    free(buffer);
+    return result;
+}
+
+// Bytes an entry takes up in the file, judged from its central directory
+// record (local extra fields usually mirror the central ones)
+static uint64_t estimate_entry_span(const archive_cdir_record_t* record) {
+    bool zip64 = record->compressed_size >= ZIP32_MAX || record->uncompressed_size >= ZIP32_MAX;
+    uint64_t span = 30 + strlen(record->name) + record->extra_len + (zip64 ? 20 : 0) + record->compressed_size;
+    if (record->flags & FLAG_DATA_DESCRIPTOR) {
+        span += zip64 ? 24 : 16;
+    }
+    return span;
+}
+
+// Copy one entry - local header, data and data descriptor - byte for byte
+static int copy_local_entry(archive_writer_t* out, FILE* source, const char* source_path,
+                            const archive_cdir_record_t* record, unsigned char* buffer) {
+    unsigned char header[30];
+    if (!read_at(source, record->local_header_offset, header, sizeof(header)) ||
+        get32(header) != SIG_LOCAL_HEADER) {
+        log_message(LOG_ERROR, "Error: Entry '%s' has no local header in '%s'\n", record->name, source_path);
+        return EXIT_ZIP_ERROR;
+    }
+
+    uint64_t data_end = record->local_header_offset + 30 + get16(header + 26) + get16(header + 28) +
+                        record->compressed_size;
+    uint64_t span = data_end - record->local_header_offset;
+
+    if (record->flags & FLAG_DATA_DESCRIPTOR) {
+        // Sizes are 8 bytes each when the local header defers to Zip64
+        bool zip64 = get32(header + 18) == ZIP32_MAX || get32(header + 22) == ZIP32_MAX ||
+                     record->compressed_size >= ZIP32_MAX || record->uncompressed_size >= ZIP32_MAX;
+        unsigned char signature[4];
+        if (!read_at(source, data_end, signature, sizeof(signature))) {
+            log_message(LOG_ERROR, "Error: Entry '%s' is truncated in '%s'\n", record->name, source_path);
+            return EXIT_ZIP_ERROR;
+        }
+        span += (get32(signature) == SIG_DATA_DESCRIPTOR ? 4 : 0) + 4 + (zip64 ? 16 : 8);
+    }
+
+    if (!seek_file(source, record->local_header_offset)) {
+        log_message(LOG_ERROR, "Error reading '%s': %s\n", source_path, strerror(errno));
+        return EXIT_ZIP_ERROR;
+    }
+
+    while (span > 0) {
+        size_t chunk = span < COMPACT_BUFFER_SIZE ? (size_t)span : COMPACT_BUFFER_SIZE;
+        if (fread(buffer, 1, chunk, source) != chunk) {
+            log_message(LOG_ERROR, "Error: Entry '%s' is truncated in '%s'\n", record->name, source_path);
+            return EXIT_ZIP_ERROR;
+        }
+        int result = write_bytes(out, buffer, chunk);
+        if (result != EXIT_SUCCESS) return result;
+        span -= chunk;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int compare_record_offsets(const void* a, const void* b) {
+    uint64_t x = (*(archive_cdir_record_t* const*)a)->local_header_offset;
+    uint64_t y = (*(archive_cdir_record_t* const*)b)->local_header_offset;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+int archive_writer_compact(const char* path, unsigned int threshold_percent, uint64_t* reclaimed) {
+    if (!path || !reclaimed) {
+        return EXIT_INVALID_ARGS;
+    }
+    *reclaimed = 0;
+
+    // Throwaway writer that only holds the existing records
+    archive_writer_t source;
+    memset(&source, 0, sizeof(source));
+    source.final_path = (char*)path;
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        log_message(LOG_ERROR, "Error opening ZIP file '%s': %s\n", path, strerror(errno));
+        return EXIT_ZIP_ERROR;
+    }
+
+    uint64_t file_size = 0;
+    uint64_t live_bytes = 0;
+    int result = get_file_length(file, &file_size) ? EXIT_SUCCESS : EXIT_ZIP_ERROR;
+    if (result == EXIT_SUCCESS) {
+        result = read_central_directory(&source, file, file_size, &live_bytes);
+    }
+    for (size_t i = 0; i < source.record_count && result == EXIT_SUCCESS; i++) {
+        live_bytes += estimate_entry_span(&source.records[i]);
+    }
+
+    uint64_t dead_bytes = file_size > live_bytes ? file_size - live_bytes : 0;
+    if (result != EXIT_SUCCESS || dead_bytes * 100 < (uint64_t)threshold_percent * file_size) {
+        free_records(&source);
+        fclose(file);
+        return result;
+    }
+
+    // Copy entries in file order, so the old archive is read front to back
+    archive_cdir_record_t** order = malloc(sizeof(archive_cdir_record_t*) * (source.record_count + 1));
+    unsigned char* buffer = malloc(COMPACT_BUFFER_SIZE);
+    archive_writer_t out;
+    if (!order || !buffer) {
+        log_message(LOG_ERROR, "Error: Out of memory compacting archive\n");
+        result = EXIT_FAILURE;
+    } else {
+        result = archive_writer_open(&out, path);
+    }
+
+    if (result == EXIT_SUCCESS) {
+        for (size_t i = 0; i < source.record_count; i++) {
+            order[i] = &source.records[i];
+        }
+        qsort(order, source.record_count, sizeof(archive_cdir_record_t*), compare_record_offsets);
+
+        uint64_t previous_source = UINT64_MAX;
+        uint64_t previous_offset = 0;
+        for (size_t i = 0; i < source.record_count && result == EXIT_SUCCESS; i++) {
+            archive_cdir_record_t* record = order[i];
+
+            // Records sharing one local entry keep sharing it
+            if (record->local_header_offset == previous_source) {
+                record->local_header_offset = previous_offset;
+                continue;
+            }
+
+            previous_source = record->local_header_offset;
+            previous_offset = out.offset;
+            result = copy_local_entry(&out, file, path, record, buffer);
+            record->local_header_offset = previous_offset;
+        }
+    }
+    fclose(file);
+
+    if (result == EXIT_SUCCESS) {
+        // The records move over to the new archive, in their original order
+        out.records = source.records;
+        out.record_count = source.record_count;
+        out.record_capacity = source.record_capacity;
+        source.records = NULL;
+        source.record_count = 0;
+
+        result = archive_writer_close(&out);
+        if (result == EXIT_SUCCESS && out.offset < file_size) {
+            *reclaimed = file_size - out.offset;
+        }
+    } else if (order && buffer) {
+        archive_writer_abort(&out);
+    }
+
+    free(order);
+    free(buffer);
+    free_records(&source);
+    return result;
+}
@@ -0,0 +1,567 @@
+#include "batch.h"
+#include "gbzip_zip.h"
+#include "zipignore.h"
+#include "batch_reader.h"
+#include "dir_scan.h"
+#include "resources.h"
+#include "metrics.h"
+#include "logging.h"
+#include <errno.h>
+
+#ifndef _WIN32
+    #include <pthread.h>
+#endif
+
+// Descriptors kept back for stdio, the manifest and the metrics/trace files
+#define BATCH_RESERVED_FILES 32
+// Deadline given to an archive that starts after the batch's has passed
+#define BATCH_MIN_DEADLINE 0.001
+
+// ============================================================================
+// Manifest
+// ============================================================================
+
+static const char* skip_space(const char* p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    return p;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool parse_hex4(const char* p, unsigned int* value) {
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hex_digit(p[i]);
+        if (digit < 0) return false;
+        *value = (*value << 4) | (unsigned int)digit;
+    }
+    return true;
+}
+
+static size_t put_utf8(char* out, unsigned long cp) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// Parse the JSON string at *p into a malloc'd copy; *p moves past it
+static char* parse_string(const char** p) {
+    const char* s = *p;
+    if (*s != '"') return NULL;
+    s++;
+
+    // Escapes never decode to more bytes than they take
+    size_t span = 0;
+    while (s[span] && s[span] != '"') span += s[span] == '\\' && s[span + 1] ? 2 : 1;
+    if (s[span] != '"') return NULL;
+
+    char* out = malloc(span + 1);
+    if (!out) return NULL;
+    size_t n = 0;
+    while (*s != '"') {
+        if ((unsigned char)*s < 0x20) break;
+        if (*s != '\\') {
+            out[n++] = *s++;
+            continue;
+        }
+        s++;
+        char c = *s++;
+        switch (c) {
+            case '"': case '\\': case '/': out[n++] = c; break;
+            case 'b': out[n++] = '\b'; break;
+            case 'f': out[n++] = '\f'; break;
+            case 'n': out[n++] = '\n'; break;
+            case 'r': out[n++] = '\r'; break;
+            case 't': out[n++] = '\t'; break;
+            case 'u': {
+                unsigned int unit;
+                if (!parse_hex4(s, &unit)) goto fail;
+                s += 4;
+                unsigned long cp = unit;
+                if (unit >= 0xD800 && unit <= 0xDBFF) {
+                    unsigned int low;
+                    if (s[0] != '\\' || s[1] != 'u' || !parse_hex4(s + 2, &low) || low < 0xDC00 || low > 0xDFFF) {
+                        goto fail;
+                    }
+                    s += 6;
+                    cp = 0x10000 + ((unsigned long)(unit - 0xD800) << 10) + (low - 0xDC00);
+                }
+                if (cp == 0) goto fail;
+                n += put_utf8(out + n, cp);
+                break;
+            }
+            default:
+                goto fail;
+        }
+    }
+    if (*s != '"') goto fail;
+    out[n] = '\0';
+    *p = s + 1;
+    return out;
+
+fail:
+    free(out);
+    return NULL;
+}
+
+void batch_job_free(batch_job_t* job) {
+    free(job->archive);
+    for (int i = 0; i < job->input_count; i++) {
+        free(job->inputs[i]);
+    }
+    free(job->inputs);
+    memset(job, 0, sizeof(*job));
+}
+
+static bool parse_inputs(const char** p, batch_job_t* job) {
+    const char* s = skip_space(*p);
+    if (*s != '[') return false;
+    s = skip_space(s + 1);
+
+    int capacity = 0;
+    while (*s != ']') {
+        if (job->input_count > 0) {
+            if (*s != ',') return false;
+            s = skip_space(s + 1);
+        }
+        char* input = parse_string(&s);
+        if (!input) return false;
+        if (job->input_count == capacity) {
+            capacity = capacity ? capacity * 2 : 4;
+            char** inputs = realloc(job->inputs, sizeof(char*) * (size_t)capacity);
+            if (!inputs) {
+                free(input);
+                return false;
+            }
+            job->inputs = inputs;
+        }
+        job->inputs[job->input_count++] = input;
+        s = skip_space(s);
+    }
+    *p = s + 1;
+    return true;
+}
+
+bool batch_parse_line(const char* line, batch_job_t* job, const char** error) {
+    memset(job, 0, sizeof(*job));
+    *error = "expected a JSON object";
+
+    const char* p = skip_space(line);
+    if (*p != '{') return false;
+    p = skip_space(p + 1);
+
+    bool first = true;
+    while (*p != '}') {
+        if (!first) {
+            if (*p != ',') goto fail;
+            p = skip_space(p + 1);
+        }
+        first = false;
+
+        char* key = parse_string(&p);
+        if (!key) goto fail;
+        p = skip_space(p);
+        if (*p != ':') {
+            free(key);
+            goto fail;
+        }
+        p = skip_space(p + 1);
+
+        bool ok;
+        if (strcmp(key, "archive") == 0 && !job->archive) {
+            job->archive = parse_string(&p);
+            ok = job->archive && job->archive[0];
+            *error = "\"archive\" must be a non-empty string";
+        } else if (strcmp(key, "inputs") == 0 && !job->inputs) {
+            ok = parse_inputs(&p, job);
+            *error = "\"inputs\" must be an array of strings";
+        } else {
+            ok = false;
+            *error = "unknown or repeated key (expected \"archive\" and \"inputs\")";
+        }
+        free(key);
+        if (!ok) goto fail;
+        p = skip_space(p);
+    }
+    if (*skip_space(p + 1) != '\0') {
+        *error = "text after the object";
+        goto fail;
+    }
+    if (!job->archive || job->input_count == 0) {
+        *error = "needs an \"archive\" and at least one input";
+        goto fail;
+    }
+    return true;
+
+fail:
+    batch_job_free(job);
+    return false;
+}
+
+// Read one line of any length into *buffer; false at end of file
+static bool read_line(FILE* f, char** buffer, size_t* capacity) {
+    size_t length = 0;
+    for (;;) {
+        if (*capacity - length < 2) {
+            size_t grown = *capacity ? *capacity * 2 : 4096;
+            char* bigger = realloc(*buffer, grown);
+            if (!bigger) return false;
+            *buffer = bigger;
+            *capacity = grown;
+        }
+        if (!fgets(*buffer + length, (int)(*capacity - length), f)) return length > 0;
+        length += strlen(*buffer + length);
+        if (length > 0 && (*buffer)[length - 1] == '\n') return true;
+    }
+}
+
+static int compare_job_archives(const void* a, const void* b) {
+    const batch_job_t* x = *(const batch_job_t* const*)a;
+    const batch_job_t* y = *(const batch_job_t* const*)b;
+    int order = strcmp(x->archive, y->archive);
+    if (order != 0) return order;
+    return x->line < y->line ? -1 : x->line > y->line;
+}
+
+// Two jobs writing one archive would race for it
+static bool find_duplicate(const batch_manifest_t* manifest, const char* path) {
+    if (manifest->count < 2) return false;
+    const batch_job_t** sorted = malloc(sizeof(batch_job_t*) * manifest->count);
+    if (!sorted) return false;
+    for (size_t i = 0; i < manifest->count; i++) {
+        sorted[i] = &manifest->jobs[i];
+    }
+    qsort(sorted, manifest->count, sizeof(batch_job_t*), compare_job_archives);
+
+    bool found = false;
+    for (size_t i = 1; i < manifest->count && !found; i++) {
+        if (strcmp(sorted[i - 1]->archive, sorted[i]->archive) == 0) {
+            log_message(LOG_ERROR, "Error: %s:%zu: archive '%s' is already written by line %zu\n", path,
+                        sorted[i]->line, sorted[i]->archive, sorted[i - 1]->line);
+            found = true;
+        }
+    }
+    free(sorted);
+    return found;
+}
+
+int batch_manifest_load(batch_manifest_t* manifest, const char* path) {
+    memset(manifest, 0, sizeof(*manifest));
+
+    FILE* f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!f) {
+        log_message(LOG_ERROR, "Error: Cannot open manifest '%s': %s\n", path, strerror(errno));
+        return EXIT_FILE_ERROR;
+    }
+
+    int result = EXIT_SUCCESS;
+    char* line = NULL;
+    size_t line_capacity = 0;
+    size_t line_number = 0;
+    size_t capacity = 0;
+    while (result == EXIT_SUCCESS && read_line(f, &line, &line_capacity)) {
+        line_number++;
+        const char* text = skip_space(line);
+        if (*text == '\0' || *text == '#') continue;
+
+        if (manifest->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            batch_job_t* jobs = realloc(manifest->jobs, sizeof(batch_job_t) * capacity);
+            if (!jobs) {
+                log_message(LOG_ERROR, "Error: Out of memory reading manifest '%s'\n", path);
+                result = EXIT_FAILURE;
+                break;
+            }
+            manifest->jobs = jobs;
+        }
+
+        const char* error;
+        batch_job_t* job = &manifest->jobs[manifest->count];
+        if (!batch_parse_line(text, job, &error)) {
+            log_message(LOG_ERROR, "Error: %s:%zu: %s\n", path, line_number, error);
+            result = EXIT_INVALID_ARGS;
+            break;
+        }
+        job->line = line_number;
+        manifest->count++;
+    }
+    if (result == EXIT_SUCCESS && ferror(f)) {
+        log_message(LOG_ERROR, "Error: Cannot read manifest '%s'\n", path);
+        result = EXIT_FILE_ERROR;
+    }
+    free(line);
+    if (f != stdin) fclose(f);
+
+    if (result == EXIT_SUCCESS && find_duplicate(manifest, path)) {
+        result = EXIT_INVALID_ARGS;
+    }
+    if (result != EXIT_SUCCESS) {
+        batch_manifest_free(manifest);
+    }
+    return result;
+}
+
+void batch_manifest_free(batch_manifest_t* manifest) {
+    for (size_t i = 0; i < manifest->count; i++) {
+        batch_job_free(&manifest->jobs[i]);
+    }
+    free(manifest->jobs);
+    memset(manifest, 0, sizeof(*manifest));
+}
+
+// ============================================================================
+// Scheduler
+// ============================================================================
+
+int batch_concurrency(size_t job_count, int threads, size_t open_files) {
+    if (threads < 1) threads = 1;
+
+    // The pool's workers each hold a batch of small files and a ring open;
+    // an archive holds itself, the file being streamed into it and a
+    // directory per scanner thread
+    size_t pool_files = (size_t)threads * (BATCH_READER_DEPTH + 1);
+    int scanners = threads < DIR_SCAN_MAX_THREADS ? threads : DIR_SCAN_MAX_THREADS;
+    size_t archive_files = (size_t)scanners + 2;
+
+    size_t by_files = 1;
+    if (open_files > BATCH_RESERVED_FILES + pool_files + archive_files) {
+        by_files = (open_files - BATCH_RESERVED_FILES - pool_files) / archive_files;
+    }
+
+    size_t concurrency = (size_t)threads;
+    if (concurrency > by_files) concurrency = by_files;
+    if (concurrency > job_count) concurrency = job_count;
+    return concurrency > 0 ? (int)concurrency : 1;
+}
+
+typedef struct {
+    const options_t* opts;          // Settings every archive is written with
+    const batch_manifest_t* manifest;
+    thread_pool_t* pool;
+    const zipignore_t* ignore_rules;
+    int concurrency;
+    double start;                   // When the batch started, for --deadline
+    bool quiet;                     // -q: report failures only
+
+    size_t next;                    // Next job to start
+    size_t failed;
+    int result;                     // Status of the first failure
+#ifndef _WIN32
+    pthread_mutex_t mutex;
+#else
+    CRITICAL_SECTION cs;
+#endif
+} batch_scheduler_t;
+
+static void scheduler_lock(batch_scheduler_t* s) {
+#ifndef _WIN32
+    pthread_mutex_lock(&s->mutex);
+#else
+    EnterCriticalSection(&s->cs);
+#endif
+}
+
+static void scheduler_unlock(batch_scheduler_t* s) {
+#ifndef _WIN32
+    pthread_mutex_unlock(&s->mutex);
+#else
+    LeaveCriticalSection(&s->cs);
+#endif
+}
+
+static double monotonic_seconds(void) {
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#else
+    return (double)GetTickCount64() / 1000.0;
+#endif
+}
+
+typedef struct {
+    batch_scheduler_t* scheduler;
+    int index;
+} batch_runner_t;
+
+// Take jobs in manifest order until none are left; each archive's scan,
+// compression and finalization run here, its compression units on the
+// shared pool
+static void run_jobs(batch_runner_t* runner) {
+    batch_scheduler_t* s = runner->scheduler;
+    metrics_thread_begin("batch", runner->index);
+
+    for (;;) {
+        scheduler_lock(s);
+        size_t index = s->next < s->manifest->count ? s->next++ : SIZE_MAX;
+        scheduler_unlock(s);
+        if (index == SIZE_MAX) break;
+
+        const batch_job_t* job = &s->manifest->jobs[index];
+        archive_stats_t stats;
+        memset(&stats, 0, sizeof(stats));
+
+        options_t opts = *s->opts;
+        opts.zip_file = job->archive;
+        opts.input_files = job->inputs;
+        opts.input_file_count = job->input_count;
+        opts.target_dir = NULL;
+        opts.batch_file = NULL;
+        opts.quiet = true;
+        opts.pool = s->pool;
+        opts.ignore_rules = s->ignore_rules;
+        opts.memory_share = s->concurrency;
+        opts.stats = &stats;
+
+        // The rate is for the whole batch, and so is the deadline: a late
+        // archive gets what is left of it (or next to nothing, and stores)
+        if (opts.target_mbps > 0) opts.target_mbps /= s->concurrency;
+        if (opts.deadline > 0) {
+            opts.deadline -= monotonic_seconds() - s->start;
+            if (opts.deadline < BATCH_MIN_DEADLINE) opts.deadline = BATCH_MIN_DEADLINE;
+        }
+
+        double start = monotonic_seconds();
+        int result = create_zip(&opts);
+        double elapsed = monotonic_seconds() - start;
+
+        // Reports go out whole, one archive at a time
+        scheduler_lock(s);
+        if (result != EXIT_SUCCESS) {
+            if (s->failed++ == 0) s->result = result;
+        }
+        if (result != EXIT_SUCCESS || !s->quiet) {
+            log_archive_result(index, job->archive, result, &stats, elapsed);
+        }
+        scheduler_unlock(s);
+    }
+}
+
+#ifndef _WIN32
+static void* batch_runner_thread(void* arg) {
+    run_jobs((batch_runner_t*)arg);
+    return NULL;
+}
+#else
+static DWORD WINAPI batch_runner_thread(LPVOID arg) {
+    run_jobs((batch_runner_t*)arg);
+    return 0;
+}
+#endif
+
+int run_batch(const options_t* opts) {
+    batch_manifest_t manifest;
+    int result = batch_manifest_load(&manifest, opts->batch_file);
+    if (result != EXIT_SUCCESS) return result;
+    if (manifest.count == 0) {
+        log_message(LOG_WARNING, "Warning: Manifest '%s' lists no archives\n", opts->batch_file);
+        batch_manifest_free(&manifest);
+        return EXIT_SUCCESS;
+    }
+
+    // Detection is cached on first use; do it before the runners start
+    int threads = resources_cpu_count();
+    resources_available_memory();
+
+    batch_scheduler_t s;
+    memset(&s, 0, sizeof(s));
+    s.opts = opts;
+    s.manifest = &manifest;
+    s.concurrency = batch_concurrency(manifest.count, threads, resources_open_file_limit());
+    s.start = monotonic_seconds();
+
+    zipignore_t ignore_rules;
+    memset(&ignore_rules, 0, sizeof(ignore_rules));
+    s.pool = zip_pool_create(threads);
+    if (!s.pool || parse_zipignore_rules(&ignore_rules, opts->zipignore_file) != EXIT_SUCCESS) {
+        log_message(LOG_ERROR, "Error: Out of memory starting the batch\n");
+        if (s.pool) zip_pool_destroy(s.pool);
+        free_zipignore(&ignore_rules);
+        batch_manifest_free(&manifest);
+        return EXIT_FAILURE;
+    }
+    s.ignore_rules = &ignore_rules;
+    // Every archive compresses with the same settings; set them up once
+    zip_pool_configure(s.pool, opts);
+
+    if (opts->verbose && !opts->quiet) {
+        printf("Creating %zu archives, %d at a time on %d threads\n", manifest.count, s.concurrency, threads);
+    }
+
+    // The archives' own messages would interleave; each is reported once
+    // it is done instead (errors still reach stderr as they happen)
+    s.quiet = g_log_config.quiet != 0;
+    g_log_config.quiet = 1;
+
+    batch_runner_t* runners = calloc((size_t)s.concurrency, sizeof(batch_runner_t));
+#ifndef _WIN32
+    pthread_mutex_init(&s.mutex, NULL);
+    pthread_t* handles = calloc((size_t)s.concurrency, sizeof(pthread_t));
+#else
+    InitializeCriticalSection(&s.cs);
+    HANDLE* handles = calloc((size_t)s.concurrency, sizeof(HANDLE));
+#endif
+
+    // The calling thread is a runner too, so one always runs
+    int started = 0;
+    for (int i = 1; runners && handles && i < s.concurrency; i++) {
+        runners[i].scheduler = &s;
+        runners[i].index = i;
+#ifndef _WIN32
+        if (pthread_create(&handles[started], NULL, batch_runner_thread, &runners[i]) != 0) break;
+#else
+        handles[started] = CreateThread(NULL, 0, batch_runner_thread, &runners[i], 0, NULL);
+        if (!handles[started]) break;
+#endif
+        started++;
+    }
+    batch_runner_t self = { .scheduler = &s, .index = 0 };
+    run_jobs(&self);
+
+#ifndef _WIN32
+    for (int i = 0; i < started; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    pthread_mutex_destroy(&s.mutex);
+#else
+    WaitForMultipleObjects((DWORD)started, handles, TRUE, INFINITE);
+    for (int i = 0; i < started; i++) {
+        CloseHandle(handles[i]);
+    }
+    DeleteCriticalSection(&s.cs);
+#endif
+    free(handles);
+    free(runners);
+    g_log_config.quiet = s.quiet;
+
+    if (!opts->quiet && !g_log_config.structured) {
+        printf("Batch complete: %zu of %zu archives created\n", manifest.count - s.failed, manifest.count);
+    }
+
+    zip_pool_destroy(s.pool);
+    free_zipignore(&ignore_rules);
+    batch_manifest_free(&manifest);
+    return s.failed > 0 ? s.result : EXIT_SUCCESS;
+}
@@ -0,0 +1,309 @@
+// AT_EMPTY_PATH and struct statx
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+#include "batch_reader.h"
+#include "metrics.h"
+
+#if defined(__linux__) && defined(GBZIP_HAVE_IO_URING)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// Completions are reaped after every phase, so the completion ring (twice
+// the submission ring) can never overflow
+struct batch_reader {
+    int ring_fd;
+    unsigned int entries;
+    bool failed;                // The ring stopped working; nothing more is read through it
+
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;               // Same as sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int sq_mask;
+    unsigned int* sq_array;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe* cqes;
+
+    // Per slot of the batch in flight
+    int fds[BATCH_READER_DEPTH];
+    int results[BATCH_READER_DEPTH];
+    struct statx stats[BATCH_READER_DEPTH];
+};
+
+static int ring_setup(unsigned int entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ring_enter(int fd, unsigned int to_submit, unsigned int min_complete) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+static void* map_ring(int fd, size_t size, uint64_t offset) {
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, (off_t)offset);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+batch_reader_t* batch_reader_create(void) {
+    batch_reader_t* reader = calloc(1, sizeof(batch_reader_t));
+    if (!reader) return NULL;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    reader->ring_fd = ring_setup(BATCH_READER_DEPTH, &params);
+    if (reader->ring_fd < 0) {
+        free(reader);
+        return NULL;
+    }
+    reader->entries = params.sq_entries;
+
+    // Opened-file reads and statx arrived together with the current-position
+    // feature (5.6); older rings would reject them one by one
+    if (!(params.features & IORING_FEAT_RW_CUR_POS) || reader->entries < BATCH_READER_DEPTH) {
+        close(reader->ring_fd);
+        free(reader);
+        return NULL;
+    }
+
+    reader->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    reader->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_map) {
+        if (reader->cq_map_size > reader->sq_map_size) reader->sq_map_size = reader->cq_map_size;
+        reader->cq_map_size = reader->sq_map_size;
+    }
+
+    reader->sq_map = map_ring(reader->ring_fd, reader->sq_map_size, IORING_OFF_SQ_RING);
+    reader->cq_map = single_map ? reader->sq_map
+                                : map_ring(reader->ring_fd, reader->cq_map_size, IORING_OFF_CQ_RING);
+    reader->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    reader->sqes = map_ring(reader->ring_fd, reader->sqes_size, IORING_OFF_SQES);
+    if (!reader->sq_map || !reader->cq_map || !reader->sqes) {
+        batch_reader_free(reader);
+        return NULL;
+    }
+
+    unsigned char* sq = reader->sq_map;
+    unsigned char* cq = reader->cq_map;
+    reader->sq_head = (unsigned int*)(sq + params.sq_off.head);
+    reader->sq_tail = (unsigned int*)(sq + params.sq_off.tail);
+    reader->sq_mask = *(unsigned int*)(sq + params.sq_off.ring_mask);
+    reader->sq_array = (unsigned int*)(sq + params.sq_off.array);
+    reader->cq_head = (unsigned int*)(cq + params.cq_off.head);
+    reader->cq_tail = (unsigned int*)(cq + params.cq_off.tail);
+    reader->cq_mask = *(unsigned int*)(cq + params.cq_off.ring_mask);
+    reader->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return reader;
+}
+
+void batch_reader_free(batch_reader_t* reader) {
+    if (!reader) return;
+    if (reader->sqes) munmap(reader->sqes, reader->sqes_size);
+    if (reader->cq_map && reader->cq_map != reader->sq_map) munmap(reader->cq_map, reader->cq_map_size);
+    if (reader->sq_map) munmap(reader->sq_map, reader->sq_map_size);
+    close(reader->ring_fd);
+    free(reader);
+}
+
+// Next free submission entry, zeroed and tagged with `slot`. The ring is at
+// least BATCH_READER_DEPTH deep and drained after every phase, so there
+// always is one.
+static struct io_uring_sqe* next_sqe(batch_reader_t* reader, unsigned int* queued, size_t slot) {
+    unsigned int tail = *reader->sq_tail + *queued;
+    unsigned int index = tail & reader->sq_mask;
+    struct io_uring_sqe* sqe = &reader->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = slot;
+    reader->sq_array[index] = index;
+    (*queued)++;
+    return sqe;
+}
+
+// Submit the `queued` entries and wait for all of them, recording each
+// result by slot. Returns false if the ring itself failed, in which case
+// the results of the phase are unknown.
+static bool run_phase(batch_reader_t* reader, unsigned int queued) {
+    if (queued == 0) return true;
+    __atomic_store_n(reader->sq_tail, *reader->sq_tail + queued, __ATOMIC_RELEASE);
+
+    unsigned int pending = queued;
+    unsigned int unsubmitted = queued;
+    while (pending > 0) {
+        int ret = ring_enter(reader->ring_fd, unsubmitted, 1);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            reader->failed = true;
+            return false;
+        }
+        unsubmitted -= (unsigned int)ret < unsubmitted ? (unsigned int)ret : unsubmitted;
+
+        unsigned int head = *reader->cq_head;
+        unsigned int tail = __atomic_load_n(reader->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail && pending > 0; head++, pending--) {
+            const struct io_uring_cqe* cqe = &reader->cqes[head & reader->cq_mask];
+            reader->results[cqe->user_data] = cqe->res;
+        }
+        __atomic_store_n(reader->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+// Finish a read the ring returned short (a network filesystem may), up to
+// the end of the file
+static bool finish_read(int fd, batch_read_t* r, uint64_t done) {
+    while (done < r->size) {
+        ssize_t n = pread(fd, r->data + done, (size_t)(r->size - done), (off_t)done);
+        metrics_count(METRICS_READ_CALLS, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        if (n == 0) break;
+        done += (uint64_t)n;
+    }
+    r->size = done;
+    return true;
+}
+
+// Open, examine, read and close up to BATCH_READER_DEPTH files, one ring
+// submission per step
+static size_t read_batch(batch_reader_t* reader, batch_read_t* reads, size_t count) {
+    unsigned int queued = 0;
+    for (size_t i = 0; i < count; i++) {
+        reads[i].read = false;
+        reads[i].data = NULL;
+        reader->fds[i] = -1;
+        reader->results[i] = -ECANCELED;
+
+        struct io_uring_sqe* sqe = next_sqe(reader, &queued, i);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)(uintptr_t)reads[i].path;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    }
+    bool ok = run_phase(reader, queued);
+    metrics_count(METRICS_OPEN_CALLS, count);
+
+    queued = 0;
+    for (size_t i = 0; ok && i < count; i++) {
+        if (reader->results[i] < 0) continue;
+        reader->fds[i] = reader->results[i];
+
+        struct io_uring_sqe* sqe = next_sqe(reader, &queued, i);
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = reader->fds[i];
+        sqe->addr = (uint64_t)(uintptr_t)"";
+        sqe->len = STATX_TYPE | STATX_MODE | STATX_SIZE;
+        sqe->off = (uint64_t)(uintptr_t)&reader->stats[i];
+        sqe->statx_flags = AT_EMPTY_PATH;
+    }
+    ok = ok && run_phase(reader, queued);
+    metrics_count(METRICS_STAT_CALLS, queued);
+
+    // Buffers for the regular files that still fit; the others are left
+    // to the caller
+    queued = 0;
+    for (size_t i = 0; ok && i < count; i++) {
+        if (reader->fds[i] < 0 || reader->results[i] < 0) continue;
+        const struct statx* st = &reader->stats[i];
+        if (!S_ISREG(st->stx_mode) || st->stx_size > reads[i].max_size || st->stx_size > SIZE_MAX) continue;
+
+        batch_read_t* r = &reads[i];
+        r->size = st->stx_size;
+        r->mode = st->stx_mode;
+        if (r->size == 0) {
+            r->read = true;
+            continue;
+        }
+        r->data = malloc((size_t)r->size);
+        if (!r->data) continue;
+
+        struct io_uring_sqe* sqe = next_sqe(reader, &queued, i);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = reader->fds[i];
+        sqe->addr = (uint64_t)(uintptr_t)r->data;
+        sqe->len = (uint32_t)(r->size < 0x7ffff000u ? r->size : 0x7ffff000u);
+        sqe->off = 0;
+    }
+    ok = ok && run_phase(reader, queued);
+    metrics_count(METRICS_READ_CALLS, queued);
+
+    size_t done = 0;
+    for (size_t i = 0; i < count; i++) {
+        batch_read_t* r = &reads[i];
+        if (r->data) {
+            int res = ok ? reader->results[i] : -1;
+            r->read = res >= 0 && finish_read(reader->fds[i], r, (uint64_t)res);
+            if (!r->read) {
+                free(r->data);
+                r->data = NULL;
+            }
+        }
+        if (r->read) {
+            done++;
+            metrics_count(METRICS_BYTES_READ, r->size);
+        }
+    }
+
+    // Close every descriptor the ring opened, falling back to close() if
+    // the ring has failed
+    queued = 0;
+    for (size_t i = 0; ok && i < count; i++) {
+        if (reader->fds[i] < 0) continue;
+        struct io_uring_sqe* sqe = next_sqe(reader, &queued, i);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = reader->fds[i];
+    }
+    if (!ok || !run_phase(reader, queued)) {
+        for (size_t i = 0; i < count; i++) {
+            if (reader->fds[i] >= 0) close(reader->fds[i]);
+        }
+    }
+    return done;
+}
+
+size_t batch_reader_read(batch_reader_t* reader, batch_read_t* reads, size_t count) {
+    size_t done = 0;
+    for (size_t first = 0; first < count; first += BATCH_READER_DEPTH) {
+        if (reader->failed) {
+            for (size_t i = first; i < count; i++) {
+                reads[i].read = false;
+                reads[i].data = NULL;
+            }
+            break;
+        }
+        size_t n = count - first < BATCH_READER_DEPTH ? count - first : BATCH_READER_DEPTH;
+        done += read_batch(reader, reads + first, n);
+    }
+    return done;
+}
+
+#else
+
+batch_reader_t* batch_reader_create(void) {
+    return NULL;
+}
+
+void batch_reader_free(batch_reader_t* reader) {
+    (void)reader;
+}
+
+size_t batch_reader_read(batch_reader_t* reader, batch_read_t* reads, size_t count) {
+    (void)reader;
+    for (size_t i = 0; i < count; i++) {
+        reads[i].read = false;
+        reads[i].data = NULL;
+    }
+    return 0;
+}
+
+#endif
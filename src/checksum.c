@@ -0,0 +1,258 @@
+#include "checksum.h"
+#include <zlib.h>
+
+#ifdef GBZIP_HAVE_LIBDEFLATE
+    #include <libdeflate.h>
+#endif
+
+// Hardware kernels are built with GCC/Clang target attributes, so other
+// compilers get the table-driven CRC only
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define CHECKSUM_HAVE_PCLMUL
+    #include <cpuid.h>
+    #include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__)
+    #define CHECKSUM_HAVE_ARMV8_CRC
+    #include <arm_acle.h>
+    #if defined(__linux__)
+        #include <sys/auxv.h>
+        #ifndef HWCAP_CRC32
+            #define HWCAP_CRC32 (1 << 7)
+        #endif
+    #endif
+    #ifdef __clang__
+        #define TARGET_ARMV8_CRC __attribute__((target("crc")))
+    #else
+        #define TARGET_ARMV8_CRC __attribute__((target("arch=armv8-a+crc")))
+    #endif
+#endif
+
+typedef struct {
+    const char* name;
+    uint32_t (*update)(uint32_t crc, const unsigned char* data, size_t size);
+} crc32_kernel_t;
+
+// ============================================================================
+// Table-driven fallback
+// ============================================================================
+
+static uint32_t crc32_table(uint32_t crc, const unsigned char* data, size_t size) {
+#ifdef GBZIP_HAVE_LIBDEFLATE
+    return libdeflate_crc32(crc, data, size);
+#else
+    // zlib takes 32-bit lengths
+    while (size > 0) {
+        uInt chunk = size > (1u << 30) ? (1u << 30) : (uInt)size;
+        crc = (uint32_t)crc32(crc, data, chunk);
+        data += chunk;
+        size -= chunk;
+    }
+    return crc;
+#endif
+}
+
+static const crc32_kernel_t KERNEL_TABLE = {
+#ifdef GBZIP_HAVE_LIBDEFLATE
+    "libdeflate",
+#else
+    "zlib",
+#endif
+    crc32_table
+};
+
+// ============================================================================
+// x86: PCLMULQDQ folding
+// ============================================================================
+
+#ifdef CHECKSUM_HAVE_PCLMUL
+
+// Fold 64-byte blocks four lanes at a time with carry-less multiplies, then
+// reduce to 32 bits with Barrett reduction ("Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ", Intel 2009; constants for the bit-reflected
+// ZIP polynomial). `size` is at least 64 and a multiple of 16; `crc` is the
+// inverted running CRC, as is the result.
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul_fold(const unsigned char* data, size_t size, uint32_t crc) {
+    static const uint64_t k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+    static const uint64_t k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+    static const uint64_t k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124ULL, 0x0000000000ULL };
+    static const uint64_t poly[2] __attribute__((aligned(16))) = { 0x01db710641ULL, 0x01f7011641ULL };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    x0 = _mm_load_si128((const __m128i*)k1k2);
+    data += 64;
+    size -= 64;
+
+    // Four lanes in parallel
+    while (size >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+        y6 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+        y7 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+        y8 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        data += 64;
+        size -= 64;
+    }
+
+    // Fold the four lanes into one
+    x0 = _mm_load_si128((const __m128i*)k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Remaining 16-byte blocks
+    while (size >= 16) {
+        x2 = _mm_loadu_si128((const __m128i*)data);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        data += 16;
+        size -= 16;
+    }
+
+    // 128 bits down to 64
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128((const __m128i*)poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const unsigned char* data, size_t size) {
+    if (size >= 64) {
+        size_t folded = size & ~(size_t)15;
+        crc = ~crc32_pclmul_fold(data, folded, ~crc);
+        data += folded;
+        size -= folded;
+    }
+    return size > 0 ? crc32_table(crc, data, size) : crc;
+}
+
+static const crc32_kernel_t KERNEL_PCLMUL = { "pclmul", crc32_pclmul };
+
+static bool cpu_has_pclmul(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+    return (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+}
+
+#endif // CHECKSUM_HAVE_PCLMUL
+
+// ============================================================================
+// AArch64: ARMv8 CRC32 instructions
+// ============================================================================
+
+#ifdef CHECKSUM_HAVE_ARMV8_CRC
+
+TARGET_ARMV8_CRC
+static uint32_t crc32_armv8(uint32_t crc, const unsigned char* data, size_t size) {
+    crc = ~crc;
+    while (size > 0 && ((uintptr_t)data & 7)) {
+        crc = __crc32b(crc, *data++);
+        size--;
+    }
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = __crc32d(crc, word);
+        data += 8;
+        size -= 8;
+    }
+    while (size > 0) {
+        crc = __crc32b(crc, *data++);
+        size--;
+    }
+    return ~crc;
+}
+
+static const crc32_kernel_t KERNEL_ARMV8 = { "armv8-crc", crc32_armv8 };
+
+static bool cpu_has_armv8_crc(void) {
+#if defined(__APPLE__)
+    return true;    // Every Apple ARM64 CPU has the CRC extension
+#elif defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return false;
+#endif
+}
+
+#endif // CHECKSUM_HAVE_ARMV8_CRC
+
+// ============================================================================
+// Dispatch
+// ============================================================================
+
+// Chosen on first use. Threads racing here all store the same pointer.
+static const crc32_kernel_t* volatile g_kernel = NULL;
+
+static const crc32_kernel_t* select_kernel(void) {
+    const crc32_kernel_t* kernel = g_kernel;
+    if (kernel) return kernel;
+
+    kernel = &KERNEL_TABLE;
+#ifdef CHECKSUM_HAVE_PCLMUL
+    if (cpu_has_pclmul()) kernel = &KERNEL_PCLMUL;
+#endif
+#ifdef CHECKSUM_HAVE_ARMV8_CRC
+    if (cpu_has_armv8_crc()) kernel = &KERNEL_ARMV8;
+#endif
+    g_kernel = kernel;
+    return kernel;
+}
+
+uint32_t checksum_crc32(uint32_t crc, const void* data, size_t size) {
+    if (size == 0) return crc;
+    return select_kernel()->update(crc, data, size);
+}
+
+const char* checksum_crc32_kernel(void) {
+    return select_kernel()->name;
+}
@@ -0,0 +1,379 @@
+#include "codec.h"
+#include "archive_writer.h"
+#include "checksum.h"
+#include <zlib.h>
+
+#ifdef GBZIP_HAVE_LIBDEFLATE
+    #include <libdeflate.h>
+#endif
+#ifdef GBZIP_HAVE_ZSTD
+    #include <zstd.h>
+#endif
+
+// zlib takes 32-bit lengths; larger buffers are fed in slices of this size
+#define ZLIB_MAX_CHUNK (1u << 30)
+
+struct codec_encoder {
+    codec_id_t codec;
+    z_stream zlib;              // CODEC_ZLIB, set up once and reset per call
+#ifdef GBZIP_HAVE_LIBDEFLATE
+    struct libdeflate_compressor* deflate;
+#endif
+#ifdef GBZIP_HAVE_ZSTD
+    ZSTD_CCtx* zstd;
+#endif
+    int level;                  // In the codec's own scale
+};
+
+struct codec_decoder {
+    uint16_t method;
+    z_stream zlib;              // ARCHIVE_METHOD_DEFLATE
+#ifdef GBZIP_HAVE_ZSTD
+    ZSTD_DCtx* zstd;            // ARCHIVE_METHOD_ZSTD
+#endif
+    bool finished;
+};
+
+const char* codec_name(codec_id_t codec) {
+    switch (codec) {
+        case CODEC_ZLIB:       return "zlib";
+        case CODEC_LIBDEFLATE: return "libdeflate";
+        case CODEC_ZSTD:       return "zstd";
+    }
+    return "unknown";
+}
+
+bool codec_from_name(const char* name, codec_id_t* codec) {
+    static const codec_id_t all[] = { CODEC_ZLIB, CODEC_LIBDEFLATE, CODEC_ZSTD };
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        if (strcmp(name, codec_name(all[i])) == 0) {
+            *codec = all[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool codec_available(codec_id_t codec) {
+    switch (codec) {
+        case CODEC_ZLIB:
+            return true;
+        case CODEC_LIBDEFLATE:
+#ifdef GBZIP_HAVE_LIBDEFLATE
+            return true;
+#else
+            return false;
+#endif
+        case CODEC_ZSTD:
+#ifdef GBZIP_HAVE_ZSTD
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+const char* codec_available_names(void) {
+    return "zlib"
+#ifdef GBZIP_HAVE_LIBDEFLATE
+           " libdeflate"
+#endif
+#ifdef GBZIP_HAVE_ZSTD
+           " zstd"
+#endif
+           ;
+}
+
+uint16_t codec_method(codec_id_t codec) {
+    return codec == CODEC_ZSTD ? ARCHIVE_METHOD_ZSTD : ARCHIVE_METHOD_DEFLATE;
+}
+
+const char* codec_method_name(uint16_t method) {
+    switch (method) {
+        case ARCHIVE_METHOD_STORE:   return "store";
+        case ARCHIVE_METHOD_DEFLATE: return "deflate";
+        case ARCHIVE_METHOD_ZSTD:    return "zstd";
+        default:                     return "unknown";
+    }
+}
+
+size_t codec_bound(codec_id_t codec, size_t input_size) {
+    switch (codec) {
+        case CODEC_ZLIB:
+            // compressBound()'s formula, without its 32-bit uLong on Windows
+            return input_size + (input_size >> 12) + (input_size >> 14) + (input_size >> 25) + 13;
+        case CODEC_LIBDEFLATE:
+#ifdef GBZIP_HAVE_LIBDEFLATE
+            return libdeflate_deflate_compress_bound(NULL, input_size);
+#else
+            return 0;
+#endif
+        case CODEC_ZSTD:
+#ifdef GBZIP_HAVE_ZSTD
+            return ZSTD_compressBound(input_size);
+#else
+            return 0;
+#endif
+    }
+    return 0;
+}
+
+// gbzip levels are zlib's; libdeflate shares the meaning of 1-9, while
+// Zstandard's default (3) sits where zlib's does (6) and 9 reaches its
+// strong-but-usable range
+static int codec_level(codec_id_t codec, int level) {
+    if (level < 1) level = 1;
+    if (level > 9) level = 9;
+    if (codec == CODEC_ZSTD) {
+        static const int zstd_levels[10] = { 1, 1, 1, 2, 2, 3, 3, 6, 12, 19 };
+        return zstd_levels[level];
+    }
+    return level;
+}
+
+// ============================================================================
+// Encoding
+// ============================================================================
+
+codec_encoder_t* codec_encoder_create(codec_id_t codec, int level) {
+    if (!codec_available(codec)) return NULL;
+
+    codec_encoder_t* encoder = calloc(1, sizeof(codec_encoder_t));
+    if (!encoder) return NULL;
+    encoder->codec = codec;
+    encoder->level = codec_level(codec, level);
+
+    bool ok = false;
+    switch (codec) {
+        case CODEC_ZLIB:
+            // Raw deflate (-15) as ZIP stores it
+            ok = deflateInit2(&encoder->zlib, encoder->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            break;
+        case CODEC_LIBDEFLATE:
+#ifdef GBZIP_HAVE_LIBDEFLATE
+            encoder->deflate = libdeflate_alloc_compressor(encoder->level);
+            ok = encoder->deflate != NULL;
+#endif
+            break;
+        case CODEC_ZSTD:
+#ifdef GBZIP_HAVE_ZSTD
+            encoder->zstd = ZSTD_createCCtx();
+            ok = encoder->zstd != NULL;
+#endif
+            break;
+    }
+
+    if (!ok) {
+        free(encoder);
+        return NULL;
+    }
+    return encoder;
+}
+
+void codec_encoder_free(codec_encoder_t* encoder) {
+    if (!encoder) return;
+    switch (encoder->codec) {
+        case CODEC_ZLIB:
+            deflateEnd(&encoder->zlib);
+            break;
+        case CODEC_LIBDEFLATE:
+#ifdef GBZIP_HAVE_LIBDEFLATE
+            libdeflate_free_compressor(encoder->deflate);
+#endif
+            break;
+        case CODEC_ZSTD:
+#ifdef GBZIP_HAVE_ZSTD
+            ZSTD_freeCCtx(encoder->zstd);
+#endif
+            break;
+    }
+    free(encoder);
+}
+
+uint16_t codec_encoder_method(const codec_encoder_t* encoder) {
+    return codec_method(encoder->codec);
+}
+
+size_t codec_encoder_bound(const codec_encoder_t* encoder, size_t input_size) {
+    return codec_bound(encoder->codec, input_size);
+}
+
+static int zlib_encode(z_stream* strm, const unsigned char* input, size_t input_size,
+                       unsigned char* output, size_t output_capacity, size_t* output_size) {
+    if (deflateReset(strm) != Z_OK) return -1;
+
+    size_t in_pos = 0;
+    size_t out_pos = 0;
+    int ret = Z_OK;
+    while (ret != Z_STREAM_END) {
+        if (strm->avail_in == 0) {
+            size_t n = input_size - in_pos;
+            strm->next_in = (Bytef*)input + in_pos;
+            strm->avail_in = n > ZLIB_MAX_CHUNK ? ZLIB_MAX_CHUNK : (uInt)n;
+            in_pos += strm->avail_in;
+        }
+
+        size_t room = output_capacity - out_pos;
+        if (room == 0) return -1;
+        strm->next_out = output + out_pos;
+        strm->avail_out = room > ZLIB_MAX_CHUNK ? ZLIB_MAX_CHUNK : (uInt)room;
+        uInt before = strm->avail_out;
+        ret = deflate(strm, in_pos == input_size ? Z_FINISH : Z_NO_FLUSH);
+        out_pos += before - strm->avail_out;
+        if (ret == Z_STREAM_ERROR) return -1;
+    }
+
+    *output_size = out_pos;
+    return 0;
+}
+
+int codec_encode(codec_encoder_t* encoder, const void* input, size_t input_size,
+                 void* output, size_t output_capacity, size_t* output_size) {
+    *output_size = 0;
+    switch (encoder->codec) {
+        case CODEC_ZLIB:
+            return zlib_encode(&encoder->zlib, input, input_size, output, output_capacity, output_size);
+        case CODEC_LIBDEFLATE: {
+#ifdef GBZIP_HAVE_LIBDEFLATE
+            // Returns 0 when the output did not fit
+            size_t n = libdeflate_deflate_compress(encoder->deflate, input, input_size, output, output_capacity);
+            if (n == 0) return -1;
+            *output_size = n;
+            return 0;
+#else
+            return -1;
+#endif
+        }
+        case CODEC_ZSTD: {
+#ifdef GBZIP_HAVE_ZSTD
+            size_t n = ZSTD_compressCCtx(encoder->zstd, output, output_capacity, input, input_size, encoder->level);
+            if (ZSTD_isError(n)) return -1;
+            *output_size = n;
+            return 0;
+#else
+            return -1;
+#endif
+        }
+    }
+    return -1;
+}
+
+int codec_compress(codec_id_t codec, int level, const void* input, size_t input_size,
+                   void* output, size_t output_capacity, size_t* output_size) {
+    codec_encoder_t* encoder = codec_encoder_create(codec, level);
+    if (!encoder) return -1;
+    int result = codec_encode(encoder, input, input_size, output, output_capacity, output_size);
+    codec_encoder_free(encoder);
+    return result;
+}
+
+// ============================================================================
+// Decoding
+// ============================================================================
+
+bool codec_can_decode(uint16_t method) {
+    if (method == ARCHIVE_METHOD_DEFLATE) return true;
+#ifdef GBZIP_HAVE_ZSTD
+    if (method == ARCHIVE_METHOD_ZSTD) return true;
+#endif
+    return false;
+}
+
+codec_decoder_t* codec_decoder_create(uint16_t method) {
+    if (!codec_can_decode(method)) return NULL;
+
+    codec_decoder_t* decoder = calloc(1, sizeof(codec_decoder_t));
+    if (!decoder) return NULL;
+    decoder->method = method;
+
+    bool ok = false;
+    if (method == ARCHIVE_METHOD_DEFLATE) {
+        ok = inflateInit2(&decoder->zlib, -15) == Z_OK;
+    }
+#ifdef GBZIP_HAVE_ZSTD
+    if (method == ARCHIVE_METHOD_ZSTD) {
+        decoder->zstd = ZSTD_createDCtx();
+        ok = decoder->zstd != NULL;
+    }
+#endif
+
+    if (!ok) {
+        free(decoder);
+        return NULL;
+    }
+    return decoder;
+}
+
+void codec_decoder_free(codec_decoder_t* decoder) {
+    if (!decoder) return;
+    if (decoder->method == ARCHIVE_METHOD_DEFLATE) {
+        inflateEnd(&decoder->zlib);
+    }
+#ifdef GBZIP_HAVE_ZSTD
+    if (decoder->method == ARCHIVE_METHOD_ZSTD) {
+        ZSTD_freeDCtx(decoder->zstd);
+    }
+#endif
+    free(decoder);
+}
+
+int codec_decode(codec_decoder_t* decoder, const unsigned char** input, size_t* input_size,
+                 unsigned char* output, size_t output_capacity, size_t* produced, bool* finished) {
+    *produced = 0;
+    *finished = decoder->finished;
+
+    if (decoder->method == ARCHIVE_METHOD_DEFLATE) {
+        // Deflate ends at its final block; anything after it is not data
+        if (decoder->finished) return 0;
+
+        z_stream* strm = &decoder->zlib;
+        strm->next_in = (Bytef*)*input;
+        strm->avail_in = *input_size > ZLIB_MAX_CHUNK ? ZLIB_MAX_CHUNK : (uInt)*input_size;
+        strm->next_out = output;
+        strm->avail_out = output_capacity > ZLIB_MAX_CHUNK ? ZLIB_MAX_CHUNK : (uInt)output_capacity;
+        uInt in_before = strm->avail_in;
+        uInt out_before = strm->avail_out;
+
+        int ret = inflate(strm, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) return -1;
+
+        size_t consumed = in_before - strm->avail_in;
+        *input += consumed;
+        *input_size -= consumed;
+        *produced = out_before - strm->avail_out;
+        decoder->finished = ret == Z_STREAM_END;
+        *finished = decoder->finished;
+        return 0;
+    }
+
+#ifdef GBZIP_HAVE_ZSTD
+    if (decoder->method == ARCHIVE_METHOD_ZSTD) {
+        // Concatenated frames (one per streamed block) decode as one
+        // stream; the data is complete whenever a frame has just ended
+        ZSTD_inBuffer in = { *input, *input_size, 0 };
+        ZSTD_outBuffer out = { output, output_capacity, 0 };
+        size_t ret = ZSTD_decompressStream(decoder->zstd, &out, &in);
+        if (ZSTD_isError(ret)) return -1;
+
+        *input += in.pos;
+        *input_size -= in.pos;
+        *produced = out.pos;
+        if (in.pos > 0 || out.pos > 0) {
+            decoder->finished = ret == 0;
+        }
+        *finished = decoder->finished;
+        return 0;
+    }
+#endif
+
+    return -1;
+}
+
+// ============================================================================
+// CRC-32
+// ============================================================================
+
+uint32_t codec_crc32(uint32_t crc, const void* data, size_t size) {
+    return checksum_crc32(crc, data, size);
+}
@@ -0,0 +1,196 @@
+#include "compress.h"
+#include "codec.h"
+#include "utils.h"
+#include <math.h>
+#include <zlib.h>
+
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#else
+#include <strings.h>
+#endif
+
+// Samples with less byte entropy than this always compress, so the trial
+// deflate is skipped for them (bits per byte)
+#define PROBE_MIN_ENTROPY 7.0
+
+uint32_t compress_crc32(const unsigned char* data, size_t size) {
+    return codec_crc32(0, data, size);
+}
+
+const char* compress_decision_name(compress_decision_t decision) {
+    static const char* names[] = {
+        "deflate", "level", "extension", "probe", "expanded", "schedule"
+    };
+    return ((size_t)decision < sizeof(names)/sizeof(names[0])) ? names[decision] : "unknown";
+}
+
+bool compress_is_compressed_format(const char* path) {
+    const char* ext = get_file_extension(path);
+    if (!ext || !*ext) return false;
+
+    // Formats whose payload is entropy-coded already; deflate gains next to nothing
+    static const char* compressed_exts[] = {
+        // Images
+        "jpg", "jpeg", "png", "gif", "webp", "heic", "heif", "avif", "jxl",
+        // Audio and video
+        "mp3", "m4a", "aac", "ogg", "oga", "opus", "flac", "mp4", "m4v", "mov",
+        "mkv", "webm", "avi", "wmv", "flv",
+        // Archives and compressed streams
+        "zip", "gz", "tgz", "bz2", "tbz2", "xz", "txz", "zst", "lz4", "lzma",
+        "7z", "rar", "cab", "br",
+        // Zip-based document and package formats
+        "jar", "war", "apk", "ipa", "whl", "nupkg", "docx", "xlsx", "pptx",
+        "odt", "ods", "odp", "epub",
+        // Fonts
+        "woff", "woff2",
+        NULL
+    };
+
+    for (int i = 0; compressed_exts[i]; i++) {
+        if (strcasecmp(ext, compressed_exts[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool compress_probe_incompressible(const unsigned char* sample, size_t size) {
+    if (!sample || size == 0) return false;
+    if (size > COMPRESS_PROBE_SIZE) size = COMPRESS_PROBE_SIZE;
+
+    // Order-0 entropy rules out text, code and most uncompressed formats
+    size_t counts[256] = {0};
+    for (size_t i = 0; i < size; i++) {
+        counts[sample[i]]++;
+    }
+    double entropy = 0.0;
+    for (int i = 0; i < 256; i++) {
+        if (counts[i] == 0) continue;
+        double p = (double)counts[i] / (double)size;
+        entropy -= p * log2(p);
+    }
+    if (entropy < PROBE_MIN_ENTROPY) return false;
+
+    // High entropy can still hide repeats; a fast deflate settles it. The
+    // output space is capped at the size that would be worth compressing to.
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, 1, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    unsigned char output[COMPRESS_PROBE_SIZE];
+    strm.next_in = (Bytef*)sample;
+    strm.avail_in = (uInt)size;
+    strm.next_out = output;
+    strm.avail_out = (uInt)(size * COMPRESS_PROBE_MAX_PERCENT / 100);
+
+    int ret = deflate(&strm, Z_FINISH);
+    deflateEnd(&strm);
+    return ret != Z_STREAM_END;
+}
+
+size_t compress_block_bound(size_t input_size) {
+    // compressBound covers zlib framing; a sync flush adds an empty stored block
+    size_t bound = (size_t)compressBound((uLong)input_size) + 16;
+    size_t zstd_bound = codec_bound(CODEC_ZSTD, input_size);
+    return zstd_bound > bound ? zstd_bound : bound;
+}
+
+// A Zstandard block is a frame of its own: frames concatenate into valid
+// entry data, so neither a dictionary nor end-of-stream marking is needed
+static int compress_block_zstd(compress_block_t* block) {
+    unsigned char* output = block->output;
+    size_t capacity = block->output_capacity;
+    bool allocated = false;
+    if (!output) {
+        capacity = compress_block_bound(block->input_size);
+        output = malloc(capacity);
+        if (!output) {
+            block->failed = true;
+            return -1;
+        }
+        allocated = true;
+    }
+
+    if (codec_compress(CODEC_ZSTD, block->level, block->input, block->input_size,
+                       output, capacity, &block->output_size) != 0) {
+        if (allocated) free(output);
+        block->failed = true;
+        return -1;
+    }
+
+    block->output = output;
+    block->output_capacity = capacity;
+    block->crc32 = compress_crc32(block->input, block->input_size);
+    block->failed = false;
+    return 0;
+}
+
+int compress_block(compress_block_t* block) {
+    if (block->codec == CODEC_ZSTD) {
+        return compress_block_zstd(block);
+    }
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+
+    // Raw deflate (-15) so blocks join into a ZIP-compatible stream
+    if (deflateInit2(&strm, block->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        block->failed = true;
+        return -1;
+    }
+
+    if (block->dictionary &&
+        deflateSetDictionary(&strm, block->dictionary, (uInt)block->dictionary_size) != Z_OK) {
+        deflateEnd(&strm);
+        block->failed = true;
+        return -1;
+    }
+
+    size_t capacity = compress_block_bound(block->input_size);
+    unsigned char* output = block->output;
+    bool allocated = false;
+    if (output) {
+        if (block->output_capacity < capacity) {
+            deflateEnd(&strm);
+            block->failed = true;
+            return -1;
+        }
+        capacity = block->output_capacity;
+    } else {
+        output = malloc(capacity);
+        if (!output) {
+            deflateEnd(&strm);
+            block->failed = true;
+            return -1;
+        }
+        allocated = true;
+    }
+
+    strm.next_in = (Bytef*)block->input;
+    strm.avail_in = (uInt)block->input_size;
+    strm.next_out = output;
+    strm.avail_out = (uInt)capacity;
+
+    int flush = block->last ? Z_FINISH : Z_SYNC_FLUSH;
+    int ret = deflate(&strm, flush);
+    bool complete = block->last ? (ret == Z_STREAM_END)
+                                : (ret == Z_OK && strm.avail_in == 0 && strm.avail_out > 0);
+
+    block->output_size = strm.total_out;
+    deflateEnd(&strm);
+
+    if (!complete) {
+        if (allocated) free(output);
+        block->failed = true;
+        return -1;
+    }
+
+    block->output = output;
+    block->output_capacity = capacity;
+    block->crc32 = compress_crc32(block->input, block->input_size);
+    block->failed = false;
+    return 0;
+}
@@ -1,13 +1,90 @@
 #include "diff.h"
 #include "utils.h"
 #include "zipignore.h"
+#include "dir_cache.h"
+#include "logging.h"
+
+// Granularity of the modification times stored in an archive
+#define ZIP_MTIME_RESOLUTION 2
+
+// A regular file found in the directory, by archive path
+typedef struct {
+    const char* path;           // In the diff context's path pool
+    uint64_t hash;
+    time_t mtime;
+    off_t size;
+    fingerprint_key_t key;      // Version of the file, for the fingerprint cache
+    bool matched;               // Has an entry in the archive
+} current_file_t;
+
+// Traversal state for collecting the current files of a directory
+typedef struct {
+    diff_context_t* diff_ctx;
+    const zipignore_t* zipignore;
+    dir_cache_t pruned;         // Ignored directories whose contents were never listed
+    current_file_t* files;
+    size_t file_count;
+    size_t file_capacity;
+} diff_scan_context_t;
+
+// 64-bit FNV-1a
+static uint64_t hash_path(const char* path) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (const unsigned char* p = (const unsigned char*)path; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Whether an archive path lies inside a directory that was pruned
+static bool is_in_pruned_dir(const dir_cache_t* pruned, const char* name) {
+    if (pruned->count == 0) return false;
+    
+    for (size_t i = 0; name[i]; i++) {
+        if (name[i] == '/' && dir_cache_contains(pruned, name, i)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Append a change whose path is already in the context's pool
+static int append_change(diff_context_t* diff_ctx, const char* path, change_type_t type,
+                         time_t old_mtime, time_t new_mtime, off_t old_size, off_t new_size) {
+    // Expand array if needed
+    if (diff_ctx->change_count >= diff_ctx->change_capacity) {
+        size_t capacity = diff_ctx->change_capacity ? diff_ctx->change_capacity * 2 : 1000;
+        file_change_t* new_changes = realloc(diff_ctx->changes, sizeof(file_change_t) * capacity);
+        if (!new_changes) {
+            return EXIT_FAILURE;
+        }
+        diff_ctx->changes = new_changes;
+        diff_ctx->change_capacity = capacity;
+    }
+    
+    file_change_t* change = &diff_ctx->changes[diff_ctx->change_count];
+    change->path = path;
+    change->change_type = type;
+    change->old_mtime = old_mtime;
+    change->new_mtime = new_mtime;
+    change->old_size = old_size;
+    change->new_size = new_size;
+    
+    diff_ctx->change_count++;
+    return EXIT_SUCCESS;
+}
 
 static int collect_files_callback(const file_info_t* info, void* user_data) {
-    diff_context_t* diff_ctx = (diff_context_t*)user_data;
+    diff_scan_context_t* scan_ctx = (diff_scan_context_t*)user_data;
+    diff_context_t* diff_ctx = scan_ctx->diff_ctx;
     
-    // Skip directories for now, we'll handle them separately
+    // Directories are only looked at to prune ignored subtrees
     if (info->is_directory) {
-        return EXIT_SUCCESS;
+        if (!should_ignore(scan_ctx->zipignore, info->path) ||
+            zipignore_may_reinclude(scan_ctx->zipignore, info->path)) {
+            return EXIT_SUCCESS;
+        }
     }
     
     // Calculate relative path
@@ -30,8 +107,114 @@ static int collect_files_callback(const file_info_t* info, void* user_data) {
         }
     }
     
-    // This will be processed in compare_with_existing_zip
-    return add_change(diff_ctx, zip_path, CHANGE_ADDED, 0, info->mtime, 0, info->size);
+    // Archive entries below it are treated as ignored too
+    if (info->is_directory) {
+        if (dir_cache_add(&scan_ctx->pruned, zip_path, strlen(zip_path)) < 0) {
+            return EXIT_FAILURE;
+        }
+        return TRAVERSE_SKIP_SUBTREE;
+    }
+    
+    if (scan_ctx->file_count == scan_ctx->file_capacity) {
+        size_t capacity = scan_ctx->file_capacity ? scan_ctx->file_capacity * 2 : 1024;
+        current_file_t* files = realloc(scan_ctx->files, sizeof(current_file_t) * capacity);
+        if (!files) {
+            return EXIT_FAILURE;
+        }
+        scan_ctx->files = files;
+        scan_ctx->file_capacity = capacity;
+    }
+    
+    // Matched against the archive in compare_with_existing_zip
+    current_file_t* file = &scan_ctx->files[scan_ctx->file_count];
+    file->path = string_pool_strdup(&diff_ctx->paths, zip_path);
+    if (!file->path) {
+        return EXIT_FAILURE;
+    }
+    file->hash = hash_path(file->path);
+    file->mtime = info->mtime;
+    file->size = info->size;
+    file->key.device = info->device;
+    file->key.inode = info->inode;
+    file->key.size = (uint64_t)info->size;
+    file->key.mtime_ns = info->mtime_ns;
+    file->matched = false;
+    
+    scan_ctx->file_count++;
+    return EXIT_SUCCESS;
+}
+
+// Open-addressed index over the current files: slots hold file index + 1,
+// zero marks an empty slot
+static size_t* build_file_index(const diff_scan_context_t* scan_ctx, size_t* mask) {
+    size_t capacity = 16;
+    while (capacity < scan_ctx->file_count * 2) capacity *= 2;
+    
+    size_t* slots = calloc(capacity, sizeof(size_t));
+    if (!slots) return NULL;
+    
+    *mask = capacity - 1;
+    for (size_t i = 0; i < scan_ctx->file_count; i++) {
+        size_t j = (size_t)scan_ctx->files[i].hash & *mask;
+        while (slots[j]) j = (j + 1) & *mask;
+        slots[j] = i + 1;
+    }
+    return slots;
+}
+
+// The current file with this archive path; traversal yields each path once
+static current_file_t* find_current_file(const diff_scan_context_t* scan_ctx, const size_t* slots,
+                                         size_t mask, const char* name) {
+    uint64_t hash = hash_path(name);
+    for (size_t j = (size_t)hash & mask; slots[j]; j = (j + 1) & mask) {
+        current_file_t* file = &scan_ctx->files[slots[j] - 1];
+        if (file->hash == hash && strcmp(file->path, name) == 0) {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+// Refine the timestamp verdict on an archived file with the fingerprint
+// cache: the same version of the file is unchanged without being read, and
+// one with a new timestamp but the same size is unchanged if its contents
+// hash the same. Unchanged files are recorded in the cache as seen.
+static int check_cached_file(fingerprint_cache_t* cache, const current_file_t* file,
+                             const zip_entry_t* zip_entry, const char* full_path, bool* modified) {
+    fingerprint_entry_t* entry = fingerprint_cache_find(cache, file->path);
+    
+    // Only trust an entry that still describes the archived data
+    bool current = entry && entry->crc32 == zip_entry->crc32 && entry->key.size == (uint64_t)zip_entry->size;
+    if (current && fingerprint_key_equal(&entry->key, &file->key)) {
+        *modified = false;
+    } else if (current && entry->hash_known && file->key.size == entry->key.size) {
+        uint64_t hash;
+        uint32_t crc;
+        if (fingerprint_file(full_path, &hash, &crc) == EXIT_SUCCESS) {
+            *modified = hash != entry->hash || crc != entry->crc32;
+        }
+    }
+    
+    // Modified files get their entry when the new version is archived
+    if (*modified) {
+        return EXIT_SUCCESS;
+    }
+    
+    if (!entry) {
+        entry = fingerprint_cache_put(cache, file->path);
+        if (!entry) return EXIT_FAILURE;
+    }
+    if (!current) {
+        // Archived without the cache: nothing is known about its contents yet
+        entry->hash_known = false;
+        entry->crc32 = zip_entry->crc32;
+        entry->method = 0;
+        entry->compressed_size = 0;
+        entry->data_offset = 0;
+    }
+    entry->key = file->key;
+    entry->seen = true;
+    return EXIT_SUCCESS;
 }
 
 int diff_zip(const options_t* opts) {
@@ -41,7 +224,7 @@ int diff_zip(const options_t* opts) {
     
     // Check if target directory exists
     if (!is_directory(opts->target_dir)) {
-        fprintf(stderr, "Error: Target directory '%s' does not exist\n", opts->target_dir);
+        log_message(LOG_ERROR, "Error: Target directory '%s' does not exist\n", opts->target_dir);
         return EXIT_FILE_ERROR;
     }
     
@@ -50,11 +233,15 @@ int diff_zip(const options_t* opts) {
     memset(&diff_ctx, 0, sizeof(diff_ctx));
     diff_ctx.base_dir = get_absolute_path(opts->target_dir);
     diff_ctx.zip_file = opts->zip_file;
+    // Changes are found with the home patterns whatever -I names
+    if (!opts->zipignore_file) {
+        diff_ctx.home_rules = opts->ignore_rules;
+    }
     diff_ctx.change_capacity = 1000;
     diff_ctx.changes = malloc(sizeof(file_change_t) * diff_ctx.change_capacity);
     
     if (!diff_ctx.base_dir || !diff_ctx.changes) {
-        fprintf(stderr, "Error: Memory allocation failed\n");
+        log_message(LOG_ERROR, "Error: Memory allocation failed\n");
         free_diff_context(&diff_ctx);
         return EXIT_FAILURE;
     }
@@ -72,6 +259,14 @@ int diff_zip(const options_t* opts) {
         }
         result = create_zip(opts);
     } else {
+        // The cache is advisory: a missing or unreadable one just starts empty
+        fingerprint_cache_t cache;
+        fingerprint_cache_init(&cache);
+        if (opts->use_cache) {
+            fingerprint_cache_load(&cache, opts->zip_file);
+            diff_ctx.cache = &cache;
+        }
+        
         // Compare with existing ZIP - use resolved base_dir for consistency
         result = compare_with_existing_zip(opts->zip_file, diff_ctx.base_dir, &diff_ctx);
         
@@ -86,13 +281,33 @@ int diff_zip(const options_t* opts) {
                 }
                 
                 // Apply changes to ZIP
-                result = apply_changes_to_zip(opts->zip_file, &diff_ctx, opts->verbose);
+                result = apply_changes_to_zip(opts->zip_file, &diff_ctx, opts);
                 
                 if (result == EXIT_SUCCESS && opts->verbose) {
                     printf("ZIP archive updated successfully\n");
                 }
             }
         }
+        
+        // Reclaim the space left by superseded entries once it adds up
+        if (result == EXIT_SUCCESS && opts->compact) {
+            uint64_t reclaimed = 0;
+            result = archive_writer_compact(opts->zip_file, ARCHIVE_COMPACT_THRESHOLD_PERCENT, &reclaimed);
+            if (result == EXIT_SUCCESS && reclaimed > 0 && opts->verbose) {
+                printf("Compacted archive, reclaimed %.1f MB\n", reclaimed / (1024.0 * 1024.0));
+            }
+            
+            // Entry data has moved
+            if (reclaimed > 0) {
+                fingerprint_cache_clear_offsets(&cache);
+            }
+        }
+        
+        // Failing to save the cache only costs the next run some work
+        if (result == EXIT_SUCCESS && diff_ctx.cache) {
+            fingerprint_cache_save(&cache, opts->zip_file);
+        }
+        fingerprint_cache_free(&cache);
     }
     
     free_diff_context(&diff_ctx);
@@ -106,7 +321,11 @@ int compare_with_existing_zip(const char* zip_file, const char* directory, diff_
     
     // Load zipignore patterns
     zipignore_t zipignore;
-    load_zipignore(&zipignore, directory, NULL);
+    if (diff_ctx->home_rules) {
+        load_zipignore_rules(&zipignore, directory, diff_ctx->home_rules, NULL);
+    } else {
+        load_zipignore(&zipignore, directory, NULL);
+    }
     
     // Get entries from ZIP file
     zip_entry_t* zip_entries = NULL;
@@ -119,32 +338,29 @@ int compare_with_existing_zip(const char* zip_file, const char* directory, diff_
     }
     
     // Collect current files in directory
-    diff_ctx->change_count = 0; // Reset change count
-    result = traverse_directory(directory, true, collect_files_callback, diff_ctx);
-    if (result != EXIT_SUCCESS) {
-        free_zip_entries(zip_entries, zip_count);
-        free_zipignore(&zipignore);
-        return result;
-    }
+    diff_scan_context_t scan_ctx = {
+        .diff_ctx = diff_ctx,
+        .zipignore = &zipignore
+    };
+    dir_cache_init(&scan_ctx.pruned);
     
-    // Create a temporary copy to track processed files
-    file_change_t* current_files = malloc(sizeof(file_change_t) * diff_ctx->change_count);
-    if (!current_files) {
-        free_zip_entries(zip_entries, zip_count);
-        free_zipignore(&zipignore);
-        return EXIT_FAILURE;
+    diff_ctx->change_count = 0; // Reset change count
+    result = traverse_directory(directory, true, collect_files_callback, &scan_ctx);
+    
+    // Index them by archive path, so each entry is matched in constant time
+    size_t mask = 0;
+    size_t* index = NULL;
+    if (result == EXIT_SUCCESS) {
+        index = build_file_index(&scan_ctx, &mask);
+        if (!index) result = EXIT_FAILURE;
     }
     
-    memcpy(current_files, diff_ctx->changes, sizeof(file_change_t) * diff_ctx->change_count);
-    size_t current_count = diff_ctx->change_count;
-    diff_ctx->change_count = 0; // Reset for actual changes
-    
     // Compare ZIP entries with current files
-    for (size_t i = 0; i < zip_count; i++) {
+    for (size_t i = 0; i < zip_count && result == EXIT_SUCCESS; i++) {
         const zip_entry_t* zip_entry = &zip_entries[i];
         
-        // Skip directories
-        if (zip_entry->is_directory) {
+        // Skip directories, and files in ignored directories that were not scanned
+        if (zip_entry->is_directory || is_in_pruned_dir(&scan_ctx.pruned, zip_entry->name)) {
             continue;
         }
         
@@ -163,81 +379,172 @@ int compare_with_existing_zip(const char* zip_file, const char* directory, diff_
             continue;
         }
         
-        // Look for this file in current files
-        bool found = false;
-        for (size_t j = 0; j < current_count; j++) {
-            if (strcmp(current_files[j].path, zip_entry->name) == 0) {
-                found = true;
-                
-                // Check if file was modified
-                if (current_files[j].new_mtime > zip_entry->mtime || 
-                    current_files[j].new_size != zip_entry->size) {
-                    
-                    add_change(diff_ctx, zip_entry->name, CHANGE_MODIFIED,
-                              zip_entry->mtime, current_files[j].new_mtime,
-                              zip_entry->size, current_files[j].new_size);
-                }
-                
-                // Mark as processed
-                current_files[j].change_type = CHANGE_NONE;
-                break;
+        current_file_t* file = find_current_file(&scan_ctx, index, mask, zip_entry->name);
+        if (file) {
+            // Check if file was modified; archive times are rounded down to
+            // the 2-second resolution of MS-DOS timestamps
+            bool modified = file->mtime >= zip_entry->mtime + ZIP_MTIME_RESOLUTION ||
+                            file->size != zip_entry->size;
+            if (diff_ctx->cache) {
+                result = check_cached_file(diff_ctx->cache, file, zip_entry, full_path, &modified);
             }
-        }
-        
-        if (!found) {
+            
+            if (modified && result == EXIT_SUCCESS) {
+                result = append_change(diff_ctx, file->path, CHANGE_MODIFIED,
+                                       zip_entry->mtime, file->mtime,
+                                       zip_entry->size, file->size);
+            }
+            
+            // Mark as processed
+            file->matched = true;
+        } else {
             // File was deleted
-            add_change(diff_ctx, zip_entry->name, CHANGE_DELETED,
-                      zip_entry->mtime, 0, zip_entry->size, 0);
+            result = add_change(diff_ctx, zip_entry->name, CHANGE_DELETED,
+                                zip_entry->mtime, 0, zip_entry->size, 0);
         }
     }
     
-    // Add new files (those not marked as CHANGE_NONE)
-    for (size_t i = 0; i < current_count; i++) {
-        if (current_files[i].change_type == CHANGE_ADDED) {
-            // Check if file should be ignored
-            char full_path[PATH_MAX];
-            snprintf(full_path, PATH_MAX, "%s%c%s", directory, PATH_SEPARATOR, current_files[i].path);
-            
-            // Convert ZIP path to system path
-            for (char* p = full_path + strlen(directory) + 1; *p; p++) {
-                if (*p == '/') {
-                    *p = PATH_SEPARATOR;
-                }
-            }
-            
-            if (!should_ignore(&zipignore, full_path)) {
-                add_change(diff_ctx, current_files[i].path, CHANGE_ADDED,
-                          0, current_files[i].new_mtime, 0, current_files[i].new_size);
+    // Add new files (those with no archive entry)
+    for (size_t i = 0; i < scan_ctx.file_count && result == EXIT_SUCCESS; i++) {
+        const current_file_t* file = &scan_ctx.files[i];
+        if (file->matched) continue;
+        
+        // Check if file should be ignored
+        char full_path[PATH_MAX];
+        snprintf(full_path, PATH_MAX, "%s%c%s", directory, PATH_SEPARATOR, file->path);
+        
+        // Convert ZIP path to system path
+        for (char* p = full_path + strlen(directory) + 1; *p; p++) {
+            if (*p == '/') {
+                *p = PATH_SEPARATOR;
             }
         }
+        
+        if (!should_ignore(&zipignore, full_path)) {
+            result = append_change(diff_ctx, file->path, CHANGE_ADDED,
+                                   0, file->mtime, 0, file->size);
+        }
     }
     
-    free(current_files);
+    free(index);
+    free(scan_ctx.files);
+    dir_cache_free(&scan_ctx.pruned);
     free_zip_entries(zip_entries, zip_count);
     free_zipignore(&zipignore);
     
+    return result;
+}
+
+// Fingerprint a file about to be archived and record it in the cache. When
+// an entry already in the archive has the same contents, its compressed
+// bytes are copied into the new entry and *reused is set.
+static int fingerprint_new_file(archive_writer_t* writer, fingerprint_cache_t* cache,
+                                const file_change_t* change, const char* file_path, bool* reused) {
+    *reused = false;
+    
+    // Files that cannot be read are left for the compressor to report
+    fingerprint_key_t key;
+    uint32_t mode = 0;
+    uint64_t hash;
+    uint32_t crc;
+    if (!fingerprint_stat(file_path, &key, &mode) || fingerprint_file(file_path, &hash, &crc) != EXIT_SUCCESS) {
+        return EXIT_SUCCESS;
+    }
+    
+    const fingerprint_entry_t* source = fingerprint_cache_find_content(cache, hash, key.size, crc);
+    if (source) {
+        archive_entry_info_t info = {
+            .name = change->path,
+            .method = source->method,
+            .crc32 = crc,
+            .compressed_size = source->compressed_size,
+            .uncompressed_size = key.size,
+            .mtime = change->new_mtime,
+            .mode = mode
+        };
+        int result = archive_writer_add_existing(writer, &info, source->path, source->data_offset);
+        if (result == EXIT_SUCCESS) {
+            *reused = true;
+        } else if (result != ARCHIVE_NO_SOURCE) {
+            return result;
+        }
+    }
+    
+    fingerprint_entry_t* entry = fingerprint_cache_put(cache, change->path);
+    if (!entry) {
+        return EXIT_FAILURE;
+    }
+    entry->key = key;
+    entry->hash = hash;
+    entry->hash_known = true;
+    entry->crc32 = crc;
+    entry->seen = true;
+    
+    // Otherwise where the compressed bytes are is filled in once they are written
+    entry->method = 0;
+    entry->compressed_size = 0;
+    entry->data_offset = 0;
+    if (*reused) {
+        const archive_cdir_record_t* record = &writer->records[writer->record_count - 1];
+        entry->method = record->method;
+        entry->compressed_size = record->compressed_size;
+        entry->data_offset = record->data_offset;
+    }
     return EXIT_SUCCESS;
 }
 
-int apply_changes_to_zip(const char* zip_file, const diff_context_t* diff_ctx, bool verbose) {
-    if (!zip_file || !diff_ctx) {
+// Point the cache at the data of the entries just compressed. An entry
+// whose CRC differs from the fingerprint changed while it was being read,
+// so its contents are unknown again.
+static void record_written_entries(const archive_writer_t* writer, size_t first, fingerprint_cache_t* cache) {
+    for (size_t i = first; i < writer->record_count; i++) {
+        const archive_cdir_record_t* record = &writer->records[i];
+        fingerprint_entry_t* entry = fingerprint_cache_find(cache, record->name);
+        if (!entry || !entry->hash_known || entry->data_offset != 0) continue;
+        
+        if (record->crc32 == entry->crc32 && record->uncompressed_size == entry->key.size) {
+            entry->method = record->method;
+            entry->compressed_size = record->compressed_size;
+            entry->data_offset = record->data_offset;
+        } else {
+            memset(&entry->key, 0, sizeof(fingerprint_key_t));
+            entry->hash_known = false;
+            entry->crc32 = record->crc32;
+        }
+    }
+}
+
+int apply_changes_to_zip(const char* zip_file, const diff_context_t* diff_ctx, const options_t* opts) {
+    if (!zip_file || !diff_ctx || !opts) {
         return EXIT_INVALID_ARGS;
     }
     
-    // Open existing ZIP for modification
-    int error;
-    zip_t* archive = zip_open(zip_file, 0, &error);
-    if (!archive) {
-        zip_error_t zip_error;
-        zip_error_init_with_code(&zip_error, error);
-        fprintf(stderr, "Error opening ZIP file '%s': %s\n", 
-                zip_file, zip_error_strerror(&zip_error));
-        zip_error_fini(&zip_error);
-        return EXIT_ZIP_ERROR;
+    // Files to compress, and the change each one came from
+    size_t slots = diff_ctx->change_count + 1;
+    zip_input_file_t* files = malloc(sizeof(zip_input_file_t) * slots);
+    const file_change_t** sources = malloc(sizeof(file_change_t*) * slots);
+    string_pool_t file_paths;
+    string_pool_init(&file_paths);
+    if (!files || !sources) {
+        free(files);
+        free(sources);
+        return EXIT_FAILURE;
     }
     
-    // Apply changes
-    for (size_t i = 0; i < diff_ctx->change_count; i++) {
+    // New entries are written after the existing data and the central
+    // directory is rewritten, so unchanged entries are never copied
+    archive_writer_t writer;
+    int result = archive_writer_open_append(&writer, zip_file);
+    if (result != EXIT_SUCCESS) {
+        free(files);
+        free(sources);
+        return result;
+    }
+    
+    size_t file_count = 0;
+    size_t source_count = 0;
+    size_t reused_count = 0;
+    for (size_t i = 0; i < diff_ctx->change_count && result == EXIT_SUCCESS; i++) {
         const file_change_t* change = &diff_ctx->changes[i];
         
         switch (change->change_type) {
@@ -256,59 +563,50 @@ int apply_changes_to_zip(const char* zip_file, const diff_context_t* diff_ctx, b
                 
                 // Check if file exists before trying to add it
                 if (!file_exists(file_path)) {
-                    if (verbose) {
-                        fprintf(stderr, "Warning: File '%s' does not exist, skipping\n", file_path);
+                    if (opts->verbose) {
+                        log_message(LOG_WARNING, "Warning: File '%s' does not exist, skipping\n", file_path);
                     }
                     break;
                 }
                 
-                // Remove old entry if it exists (for modifications)
-                if (change->change_type == CHANGE_MODIFIED) {
-                    zip_int64_t index = zip_name_locate(archive, change->path, 0);
-                    if (index >= 0) {
-                        zip_delete(archive, index);
-                    }
-                }
+                // The new entry supersedes any old one of the same name
+                archive_writer_remove(&writer, change->path);
+                sources[source_count++] = change;
                 
-                // Add new/updated file
-                zip_source_t* source = zip_source_file(archive, file_path, 0, -1);
-                if (!source) {
-                    fprintf(stderr, "Error creating ZIP source for file '%s': %s\n", 
-                            file_path, zip_strerror(archive));
-                    zip_discard(archive);
-                    return EXIT_ZIP_ERROR;
-                }
-                
-                zip_int64_t idx = zip_file_add(archive, change->path, source, ZIP_FL_ENC_UTF_8);
-                if (idx < 0) {
-                    fprintf(stderr, "Error adding file '%s' to archive: %s\n", 
-                            change->path, zip_strerror(archive));
-                    zip_source_free(source);
-                    zip_discard(archive);
-                    return EXIT_ZIP_ERROR;
+                if (diff_ctx->cache) {
+                    bool reused = false;
+                    result = fingerprint_new_file(&writer, diff_ctx->cache, change, file_path, &reused);
+                    if (result != EXIT_SUCCESS || reused) {
+                        reused_count += reused ? 1 : 0;
+                        break;
+                    }
                 }
                 
-                // Set file modification time
-                zip_file_set_mtime(archive, idx, change->new_mtime, 0);
-                
-                if (verbose) {
-                    printf("%s: %s\n", 
-                           change->change_type == CHANGE_ADDED ? "Added" : "Modified", 
-                           change->path);
+                const char* path_copy = string_pool_strdup(&file_paths, file_path);
+                if (!path_copy) {
+                    result = EXIT_FAILURE;
+                    break;
                 }
+                files[file_count].file_path = path_copy;
+                files[file_count].archive_path = change->path;
+                files[file_count].size = (off_t)change->new_size;
+                files[file_count].mtime = change->new_mtime;
+                file_count++;
                 break;
             }
             
             case CHANGE_DELETED: {
-                zip_int64_t index = zip_name_locate(archive, change->path, 0);
-                if (index >= 0) {
-                    zip_delete(archive, index);
-                    
-                    if (verbose) {
+                // Update mode (-u) keeps the entries of files that are gone
+                if (!opts->diff_mode) {
+                    break;
+                }
+                
+                if (archive_writer_remove(&writer, change->path) > 0) {
+                    if (opts->verbose) {
                         printf("Deleted: %s\n", change->path);
                     }
                 } else {
-                    if (verbose) {
+                    if (opts->verbose) {
                         printf("Warning: Could not find file '%s' to delete\n", change->path);
                     }
                 }
@@ -320,13 +618,40 @@ int apply_changes_to_zip(const char* zip_file, const diff_context_t* diff_ctx, b
         }
     }
     
-    // Close and save changes
-    if (zip_close(archive) < 0) {
-        fprintf(stderr, "Error closing ZIP file: %s\n", zip_strerror(archive));
-        return EXIT_ZIP_ERROR;
+    size_t added_count = 0;
+    size_t first_compressed = writer.record_count;
+    if (result == EXIT_SUCCESS) {
+        result = add_files_to_archive(&writer, files, file_count, opts, &added_count);
+    }
+    if (result == EXIT_SUCCESS && diff_ctx->cache) {
+        record_written_entries(&writer, first_compressed, diff_ctx->cache);
     }
     
-    return EXIT_SUCCESS;
+    if (result == EXIT_SUCCESS && source_count == 0 && writer.removed_count == 0) {
+        // Nothing to write; leave the archive exactly as it was
+        archive_writer_abort(&writer);
+    } else if (result == EXIT_SUCCESS) {
+        // Write the new central directory
+        result = archive_writer_close(&writer);
+    } else {
+        archive_writer_abort(&writer);
+    }
+    
+    if (result == EXIT_SUCCESS && opts->verbose) {
+        for (size_t i = 0; i < source_count; i++) {
+            printf("%s: %s\n", 
+                   sources[i]->change_type == CHANGE_ADDED ? "Added" : "Modified", 
+                   sources[i]->path);
+        }
+        if (reused_count > 0) {
+            printf("Reused compressed data of %zu files already in the archive\n", reused_count);
+        }
+    }
+    
+    string_pool_free(&file_paths);
+    free(sources);
+    free(files);
+    return result;
 }
 
 int add_change(diff_context_t* diff_ctx, const char* path, change_type_t type, 
@@ -335,34 +660,18 @@ int add_change(diff_context_t* diff_ctx, const char* path, change_type_t type,
         return EXIT_INVALID_ARGS;
     }
     
-    // Expand array if needed
-    if (diff_ctx->change_count >= diff_ctx->change_capacity) {
-        diff_ctx->change_capacity *= 2;
-        file_change_t* new_changes = realloc(diff_ctx->changes, 
-                                            sizeof(file_change_t) * diff_ctx->change_capacity);
-        if (!new_changes) {
-            return EXIT_FAILURE;
-        }
-        diff_ctx->changes = new_changes;
+    const char* copy = string_pool_strdup(&diff_ctx->paths, path);
+    if (!copy) {
+        return EXIT_FAILURE;
     }
-    
-    file_change_t* change = &diff_ctx->changes[diff_ctx->change_count];
-    strncpy(change->path, path, PATH_MAX - 1);
-    change->path[PATH_MAX - 1] = '\0';
-    change->change_type = type;
-    change->old_mtime = old_mtime;
-    change->new_mtime = new_mtime;
-    change->old_size = old_size;
-    change->new_size = new_size;
-    
-    diff_ctx->change_count++;
-    return EXIT_SUCCESS;
+    return append_change(diff_ctx, copy, type, old_mtime, new_mtime, old_size, new_size);
 }
 
 void free_diff_context(diff_context_t* diff_ctx) {
     if (!diff_ctx) return;
     
     free(diff_ctx->changes);
+    string_pool_free(&diff_ctx->paths);
     free(diff_ctx->base_dir);
     memset(diff_ctx, 0, sizeof(diff_context_t));
 }
@@ -0,0 +1,245 @@
+#include "dir_cache.h"
+#include "utils.h"
+#include "logging.h"
+#include <errno.h>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+#endif
+
+// Directories kept open while creating the skeleton; deeper levels are
+// created relative to the deepest open one
+#define DIR_CACHE_MAX_OPEN 64
+
+// 64-bit FNV-1a
+static uint64_t hash_path(const char* path, size_t len) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)path[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool slot_matches(const char* slot, const char* path, size_t len) {
+    return strncmp(slot, path, len) == 0 && slot[len] == '\0';
+}
+
+void dir_cache_init(dir_cache_t* cache) {
+    memset(cache, 0, sizeof(dir_cache_t));
+}
+
+void dir_cache_free(dir_cache_t* cache) {
+    for (size_t i = 0; i < cache->capacity; i++) {
+        free(cache->slots[i]);
+    }
+    free(cache->slots);
+    memset(cache, 0, sizeof(dir_cache_t));
+}
+
+bool dir_cache_contains(const dir_cache_t* cache, const char* path, size_t len) {
+    if (cache->capacity == 0) return false;
+    
+    size_t mask = cache->capacity - 1;
+    for (size_t i = (size_t)hash_path(path, len) & mask; cache->slots[i]; i = (i + 1) & mask) {
+        if (slot_matches(cache->slots[i], path, len)) return true;
+    }
+    return false;
+}
+
+static int dir_cache_grow(dir_cache_t* cache) {
+    size_t capacity = cache->capacity ? cache->capacity * 2 : 256;
+    char** slots = calloc(capacity, sizeof(char*));
+    if (!slots) return -1;
+    
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < cache->capacity; i++) {
+        char* path = cache->slots[i];
+        if (!path) continue;
+        size_t j = (size_t)hash_path(path, strlen(path)) & mask;
+        while (slots[j]) j = (j + 1) & mask;
+        slots[j] = path;
+    }
+    
+    free(cache->slots);
+    cache->slots = slots;
+    cache->capacity = capacity;
+    return 0;
+}
+
+int dir_cache_add(dir_cache_t* cache, const char* path, size_t len) {
+    // Keep the load factor under 3/4
+    if ((cache->count + 1) * 4 > cache->capacity * 3 && dir_cache_grow(cache) != 0) {
+        return -1;
+    }
+    
+    size_t mask = cache->capacity - 1;
+    size_t i = (size_t)hash_path(path, len) & mask;
+    for (; cache->slots[i]; i = (i + 1) & mask) {
+        if (slot_matches(cache->slots[i], path, len)) return 0;
+    }
+    
+    char* copy = malloc(len + 1);
+    if (!copy) return -1;
+    memcpy(copy, path, len);
+    copy[len] = '\0';
+    
+    cache->slots[i] = copy;
+    cache->count++;
+    return 1;
+}
+
+int dir_cache_add_entry(dir_cache_t* cache, const char* entry_name) {
+    if (!entry_name) return 0;
+    
+    size_t len = strlen(entry_name);
+    if (len > 0 && entry_name[len - 1] != '/') {
+        // A file: start from its parent directory
+        while (len > 0 && entry_name[len - 1] != '/') len--;
+    }
+    
+    while (true) {
+        while (len > 0 && entry_name[len - 1] == '/') len--;
+        if (len == 0) return 0;
+        
+        // Once a directory is known, so are all of its ancestors
+        int added = dir_cache_add(cache, entry_name, len);
+        if (added <= 0) return added;
+        
+        while (len > 0 && entry_name[len - 1] != '/') len--;
+    }
+}
+
+// Order in which a directory's whole subtree directly follows it: '/' sorts
+// before every other byte, so "a/b" comes before "a-c"
+static int compare_dir_paths(const void* a, const void* b) {
+    const unsigned char* x = *(const unsigned char* const*)a;
+    const unsigned char* y = *(const unsigned char* const*)b;
+    while (*x && *x == *y) {
+        x++;
+        y++;
+    }
+    int cx = *x == '/' ? 1 : *x;
+    int cy = *y == '/' ? 1 : *y;
+    return cx - cy;
+}
+
+#ifndef _WIN32
+// Walk the sorted paths keeping the chain of open ancestor directories, so
+// each directory is created with one mkdirat() against its open parent
+static int create_sorted(char** dirs, size_t count, const char* root) {
+    int root_fd = open(root, O_RDONLY | O_DIRECTORY);
+    if (root_fd < 0) {
+        log_message(LOG_ERROR, "Error opening directory '%s'\n", root);
+        return EXIT_FILE_ERROR;
+    }
+    
+    int fds[DIR_CACHE_MAX_OPEN];
+    size_t ends[DIR_CACHE_MAX_OPEN];   // Prefix length of dirs[i] each fd refers to
+    size_t depth = 0;
+    const char* prev = "";
+    int result = EXIT_SUCCESS;
+    char name[PATH_MAX];
+    
+    for (size_t i = 0; i < count && result == EXIT_SUCCESS; i++) {
+        const char* dir = dirs[i];
+        size_t len = strlen(dir);
+        
+        // Keep the open ancestors this directory shares with the previous one
+        while (depth > 0) {
+            size_t end = ends[depth - 1];
+            if (strncmp(dir, prev, end) == 0 && (dir[end] == '/' || dir[end] == '\0')) break;
+            close(fds[--depth]);
+        }
+        
+        size_t base = depth > 0 ? ends[depth - 1] + 1 : 0;
+        size_t start = base;
+        while (start < len) {
+            const char* slash = strchr(dir + start, '/');
+            size_t end = slash ? (size_t)(slash - dir) : len;
+            if (end == start) {
+                // Empty component ("a//b")
+                start = end + 1;
+                if (base == end) base = start;
+                continue;
+            }
+            
+            // Path relative to the deepest open directory: one component,
+            // unless the open chain is full
+            size_t name_len = end - base;
+            if (name_len >= sizeof(name)) {
+                result = EXIT_FILE_ERROR;
+                break;
+            }
+            memcpy(name, dir + base, name_len);
+            name[name_len] = '\0';
+            
+            int parent = depth > 0 ? fds[depth - 1] : root_fd;
+            if (mkdirat(parent, name, 0755) != 0 && errno != EEXIST) {
+                log_message(LOG_ERROR, "Error creating directory '%s'\n", dir);
+                result = EXIT_FILE_ERROR;
+                break;
+            }
+            
+            if (depth < DIR_CACHE_MAX_OPEN) {
+                int fd = openat(parent, name, O_RDONLY | O_DIRECTORY);
+                if (fd < 0) {
+                    log_message(LOG_ERROR, "Error creating directory '%s'\n", dir);
+                    result = EXIT_FILE_ERROR;
+                    break;
+                }
+                fds[depth] = fd;
+                ends[depth] = end;
+                depth++;
+                base = end + 1;
+            }
+            start = end + 1;
+        }
+        prev = dir;
+    }
+    
+    while (depth > 0) {
+        close(fds[--depth]);
+    }
+    close(root_fd);
+    return result;
+}
+#else
+static int create_sorted(char** dirs, size_t count, const char* root) {
+    for (size_t i = 0; i < count; i++) {
+        char* path = join_path(root, dirs[i]);
+        if (!path) return EXIT_FAILURE;
+        
+        for (char* p = path; *p; p++) {
+            if (*p == '/') *p = PATH_SEPARATOR;
+        }
+        
+        // Parents are created first, so no recursive walk is needed
+        if (!CreateDirectoryA(path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+            log_message(LOG_ERROR, "Error creating directory '%s'\n", path);
+            free(path);
+            return EXIT_FILE_ERROR;
+        }
+        free(path);
+    }
+    return EXIT_SUCCESS;
+}
+#endif
+
+int dir_cache_create_all(const dir_cache_t* cache, const char* root) {
+    if (!cache || !root) return EXIT_INVALID_ARGS;
+    if (cache->count == 0) return EXIT_SUCCESS;
+    
+    char** dirs = malloc(cache->count * sizeof(char*));
+    if (!dirs) return EXIT_FAILURE;
+    
+    size_t count = 0;
+    for (size_t i = 0; i < cache->capacity; i++) {
+        if (cache->slots[i]) dirs[count++] = cache->slots[i];
+    }
+    qsort(dirs, count, sizeof(char*), compare_dir_paths);
+    
+    int result = create_sorted(dirs, count, root);
+    free(dirs);
+    return result;
+}
@@ -0,0 +1,460 @@
+#include "dir_scan.h"
+#include "resources.h"
+#include "metrics.h"
+#include "logging.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+
+typedef enum {
+    SCAN_QUEUED,                // Waiting for a worker (or the consumer) to list it
+    SCAN_LISTING,
+    SCAN_DONE
+} scan_state_t;
+
+typedef struct scan_dir scan_dir_t;
+
+typedef struct {
+    const char* name;           // Into the directory's name block
+    size_t name_offset;         // Same, while the block may still move
+    bool is_directory;
+    time_t mtime;
+    off_t size;
+    uint64_t device;
+    uint64_t inode;
+    int64_t mtime_ns;
+    scan_dir_t* child;          // Listing of this subdirectory (recursive scans)
+} scan_entry_t;
+
+struct scan_dir {
+    char* path;
+    scan_dir_t* parent;
+    scan_dir_t* next_node;      // Every node the scan allocated
+    scan_state_t state;
+    bool skipped;               // The callback pruned this subtree
+    int result;
+    scan_entry_t* entries;      // Sorted by name once the state is SCAN_DONE
+    size_t count;
+    char* names;
+};
+
+// Directories waiting to be listed. The owner pops the newest (the next one
+// the consumer will visit), thieves take the oldest, which heads the subtree
+// needed furthest in the future.
+typedef struct {
+    scan_dir_t** items;
+    size_t head;
+    size_t count;
+    size_t capacity;
+} scan_deque_t;
+
+typedef struct scanner scanner_t;
+
+typedef struct {
+    scanner_t* scanner;
+    int id;
+} scan_worker_t;
+
+// A single lock covers the deques and node states: each work item is a
+// whole directory, so it is taken a handful of times per readdir() pass
+struct scanner {
+    bool recursive;
+    scan_deque_t* deques;
+    int num_deques;
+    int num_workers;
+    bool shutdown;
+    scan_dir_t* nodes;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_available;
+    pthread_cond_t listed;
+    pthread_t* threads;
+    scan_worker_t* workers;
+    log_config_t* log_config;   // The scanning run's, adopted by the workers
+};
+
+static int get_scan_threads(void) {
+    int nprocs = resources_cpu_count();
+    if (nprocs <= 1) return 0;
+    return nprocs > DIR_SCAN_MAX_THREADS ? DIR_SCAN_MAX_THREADS : nprocs;
+}
+
+static scan_dir_t* scan_dir_new(char* path, scan_dir_t* parent) {
+    scan_dir_t* dir = calloc(1, sizeof(scan_dir_t));
+    if (!dir) {
+        free(path);
+        return NULL;
+    }
+    dir->path = path;
+    dir->parent = parent;
+    dir->state = SCAN_QUEUED;
+    return dir;
+}
+
+// Whether `dir` lies in a pruned subtree. Caller holds the scanner lock.
+static bool scan_dir_skipped(const scan_dir_t* dir) {
+    for (; dir; dir = dir->parent) {
+        if (dir->skipped) return true;
+    }
+    return false;
+}
+
+static void scan_dir_free_listing(scan_dir_t* dir) {
+    free(dir->entries);
+    free(dir->names);
+    dir->entries = NULL;
+    dir->names = NULL;
+    dir->count = 0;
+}
+
+static bool deque_push(scan_deque_t* deque, scan_dir_t* dir) {
+    if (deque->count == deque->capacity) {
+        size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+        scan_dir_t** items = malloc(capacity * sizeof(scan_dir_t*));
+        if (!items) return false;
+        for (size_t i = 0; i < deque->count; i++) {
+            items[i] = deque->items[(deque->head + i) % deque->capacity];
+        }
+        free(deque->items);
+        deque->items = items;
+        deque->head = 0;
+        deque->capacity = capacity;
+    }
+    deque->items[(deque->head + deque->count) % deque->capacity] = dir;
+    deque->count++;
+    return true;
+}
+
+static scan_dir_t* deque_pop_newest(scan_deque_t* deque) {
+    if (deque->count == 0) return NULL;
+    deque->count--;
+    return deque->items[(deque->head + deque->count) % deque->capacity];
+}
+
+static scan_dir_t* deque_pop_oldest(scan_deque_t* deque) {
+    if (deque->count == 0) return NULL;
+    scan_dir_t* dir = deque->items[deque->head];
+    deque->head = (deque->head + 1) % deque->capacity;
+    deque->count--;
+    return dir;
+}
+
+// Caller holds the scanner lock
+static scan_dir_t* scanner_take(scanner_t* scanner, int id) {
+    scan_dir_t* dir = deque_pop_newest(&scanner->deques[id]);
+    for (int i = 1; !dir && i < scanner->num_deques; i++) {
+        dir = deque_pop_oldest(&scanner->deques[(id + i) % scanner->num_deques]);
+    }
+    return dir;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    return strcmp(((const scan_entry_t*)a)->name, ((const scan_entry_t*)b)->name);
+}
+
+// Read one directory: a single fstatat() relative to the open directory for
+// each entry, skipped entirely when d_type already says it cannot be archived
+static int list_directory(scan_dir_t* dir, bool recursive) {
+    DIR* handle = opendir(dir->path);
+    metrics_count(METRICS_OPEN_CALLS, 1);
+    if (!handle) return EXIT_FAILURE;
+    int fd = dirfd(handle);
+    
+    size_t capacity = 0;
+    size_t names_len = 0;
+    size_t names_capacity = 0;
+    int result = EXIT_SUCCESS;
+    struct dirent* ent;
+    
+    while ((ent = readdir(handle)) != NULL) {
+        const char* name = ent->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+        
+#ifdef DT_UNKNOWN
+        // Devices, FIFOs and sockets cannot be stored (and reading a FIFO
+        // would block); symlinks and DT_UNKNOWN are resolved by the stat
+        if (ent->d_type == DT_FIFO || ent->d_type == DT_SOCK ||
+            ent->d_type == DT_CHR || ent->d_type == DT_BLK) {
+            continue;
+        }
+#endif
+        
+        struct stat st;
+        metrics_count(METRICS_STAT_CALLS, 1);
+        if (fstatat(fd, name, &st, 0) != 0) continue;
+        if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) continue;
+        
+        if (dir->count == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 32;
+            scan_entry_t* entries = realloc(dir->entries, new_capacity * sizeof(scan_entry_t));
+            if (!entries) {
+                result = EXIT_FAILURE;
+                break;
+            }
+            dir->entries = entries;
+            capacity = new_capacity;
+        }
+        
+        size_t name_len = strlen(name) + 1;
+        if (names_len + name_len > names_capacity) {
+            size_t new_capacity = names_capacity ? names_capacity * 2 : 1024;
+            while (new_capacity < names_len + name_len) new_capacity *= 2;
+            char* names = realloc(dir->names, new_capacity);
+            if (!names) {
+                result = EXIT_FAILURE;
+                break;
+            }
+            dir->names = names;
+            names_capacity = new_capacity;
+        }
+        memcpy(dir->names + names_len, name, name_len);
+        
+        scan_entry_t* entry = &dir->entries[dir->count++];
+        entry->name_offset = names_len;
+        entry->is_directory = S_ISDIR(st.st_mode);
+        entry->mtime = st.st_mtime;
+        entry->size = entry->is_directory ? 0 : st.st_size;
+        entry->device = (uint64_t)st.st_dev;
+        entry->inode = (uint64_t)st.st_ino;
+#ifdef __APPLE__
+        entry->mtime_ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+        entry->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+        entry->child = NULL;
+        names_len += name_len;
+    }
+    closedir(handle);
+    
+    for (size_t i = 0; i < dir->count; i++) {
+        dir->entries[i].name = dir->names + dir->entries[i].name_offset;
+    }
+    if (dir->count > 1) {
+        qsort(dir->entries, dir->count, sizeof(scan_entry_t), compare_entries);
+    }
+    
+    for (size_t i = 0; result == EXIT_SUCCESS && recursive && i < dir->count; i++) {
+        scan_entry_t* entry = &dir->entries[i];
+        if (!entry->is_directory) continue;
+        
+        char* path = join_path(dir->path, entry->name);
+        entry->child = path ? scan_dir_new(path, dir) : NULL;
+        if (!entry->child) result = EXIT_FAILURE;
+    }
+    return result;
+}
+
+// Record a finished listing and queue its subdirectories on deque `id`.
+// Caller holds the scanner lock.
+static void scanner_publish(scanner_t* scanner, scan_dir_t* dir, int result, int id) {
+    dir->result = result;
+    dir->state = SCAN_DONE;
+    
+    // Children are pushed in reverse so the owner pops them in visiting order
+    bool queued = false;
+    bool prefetch = scanner->num_workers > 0 && result == EXIT_SUCCESS && !scan_dir_skipped(dir);
+    for (size_t i = dir->count; i-- > 0;) {
+        scan_dir_t* child = dir->entries[i].child;
+        if (!child) continue;
+        child->next_node = scanner->nodes;
+        scanner->nodes = child;
+        if (prefetch && deque_push(&scanner->deques[id], child)) {
+            queued = true;
+        }
+    }
+    
+    if (queued) pthread_cond_broadcast(&scanner->work_available);
+    pthread_cond_broadcast(&scanner->listed);
+}
+
+static void* scan_worker_thread(void* arg) {
+    scan_worker_t* worker = (scan_worker_t*)arg;
+    scanner_t* scanner = worker->scanner;
+    log_config_use(scanner->log_config);
+    metrics_thread_begin("scan", worker->id);
+    
+    pthread_mutex_lock(&scanner->mutex);
+    while (!scanner->shutdown) {
+        scan_dir_t* dir = scanner_take(scanner, worker->id);
+        if (!dir) {
+            uint64_t idle_start = metrics_start();
+            pthread_cond_wait(&scanner->work_available, &scanner->mutex);
+            metrics_stop(METRICS_TIMER_IDLE, idle_start, NULL);
+            continue;
+        }
+        // The consumer may have listed it already, or pruned it
+        if (dir->state != SCAN_QUEUED) continue;
+        if (scan_dir_skipped(dir)) {
+            dir->state = SCAN_DONE;
+            continue;
+        }
+        
+        dir->state = SCAN_LISTING;
+        pthread_mutex_unlock(&scanner->mutex);
+        uint64_t busy_start = metrics_start();
+        int result = list_directory(dir, scanner->recursive);
+        metrics_stop(METRICS_TIMER_BUSY, busy_start, "list directory");
+        pthread_mutex_lock(&scanner->mutex);
+        scanner_publish(scanner, dir, result, worker->id);
+    }
+    pthread_mutex_unlock(&scanner->mutex);
+    metrics_thread_end();
+    return NULL;
+}
+
+// Wait for `dir` to be listed, listing it on this thread if no worker has
+// picked it up yet
+static int scanner_wait(scanner_t* scanner, scan_dir_t* dir) {
+    pthread_mutex_lock(&scanner->mutex);
+    if (dir->state == SCAN_QUEUED) {
+        dir->state = SCAN_LISTING;
+        pthread_mutex_unlock(&scanner->mutex);
+        int result = list_directory(dir, scanner->recursive);
+        pthread_mutex_lock(&scanner->mutex);
+        scanner_publish(scanner, dir, result, 0);
+    }
+    while (dir->state != SCAN_DONE) {
+        pthread_cond_wait(&scanner->listed, &scanner->mutex);
+    }
+    int result = dir->result;
+    pthread_mutex_unlock(&scanner->mutex);
+    return result;
+}
+
+// Run the callbacks for `dir` and its subtree; info->path holds the
+// directory's path (path_len bytes) and is extended in place for children
+static int emit_directory(scanner_t* scanner, scan_dir_t* dir, file_info_t* info, size_t path_len,
+                          file_callback_t callback, void* user_data) {
+    int result = scanner_wait(scanner, dir);
+    if (result != EXIT_SUCCESS) return result;
+    
+    size_t prefix_len = path_len;
+    if (prefix_len > 0 && info->path[prefix_len - 1] != PATH_SEPARATOR) {
+        if (prefix_len + 1 >= PATH_MAX) return EXIT_FAILURE;
+        info->path[prefix_len++] = PATH_SEPARATOR;
+    }
+    
+    for (size_t i = 0; i < dir->count && result == EXIT_SUCCESS; i++) {
+        const scan_entry_t* entry = &dir->entries[i];
+        size_t name_len = strlen(entry->name);
+        if (prefix_len + name_len >= PATH_MAX) {
+            info->path[path_len] = '\0';
+            log_message(LOG_WARNING, "Warning: Path too long, skipping entry in '%s'\n", info->path);
+            continue;
+        }
+        memcpy(info->path + prefix_len, entry->name, name_len + 1);
+        info->is_directory = entry->is_directory;
+        info->mtime = entry->mtime;
+        info->size = entry->size;
+        info->device = entry->device;
+        info->inode = entry->inode;
+        info->mtime_ns = entry->mtime_ns;
+        
+        result = callback(info, user_data);
+        if (result == TRAVERSE_SKIP_SUBTREE) {
+            result = EXIT_SUCCESS;
+            if (entry->child) {
+                // Stop workers from listing anything below it
+                pthread_mutex_lock(&scanner->mutex);
+                entry->child->skipped = true;
+                pthread_mutex_unlock(&scanner->mutex);
+            }
+        } else if (result == EXIT_SUCCESS && entry->child) {
+            result = emit_directory(scanner, entry->child, info, prefix_len + name_len,
+                                    callback, user_data);
+        }
+    }
+    
+    // Only this thread reads a listing once it is done
+    scan_dir_free_listing(dir);
+    return result;
+}
+
+static void scanner_start(scanner_t* scanner, int num_threads) {
+    scanner->deques = calloc(num_threads, sizeof(scan_deque_t));
+    scanner->threads = calloc(num_threads, sizeof(pthread_t));
+    scanner->workers = calloc(num_threads, sizeof(scan_worker_t));
+    if (!scanner->deques || !scanner->threads || !scanner->workers) return;
+    
+    // Deques exist even for workers that fail to start; the others steal
+    // from them and the consumer lists anything left behind
+    scanner->num_deques = num_threads;
+    scanner->log_config = log_config_current();
+    pthread_mutex_lock(&scanner->mutex);
+    for (int i = 0; i < num_threads; i++) {
+        scanner->workers[i].scanner = scanner;
+        scanner->workers[i].id = i;
+        if (pthread_create(&scanner->threads[scanner->num_workers], NULL,
+                           scan_worker_thread, &scanner->workers[i]) != 0) {
+            break;
+        }
+        scanner->num_workers++;
+    }
+    pthread_mutex_unlock(&scanner->mutex);
+}
+
+static void scanner_stop(scanner_t* scanner) {
+    pthread_mutex_lock(&scanner->mutex);
+    scanner->shutdown = true;
+    pthread_cond_broadcast(&scanner->work_available);
+    pthread_mutex_unlock(&scanner->mutex);
+    
+    for (int i = 0; i < scanner->num_workers; i++) {
+        pthread_join(scanner->threads[i], NULL);
+    }
+    
+    for (int i = 0; i < scanner->num_deques; i++) {
+        free(scanner->deques[i].items);
+    }
+    free(scanner->deques);
+    free(scanner->threads);
+    free(scanner->workers);
+    
+    scan_dir_t* node = scanner->nodes;
+    while (node) {
+        scan_dir_t* next = node->next_node;
+        scan_dir_free_listing(node);
+        free(node->path);
+        free(node);
+        node = next;
+    }
+}
+
+int dir_scan(const char* root, bool recursive, file_callback_t callback, void* user_data) {
+    if (!root || !callback) return EXIT_FAILURE;
+    
+    size_t root_len = strlen(root);
+    if (root_len >= PATH_MAX) return EXIT_FAILURE;
+    
+    char* root_path = malloc(root_len + 1);
+    if (!root_path) return EXIT_FAILURE;
+    memcpy(root_path, root, root_len + 1);
+    
+    scan_dir_t* root_dir = scan_dir_new(root_path, NULL);
+    if (!root_dir) return EXIT_FAILURE;
+    
+    scanner_t scanner;
+    memset(&scanner, 0, sizeof(scanner));
+    scanner.recursive = recursive;
+    scanner.nodes = root_dir;
+    pthread_mutex_init(&scanner.mutex, NULL);
+    pthread_cond_init(&scanner.work_available, NULL);
+    pthread_cond_init(&scanner.listed, NULL);
+    
+    // A flat scan is a single directory, so there is nothing to share out
+    int num_threads = recursive ? get_scan_threads() : 0;
+    if (num_threads > 0) scanner_start(&scanner, num_threads);
+    
+    file_info_t info;
+    memcpy(info.path, root, root_len + 1);
+    int result = emit_directory(&scanner, root_dir, &info, root_len, callback, user_data);
+    
+    scanner_stop(&scanner);
+    pthread_mutex_destroy(&scanner.mutex);
+    pthread_cond_destroy(&scanner.work_available);
+    pthread_cond_destroy(&scanner.listed);
+    return result;
+}
+#endif
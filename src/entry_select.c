@@ -0,0 +1,57 @@
+#include "entry_select.h"
+#include "logging.h"
+
+int entry_select_init(entry_select_t* select, const char* const* names, int count) {
+    memset(select, 0, sizeof(entry_select_t));
+    select->names = names;
+    select->count = count;
+    select->literal = count > 0;
+
+    for (int i = 0; i < count; i++) {
+        char pattern[PATH_MAX];
+        const char* text = names[i];
+        bool is_negation = text[0] == '!';
+        if (is_negation) text++;
+
+        bool rooted = text[0] == '/';
+        while (*text == '/') text++;
+
+        size_t len = strlen(text);
+        if (len >= sizeof(pattern)) {
+            log_message(LOG_ERROR, "Error: Selector too long: %s\n", names[i]);
+            entry_select_free(select);
+            return EXIT_INVALID_ARGS;
+        }
+        memcpy(pattern, text, len + 1);
+        for (char* p = pattern; *p; p++) {
+            if (*p == '\\') *p = '/';
+        }
+
+        bool is_directory = len > 0 && pattern[len - 1] == '/';
+        while (len > 0 && pattern[len - 1] == '/') pattern[--len] = '\0';
+        if (len == 0) continue;
+
+        // A plain name is a path from the root: the entry and everything below it
+        bool wildcard = strpbrk(pattern, "*?[") != NULL;
+        if (wildcard || is_negation || is_directory) {
+            select->literal = false;
+        }
+        bool is_anchored = !wildcard || rooted || strchr(pattern, '/') != NULL;
+
+        if (zipignore_add_pattern(&select->patterns, "", pattern, is_directory || !wildcard,
+                                  is_negation, is_anchored) != EXIT_SUCCESS) {
+            entry_select_free(select);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+void entry_select_free(entry_select_t* select) {
+    free_zipignore(&select->patterns);
+    select->count = 0;
+}
+
+bool entry_select_match(const entry_select_t* select, const char* name) {
+    return select->count == 0 || should_ignore(&select->patterns, name);
+}
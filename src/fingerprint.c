@@ -0,0 +1,549 @@
+#include "fingerprint.h"
+#include <errno.h>
+#include "codec.h"
+#include "logging.h"
+
+#ifdef _WIN32
+    #include <sys/stat.h>
+#endif
+
+// Cache file layout, all integers little-endian:
+//   "GBZC" u32 version  u64 count
+//   count x { u16 path_len  path  u64 device  u64 inode  u64 size  i64 mtime_ns
+//             u64 hash  u8 flags  u32 crc32  u16 method  u64 compressed_size  u64 data_offset }
+#define CACHE_MAGIC        "GBZC"
+#define CACHE_VERSION      1
+#define CACHE_HEADER_SIZE  16
+#define CACHE_RECORD_SIZE  (2 + 8 * 5 + 1 + 4 + 2 + 8 * 2)   // Excluding the path
+
+#define CACHE_FLAG_HASH_KNOWN 0x01
+
+// Read size when fingerprinting a file
+#define FINGERPRINT_BUFFER_SIZE (1024 * 1024)
+
+// ============================================================================
+// XXH64
+// ============================================================================
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+typedef struct {
+    uint64_t acc[4];
+    uint64_t total;
+    unsigned char buffer[32];
+    size_t buffered;
+} hash_state_t;
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char* p) {
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+           ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static uint32_t read32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint64_t hash_merge(uint64_t acc, uint64_t value) {
+    acc ^= hash_round(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+static void hash_init(hash_state_t* state) {
+    memset(state, 0, sizeof(hash_state_t));
+    state->acc[0] = PRIME64_1 + PRIME64_2;
+    state->acc[1] = PRIME64_2;
+    state->acc[2] = 0;
+    state->acc[3] = 0 - PRIME64_1;
+}
+
+static void hash_stripe(hash_state_t* state, const unsigned char* p) {
+    state->acc[0] = hash_round(state->acc[0], read64(p));
+    state->acc[1] = hash_round(state->acc[1], read64(p + 8));
+    state->acc[2] = hash_round(state->acc[2], read64(p + 16));
+    state->acc[3] = hash_round(state->acc[3], read64(p + 24));
+}
+
+static void hash_update(hash_state_t* state, const unsigned char* data, size_t size) {
+    state->total += size;
+    
+    if (state->buffered > 0) {
+        size_t take = 32 - state->buffered;
+        if (take > size) take = size;
+        memcpy(state->buffer + state->buffered, data, take);
+        state->buffered += take;
+        data += take;
+        size -= take;
+        if (state->buffered < 32) return;
+        hash_stripe(state, state->buffer);
+        state->buffered = 0;
+    }
+    
+    while (size >= 32) {
+        hash_stripe(state, data);
+        data += 32;
+        size -= 32;
+    }
+    
+    memcpy(state->buffer, data, size);
+    state->buffered = size;
+}
+
+static uint64_t hash_digest(const hash_state_t* state) {
+    uint64_t h;
+    if (state->total >= 32) {
+        h = rotl64(state->acc[0], 1) + rotl64(state->acc[1], 7) +
+            rotl64(state->acc[2], 12) + rotl64(state->acc[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = hash_merge(h, state->acc[i]);
+        }
+    } else {
+        h = PRIME64_5;
+    }
+    h += state->total;
+    
+    const unsigned char* p = state->buffer;
+    size_t left = state->buffered;
+    for (; left >= 8; p += 8, left -= 8) {
+        h ^= hash_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (left >= 4) {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        left -= 4;
+    }
+    for (; left > 0; p++, left--) {
+        h ^= *p * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+    
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t fingerprint_hash(const void* data, size_t size) {
+    hash_state_t state;
+    hash_init(&state);
+    hash_update(&state, (const unsigned char*)data, size);
+    return hash_digest(&state);
+}
+
+int fingerprint_file(const char* path, uint64_t* hash, uint32_t* crc32_out) {
+    if (!path || !hash || !crc32_out) {
+        return EXIT_INVALID_ARGS;
+    }
+    
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        log_message(LOG_ERROR, "Error opening file '%s': %s\n", path, strerror(errno));
+        return EXIT_FILE_ERROR;
+    }
+    
+    unsigned char* buffer = malloc(FINGERPRINT_BUFFER_SIZE);
+    if (!buffer) {
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+    
+    hash_state_t state;
+    hash_init(&state);
+    uint32_t crc = 0;
+    
+    size_t n;
+    while ((n = fread(buffer, 1, FINGERPRINT_BUFFER_SIZE, file)) > 0) {
+        hash_update(&state, buffer, n);
+        crc = codec_crc32(crc, buffer, n);
+    }
+    
+    int result = ferror(file) ? EXIT_FILE_ERROR : EXIT_SUCCESS;
+    if (result != EXIT_SUCCESS) {
+        log_message(LOG_ERROR, "Error reading file '%s'\n", path);
+    }
+    
+    free(buffer);
+    fclose(file);
+    
+    *hash = hash_digest(&state);
+    *crc32_out = crc;
+    return result;
+}
+
+bool fingerprint_key_equal(const fingerprint_key_t* a, const fingerprint_key_t* b) {
+    return a->device == b->device && a->inode == b->inode &&
+           a->size == b->size && a->mtime_ns == b->mtime_ns;
+}
+
+bool fingerprint_stat(const char* path, fingerprint_key_t* key, uint32_t* mode) {
+    memset(key, 0, sizeof(fingerprint_key_t));
+    
+#ifdef _WIN32
+    // Matches what directory traversal reports: no device or inode, whole seconds
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0) return false;
+    key->mtime_ns = (int64_t)st.st_mtime * 1000000000LL;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+    key->device = (uint64_t)st.st_dev;
+    key->inode = (uint64_t)st.st_ino;
+#ifdef __APPLE__
+    key->mtime_ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    key->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+#endif
+    
+    key->size = (uint64_t)st.st_size;
+    if (mode) *mode = (uint32_t)st.st_mode;
+    return true;
+}
+
+// ============================================================================
+// Cache table
+// ============================================================================
+
+// 64-bit FNV-1a
+static uint64_t hash_path(const char* path) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (const unsigned char* p = (const unsigned char*)path; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void fingerprint_cache_init(fingerprint_cache_t* cache) {
+    memset(cache, 0, sizeof(fingerprint_cache_t));
+    string_pool_init(&cache->paths);
+}
+
+void fingerprint_cache_free(fingerprint_cache_t* cache) {
+    if (!cache) return;
+    
+    free(cache->entries);
+    free(cache->path_index);
+    free(cache->content_index);
+    string_pool_free(&cache->paths);
+    memset(cache, 0, sizeof(fingerprint_cache_t));
+}
+
+static bool rebuild_path_index(fingerprint_cache_t* cache, size_t capacity) {
+    size_t* slots = calloc(capacity, sizeof(size_t));
+    if (!slots) return false;
+    
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < cache->count; i++) {
+        size_t j = (size_t)hash_path(cache->entries[i].path) & mask;
+        while (slots[j]) j = (j + 1) & mask;
+        slots[j] = i + 1;
+    }
+    
+    free(cache->path_index);
+    cache->path_index = slots;
+    cache->path_index_mask = mask;
+    return true;
+}
+
+fingerprint_entry_t* fingerprint_cache_find(const fingerprint_cache_t* cache, const char* path) {
+    if (!cache || !path || !cache->path_index) return NULL;
+    
+    size_t mask = cache->path_index_mask;
+    for (size_t j = (size_t)hash_path(path) & mask; cache->path_index[j]; j = (j + 1) & mask) {
+        fingerprint_entry_t* entry = &cache->entries[cache->path_index[j] - 1];
+        if (strcmp(entry->path, path) == 0) return entry;
+    }
+    return NULL;
+}
+
+fingerprint_entry_t* fingerprint_cache_put(fingerprint_cache_t* cache, const char* path) {
+    if (!cache || !path) return NULL;
+    
+    fingerprint_entry_t* existing = fingerprint_cache_find(cache, path);
+    if (existing) return existing;
+    
+    // Keep the path index under half full
+    size_t index_capacity = cache->path_index ? cache->path_index_mask + 1 : 0;
+    if ((cache->count + 1) * 2 > index_capacity &&
+        !rebuild_path_index(cache, index_capacity ? index_capacity * 2 : 1024)) {
+        return NULL;
+    }
+    
+    if (cache->count == cache->capacity) {
+        size_t capacity = cache->capacity ? cache->capacity * 2 : 1024;
+        fingerprint_entry_t* entries = realloc(cache->entries, sizeof(fingerprint_entry_t) * capacity);
+        if (!entries) return NULL;
+        cache->entries = entries;
+        cache->capacity = capacity;
+    }
+    
+    fingerprint_entry_t* entry = &cache->entries[cache->count];
+    memset(entry, 0, sizeof(fingerprint_entry_t));
+    entry->path = string_pool_strdup(&cache->paths, path);
+    if (!entry->path) return NULL;
+    
+    size_t mask = cache->path_index_mask;
+    size_t j = (size_t)hash_path(path) & mask;
+    while (cache->path_index[j]) j = (j + 1) & mask;
+    cache->path_index[j] = ++cache->count;
+    return entry;
+}
+
+static bool is_content_source(const fingerprint_entry_t* entry) {
+    return entry->hash_known && entry->data_offset != 0;
+}
+
+// Entries whose bytes can be reused, by content hash. Entries added or
+// changed later are checked again on lookup, so a stale slot never matches.
+static bool build_content_index(fingerprint_cache_t* cache) {
+    size_t capacity = 16;
+    while (capacity < cache->count * 2) capacity *= 2;
+    
+    cache->content_index = calloc(capacity, sizeof(size_t));
+    if (!cache->content_index) return false;
+    
+    cache->content_index_mask = capacity - 1;
+    for (size_t i = 0; i < cache->count; i++) {
+        if (!is_content_source(&cache->entries[i])) continue;
+        size_t j = (size_t)cache->entries[i].hash & cache->content_index_mask;
+        while (cache->content_index[j]) j = (j + 1) & cache->content_index_mask;
+        cache->content_index[j] = i + 1;
+    }
+    return true;
+}
+
+const fingerprint_entry_t* fingerprint_cache_find_content(fingerprint_cache_t* cache, uint64_t hash,
+                                                          uint64_t size, uint32_t crc32) {
+    if (!cache || cache->count == 0) return NULL;
+    if (!cache->content_index && !build_content_index(cache)) return NULL;
+    
+    size_t mask = cache->content_index_mask;
+    for (size_t j = (size_t)hash & mask; cache->content_index[j]; j = (j + 1) & mask) {
+        const fingerprint_entry_t* entry = &cache->entries[cache->content_index[j] - 1];
+        if (is_content_source(entry) && entry->hash == hash &&
+            entry->key.size == size && entry->crc32 == crc32) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+void fingerprint_cache_clear_offsets(fingerprint_cache_t* cache) {
+    if (!cache) return;
+    
+    for (size_t i = 0; i < cache->count; i++) {
+        cache->entries[i].data_offset = 0;
+    }
+    free(cache->content_index);
+    cache->content_index = NULL;
+}
+
+// ============================================================================
+// Cache file
+// ============================================================================
+
+static char* cache_path_for(const char* archive_path) {
+    size_t len = strlen(archive_path) + sizeof(FINGERPRINT_CACHE_SUFFIX);
+    char* path = malloc(len);
+    if (path) snprintf(path, len, "%s%s", archive_path, FINGERPRINT_CACHE_SUFFIX);
+    return path;
+}
+
+static unsigned char* put_u16(unsigned char* p, uint16_t v) {
+    p[0] = (unsigned char)(v & 0xFF);
+    p[1] = (unsigned char)(v >> 8);
+    return p + 2;
+}
+
+static unsigned char* put_u32(unsigned char* p, uint32_t v) {
+    p = put_u16(p, (uint16_t)(v & 0xFFFF));
+    return put_u16(p, (uint16_t)(v >> 16));
+}
+
+static unsigned char* put_u64(unsigned char* p, uint64_t v) {
+    p = put_u32(p, (uint32_t)(v & 0xFFFFFFFFu));
+    return put_u32(p, (uint32_t)(v >> 32));
+}
+
+// Parse a whole cache file; false if it is not one this version wrote
+static bool parse_cache(fingerprint_cache_t* cache, const unsigned char* data, size_t size) {
+    if (size < CACHE_HEADER_SIZE || memcmp(data, CACHE_MAGIC, 4) != 0 ||
+        read32(data + 4) != CACHE_VERSION) {
+        return false;
+    }
+    
+    uint64_t count = read64(data + 8);
+    const unsigned char* p = data + CACHE_HEADER_SIZE;
+    const unsigned char* end = data + size;
+    
+    for (uint64_t i = 0; i < count; i++) {
+        if ((size_t)(end - p) < CACHE_RECORD_SIZE) return false;
+        size_t path_len = (size_t)(p[0] | (p[1] << 8));
+        if ((size_t)(end - p) < CACHE_RECORD_SIZE + path_len || path_len == 0 || path_len >= PATH_MAX) {
+            return false;
+        }
+        
+        char path[PATH_MAX];
+        memcpy(path, p + 2, path_len);
+        path[path_len] = '\0';
+        p += 2 + path_len;
+        
+        fingerprint_entry_t* entry = fingerprint_cache_put(cache, path);
+        if (!entry) return false;
+        entry->key.device = read64(p);
+        entry->key.inode = read64(p + 8);
+        entry->key.size = read64(p + 16);
+        entry->key.mtime_ns = (int64_t)read64(p + 24);
+        entry->hash = read64(p + 32);
+        entry->hash_known = (p[40] & CACHE_FLAG_HASH_KNOWN) != 0;
+        entry->crc32 = read32(p + 41);
+        entry->method = (uint16_t)(p[45] | (p[46] << 8));
+        entry->compressed_size = read64(p + 47);
+        entry->data_offset = read64(p + 55);
+        p += CACHE_RECORD_SIZE - 2;
+    }
+    return p == end;
+}
+
+int fingerprint_cache_load(fingerprint_cache_t* cache, const char* archive_path) {
+    if (!cache || !archive_path) {
+        return EXIT_INVALID_ARGS;
+    }
+    
+    char* path = cache_path_for(archive_path);
+    if (!path) return EXIT_FAILURE;
+    
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        // No cache yet
+        free(path);
+        return EXIT_SUCCESS;
+    }
+    
+    unsigned char* data = NULL;
+    size_t size = 0;
+    bool valid = false;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long length = ftell(file);
+        if (length >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+            size = (size_t)length;
+            data = malloc(size ? size : 1);
+            valid = data && fread(data, 1, size, file) == size;
+        }
+    }
+    fclose(file);
+    
+    if (valid) {
+        valid = parse_cache(cache, data, size);
+    }
+    if (!valid) {
+        log_message(LOG_WARNING, "Warning: Ignoring unreadable cache '%s'\n", path);
+        fingerprint_cache_free(cache);
+        fingerprint_cache_init(cache);
+    }
+    
+    free(data);
+    free(path);
+    return EXIT_SUCCESS;
+}
+
+int fingerprint_cache_save(const fingerprint_cache_t* cache, const char* archive_path) {
+    if (!cache || !archive_path) {
+        return EXIT_INVALID_ARGS;
+    }
+    
+    char* path = cache_path_for(archive_path);
+    size_t temp_len = strlen(archive_path) + sizeof(FINGERPRINT_CACHE_SUFFIX) + 4;
+    char* temp_path = malloc(temp_len);
+    if (!path || !temp_path) {
+        free(path);
+        free(temp_path);
+        return EXIT_FAILURE;
+    }
+    snprintf(temp_path, temp_len, "%s.tmp", path);
+    
+    // Written next to the cache and moved over it, so a crash never leaves half a cache
+    FILE* file = fopen(temp_path, "wb");
+    if (!file) {
+        log_message(LOG_WARNING, "Warning: Could not create cache '%s': %s\n", temp_path, strerror(errno));
+        free(path);
+        free(temp_path);
+        return EXIT_FILE_ERROR;
+    }
+    
+    uint64_t count = 0;
+    for (size_t i = 0; i < cache->count; i++) {
+        if (cache->entries[i].seen) count++;
+    }
+    
+    unsigned char record[CACHE_RECORD_SIZE + PATH_MAX];
+    memcpy(record, CACHE_MAGIC, 4);
+    unsigned char* p = put_u32(record + 4, CACHE_VERSION);
+    p = put_u64(p, count);
+    bool ok = fwrite(record, 1, CACHE_HEADER_SIZE, file) == CACHE_HEADER_SIZE;
+    
+    for (size_t i = 0; i < cache->count && ok; i++) {
+        const fingerprint_entry_t* entry = &cache->entries[i];
+        if (!entry->seen) continue;
+        
+        size_t path_len = strlen(entry->path);
+        if (path_len >= PATH_MAX) {
+            ok = false;
+            break;
+        }
+        
+        p = put_u16(record, (uint16_t)path_len);
+        memcpy(p, entry->path, path_len);
+        p += path_len;
+        p = put_u64(p, entry->key.device);
+        p = put_u64(p, entry->key.inode);
+        p = put_u64(p, entry->key.size);
+        p = put_u64(p, (uint64_t)entry->key.mtime_ns);
+        p = put_u64(p, entry->hash);
+        *p++ = entry->hash_known ? CACHE_FLAG_HASH_KNOWN : 0;
+        p = put_u32(p, entry->crc32);
+        p = put_u16(p, entry->method);
+        p = put_u64(p, entry->compressed_size);
+        p = put_u64(p, entry->data_offset);
+        
+        size_t record_size = (size_t)(p - record);
+        ok = fwrite(record, 1, record_size, file) == record_size;
+    }
+    
+    if (fclose(file) != 0) ok = false;
+    
+#ifdef _WIN32
+    if (ok && !MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING)) ok = false;
+#else
+    if (ok && rename(temp_path, path) != 0) ok = false;
+#endif
+    
+    int result = EXIT_SUCCESS;
+    if (!ok) {
+        log_message(LOG_WARNING, "Warning: Could not write cache '%s': %s\n", path, strerror(errno));
+        remove(temp_path);
+        result = EXIT_FILE_ERROR;
+    }
+    
+    free(path);
+    free(temp_path);
+    return result;
+}
@@ -0,0 +1,265 @@
+#include "input_source.h"
+#include "metrics.h"
+
+#ifndef _WIN32
+    #include <sys/mman.h>
+#endif
+#ifdef __linux__
+    #include <fcntl.h>
+    #include <sys/ioctl.h>
+    #include <linux/fs.h>
+    #include <linux/fiemap.h>
+#endif
+
+// Default read-ahead past each mapped window
+#define DEFAULT_READAHEAD (4 * 1024 * 1024)
+
+// ============================================================================
+// Mapping
+// ============================================================================
+
+#ifndef _WIN32
+
+static uint64_t page_size(void) {
+    static long size = 0;
+    if (size <= 0) {
+        size = sysconf(_SC_PAGESIZE);
+        if (size <= 0) size = 4096;
+    }
+    return (uint64_t)size;
+}
+
+static const unsigned char* map_file(FILE* f, uint64_t size) {
+    void* map = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fileno(f), 0);
+    if (map == MAP_FAILED) return NULL;
+
+    // Larger read-ahead, and pages behind the reader are reclaimed first
+    madvise(map, (size_t)size, MADV_SEQUENTIAL);
+    return map;
+}
+
+static void unmap_file(const unsigned char* map, uint64_t size) {
+    munmap((void*)map, (size_t)size);
+}
+
+// Start reading [offset, offset + length) in the background and, where
+// Linux can (5.14+), map its pages in one call: faulting them in one by one
+// costs more than the copy a read would have made
+static void prefetch(const unsigned char* map, uint64_t map_size, uint64_t offset, uint64_t length) {
+    if (offset >= map_size || length == 0) return;
+    if (length > map_size - offset) length = map_size - offset;
+
+    uint64_t start = offset & ~(page_size() - 1);
+    void* address = (void*)(map + start);
+    size_t span = (size_t)(offset + length - start);
+    madvise(address, span, MADV_WILLNEED);
+#ifdef MADV_POPULATE_READ
+    madvise(address, span, MADV_POPULATE_READ);
+#endif
+}
+
+// Drop the pages in [from, to) from this process; they fault back in from
+// the page cache if read again. `from` is page aligned; returns where the
+// discarded pages end, `to` rounded down to a page.
+static uint64_t discard(const unsigned char* map, uint64_t from, uint64_t to) {
+    to &= ~(page_size() - 1);
+    if (to > from) {
+        madvise((void*)(map + from), (size_t)(to - from), MADV_DONTNEED);
+    }
+    return to > from ? to : from;
+}
+
+#else
+
+static const unsigned char* map_file(FILE* f, uint64_t size) {
+    (void)size;
+    HANDLE file = (HANDLE)_get_osfhandle(_fileno(f));
+    if (file == INVALID_HANDLE_VALUE || GetFileType(file) != FILE_TYPE_DISK) return NULL;
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) return NULL;
+
+    // The view keeps the mapping object alive
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    return view;
+}
+
+static void unmap_file(const unsigned char* map, uint64_t size) {
+    (void)size;
+    UnmapViewOfFile(map);
+}
+
+// The memory manager reads mapped files ahead on its own, and the hints
+// that could steer it need newer Windows than gbzip targets
+static void prefetch(const unsigned char* map, uint64_t map_size, uint64_t offset, uint64_t length) {
+    (void)map;
+    (void)map_size;
+    (void)offset;
+    (void)length;
+}
+
+static uint64_t discard(const unsigned char* map, uint64_t from, uint64_t to) {
+    (void)map;
+    (void)from;
+    return to;
+}
+
+#endif
+
+// ============================================================================
+// Input source
+// ============================================================================
+
+int input_source_open(input_source_t* src, const char* path, bool allow_map) {
+    memset(src, 0, sizeof(*src));
+    src->readahead = DEFAULT_READAHEAD;
+
+    FILE* f = fopen(path, "rb");
+    metrics_count(METRICS_OPEN_CALLS, 1);
+    if (!f) return -1;
+
+    // Size from the open handle (ftell is limited to 2GB where long is 32-bit)
+#ifndef _WIN32
+    struct stat st;
+    metrics_count(METRICS_STAT_CALLS, 1);
+    if (fstat(fileno(f), &st) != 0) {
+        fclose(f);
+        return -1;
+    }
+    src->mode = (uint32_t)st.st_mode;
+    int64_t file_size = (int64_t)st.st_size;
+    bool regular = S_ISREG(st.st_mode);
+#else
+    int64_t file_size = _filelengthi64(_fileno(f));
+    bool regular = true;    // Checked by map_file()
+#endif
+
+    if (file_size < 0) {
+        fclose(f);
+        return -1;
+    }
+    src->size = (uint64_t)file_size;
+
+    // Past SIZE_MAX the file does not fit the address space and is read
+    if (allow_map && regular && src->size >= INPUT_MAP_MIN_SIZE && src->size <= SIZE_MAX) {
+        src->map = map_file(f, src->size);
+    }
+
+    if (src->map) {
+        fclose(f);
+        prefetch(src->map, src->size, 0, src->readahead);
+        src->prefetched = src->readahead;
+    } else {
+        src->file = f;
+    }
+    return 0;
+}
+
+void input_source_open_memory(input_source_t* src, const unsigned char* data, uint64_t size, uint32_t mode) {
+    memset(src, 0, sizeof(*src));
+    src->map = data;
+    src->borrowed = true;
+    src->size = size;
+    src->mode = mode;
+}
+
+void input_source_close(input_source_t* src) {
+    if (src->map && !src->borrowed) {
+        unmap_file(src->map, src->size);
+        src->map = NULL;
+    }
+    if (src->file) {
+        fclose(src->file);
+        src->file = NULL;
+    }
+}
+
+bool input_source_mapped(const input_source_t* src) {
+    return src->map != NULL;
+}
+
+const unsigned char* input_source_next(input_source_t* src, unsigned char* buffer, size_t max_size,
+                                       size_t* size) {
+    *size = 0;
+
+    if (!src->map) {
+        size_t n = fread(buffer, 1, max_size, src->file);
+        if (ferror(src->file)) return NULL;
+        src->offset += n;
+        *size = n;
+        metrics_count(METRICS_READ_CALLS, 1);
+        metrics_count(METRICS_BYTES_READ, n);
+        return buffer;
+    }
+
+    uint64_t left = src->size - src->offset;
+    size_t n = left < max_size ? (size_t)left : max_size;
+    const unsigned char* window = src->map + src->offset;
+    src->offset += n;
+    *size = n;
+    if (src->borrowed) return window;
+    metrics_count(METRICS_BYTES_READ, n);
+
+    // Keep the kernel reading ahead of the window just handed out
+    uint64_t ahead = src->offset + src->readahead;
+    if (ahead > src->prefetched) {
+        uint64_t from = src->prefetched > src->offset ? src->prefetched : src->offset;
+        prefetch(src->map, src->size, from, ahead - from);
+        src->prefetched = ahead;
+    }
+    return window;
+}
+
+int input_source_rewind(input_source_t* src) {
+    if (src->file && fseek(src->file, 0, SEEK_SET) != 0) return -1;
+    src->offset = 0;
+    return 0;
+}
+
+void input_source_release(input_source_t* src, uint64_t offset) {
+    if (!src->map || src->borrowed || offset <= src->released) return;
+    if (offset > src->size) offset = src->size;
+
+    src->released = discard(src->map, src->released, offset);
+}
+
+// ============================================================================
+// Placement
+// ============================================================================
+
+#ifdef __linux__
+
+bool input_source_disk_offset(const char* path, uint64_t* offset) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    metrics_count(METRICS_OPEN_CALLS, 1);
+
+    // Only the first extent is needed. No FIEMAP_FLAG_SYNC: flushing dirty
+    // data would cost more than the seeks this saves.
+    struct {
+        struct fiemap map;
+        struct fiemap_extent extent;
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.map.fm_start = 0;
+    request.map.fm_length = FIEMAP_MAX_OFFSET;
+    request.map.fm_extent_count = 1;
+
+    bool found = ioctl(fd, FS_IOC_FIEMAP, &request.map) == 0 && request.map.fm_mapped_extents > 0 &&
+                 !(request.extent.fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC |
+                                              FIEMAP_EXTENT_DATA_INLINE));
+    if (found) *offset = request.extent.fe_physical;
+    close(fd);
+    return found;
+}
+
+#else
+
+bool input_source_disk_offset(const char* path, uint64_t* offset) {
+    (void)path;
+    (void)offset;
+    return false;
+}
+
+#endif
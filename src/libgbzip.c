@@ -0,0 +1,260 @@
+#include "libgbzip.h"
+#include "engine.h"
+#include "gbzip.h"
+#include "gbzip_zip.h"
+#include "diff.h"
+#include "zipignore.h"
+#include "codec.h"
+#include "logging.h"
+#include "resources.h"
+
+#ifndef _WIN32
+    #include <pthread.h>
+#endif
+
+// Operations of one engine run one at a time: a run with other settings
+// needs the pool to itself. Other engines' operations run alongside, each
+// logging to its own sink through log_config_use() and sizing itself by
+// resources_configure_thread(); metrics stay off in the library.
+#ifndef _WIN32
+typedef pthread_mutex_t engine_mutex_t;
+#else
+typedef SRWLOCK engine_mutex_t;
+#endif
+
+struct gbzip_engine {
+    gbzip_config_t config;
+    char* ignore_file;          // Owned copy of config.ignore_file
+    thread_pool_t* pool;        // Workers, their buffers and encoders, kept across operations
+    zipignore_t ignore_rules;   // ignore_file, or ~/.zipignore, parsed once
+    engine_mutex_t run_lock;    // Held for a whole operation
+    engine_mutex_t event_lock;  // One on_event call at a time
+};
+
+static void engine_mutex_init(engine_mutex_t* mutex) {
+#ifndef _WIN32
+    pthread_mutex_init(mutex, NULL);
+#else
+    InitializeSRWLock(mutex);
+#endif
+}
+
+static void engine_mutex_destroy(engine_mutex_t* mutex) {
+#ifndef _WIN32
+    pthread_mutex_destroy(mutex);
+#else
+    (void)mutex;
+#endif
+}
+
+static void engine_lock(engine_mutex_t* mutex) {
+#ifndef _WIN32
+    pthread_mutex_lock(mutex);
+#else
+    AcquireSRWLockExclusive(mutex);
+#endif
+}
+
+static void engine_unlock(engine_mutex_t* mutex) {
+#ifndef _WIN32
+    pthread_mutex_unlock(mutex);
+#else
+    ReleaseSRWLockExclusive(mutex);
+#endif
+}
+
+static gbzip_event_type_t event_type(const log_record_t* record) {
+    switch (record->event) {
+        case EVENT_FILE_ADD:    return GBZIP_EVENT_FILE;
+        case EVENT_FILE_IGNORE: return GBZIP_EVENT_IGNORED;
+        case EVENT_PROGRESS:    return GBZIP_EVENT_PROGRESS;
+        case EVENT_COMPLETE:    return GBZIP_EVENT_COMPLETE;
+        case EVENT_ERROR:       return GBZIP_EVENT_ERROR;
+        case EVENT_WARNING:     return GBZIP_EVENT_WARNING;
+        default:
+            if (record->level >= LOG_ERROR && record->level != LOG_SUCCESS) return GBZIP_EVENT_ERROR;
+            return record->level == LOG_WARNING ? GBZIP_EVENT_WARNING : GBZIP_EVENT_INFO;
+    }
+}
+
+// Log sink of a running operation: the engine's callback
+static void forward_event(const log_record_t* record, void* user_data) {
+    gbzip_engine_t* engine = user_data;
+    if (!engine->config.on_event) return;
+
+    gbzip_event_t event = {
+        .type = event_type(record),
+        .path = record->path,
+        .bytes = record->bytes,
+        .files_done = record->files_done,
+        .files_total = record->files_total,
+        .percent = record->percent
+    };
+    // File and progress records carry a label rather than a message
+    if (event.type != GBZIP_EVENT_FILE && event.type != GBZIP_EVENT_IGNORED && event.type != GBZIP_EVENT_PROGRESS) {
+        event.message = record->message;
+    }
+    engine_lock(&engine->event_lock);
+    engine->config.on_event(&event, engine->config.user_data);
+    engine_unlock(&engine->event_lock);
+}
+
+gbzip_engine_t* gbzip_engine_new(const gbzip_config_t* config) {
+    gbzip_engine_t* engine = calloc(1, sizeof(gbzip_engine_t));
+    if (!engine) return NULL;
+    if (config) engine->config = *config;
+
+    if (engine->config.ignore_file) {
+        engine->ignore_file = strdup(engine->config.ignore_file);
+        if (!engine->ignore_file) {
+            free(engine);
+            return NULL;
+        }
+        engine->config.ignore_file = engine->ignore_file;
+    }
+
+    engine_mutex_init(&engine->run_lock);
+    engine_mutex_init(&engine->event_lock);
+
+    // Thread detection follows the engine's overrides
+    resources_configure_thread(engine->config.threads, engine->config.memory_limit);
+    engine->pool = zip_pool_create(resources_cpu_count());
+    resources_release_thread();
+
+    if (!engine->pool || parse_zipignore_rules(&engine->ignore_rules, engine->ignore_file) != EXIT_SUCCESS) {
+        gbzip_engine_free(engine);
+        return NULL;
+    }
+    return engine;
+}
+
+void gbzip_engine_free(gbzip_engine_t* engine) {
+    if (!engine) return;
+    zip_pool_destroy(engine->pool);
+    free_zipignore(&engine->ignore_rules);
+    free(engine->ignore_file);
+    engine_mutex_destroy(&engine->run_lock);
+    engine_mutex_destroy(&engine->event_lock);
+    free(engine);
+}
+
+// Options of a CLI run without console output
+static void engine_options(const gbzip_engine_t* engine, options_t* opts, operation_t operation,
+                           const char* archive) {
+    memset(opts, 0, sizeof(*opts));
+    opts->operation = operation;
+    opts->zip_file = (char*)archive;
+    opts->zipignore_file = engine->ignore_file;
+    opts->recursive = true;
+    opts->quiet = true;
+    opts->compression_level = 6;
+    opts->buffer_size = engine->config.buffer_size;
+    opts->num_threads = engine->config.threads;
+    opts->memory_limit = engine->config.memory_limit;
+}
+
+static int apply_options(options_t* opts, const gbzip_options_t* options) {
+    if (!options) return EXIT_SUCCESS;
+
+    if (options->level == GBZIP_LEVEL_STORE) {
+        opts->store_only = true;
+        opts->compression_level = 0;
+    } else if (options->level >= 1 && options->level <= 9) {
+        opts->compression_level = options->level;
+    } else if (options->level != 0) {
+        return EXIT_INVALID_ARGS;
+    }
+
+    opts->codec = (codec_id_t)options->codec;
+    if (!codec_available(opts->codec)) return EXIT_INVALID_ARGS;
+
+    opts->junk_paths = options->junk_paths;
+    opts->recursive = !options->no_recursion;
+    opts->always_deflate = options->always_deflate;
+    opts->compact = options->compact;
+    if (options->target_mbps < 0 || options->deadline < 0 ||
+        (options->target_mbps > 0 && options->deadline > 0)) {
+        return EXIT_INVALID_ARGS;
+    }
+    opts->target_mbps = options->target_mbps;
+    opts->deadline = options->deadline;
+    return EXIT_SUCCESS;
+}
+
+gbzip_engine_t* engine_new_for_options(const options_t* opts) {
+    gbzip_config_t config = {
+        .threads = opts->num_threads,
+        .memory_limit = opts->memory_limit,
+        .buffer_size = opts->buffer_size,
+        .ignore_file = opts->zipignore_file
+    };
+    return gbzip_engine_new(&config);
+}
+
+// Run one operation on the engine's pool and rules, with its logging and
+// resource settings in effect on this thread and the threads working for it
+int engine_run(gbzip_engine_t* engine, engine_operation_t operation, options_t* opts, bool console) {
+    opts->pool = engine->pool;
+    opts->ignore_rules = &engine->ignore_rules;
+
+    engine_lock(&engine->run_lock);
+
+    log_config_t log_config = {0};
+    if (!console) {
+        log_config.quiet = 1;
+        log_config.output_stream = stdout;
+        log_config.sink = forward_event;
+        log_config.sink_data = engine;
+        log_config_use(&log_config);
+    }
+    resources_configure_thread(engine->config.threads, engine->config.memory_limit);
+
+    int result = operation(opts);
+
+    resources_release_thread();
+    log_config_use(NULL);
+    engine_unlock(&engine->run_lock);
+    return result;
+}
+
+int gbzip_create(gbzip_engine_t* engine, const char* archive, const char* const* inputs, int count,
+                 const gbzip_options_t* options) {
+    if (!engine || !archive || count < 0 || (count > 0 && !inputs)) return EXIT_INVALID_ARGS;
+
+    options_t opts;
+    engine_options(engine, &opts, OP_CREATE, archive);
+    if (apply_options(&opts, options) != EXIT_SUCCESS) return EXIT_INVALID_ARGS;
+
+    if (count > 0) {
+        opts.input_files = (char**)inputs;
+        opts.input_file_count = count;
+    } else {
+        opts.target_dir = ".";
+    }
+    return engine_run(engine, create_zip, &opts, false);
+}
+
+int gbzip_extract(gbzip_engine_t* engine, const char* archive, const char* directory,
+                  const char* const* names, int count) {
+    if (!engine || !archive || !directory || count < 0 || (count > 0 && !names)) return EXIT_INVALID_ARGS;
+
+    options_t opts;
+    engine_options(engine, &opts, OP_EXTRACT, archive);
+    opts.target_dir = (char*)directory;
+    opts.input_files = (char**)names;
+    opts.input_file_count = count;
+    return engine_run(engine, extract_zip, &opts, false);
+}
+
+int gbzip_diff(gbzip_engine_t* engine, const char* archive, const char* directory,
+               const gbzip_options_t* options) {
+    if (!engine || !archive || !directory) return EXIT_INVALID_ARGS;
+
+    options_t opts;
+    engine_options(engine, &opts, OP_CREATE, archive);
+    if (apply_options(&opts, options) != EXIT_SUCCESS) return EXIT_INVALID_ARGS;
+
+    opts.diff_mode = true;
+    opts.target_dir = (char*)directory;
+    return engine_run(engine, diff_zip, &opts, false);
+}
@@ -1,4 +1,5 @@
 #include "logging.h"
+#include "metrics.h"
 #include <stdarg.h>
 #include <string.h>
 #include <time.h>
@@ -8,9 +9,21 @@ log_config_t g_log_config = {
     .verbose = 0,
     .quiet = 0,
     .structured = 0,
-    .output_stream = NULL
+    .output_stream = NULL,
+    .sink = NULL,
+    .sink_data = NULL
 };
 
+static THREAD_LOCAL log_config_t* t_log_config;
+
+log_config_t* log_config_current(void) {
+    return t_log_config ? t_log_config : &g_log_config;
+}
+
+void log_config_use(log_config_t* config) {
+    t_log_config = config;
+}
+
 void init_logging(log_config_t* config) {
     if (config) {
         memcpy(&g_log_config, config, sizeof(log_config_t));
@@ -43,43 +56,75 @@ const char* format_timestamp(void) {
     return timestamp;
 }
 
+// Hand a record to the sink, formatting its message if there is one
+static void emit_record(log_record_t* record, const char* format, va_list args) {
+    const log_config_t* config = log_config_current();
+    char message[1024];
+    if (format) {
+        vsnprintf(message, sizeof(message), format, args);
+        size_t len = strlen(message);
+        while (len > 0 && message[len - 1] == '\n') message[--len] = '\0';
+        record->message = message;
+    }
+    config->sink(record, config->sink_data);
+}
+
 void log_event(event_type_t event, log_level_t level, const char* format, ...) {
-    if (g_log_config.quiet && level < LOG_WARNING) {
+    const log_config_t* config = log_config_current();
+    if (config->sink) {
+        log_record_t record = { .event = event, .level = level };
+        va_list args;
+        va_start(args, format);
+        emit_record(&record, format, args);
+        va_end(args);
+        return;
+    }
+    if (config->quiet && level < LOG_WARNING) {
         return;
     }
     
     va_list args;
     va_start(args, format);
     
-    if (g_log_config.structured) {
+    if (config->structured) {
         // JSON-like structured output for UI parsing
-        fprintf(g_log_config.output_stream, "{\"timestamp\":\"%s\",\"event\":\"%s\",\"level\":\"%s\",\"message\":\"",
+        fprintf(config->output_stream, "{\"timestamp\":\"%s\",\"event\":\"%s\",\"level\":\"%s\",\"message\":\"",
                 format_timestamp(), get_event_name(event), get_level_name(level));
-        vfprintf(g_log_config.output_stream, format, args);
-        fprintf(g_log_config.output_stream, "\"}\n");
+        vfprintf(config->output_stream, format, args);
+        fprintf(config->output_stream, "\"}\n");
     } else {
-        if (g_log_config.verbose) {
-            fprintf(g_log_config.output_stream, "[%s] %s: ", get_level_name(level), get_event_name(event));
+        if (config->verbose) {
+            fprintf(config->output_stream, "[%s] %s: ", get_level_name(level), get_event_name(event));
         }
-        vfprintf(g_log_config.output_stream, format, args);
-        if (!g_log_config.structured) {
-            fprintf(g_log_config.output_stream, "\n");
+        vfprintf(config->output_stream, format, args);
+        if (!config->structured) {
+            fprintf(config->output_stream, "\n");
         }
     }
     
     va_end(args);
-    fflush(g_log_config.output_stream);
+    fflush(config->output_stream);
 }
 
 void log_progress(const progress_t* progress, const char* phase, double percent, double speed, const char* speed_units) {
-    if (g_log_config.quiet) {
+    const log_config_t* config = log_config_current();
+    if (config->sink) {
+        log_record_t record = {
+            .event = EVENT_PROGRESS, .level = LOG_PROGRESS, .message = phase,
+            .bytes = progress->processed_bytes, .files_done = progress->processed_files,
+            .files_total = progress->total_files, .percent = percent
+        };
+        config->sink(&record, config->sink_data);
+        return;
+    }
+    if (config->quiet) {
         return;
     }
     
     time_t elapsed = time(NULL) - progress->start_time;
     
-    if (g_log_config.structured) {
-        fprintf(g_log_config.output_stream, 
+    if (config->structured) {
+        fprintf(config->output_stream, 
                 "{\"timestamp\":\"%s\",\"event\":\"PROGRESS\",\"level\":\"INFO\","
                 "\"phase\":\"%s\",\"percent\":%.1f,\"files_processed\":%zu,\"total_files\":%zu,"
                 "\"bytes_processed\":%zu,\"speed\":%.1f,\"speed_units\":\"%s\",\"elapsed\":%ld}\n",
@@ -92,42 +137,78 @@ void log_progress(const progress_t* progress, const char* phase, double percent,
             char animation = spinner[step % 4];
             step++;
             
-            fprintf(g_log_config.output_stream, "\rCompressing and writing archive %c (%.1f%%) - %.1f %s - %lds elapsed", 
+            fprintf(config->output_stream, "\rCompressing and writing archive %c (%.1f%%) - %.1f %s - %lds elapsed", 
                    animation, percent, speed, speed_units, elapsed);
         } else {
             // File adding phase
-            fprintf(g_log_config.output_stream, "\r%s: %zu/%zu files (%.1f%%) - %.1f %s", 
+            fprintf(config->output_stream, "\r%s: %zu/%zu files (%.1f%%) - %.1f %s", 
                    phase, progress->processed_files, progress->total_files, percent, speed, speed_units);
         }
     }
     
-    fflush(g_log_config.output_stream);
+    fflush(config->output_stream);
 }
 
 void log_file_operation(const char* operation, const char* file_path, size_t file_size) {
-    if (g_log_config.quiet && !g_log_config.verbose) {
+    const log_config_t* config = log_config_current();
+    if (config->sink) {
+        bool ignored = strcmp(operation, "Ignored") == 0;
+        log_record_t record = {
+            .event = ignored ? EVENT_FILE_IGNORE : EVENT_FILE_ADD, .level = LOG_DEBUG,
+            .message = operation, .path = file_path, .bytes = file_size
+        };
+        config->sink(&record, config->sink_data);
+        return;
+    }
+    if (config->quiet && !config->verbose) {
         return;
     }
     
-    if (g_log_config.structured) {
-        fprintf(g_log_config.output_stream,
+    if (config->structured) {
+        fprintf(config->output_stream,
                 "{\"timestamp\":\"%s\",\"event\":\"FILE_OPERATION\",\"level\":\"DEBUG\","
                 "\"operation\":\"%s\",\"file_path\":\"%s\",\"file_size\":%zu}\n",
                 format_timestamp(), operation, file_path, file_size);
-    } else if (g_log_config.verbose) {
+    } else if (config->verbose) {
         if (file_size > 10 * 1024 * 1024) { // Show size for files > 10MB
             double size_mb = file_size / (1024.0 * 1024.0);
-            fprintf(g_log_config.output_stream, "%s: %s (%.1f MB)\n", operation, file_path, size_mb);
+            fprintf(config->output_stream, "%s: %s (%.1f MB)\n", operation, file_path, size_mb);
         } else {
-            fprintf(g_log_config.output_stream, "%s: %s\n", operation, file_path);
+            fprintf(config->output_stream, "%s: %s\n", operation, file_path);
         }
     }
     
-    fflush(g_log_config.output_stream);
+    fflush(config->output_stream);
+}
+
+void log_file_compression(const char* file_path, uint64_t file_size, uint64_t compressed_size,
+                          const char* method, const char* reason) {
+    const log_config_t* config = log_config_current();
+    // Only structured output reports how each entry was encoded
+    if (!config->structured || (config->quiet && !config->verbose)) {
+        return;
+    }
+    
+    fprintf(config->output_stream,
+            "{\"timestamp\":\"%s\",\"event\":\"COMPRESSION\",\"level\":\"DEBUG\","
+            "\"file_path\":\"%s\",\"method\":\"%s\",\"reason\":\"%s\","
+            "\"file_size\":%llu,\"compressed_size\":%llu}\n",
+            format_timestamp(), file_path, method, reason,
+            (unsigned long long)file_size, (unsigned long long)compressed_size);
+    fflush(config->output_stream);
 }
 
 void log_archive_info(const char* archive_path, size_t total_files, size_t total_bytes, double elapsed_time) {
-    if (g_log_config.quiet) {
+    const log_config_t* config = log_config_current();
+    if (config->sink) {
+        log_record_t record = {
+            .event = EVENT_COMPLETE, .level = LOG_SUCCESS, .path = archive_path,
+            .bytes = total_bytes, .files_done = total_files, .files_total = total_files, .percent = 100.0
+        };
+        config->sink(&record, config->sink_data);
+        return;
+    }
+    if (config->quiet) {
         return;
     }
     
@@ -143,26 +224,87 @@ void log_archive_info(const char* archive_path, size_t total_files, size_t total
         }
     }
     
-    if (g_log_config.structured) {
-        fprintf(g_log_config.output_stream,
+    if (config->structured) {
+        fprintf(config->output_stream,
                 "{\"timestamp\":\"%s\",\"event\":\"COMPLETE\",\"level\":\"SUCCESS\","
                 "\"archive_path\":\"%s\",\"total_files\":%zu,\"total_bytes\":%zu,"
-                "\"elapsed_time\":%.1f,\"average_speed\":%.1f,\"speed_units\":\"%s\"}\n",
+                "\"elapsed_time\":%.1f,\"average_speed\":%.1f,\"speed_units\":\"%s\"",
                 format_timestamp(), archive_path, total_files, total_bytes,
                 elapsed_time, speed, speed_units);
+        if (g_metrics_enabled) {
+            fprintf(config->output_stream, ",\"metrics\":");
+            metrics_write_json(config->output_stream);
+        }
+        fprintf(config->output_stream, "}\n");
     } else {
-        fprintf(g_log_config.output_stream, "ZIP archive created successfully\n");
-        fprintf(g_log_config.output_stream, "Files processed: %zu\n", total_files);
-        fprintf(g_log_config.output_stream, "Total size: %zu bytes\n", total_bytes);
-        fprintf(g_log_config.output_stream, "Average speed: %.1f %s\n", speed, speed_units);
-        fprintf(g_log_config.output_stream, "Total time: %.0f seconds\n", elapsed_time);
+        fprintf(config->output_stream, "ZIP archive created successfully\n");
+        fprintf(config->output_stream, "Files processed: %zu\n", total_files);
+        fprintf(config->output_stream, "Total size: %zu bytes\n", total_bytes);
+        fprintf(config->output_stream, "Average speed: %.1f %s\n", speed, speed_units);
+        fprintf(config->output_stream, "Total time: %.0f seconds\n", elapsed_time);
     }
     
-    fflush(g_log_config.output_stream);
+    fflush(config->output_stream);
+}
+
+void log_archive_result(size_t job, const char* archive_path, int status, const archive_stats_t* stats,
+                        double elapsed_time) {
+    const log_config_t* config = log_config_current();
+    bool ok = status == EXIT_SUCCESS;
+    if (config->sink) {
+        log_record_t record = {
+            .event = ok ? EVENT_COMPLETE : EVENT_ERROR, .level = ok ? LOG_SUCCESS : LOG_ERROR,
+            .message = ok ? NULL : "archive failed", .path = archive_path, .bytes = stats->bytes,
+            .files_done = stats->files, .files_total = stats->files, .percent = ok ? 100.0 : 0.0
+        };
+        config->sink(&record, config->sink_data);
+        return;
+    }
+
+    if (config->structured) {
+        // Failures go out on stdout too, so the per-archive lines stay together
+        fprintf(config->output_stream,
+                "{\"timestamp\":\"%s\",\"event\":\"%s\",\"level\":\"%s\","
+                "\"job\":%zu,\"archive_path\":\"%s\",\"status\":%d,\"total_files\":%zu,"
+                "\"total_bytes\":%llu,\"archive_bytes\":%llu,\"elapsed_time\":%.1f}\n",
+                format_timestamp(), ok ? "COMPLETE" : "ERROR", ok ? "SUCCESS" : "ERROR",
+                job, archive_path, status, stats->files, (unsigned long long)stats->bytes,
+                (unsigned long long)stats->archive_bytes, elapsed_time);
+        fflush(config->output_stream);
+    } else if (!ok) {
+        fprintf(stderr, "Error: Failed to create '%s' (status %d)\n", archive_path, status);
+        fflush(stderr);
+    } else {
+        fprintf(config->output_stream, "Created '%s': %zu files, %llu bytes in %.1f seconds\n",
+                archive_path, stats->files, (unsigned long long)stats->archive_bytes, elapsed_time);
+        fflush(config->output_stream);
+    }
+}
+
+void log_run_metrics(const char* operation) {
+    const log_config_t* config = log_config_current();
+    if (!config->structured || config->quiet || !g_metrics_enabled) {
+        return;
+    }
+    
+    fprintf(config->output_stream,
+            "{\"timestamp\":\"%s\",\"event\":\"COMPLETE\",\"level\":\"INFO\","
+            "\"operation\":\"%s\",\"metrics\":",
+            format_timestamp(), operation);
+    metrics_write_json(config->output_stream);
+    fprintf(config->output_stream, "}\n");
+    fflush(config->output_stream);
 }
 
 void log_error(const char* context, const char* error_message) {
-    if (g_log_config.structured) {
+    const log_config_t* config = log_config_current();
+    if (config->sink) {
+        log_record_t record = { .event = EVENT_ERROR, .level = LOG_ERROR, .message = error_message,
+                                .path = context };
+        config->sink(&record, config->sink_data);
+        return;
+    }
+    if (config->structured) {
         fprintf(stderr,
                 "{\"timestamp\":\"%s\",\"event\":\"ERROR\",\"level\":\"ERROR\","
                 "\"context\":\"%s\",\"message\":\"%s\"}\n",
@@ -174,17 +316,31 @@ void log_error(const char* context, const char* error_message) {
     fflush(stderr);
 }
 
+void log_message(log_level_t level, const char* format, ...) {
+    const log_config_t* config = log_config_current();
+    va_list args;
+    va_start(args, format);
+    if (config->sink) {
+        log_record_t record = { .event = level >= LOG_ERROR ? EVENT_ERROR : EVENT_WARNING, .level = level };
+        emit_record(&record, format, args);
+    } else {
+        vfprintf(stderr, format, args);
+    }
+    va_end(args);
+}
+
 void log_traditional(log_level_t level, const char* format, ...) {
-    if (g_log_config.quiet && level < LOG_WARNING) {
+    const log_config_t* config = log_config_current();
+    if (config->quiet && level < LOG_WARNING) {
         return;
     }
     
     va_list args;
     va_start(args, format);
     
-    FILE* stream = (level >= LOG_WARNING) ? stderr : g_log_config.output_stream;
+    FILE* stream = (level >= LOG_WARNING) ? stderr : config->output_stream;
     
-    if (g_log_config.verbose && !g_log_config.structured) {
+    if (config->verbose && !config->structured) {
         fprintf(stream, "[%s] ", get_level_name(level));
     }
     
@@ -4,6 +4,12 @@
 #include "diff.h"
 #include "utils.h"
 #include "logging.h"
+#include "archive_writer.h"
+#include "codec.h"
+#include "resources.h"
+#include "metrics.h"
+#include "batch.h"
+#include "engine.h"
 
 void print_usage(const char* program_name) {
     printf("gbzip - ZIP utility with gitignore-style patterns\n");
@@ -13,13 +19,33 @@ void print_usage(const char* program_name) {
     printf("  -r   recurse into directories (default)     -j   junk (don't record) directory names\n");
     printf("  -0   store only (no compression)            -9   compress better\n");
     printf("  -q   quiet operation (no TUI)               -u   update: only changed or new files\n");
-    printf("  -f   force overwrite existing files\n");
+    printf("  -f   force overwrite existing files         -t   test archive integrity (CRC-32, all cores)\n");
     printf("  -s   structured output (JSON-like for UI)   -x   extract files from zipfile\n");
     printf("  -l   list files in zipfile                  -T   timestamp archive to latest\n");
     printf("  -d <dir>  extract files into directory     -m   move into zipfile (delete OS files)\n");
     printf("  -i   include only files matching patterns   -@   read names from stdin\n");
     printf("  -I <file>  use custom zipignore file        -Z   create default .zipignore file\n");
     printf("  -D   differential update (timestamp based)  -h   show this help message\n");
+    printf("      --buffer-size <size>  read/compress buffer size per block, e.g. 4M (default 1M)\n");
+    printf("      --threads <n>  worker threads (default: CPUs allowed by affinity and cgroup quota)\n");
+    printf("      --memory-limit <size>  cap memory use, e.g. 512M (default: host or cgroup limit)\n");
+    printf("      --target-mbps <n>  pick the level per file and block to compress n MB/s of input\n");
+    printf("      --deadline <time>  same, to finish within time, e.g. 900, 15m or 2h; the level\n");
+    printf("                      given (default 6) is the highest, store the lowest\n");
+    printf("      --sort <order>  entry order: name (default), inode, or disk (data order on disk,\n");
+    printf("                      for seek-bound disks and network filesystems)\n");
+    printf("      --metrics <file>  write run metrics as a Prometheus textfile (-s reports them too)\n");
+    printf("      --trace <file>    write a Chrome trace of the run (chrome://tracing, Perfetto)\n");
+    printf("      --stdout   write the archive to stdout (same as zipfile -), for pipes\n");
+    printf("      --batch <manifest>  create every archive listed in manifest, one JSON object\n");
+    printf("                      per line: {\"archive\": \"a.zip\", \"inputs\": [\"dir\", ...]}\n");
+    printf("      --always-deflate  deflate every file, even already-compressed formats\n");
+    printf("      --codec <name>  compression backend: zlib (default), libdeflate, or zstd\n");
+    printf("                      (ZIP method 93, needs a zstd-aware unzip); built: %s\n",
+           codec_available_names());
+    printf("      --compact  with -D/-u, rewrite the archive once %d%%+ of it is dead space\n",
+           ARCHIVE_COMPACT_THRESHOLD_PERCENT);
+    printf("      --cache    with -D/-u, keep file fingerprints in <zipfile>%s\n", FINGERPRINT_CACHE_SUFFIX);
     printf("      --version  show version information\n\n");
     printf("Examples:\n");
     printf("  %s archive.zip *.c src/         Create archive from C files and src directory\n", program_name);
@@ -27,8 +53,14 @@ void print_usage(const char* program_name) {
     printf("  %s -x archive.zip               Extract archive to current directory\n", program_name);
     printf("  %s -x -d mydir archive.zip      Extract archive to mydir directory\n", program_name);
     printf("  %s -x archive.zip mydir         Alternative: extract to mydir directory\n", program_name);
+    printf("  %s -x -d out a.zip etc/app.conf '*.md'  Extract only the named entries\n", program_name);
     printf("  %s -l archive.zip               List contents of archive\n", program_name);
+    printf("  %s -l archive.zip 'src/**/*.c'  List only the matching entries\n", program_name);
+    printf("  %s -t archive.zip               Verify every entry of archive\n", program_name);
     printf("  %s -D archive.zip project/      Update archive with changes in project\n", program_name);
+    printf("  %s - project/ | ssh host ...   Stream archive of project to stdout\n", program_name);
+    printf("  ls *.c | %s -@ c.zip            Add the files named on stdin\n", program_name);
+    printf("  %s -s --batch jobs.jsonl        Create many archives on one scheduler\n", program_name);
     printf("  %s -Z                           Create default .zipignore file\n", program_name);
     printf("\nSecurity Notes:\n");
     printf("  - Only extract archives from trusted sources\n");
@@ -59,6 +91,10 @@ int parse_arguments(int argc, char* argv[], options_t* opts) {
     while (arg_index < argc && argv[arg_index][0] == '-') {
         const char* arg = argv[arg_index];
         
+        // A lone "-" is the zipfile: the archive goes to stdout
+        if (strcmp(arg, "-") == 0) {
+            break;
+        }
 
         if (strcmp(arg, "--version") == 0) {
             opts->operation = OP_VERSION;
@@ -66,6 +102,115 @@ int parse_arguments(int argc, char* argv[], options_t* opts) {
         } else if (strcmp(arg, "--help") == 0) {
             opts->operation = OP_HELP;
             return EXIT_SUCCESS;
+        } else if (strcmp(arg, "--buffer-size") == 0) {
+            uint64_t size = 0;
+            if (++arg_index >= argc || !parse_size(argv[arg_index], &size) || size == 0 || size > SIZE_MAX) {
+                fprintf(stderr, "Error: --buffer-size requires a size such as 256K or 4M\n");
+                return EXIT_INVALID_ARGS;
+            }
+            opts->buffer_size = (size_t)size;
+            arg_index++;
+            continue;
+        } else if (strcmp(arg, "--threads") == 0) {
+            char* end = NULL;
+            long threads = ++arg_index < argc ? strtol(argv[arg_index], &end, 10) : 0;
+            if (!end || *end != '\0' || threads < 1 || threads > 256) {
+                fprintf(stderr, "Error: --threads requires a count from 1 to 256\n");
+                return EXIT_INVALID_ARGS;
+            }
+            opts->num_threads = (int)threads;
+            arg_index++;
+            continue;
+        } else if (strcmp(arg, "--sort") == 0) {
+            const char* order = ++arg_index < argc ? argv[arg_index] : "";
+            if (strcmp(order, "name") == 0) {
+                opts->sort_order = SORT_NAME;
+            } else if (strcmp(order, "inode") == 0) {
+                opts->sort_order = SORT_INODE;
+            } else if (strcmp(order, "disk") == 0) {
+                opts->sort_order = SORT_DISK;
+            } else {
+                fprintf(stderr, "Error: --sort requires one of name, inode, disk\n");
+                return EXIT_INVALID_ARGS;
+            }
+            arg_index++;
+            continue;
+        } else if (strcmp(arg, "--target-mbps") == 0) {
+            char* end = NULL;
+            double rate = ++arg_index < argc ? strtod(argv[arg_index], &end) : 0;
+            if (!end || *end != '\0' || !(rate > 0)) {
+                fprintf(stderr, "Error: --target-mbps requires a rate in MB/s such as 200\n");
+                return EXIT_INVALID_ARGS;
+            }
+            opts->target_mbps = rate;
+            arg_index++;
+            continue;
+        } else if (strcmp(arg, "--deadline") == 0) {
+            if (++arg_index >= argc || !parse_duration(argv[arg_index], &opts->deadline)) {
+                fprintf(stderr, "Error: --deadline requires a time such as 900, 15m or 2h\n");
+                return EXIT_INVALID_ARGS;
+            }
+            arg_index++;
+            continue;
+        } else if (strcmp(arg, "--memory-limit") == 0) {
+            uint64_t size = 0;
+            if (++arg_index >= argc || !parse_size(argv[arg_index], &size) || size == 0) {
+                fprintf(stderr, "Error: --memory-limit requires a size such as 512M or 2G\n");
+                return EXIT_INVALID_ARGS;
+            }
+            opts->memory_limit = size;
+            arg_index++;
+            continue;
+        } else if (strcmp(arg, "--metrics") == 0 || strcmp(arg, "--trace") == 0) {
+            if (++arg_index >= argc) {
+                fprintf(stderr, "Error: %s requires a file name\n", arg);
+                return EXIT_INVALID_ARGS;
+            }
+            if (arg[2] == 'm') {
+                opts->metrics_file = argv[arg_index];
+            } else {
+                opts->trace_file = argv[arg_index];
+            }
+            arg_index++;
+            continue;
+        } else if (strcmp(arg, "--batch") == 0 || strncmp(arg, "--batch=", 8) == 0) {
+            const char* manifest = arg[7] == '=' ? arg + 8 : (++arg_index < argc ? argv[arg_index] : NULL);
+            if (!manifest || !*manifest) {
+                fprintf(stderr, "Error: --batch requires a manifest file (- for stdin)\n");
+                return EXIT_INVALID_ARGS;
+            }
+            opts->batch_file = manifest;
+            arg_index++;
+            continue;
+        } else if (strcmp(arg, "--stdout") == 0) {
+            opts->to_stdout = true;
+            arg_index++;
+            continue;
+        } else if (strcmp(arg, "--compact") == 0) {
+            opts->compact = true;
+            arg_index++;
+            continue;
+        } else if (strcmp(arg, "--always-deflate") == 0) {
+            opts->always_deflate = true;
+            arg_index++;
+            continue;
+        } else if (strcmp(arg, "--cache") == 0) {
+            opts->use_cache = true;
+            arg_index++;
+            continue;
+        } else if (strcmp(arg, "--codec") == 0 || strncmp(arg, "--codec=", 8) == 0) {
+            const char* name = arg[7] == '=' ? arg + 8 : (++arg_index < argc ? argv[arg_index] : NULL);
+            if (!name || !codec_from_name(name, &opts->codec)) {
+                fprintf(stderr, "Error: --codec requires one of zlib, libdeflate, zstd\n");
+                return EXIT_INVALID_ARGS;
+            }
+            if (!codec_available(opts->codec)) {
+                fprintf(stderr, "Error: This build of gbzip has no %s codec (available: %s)\n",
+                        name, codec_available_names());
+                return EXIT_INVALID_ARGS;
+            }
+            arg_index++;
+            continue;
         }
         
 
@@ -150,13 +295,29 @@ int parse_arguments(int argc, char* argv[], options_t* opts) {
         arg_index++;
     }
     
+    if (opts->target_mbps > 0 && opts->deadline > 0) {
+        fprintf(stderr, "Error: Give either --target-mbps or --deadline, not both\n");
+        return EXIT_INVALID_ARGS;
+    }
+    
     // Handle special case for creating default zipignore
     if (opts->create_default_zipignore) {
         return EXIT_SUCCESS; // Will be handled in main()
     }
     
+    // The manifest names the archives and their inputs
+    if (opts->batch_file) {
+        if (arg_index < argc || opts->operation != OP_CREATE || opts->to_stdout || opts->update_mode ||
+            opts->diff_mode || opts->test_mode || opts->read_stdin || opts->move_mode) {
+            fprintf(stderr, "Error: --batch takes no zipfile or files, and only creates new archives "
+                            "(not with -x, -l, -u, -D, -t, -m, -@ or --stdout)\n");
+            return EXIT_INVALID_ARGS;
+        }
+        return EXIT_SUCCESS;
+    }
+    
     // Parse zipfile and input files (zip-style)
-    if (arg_index >= argc) {
+    if (arg_index >= argc && !opts->to_stdout) {
         if (opts->operation == OP_HELP) {
             return EXIT_SUCCESS;
         }
@@ -164,32 +325,55 @@ int parse_arguments(int argc, char* argv[], options_t* opts) {
         return EXIT_INVALID_ARGS;
     }
     
-    // First non-option argument is the zipfile
-    opts->zip_file = argv[arg_index++];
+    // First non-option argument is the zipfile, unless --stdout stands in for it
+    if (opts->to_stdout) {
+        opts->zip_file = "-";
+    } else {
+        opts->zip_file = argv[arg_index++];
+        opts->to_stdout = strcmp(opts->zip_file, "-") == 0;
+    }
     
-    // Remaining arguments are input files/directories
+    // A stream can only be written front to back, once
+    if (opts->to_stdout && (opts->operation != OP_CREATE || opts->update_mode || opts->diff_mode ||
+                            opts->test_mode)) {
+        fprintf(stderr, "Error: Writing to stdout only creates new archives (not with -x, -l, -u, -D or -t)\n");
+        return EXIT_INVALID_ARGS;
+    }
+    
+    // Remaining arguments are input files/directories (entry selectors for -x and -l)
     if (arg_index < argc) {
         opts->input_files = &argv[arg_index];
         opts->input_file_count = argc - arg_index;
     } else {
-        // No input files specified
-        if (opts->operation == OP_CREATE && !opts->diff_mode) {
+        // No input files specified (-@ lists them on stdin instead)
+        if (opts->operation == OP_CREATE && !opts->diff_mode && !opts->read_stdin) {
             opts->target_dir = "."; // Default to current directory
         }
     }
     
-    // Set target directory for extraction if not specified
+    // Set target directory for extraction if not specified. The names after
+    // it (after the zipfile with -d) select the entries to extract, as
+    // they select the entries to list with -l.
     if (opts->operation == OP_EXTRACT && !opts->target_dir) {
         // Check if there's a directory specified after the zip file
         if (opts->input_file_count > 0) {
             opts->target_dir = opts->input_files[0];
-            opts->input_files = NULL;
-            opts->input_file_count = 0;
+            opts->input_files++;
+            opts->input_file_count--;
         } else {
             opts->target_dir = ".";
         }
     }
     
+    // Update mode appends to the archive like differential mode when it is
+    // given a single directory (or none), it just keeps deleted files
+    if (opts->update_mode && !opts->diff_mode && opts->operation == OP_CREATE &&
+        opts->input_file_count == 1 && is_directory(opts->input_files[0])) {
+        opts->target_dir = opts->input_files[0];
+        opts->input_files = NULL;
+        opts->input_file_count = 0;
+    }
+    
     // Set target directory for differential mode if not specified
     if (opts->diff_mode && !opts->target_dir) {
         if (opts->input_file_count > 0) {
@@ -205,6 +389,93 @@ int parse_arguments(int argc, char* argv[], options_t* opts) {
     return EXIT_SUCCESS;
 }
 
+// Create, update and extract run on a libgbzip engine, the same way the
+// library's calls do
+static int run_on_engine(engine_operation_t operation, options_t* opts) {
+    gbzip_engine_t* engine = engine_new_for_options(opts);
+    if (!engine) {
+        fprintf(stderr, "Error: Could not set up the compression engine\n");
+        return EXIT_FAILURE;
+    }
+    int result = engine_run(engine, operation, opts, true);
+    gbzip_engine_free(engine);
+    return result;
+}
+
+// Run the requested operation. `reported` is set when the operation ended
+// with an archive summary, which carries the run metrics itself.
+static int run_operation(options_t* opts, const char* program_name, bool* reported) {
+    int result;
+    *reported = false;
+    
+    switch (opts->operation) {
+        case OP_HELP:
+            print_usage(program_name);
+            return EXIT_SUCCESS;
+            
+        case OP_VERSION:
+            print_version();
+            return EXIT_SUCCESS;
+            
+        case OP_CREATE:
+            // Each archive of a batch reports itself
+            if (opts->batch_file) {
+                return run_batch(opts);
+            }
+            // -t on its own tests an existing archive; with files it tests
+            // the archive once they have been added
+            if (opts->test_mode && opts->input_file_count == 0 && !opts->read_stdin && !opts->diff_mode &&
+                !opts->update_mode) {
+                return verify_zip(opts);
+            }
+            if (opts->diff_mode || (opts->update_mode && opts->target_dir)) {
+                result = run_on_engine(diff_zip, opts);
+            } else {
+                result = run_on_engine(create_zip, opts);
+                *reported = true;
+            }
+            if (result == EXIT_SUCCESS && opts->test_mode) {
+                result = verify_zip(opts);
+                *reported = false;
+            }
+            return result;
+            
+        case OP_EXTRACT:
+            return run_on_engine(extract_zip, opts);
+            
+        case OP_LIST:
+            return list_zip(opts);
+            
+        default:
+            fprintf(stderr, "Error: Invalid operation\n");
+            return EXIT_FAILURE;
+    }
+}
+
+// Label of the run in metrics reports
+static const char* operation_name(const options_t* opts) {
+    switch (opts->operation) {
+        case OP_EXTRACT:
+            return "extract";
+        case OP_LIST:
+            return "list";
+        case OP_CREATE:
+            if (opts->batch_file) {
+                return "batch";
+            }
+            if (opts->test_mode && opts->input_file_count == 0 && !opts->read_stdin && !opts->diff_mode &&
+                !opts->update_mode) {
+                return "verify";
+            }
+            if (opts->diff_mode || (opts->update_mode && opts->target_dir)) {
+                return "update";
+            }
+            return "create";
+        default:
+            return "other";
+    }
+}
+
 int main(int argc, char* argv[]) {
     options_t opts;
     int result = parse_arguments(argc, argv, &opts);
@@ -216,40 +487,41 @@ int main(int argc, char* argv[]) {
         return result;
     }
     
+    resources_configure(opts.num_threads, opts.memory_limit);
+    
     log_config_t log_config = {0};
     log_config.verbose = opts.verbose;
     log_config.quiet = opts.quiet;
     log_config.structured = opts.structured;
-    log_config.output_stream = stdout;
+    // Keep stdout for the archive when it is streamed there
+    log_config.output_stream = opts.to_stdout ? stderr : stdout;
     init_logging(&log_config);
     
     if (opts.create_default_zipignore) {
         return create_default_zipignore();
     }
     
-    switch (opts.operation) {
-        case OP_HELP:
-            print_usage(argv[0]);
-            return EXIT_SUCCESS;
-            
-        case OP_VERSION:
-            print_version();
-            return EXIT_SUCCESS;
-            
-        case OP_CREATE:
-            if (opts.diff_mode) {
-                return diff_zip(&opts);
-            }
-            return create_zip(&opts);
-            
-        case OP_EXTRACT:
-            return extract_zip(&opts);
-            
-        case OP_LIST:
-            return list_zip(&opts);
-            
-        default:
-            fprintf(stderr, "Error: Invalid operation\n");
-            return EXIT_FAILURE;
+    // Collected for -s, --metrics and --trace, and skipped otherwise
+    metrics_init(opts.structured || opts.metrics_file || opts.trace_file, opts.trace_file != NULL);
+    if (opts.target_mbps > 0 || opts.deadline > 0) {
+        metrics_set_pace(opts.target_mbps, opts.deadline);
     }
+    
+    bool reported;
+    result = run_operation(&opts, argv[0], &reported);
+    
+    const char* operation = operation_name(&opts);
+    if (!reported && opts.operation != OP_HELP && opts.operation != OP_VERSION) {
+        log_run_metrics(operation);
+    }
+    if (opts.metrics_file && metrics_write_prometheus(opts.metrics_file, operation) != EXIT_SUCCESS &&
+        result == EXIT_SUCCESS) {
+        result = EXIT_FILE_ERROR;
+    }
+    if (opts.trace_file && metrics_write_trace(opts.trace_file) != EXIT_SUCCESS && result == EXIT_SUCCESS) {
+        result = EXIT_FILE_ERROR;
+    }
+    metrics_shutdown();
+    
+    return result;
 }
\ No newline at end of file
@@ -0,0 +1,499 @@
+#include "metrics.h"
+#include "logging.h"
+#include <errno.h>
+
+#ifndef _WIN32
+    #include <pthread.h>
+    #include <time.h>
+#else
+    #include <windows.h>
+#endif
+
+static const char* const PHASE_NAMES[METRICS_PHASE_COUNT] = {
+    "scan", "compress", "finalize", "extract", "verify"
+};
+
+typedef struct {
+    const char* name;
+    uint64_t start;             // Nanoseconds since metrics_init()
+    uint64_t duration;
+} metrics_span_t;
+
+// One per thread, owned by the registry and kept after the thread exits
+typedef struct metrics_thread {
+    const char* role;
+    int index;
+    uint64_t counters[METRICS_COUNTER_COUNT];
+    uint64_t timers[METRICS_TIMER_COUNT];
+    uint64_t items;
+    uint64_t queue_samples;
+    uint64_t queue_depth_sum;
+    uint64_t queue_depth_max;
+    uint64_t level_input[METRICS_LEVEL_COUNT];
+    uint64_t level_output[METRICS_LEVEL_COUNT];
+    uint64_t pace_cpu;          // Nanoseconds compressing paced items
+    uint64_t pace_wait;         // Nanoseconds the same items spent waiting
+    metrics_span_t* spans;
+    size_t span_count;
+    size_t span_capacity;
+    uint64_t spans_dropped;
+    struct metrics_thread* next;
+} metrics_thread_t;
+
+bool g_metrics_enabled = false;
+
+static bool g_trace = false;
+static uint64_t g_origin;
+static uint64_t g_phase_start[METRICS_PHASE_COUNT];
+static uint64_t g_phase_time[METRICS_PHASE_COUNT];
+static bool g_phase_used[METRICS_PHASE_COUNT];
+static int g_phase_depth[METRICS_PHASE_COUNT];     // Runs inside each phase right now
+static metrics_thread_t* g_threads;        // Registration order, newest last
+static metrics_thread_t* g_threads_tail;
+static int g_unnamed_threads;
+static bool g_paced;
+static double g_pace_target_mbps;
+static double g_pace_deadline;
+
+#ifndef _WIN32
+static pthread_mutex_t g_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+#else
+static SRWLOCK g_registry_lock = SRWLOCK_INIT;
+#endif
+
+static THREAD_LOCAL metrics_thread_t* t_self;
+
+static uint64_t now_ns(void) {
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#else
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (!frequency.QuadPart) QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#endif
+}
+
+static void registry_lock(void) {
+#ifndef _WIN32
+    pthread_mutex_lock(&g_registry_mutex);
+#else
+    AcquireSRWLockExclusive(&g_registry_lock);
+#endif
+}
+
+static void registry_unlock(void) {
+#ifndef _WIN32
+    pthread_mutex_unlock(&g_registry_mutex);
+#else
+    ReleaseSRWLockExclusive(&g_registry_lock);
+#endif
+}
+
+// A new slot for the calling thread; NULL when out of memory, in which case
+// the thread simply goes uncounted
+static metrics_thread_t* register_thread(const char* role, int index) {
+    metrics_thread_t* slot = calloc(1, sizeof(metrics_thread_t));
+    if (!slot) return NULL;
+
+    registry_lock();
+    slot->role = role;
+    slot->index = index >= 0 ? index : g_unnamed_threads++;
+    if (g_threads_tail) g_threads_tail->next = slot;
+    else g_threads = slot;
+    g_threads_tail = slot;
+    registry_unlock();
+
+    t_self = slot;
+    return slot;
+}
+
+static metrics_thread_t* self(void) {
+    return t_self ? t_self : register_thread("thread", -1);
+}
+
+void metrics_init(bool enabled, bool trace) {
+    g_metrics_enabled = enabled;
+    g_trace = enabled && trace;
+    if (!enabled) return;
+
+    g_origin = now_ns();
+    register_thread("main", 0);
+}
+
+void metrics_shutdown(void) {
+    registry_lock();
+    metrics_thread_t* slot = g_threads;
+    g_threads = g_threads_tail = NULL;
+    registry_unlock();
+
+    while (slot) {
+        metrics_thread_t* next = slot->next;
+        free(slot->spans);
+        free(slot);
+        slot = next;
+    }
+    t_self = NULL;
+    g_metrics_enabled = false;
+    g_paced = false;
+}
+
+void metrics_thread_begin(const char* role, int index) {
+    if (!g_metrics_enabled) return;
+    register_thread(role, index);
+}
+
+void metrics_thread_end(void) {
+    t_self = NULL;
+}
+
+void metrics_count(metrics_counter_t counter, uint64_t amount) {
+    if (!g_metrics_enabled) return;
+    metrics_thread_t* slot = self();
+    if (slot) slot->counters[counter] += amount;
+}
+
+uint64_t metrics_start(void) {
+    return g_metrics_enabled ? now_ns() : 0;
+}
+
+static void record_span(metrics_thread_t* slot, const char* name, uint64_t start, uint64_t duration) {
+    if (slot->span_count == slot->span_capacity) {
+        if (slot->span_capacity >= METRICS_MAX_SPANS_PER_THREAD) {
+            slot->spans_dropped++;
+            return;
+        }
+        size_t capacity = slot->span_capacity ? slot->span_capacity * 2 : 256;
+        metrics_span_t* spans = realloc(slot->spans, capacity * sizeof(metrics_span_t));
+        if (!spans) {
+            slot->spans_dropped++;
+            return;
+        }
+        slot->spans = spans;
+        slot->span_capacity = capacity;
+    }
+    metrics_span_t* span = &slot->spans[slot->span_count++];
+    span->name = name;
+    span->start = start - g_origin;
+    span->duration = duration;
+}
+
+void metrics_stop(metrics_timer_t timer, uint64_t start, const char* span) {
+    if (!g_metrics_enabled || start == 0) return;
+    metrics_thread_t* slot = self();
+    if (!slot) return;
+
+    uint64_t duration = now_ns() - start;
+    slot->timers[timer] += duration;
+    if (timer == METRICS_TIMER_BUSY) slot->items++;
+    if (g_trace && span) record_span(slot, span, start, duration);
+}
+
+void metrics_sample_queue(size_t depth) {
+    if (!g_metrics_enabled) return;
+    metrics_thread_t* slot = self();
+    if (!slot) return;
+
+    slot->queue_samples++;
+    slot->queue_depth_sum += depth;
+    if (depth > slot->queue_depth_max) slot->queue_depth_max = depth;
+}
+
+void metrics_phase_begin(metrics_phase_t phase) {
+    if (!g_metrics_enabled) return;
+    registry_lock();
+    if (g_phase_depth[phase]++ == 0) g_phase_start[phase] = now_ns();
+    registry_unlock();
+}
+
+void metrics_phase_end(metrics_phase_t phase) {
+    if (!g_metrics_enabled) return;
+    registry_lock();
+    uint64_t start = 0;
+    uint64_t duration = 0;
+    if (g_phase_depth[phase] > 0 && --g_phase_depth[phase] == 0) {
+        start = g_phase_start[phase];
+        duration = now_ns() - start;
+        g_phase_time[phase] += duration;
+        g_phase_used[phase] = true;
+        g_phase_start[phase] = 0;
+    }
+    registry_unlock();
+    if (start == 0) return;
+
+    metrics_thread_t* slot = self();
+    if (g_trace && slot) record_span(slot, PHASE_NAMES[phase], start, duration);
+}
+
+void metrics_set_pace(double target_mbps, double deadline) {
+    if (!g_metrics_enabled) return;
+    g_paced = true;
+    g_pace_target_mbps = target_mbps;
+    g_pace_deadline = deadline;
+}
+
+void metrics_count_level(int level, uint64_t input, uint64_t output, uint64_t cpu_ns, uint64_t wait_ns) {
+    if (!g_metrics_enabled || level < 0 || level >= METRICS_LEVEL_COUNT) return;
+    metrics_thread_t* slot = self();
+    if (!slot) return;
+    slot->level_input[level] += input;
+    slot->level_output[level] += output;
+    slot->pace_cpu += cpu_ns;
+    slot->pace_wait += wait_ns;
+}
+
+// ============================================================================
+// Reports
+// ============================================================================
+
+static const char* const COUNTER_NAMES[METRICS_COUNTER_COUNT] = {
+    "bytes_read", "bytes_written", "open_calls", "stat_calls", "read_calls", "ignore_checks"
+};
+
+typedef struct {
+    uint64_t counters[METRICS_COUNTER_COUNT];
+    uint64_t timers[METRICS_TIMER_COUNT];
+    uint64_t queue_samples;
+    uint64_t queue_depth_sum;
+    uint64_t queue_depth_max;
+    uint64_t spans_dropped;
+    uint64_t level_input[METRICS_LEVEL_COUNT];
+    uint64_t level_output[METRICS_LEVEL_COUNT];
+    uint64_t paced_input;
+    uint64_t pace_cpu;
+    uint64_t pace_wait;
+} metrics_totals_t;
+
+static void sum_threads(metrics_totals_t* totals) {
+    memset(totals, 0, sizeof(*totals));
+    for (metrics_thread_t* slot = g_threads; slot; slot = slot->next) {
+        for (int i = 0; i < METRICS_COUNTER_COUNT; i++) totals->counters[i] += slot->counters[i];
+        for (int i = 0; i < METRICS_TIMER_COUNT; i++) totals->timers[i] += slot->timers[i];
+        totals->queue_samples += slot->queue_samples;
+        totals->queue_depth_sum += slot->queue_depth_sum;
+        if (slot->queue_depth_max > totals->queue_depth_max) totals->queue_depth_max = slot->queue_depth_max;
+        totals->spans_dropped += slot->spans_dropped;
+        for (int i = 0; i < METRICS_LEVEL_COUNT; i++) {
+            totals->level_input[i] += slot->level_input[i];
+            totals->level_output[i] += slot->level_output[i];
+            totals->paced_input += slot->level_input[i];
+        }
+        totals->pace_cpu += slot->pace_cpu;
+        totals->pace_wait += slot->pace_wait;
+    }
+}
+
+static double seconds(uint64_t ns) {
+    return (double)ns / 1e9;
+}
+
+// Paced input over the run's wall time, in MB/s
+static double pace_achieved_mbps(const metrics_totals_t* totals) {
+    double wall = seconds(now_ns() - g_origin);
+    return wall > 0 ? (double)totals->paced_input / wall / (1024.0 * 1024.0) : 0.0;
+}
+
+// The compressing threads mostly waited on input rather than computed
+static const char* pace_bound(const metrics_totals_t* totals) {
+    return totals->pace_wait > totals->pace_cpu ? "io" : "cpu";
+}
+
+void metrics_write_json(FILE* out) {
+    if (!g_metrics_enabled) {
+        fprintf(out, "{}");
+        return;
+    }
+
+    metrics_totals_t totals;
+    sum_threads(&totals);
+
+    fprintf(out, "{\"wall_s\":%.6f,\"phases\":{", seconds(now_ns() - g_origin));
+    bool first = true;
+    for (int i = 0; i < METRICS_PHASE_COUNT; i++) {
+        if (!g_phase_used[i]) continue;
+        fprintf(out, "%s\"%s\":%.6f", first ? "" : ",", PHASE_NAMES[i], seconds(g_phase_time[i]));
+        first = false;
+    }
+    fprintf(out, "}");
+
+    for (int i = 0; i < METRICS_COUNTER_COUNT; i++) {
+        fprintf(out, ",\"%s\":%llu", COUNTER_NAMES[i], (unsigned long long)totals.counters[i]);
+    }
+    fprintf(out, ",\"ignore_s\":%.6f,\"queue_depth_max\":%llu,\"queue_depth_mean\":%.2f,\"threads\":[",
+            seconds(totals.timers[METRICS_TIMER_IGNORE]), (unsigned long long)totals.queue_depth_max,
+            totals.queue_samples ? (double)totals.queue_depth_sum / (double)totals.queue_samples : 0.0);
+
+    for (metrics_thread_t* slot = g_threads; slot; slot = slot->next) {
+        fprintf(out, "%s{\"role\":\"%s\",\"index\":%d,\"busy_s\":%.6f,\"idle_s\":%.6f,\"items\":%llu,"
+                "\"bytes_read\":%llu}",
+                slot == g_threads ? "" : ",", slot->role, slot->index, seconds(slot->timers[METRICS_TIMER_BUSY]),
+                seconds(slot->timers[METRICS_TIMER_IDLE]), (unsigned long long)slot->items,
+                (unsigned long long)slot->counters[METRICS_BYTES_READ]);
+    }
+    fprintf(out, "]");
+
+    if (g_paced) {
+        fprintf(out, ",\"pace\":{\"target_mbps\":%.2f,\"deadline_s\":%.1f,\"achieved_mbps\":%.2f,"
+                "\"compress_cpu_s\":%.6f,\"input_wait_s\":%.6f,\"bound\":\"%s\",\"levels\":{",
+                g_pace_target_mbps, g_pace_deadline, pace_achieved_mbps(&totals), seconds(totals.pace_cpu),
+                seconds(totals.pace_wait), pace_bound(&totals));
+        first = true;
+        for (int i = 0; i < METRICS_LEVEL_COUNT; i++) {
+            if (totals.level_input[i] == 0) continue;
+            fprintf(out, "%s\"%d\":{\"bytes_in\":%llu,\"bytes_out\":%llu}", first ? "" : ",", i,
+                    (unsigned long long)totals.level_input[i], (unsigned long long)totals.level_output[i]);
+            first = false;
+        }
+        fprintf(out, "}}");
+    }
+    fprintf(out, "}");
+}
+
+static bool replace_file(const char* temp_path, const char* path) {
+#ifdef _WIN32
+    return MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(temp_path, path) == 0;
+#endif
+}
+
+int metrics_write_prometheus(const char* path, const char* operation) {
+    if (!g_metrics_enabled) return EXIT_SUCCESS;
+
+    // The textfile collector may read at any moment: never show a partial file
+    char temp_path[PATH_MAX];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int)sizeof(temp_path)) {
+        log_message(LOG_ERROR, "Error: Metrics path too long: %s\n", path);
+        return EXIT_INVALID_ARGS;
+    }
+    FILE* out = fopen(temp_path, "w");
+    if (!out) {
+        log_message(LOG_ERROR, "Error: Cannot write metrics '%s': %s\n", temp_path, strerror(errno));
+        return EXIT_FILE_ERROR;
+    }
+
+    metrics_totals_t totals;
+    sum_threads(&totals);
+
+    fprintf(out, "# HELP gbzip_run_seconds Wall time of the last run\n# TYPE gbzip_run_seconds gauge\n");
+    fprintf(out, "gbzip_run_seconds{operation=\"%s\"} %.6f\n", operation, seconds(now_ns() - g_origin));
+    fprintf(out, "# HELP gbzip_last_run_timestamp_seconds When the last run finished\n"
+                 "# TYPE gbzip_last_run_timestamp_seconds gauge\n");
+    fprintf(out, "gbzip_last_run_timestamp_seconds{operation=\"%s\"} %lld\n", operation, (long long)time(NULL));
+
+    fprintf(out, "# HELP gbzip_phase_seconds Wall time per phase\n# TYPE gbzip_phase_seconds gauge\n");
+    for (int i = 0; i < METRICS_PHASE_COUNT; i++) {
+        if (!g_phase_used[i]) continue;
+        fprintf(out, "gbzip_phase_seconds{operation=\"%s\",phase=\"%s\"} %.6f\n", operation, PHASE_NAMES[i],
+                seconds(g_phase_time[i]));
+    }
+
+    for (int i = 0; i < METRICS_COUNTER_COUNT; i++) {
+        fprintf(out, "# TYPE gbzip_%s gauge\ngbzip_%s{operation=\"%s\"} %llu\n", COUNTER_NAMES[i],
+                COUNTER_NAMES[i], operation, (unsigned long long)totals.counters[i]);
+    }
+    fprintf(out, "# HELP gbzip_ignore_seconds Time spent matching ignore patterns, summed over threads\n"
+                 "# TYPE gbzip_ignore_seconds gauge\n");
+    fprintf(out, "gbzip_ignore_seconds{operation=\"%s\"} %.6f\n", operation,
+            seconds(totals.timers[METRICS_TIMER_IGNORE]));
+    fprintf(out, "# TYPE gbzip_queue_depth_max gauge\ngbzip_queue_depth_max{operation=\"%s\"} %llu\n", operation,
+            (unsigned long long)totals.queue_depth_max);
+    fprintf(out, "# TYPE gbzip_queue_depth_mean gauge\ngbzip_queue_depth_mean{operation=\"%s\"} %.2f\n", operation,
+            totals.queue_samples ? (double)totals.queue_depth_sum / (double)totals.queue_samples : 0.0);
+
+    static const char* const THREAD_METRICS[] = { "busy", "idle" };
+    for (int t = 0; t < 2; t++) {
+        fprintf(out, "# HELP gbzip_thread_%s_seconds Time each thread spent %s\n"
+                     "# TYPE gbzip_thread_%s_seconds gauge\n",
+                THREAD_METRICS[t], t == 0 ? "working" : "waiting", THREAD_METRICS[t]);
+        for (metrics_thread_t* slot = g_threads; slot; slot = slot->next) {
+            fprintf(out, "gbzip_thread_%s_seconds{operation=\"%s\",role=\"%s\",thread=\"%d\"} %.6f\n",
+                    THREAD_METRICS[t], operation, slot->role, slot->index,
+                    seconds(slot->timers[t == 0 ? METRICS_TIMER_BUSY : METRICS_TIMER_IDLE]));
+        }
+    }
+    fprintf(out, "# TYPE gbzip_thread_items gauge\n");
+    for (metrics_thread_t* slot = g_threads; slot; slot = slot->next) {
+        fprintf(out, "gbzip_thread_items{operation=\"%s\",role=\"%s\",thread=\"%d\"} %llu\n", operation,
+                slot->role, slot->index, (unsigned long long)slot->items);
+    }
+
+    if (g_paced) {
+        fprintf(out, "# HELP gbzip_pace_target_mbps Input rate asked for with --target-mbps (0 with --deadline)\n"
+                     "# TYPE gbzip_pace_target_mbps gauge\n");
+        fprintf(out, "gbzip_pace_target_mbps{operation=\"%s\"} %.2f\n", operation, g_pace_target_mbps);
+        fprintf(out, "# HELP gbzip_pace_deadline_seconds --deadline (0 with --target-mbps)\n"
+                     "# TYPE gbzip_pace_deadline_seconds gauge\n");
+        fprintf(out, "gbzip_pace_deadline_seconds{operation=\"%s\"} %.1f\n", operation, g_pace_deadline);
+        fprintf(out, "# HELP gbzip_pace_achieved_mbps Input compressed per second of the run\n"
+                     "# TYPE gbzip_pace_achieved_mbps gauge\n");
+        fprintf(out, "gbzip_pace_achieved_mbps{operation=\"%s\"} %.2f\n", operation, pace_achieved_mbps(&totals));
+        fprintf(out, "# HELP gbzip_pace_io_bound Whether compressing threads mostly waited on input\n"
+                     "# TYPE gbzip_pace_io_bound gauge\n");
+        fprintf(out, "gbzip_pace_io_bound{operation=\"%s\"} %d\n", operation,
+                strcmp(pace_bound(&totals), "io") == 0);
+        fprintf(out, "# HELP gbzip_level_input_bytes Input bytes per compression level chosen (0 = stored)\n"
+                     "# TYPE gbzip_level_input_bytes gauge\n");
+        for (int i = 0; i < METRICS_LEVEL_COUNT; i++) {
+            if (totals.level_input[i] == 0) continue;
+            fprintf(out, "gbzip_level_input_bytes{operation=\"%s\",level=\"%d\"} %llu\n", operation, i,
+                    (unsigned long long)totals.level_input[i]);
+        }
+        fprintf(out, "# TYPE gbzip_level_output_bytes gauge\n");
+        for (int i = 0; i < METRICS_LEVEL_COUNT; i++) {
+            if (totals.level_input[i] == 0) continue;
+            fprintf(out, "gbzip_level_output_bytes{operation=\"%s\",level=\"%d\"} %llu\n", operation, i,
+                    (unsigned long long)totals.level_output[i]);
+        }
+    }
+
+    bool ok = !ferror(out);
+    if (fclose(out) != 0) ok = false;
+    if (ok && !replace_file(temp_path, path)) ok = false;
+    if (!ok) {
+        log_message(LOG_ERROR, "Error: Cannot write metrics '%s': %s\n", path, strerror(errno));
+        remove(temp_path);
+        return EXIT_FILE_ERROR;
+    }
+    return EXIT_SUCCESS;
+}
+
+int metrics_write_trace(const char* path) {
+    if (!g_metrics_enabled) return EXIT_SUCCESS;
+
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        log_message(LOG_ERROR, "Error: Cannot write trace '%s': %s\n", path, strerror(errno));
+        return EXIT_FILE_ERROR;
+    }
+
+    // Complete ("X") events in microseconds, one track per thread slot
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    int tid = 0;
+    bool first = true;
+    uint64_t dropped = 0;
+    for (metrics_thread_t* slot = g_threads; slot; slot = slot->next, tid++) {
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s %d\"}}", first ? "" : ",\n", tid, slot->role, slot->index);
+        first = false;
+        for (size_t i = 0; i < slot->span_count; i++) {
+            const metrics_span_t* span = &slot->spans[i];
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"gbzip\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                    "\"ts\":%.3f,\"dur\":%.3f}", span->name, tid, (double)span->start / 1000.0,
+                    (double)span->duration / 1000.0);
+        }
+        dropped += slot->spans_dropped;
+    }
+    fprintf(out, "\n],\"otherData\":{\"spans_dropped\":%llu}}\n", (unsigned long long)dropped);
+
+    bool ok = !ferror(out);
+    if (fclose(out) != 0) ok = false;
+    if (!ok) {
+        log_message(LOG_ERROR, "Error: Cannot write trace '%s': %s\n", path, strerror(errno));
+        return EXIT_FILE_ERROR;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+// copy_file_range() and fallocate() are GNU extensions
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+
+#include "output_file.h"
+
+#ifdef __linux__
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <sys/sendfile.h>
+#elif defined(__APPLE__)
+    #include <fcntl.h>
+#endif
+
+// Largest request per system call; both calls stop short of 2GB anyway
+#define COPY_CHUNK_SIZE (1024ULL * 1024 * 1024)
+
+// ============================================================================
+// Preallocation
+// ============================================================================
+
+void output_file_preallocate(FILE* file, uint64_t size) {
+    if (size < OUTPUT_PREALLOCATE_MIN_SIZE) return;
+
+#if defined(__linux__)
+    // Not posix_fallocate(): it sets the file size, and where the
+    // filesystem cannot allocate ahead glibc writes zeros instead
+    fallocate(fileno(file), FALLOC_FL_KEEP_SIZE, 0, (off_t)size);
+#elif defined(__APPLE__)
+    fstore_t store = { F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, (off_t)size, 0 };
+    if (fcntl(fileno(file), F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        fcntl(fileno(file), F_PREALLOCATE, &store);
+    }
+#elif defined(_WIN32)
+    // Allocation size only: SetFileValidData() would also move the end of
+    // the file, needs a privilege, and exposes whatever the disk held
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = (LONGLONG)size;
+    SetFileInformationByHandle((HANDLE)_get_osfhandle(_fileno(file)), FileAllocationInfo, &info, sizeof(info));
+#else
+    (void)file;
+#endif
+}
+
+// ============================================================================
+// In-kernel copies
+// ============================================================================
+
+#ifdef OUTPUT_FILE_HAVE_COPY_RANGE
+
+// Errors that mean this way of copying is not available for these files,
+// rather than that copying failed
+static bool copy_unsupported(int error) {
+    return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP || error == EBADF;
+}
+
+bool output_file_copy_range(FILE* output, FILE* source, uint64_t offset, uint64_t size) {
+    if (fflush(output) != 0) return false;
+
+    off_t start = ftello(output);
+    if (start < 0) return false;
+
+    int out_fd = fileno(output);
+    int in_fd = fileno(source);
+    off64_t in_offset = (off64_t)offset;
+    uint64_t copied = 0;
+    bool use_sendfile = false;
+
+    while (copied < size) {
+        uint64_t left = size - copied;
+        size_t chunk = left < COPY_CHUNK_SIZE ? (size_t)left : (size_t)COPY_CHUNK_SIZE;
+        ssize_t n;
+        if (!use_sendfile) {
+            n = copy_file_range(in_fd, &in_offset, out_fd, NULL, chunk, 0);
+            // Kernels before 5.3 only copy within one filesystem
+            if (n < 0 && copied == 0 && copy_unsupported(errno)) {
+                use_sendfile = true;
+                continue;
+            }
+        } else {
+            n = sendfile64(out_fd, in_fd, &in_offset, chunk);
+        }
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        copied += (uint64_t)n;
+    }
+
+    // Drop a partial copy. Seeking the stream keeps its idea of the
+    // position in step with the descriptor.
+    if (copied < size) {
+        if (copied > 0 && ftruncate(out_fd, start) != 0) {
+            // Harmless: the caller writes the same bytes over it from `start`
+        }
+        fseeko(output, start, SEEK_SET);
+        return false;
+    }
+    return fseeko(output, start + (off_t)size, SEEK_SET) == 0;
+}
+
+#else
+
+bool output_file_copy_range(FILE* output, FILE* source, uint64_t offset, uint64_t size) {
+    (void)output;
+    (void)source;
+    (void)offset;
+    (void)size;
+    return false;
+}
+
+#endif // OUTPUT_FILE_HAVE_COPY_RANGE
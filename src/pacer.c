@@ -0,0 +1,247 @@
+#include "pacer.h"
+#include "metrics.h"
+
+#ifndef _WIN32
+    #include <pthread.h>
+    #include <time.h>
+#else
+    #include <windows.h>
+#endif
+
+// Deflate speed of each level relative to level 1, for levels not measured
+// yet; store only copies and checksums
+static const double RELATIVE_SPEED[PACER_LEVELS] = {
+    8.0, 1.00, 0.92, 0.80, 0.58, 0.48, 0.38, 0.30, 0.17, 0.10
+};
+
+// Items of this much input or more move the model a full step
+#define PACER_SAMPLE_BYTES (1024 * 1024)
+#define PACER_SMOOTHING 0.3
+
+struct pacer {
+    double start;
+    double target_rate;             // Bytes per second, 0 with a deadline
+    double deadline;                // Seconds after start, 0 with a target rate
+    int max_level;
+    int threads;
+    uint64_t total;
+    uint64_t done;
+
+    // Model: CPU speed per level (bytes per CPU second on one thread), the
+    // same divided by RELATIVE_SPEED over all levels, and seconds per byte a
+    // worker waits rather than computes
+    double speed[PACER_LEVELS];
+    bool measured[PACER_LEVELS];
+    double scale;
+    double wait_cost;
+    bool calibrated;
+    double busy_wall;
+    double busy_cpu;
+
+    int level;
+    double decided_at;
+    bool decided;
+
+    uint64_t level_input[PACER_LEVELS];
+    uint64_t level_output[PACER_LEVELS];
+
+#ifndef _WIN32
+    pthread_mutex_t mutex;
+#else
+    CRITICAL_SECTION cs;
+#endif
+};
+
+static void pacer_lock(pacer_t* pacer) {
+#ifndef _WIN32
+    pthread_mutex_lock(&pacer->mutex);
+#else
+    EnterCriticalSection(&pacer->cs);
+#endif
+}
+
+static void pacer_unlock(pacer_t* pacer) {
+#ifndef _WIN32
+    pthread_mutex_unlock(&pacer->mutex);
+#else
+    LeaveCriticalSection(&pacer->cs);
+#endif
+}
+
+static double wall_seconds(void) {
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#else
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#endif
+}
+
+// CPU time of the calling thread
+static double cpu_seconds(void) {
+#ifndef _WIN32
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0.0;
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#else
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) return 0.0;
+    ULARGE_INTEGER k = { .LowPart = kernel.dwLowDateTime, .HighPart = kernel.dwHighDateTime };
+    ULARGE_INTEGER u = { .LowPart = user.dwLowDateTime, .HighPart = user.dwHighDateTime };
+    return (double)(k.QuadPart + u.QuadPart) / 1e7;
+#endif
+}
+
+pacer_t* pacer_create(double target_mbps, double deadline, int max_level) {
+    if (target_mbps <= 0 && deadline <= 0) return NULL;
+
+    pacer_t* pacer = calloc(1, sizeof(pacer_t));
+    if (!pacer) return NULL;
+    pacer->start = wall_seconds();
+    pacer->target_rate = deadline > 0 ? 0.0 : target_mbps * 1024.0 * 1024.0;
+    pacer->deadline = deadline > 0 ? deadline : 0.0;
+    pacer->max_level = max_level < 1 ? 1 : (max_level >= PACER_LEVELS ? PACER_LEVELS - 1 : max_level);
+    pacer->threads = 1;
+    pacer->level = pacer->max_level;
+#ifndef _WIN32
+    pthread_mutex_init(&pacer->mutex, NULL);
+#else
+    InitializeCriticalSection(&pacer->cs);
+#endif
+    return pacer;
+}
+
+void pacer_free(pacer_t* pacer) {
+    if (!pacer) return;
+#ifndef _WIN32
+    pthread_mutex_destroy(&pacer->mutex);
+#else
+    DeleteCriticalSection(&pacer->cs);
+#endif
+    free(pacer);
+}
+
+void pacer_begin(pacer_t* pacer, uint64_t total_bytes, int threads) {
+    if (!pacer) return;
+    pacer_lock(pacer);
+    pacer->total = total_bytes;
+    pacer->threads = threads > 0 ? threads : 1;
+    pacer_unlock(pacer);
+}
+
+// Input bytes per second the pool can finish at `level`
+static double capacity(const pacer_t* pacer, int level) {
+    double speed = pacer->measured[level] ? pacer->speed[level] : pacer->scale * RELATIVE_SPEED[level];
+    if (speed <= 0) return 0.0;
+    return (double)pacer->threads / (1.0 / speed + pacer->wait_cost);
+}
+
+static int decide(const pacer_t* pacer, double now) {
+    // Nothing measured yet: start at the top
+    if (!pacer->calibrated) return pacer->max_level;
+
+    double required = pacer->target_rate;
+    if (pacer->deadline > 0) {
+        double left = pacer->deadline * (1.0 - PACER_DEADLINE_RESERVE) - (now - pacer->start);
+        if (pacer->done >= pacer->total) return pacer->level;
+        if (left <= 0) return 0;
+        required = (double)(pacer->total - pacer->done) / left;
+    }
+    required *= PACER_HEADROOM;
+
+    int level = -1;
+    for (int l = pacer->max_level; l >= 1 && level < 0; l--) {
+        if (capacity(pacer, l) >= required) level = l;
+    }
+    if (level < 0) {
+        // Behind at every level: store, unless waiting on input hides most
+        // of what compressing costs
+        double floor = capacity(pacer, 0) * 0.9;
+        level = 0;
+        for (int l = pacer->max_level; l >= 1 && level == 0; l--) {
+            if (capacity(pacer, l) >= floor) level = l;
+        }
+    }
+
+    // Falling behind acts at once; catching up climbs a step at a time
+    if (level > pacer->level + 1) level = pacer->level + 1;
+    return level;
+}
+
+int pacer_level(pacer_t* pacer) {
+    pacer_lock(pacer);
+    double now = wall_seconds();
+    if (!pacer->decided || now - pacer->decided_at >= PACER_INTERVAL_MS / 1000.0) {
+        pacer->level = decide(pacer, now);
+        pacer->decided_at = now;
+        pacer->decided = true;
+    }
+    int level = pacer->level;
+    pacer_unlock(pacer);
+    return level;
+}
+
+void pacer_sample(pacer_sample_t* sample) {
+    sample->wall = wall_seconds();
+    sample->cpu = cpu_seconds();
+}
+
+static double smooth(double average, double value, double weight, bool first) {
+    return first ? value : average + (value - average) * weight;
+}
+
+void pacer_record(pacer_t* pacer, int level, uint64_t bytes, uint64_t input, uint64_t output,
+                  const pacer_sample_t* start) {
+    if (level < 0) level = 0;
+    if (level >= PACER_LEVELS) level = PACER_LEVELS - 1;
+
+    double wall = 0.0;
+    double cpu = 0.0;
+    if (start) {
+        wall = wall_seconds() - start->wall;
+        cpu = cpu_seconds() - start->cpu;
+        if (cpu > wall) cpu = wall;
+        if (cpu < 0) cpu = 0;
+    }
+    metrics_count_level(level, input, output, (uint64_t)(cpu * 1e9), (uint64_t)((wall - cpu) * 1e9));
+
+    pacer_lock(pacer);
+    pacer->done += bytes;
+    pacer->level_input[level] += input;
+    pacer->level_output[level] += output;
+
+    if (start && input > 0 && wall > 0) {
+        // A coarse thread clock can read 0 for a short item
+        double compute = cpu > 0 ? cpu : wall;
+        double speed = (double)input / compute;
+        double weight = PACER_SMOOTHING * ((double)input < PACER_SAMPLE_BYTES ? (double)input / PACER_SAMPLE_BYTES : 1.0);
+
+        pacer->speed[level] = smooth(pacer->speed[level], speed, weight, !pacer->measured[level]);
+        pacer->measured[level] = true;
+        pacer->scale = smooth(pacer->scale, speed / RELATIVE_SPEED[level], weight, !pacer->calibrated);
+        pacer->wait_cost = smooth(pacer->wait_cost, (wall - cpu) / (double)input, weight, !pacer->calibrated);
+        pacer->calibrated = true;
+        pacer->busy_wall += wall;
+        pacer->busy_cpu += cpu;
+    }
+    pacer_unlock(pacer);
+}
+
+void pacer_report(pacer_t* pacer, pacer_report_t* report) {
+    memset(report, 0, sizeof(*report));
+    pacer_lock(pacer);
+    double elapsed = wall_seconds() - pacer->start;
+    double mb = 1024.0 * 1024.0;
+    report->deadline = pacer->deadline;
+    report->target_mbps = pacer->deadline > 0 ? (double)pacer->total / pacer->deadline / mb
+                                              : pacer->target_rate / mb;
+    report->achieved_mbps = elapsed > 0 ? (double)pacer->done / elapsed / mb : 0.0;
+    report->io_bound = pacer->busy_wall > 0 && pacer->busy_cpu < pacer->busy_wall / 2;
+    memcpy(report->level_input, pacer->level_input, sizeof(report->level_input));
+    memcpy(report->level_output, pacer->level_output, sizeof(report->level_output));
+    pacer_unlock(pacer);
+}
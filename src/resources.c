@@ -0,0 +1,500 @@
+// sched_getaffinity() and CPU_COUNT() are GNU extensions
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+
+#include "resources.h"
+#include <errno.h>
+
+#ifndef _WIN32
+    #include <pthread.h>
+    #include <time.h>
+    #include <sys/resource.h>
+    #ifdef __APPLE__
+        #include <sys/sysctl.h>
+        #include <mach/mach.h>
+    #else
+        #include <sched.h>
+        #include <sys/sysinfo.h>
+    #endif
+#else
+    #include <windows.h>
+#endif
+
+// Fallbacks when the system cannot be queried
+#define DEFAULT_CPU_COUNT 4
+#define DEFAULT_AVAILABLE_MEMORY (2ULL * 1024 * 1024 * 1024)
+#define DEFAULT_OPEN_FILES 1024
+
+// Detected CPUs beyond this add little to a single archive; --threads may
+// ask for more, up to MAX_THREADS
+#define DEFAULT_MAX_THREADS 16
+#define MAX_THREADS 256
+
+typedef struct {
+    int threads;
+    uint64_t memory_limit;
+} resources_settings_t;
+
+static resources_settings_t g_settings;
+static THREAD_LOCAL resources_settings_t t_settings;
+static THREAD_LOCAL bool t_configured;
+
+static const resources_settings_t* settings(void) {
+    return t_configured ? &t_settings : &g_settings;
+}
+
+void resources_configure(int threads, uint64_t memory_limit) {
+    g_settings.threads = threads > MAX_THREADS ? MAX_THREADS : threads;
+    g_settings.memory_limit = memory_limit;
+}
+
+void resources_configure_thread(int threads, uint64_t memory_limit) {
+    t_settings.threads = threads > MAX_THREADS ? MAX_THREADS : threads;
+    t_settings.memory_limit = memory_limit;
+    t_configured = true;
+}
+
+void resources_release_thread(void) {
+    t_configured = false;
+}
+
+uint64_t resources_memory_limit(void) {
+    return settings()->memory_limit;
+}
+
+static double monotonic_seconds(void) {
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#else
+    return (double)GetTickCount64() / 1000.0;
+#endif
+}
+
+// ============================================================================
+// cgroups (Linux)
+// ============================================================================
+
+#if defined(__linux__)
+
+#define CGROUP_ROOT    "/sys/fs/cgroup"
+#define CGROUP_V1_CPU  CGROUP_ROOT "/cpu"
+#define CGROUP_V1_MEM  CGROUP_ROOT "/memory"
+
+// Where this process sits in each hierarchy, from /proc/self/cgroup
+typedef struct {
+    bool v2;                    // CGROUP_ROOT is the unified hierarchy
+    char v2_path[PATH_MAX];
+    char cpu_path[PATH_MAX];    // v1 "cpu" controller
+    char memory_path[PATH_MAX]; // v1 "memory" controller
+} cgroup_paths_t;
+
+// Read once, by whichever thread asks first
+static cgroup_paths_t g_cgroups;
+static pthread_once_t g_cgroups_once = PTHREAD_ONCE_INIT;
+
+// Whether the comma-separated controller list names `controller`
+static bool has_controller(const char* list, size_t len, const char* controller) {
+    size_t want = strlen(controller);
+    const char* end = list + len;
+    while (list < end) {
+        const char* comma = memchr(list, ',', (size_t)(end - list));
+        size_t item = comma ? (size_t)(comma - list) : (size_t)(end - list);
+        if (item == want && strncmp(list, controller, want) == 0) return true;
+        list += item + 1;
+    }
+    return false;
+}
+
+static void load_cgroup_paths(void) {
+    char probe[PATH_MAX];
+    snprintf(probe, sizeof(probe), "%s/cgroup.controllers", CGROUP_ROOT);
+    g_cgroups.v2 = access(probe, F_OK) == 0;
+
+    FILE* f = fopen("/proc/self/cgroup", "r");
+    if (!f) return;
+
+    // Lines are "id:controllers:path"; v2 has id 0 and no controllers
+    char line[PATH_MAX + 64];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        char* first = strchr(line, ':');
+        char* second = first ? strchr(first + 1, ':') : NULL;
+        if (!second) continue;
+
+        const char* controllers = first + 1;
+        size_t controllers_len = (size_t)(second - controllers);
+        const char* path = second + 1;
+        if (controllers_len == 0) {
+            snprintf(g_cgroups.v2_path, PATH_MAX, "%s", path);
+        } else if (has_controller(controllers, controllers_len, "cpu")) {
+            snprintf(g_cgroups.cpu_path, PATH_MAX, "%s", path);
+        } else if (has_controller(controllers, controllers_len, "memory")) {
+            snprintf(g_cgroups.memory_path, PATH_MAX, "%s", path);
+        }
+    }
+    fclose(f);
+}
+
+static const cgroup_paths_t* cgroup_paths(void) {
+    pthread_once(&g_cgroups_once, load_cgroup_paths);
+    return &g_cgroups;
+}
+
+static bool read_first_line(const char* path, char* buf, size_t size) {
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+    bool ok = fgets(buf, (int)size, f) != NULL;
+    fclose(f);
+    return ok;
+}
+
+// A plain number; "max" and anything else unparsable mean no value
+static bool read_u64(const char* dir, const char* name, uint64_t* value) {
+    char path[PATH_MAX];
+    char buf[64];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if (!read_first_line(path, buf, sizeof(buf))) return false;
+
+    char* end;
+    errno = 0;
+    unsigned long long v = strtoull(buf, &end, 10);
+    if (end == buf || errno != 0) return false;
+    *value = (uint64_t)v;
+    return true;
+}
+
+// `key value` line of a memory.stat file
+static bool read_stat(const char* dir, const char* key, uint64_t* value) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/memory.stat", dir);
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+
+    char line[256];
+    size_t key_len = strlen(key);
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, key, key_len) == 0 && line[key_len] == ' ') {
+            *value = (uint64_t)strtoull(line + key_len + 1, NULL, 10);
+            found = true;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// Call `visit` on `mount`/`path` and every ancestor up to the mount itself,
+// since a limit set on a parent applies to its children. In a container
+// whose cgroup namespace is not private the host path does not exist under
+// the mount, and only the mount (the container's own cgroup) is visited.
+static void walk_cgroup(const char* mount, const char* path, void (*visit)(const char* dir, void* user),
+                        void* user) {
+    char dir[PATH_MAX];
+    int len = snprintf(dir, sizeof(dir), "%s%s", mount, path[0] == '/' ? path : "/");
+    if (len <= 0 || len >= (int)sizeof(dir)) return;
+
+    size_t mount_len = strlen(mount);
+    for (;;) {
+        size_t n = strlen(dir);
+        while (n > mount_len && dir[n - 1] == '/') dir[--n] = '\0';
+        if (access(dir, F_OK) == 0) visit(dir, user);
+        if (n <= mount_len) break;
+
+        char* slash = strrchr(dir + mount_len, '/');
+        if (!slash) break;
+        *slash = '\0';
+    }
+}
+
+static void visit_cpu_quota(const char* dir, void* user) {
+    double* cpus = user;
+    double quota = 0, period = 0;
+
+    char path[PATH_MAX];
+    char buf[64];
+    snprintf(path, sizeof(path), "%s/cpu.max", dir);
+    if (read_first_line(path, buf, sizeof(buf))) {
+        // v2: "quota period", quota "max" when unlimited
+        if (sscanf(buf, "%lf %lf", &quota, &period) != 2) return;
+    } else {
+        uint64_t q = 0, p = 0;
+        long long signed_quota = 0;
+        snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", dir);
+        if (!read_first_line(path, buf, sizeof(buf)) || sscanf(buf, "%lld", &signed_quota) != 1 ||
+            signed_quota <= 0 || !read_u64(dir, "cpu.cfs_period_us", &p)) {
+            return;
+        }
+        q = (uint64_t)signed_quota;
+        quota = (double)q;
+        period = (double)p;
+    }
+
+    if (quota > 0 && period > 0) {
+        double limit = quota / period;
+        if (*cpus <= 0 || limit < *cpus) *cpus = limit;
+    }
+}
+
+// Fewest CPUs any cgroup level allows, 0 when unlimited
+static int cgroup_cpu_limit(void) {
+    const cgroup_paths_t* paths = cgroup_paths();
+    double cpus = 0;
+    if (paths->v2) {
+        walk_cgroup(CGROUP_ROOT, paths->v2_path, visit_cpu_quota, &cpus);
+    } else {
+        walk_cgroup(CGROUP_V1_CPU, paths->cpu_path, visit_cpu_quota, &cpus);
+        if (cpus <= 0) {
+            walk_cgroup(CGROUP_ROOT "/cpu,cpuacct", paths->cpu_path, visit_cpu_quota, &cpus);
+        }
+    }
+    if (cpus <= 0) return 0;
+
+    int whole = (int)cpus;
+    return (double)whole < cpus ? whole + 1 : (whole > 0 ? whole : 1);
+}
+
+typedef struct {
+    bool v2;
+    bool limited;
+    uint64_t headroom;
+} memory_visit_t;
+
+static void visit_memory_limit(const char* dir, void* user) {
+    memory_visit_t* visit = user;
+    uint64_t limit = 0, usage = 0, inactive = 0;
+
+    bool ok = visit->v2 ? read_u64(dir, "memory.max", &limit) && read_u64(dir, "memory.current", &usage)
+                        : read_u64(dir, "memory.limit_in_bytes", &limit) &&
+                          read_u64(dir, "memory.usage_in_bytes", &usage);
+    // v1 reports "no limit" as a huge page-aligned number
+    if (!ok || limit >= (1ULL << 60)) return;
+
+    // Inactive page cache is reclaimed before the cgroup is at its limit
+    read_stat(dir, visit->v2 ? "inactive_file" : "total_inactive_file", &inactive);
+    uint64_t used = usage > inactive ? usage - inactive : 0;
+    uint64_t headroom = limit > used ? limit - used : 0;
+    if (!visit->limited || headroom < visit->headroom) {
+        visit->headroom = headroom;
+        visit->limited = true;
+    }
+}
+
+// Least headroom under any cgroup memory limit; false when there is none
+static bool cgroup_memory_headroom(uint64_t* headroom) {
+    const cgroup_paths_t* paths = cgroup_paths();
+    memory_visit_t visit = { .v2 = paths->v2 };
+    walk_cgroup(paths->v2 ? CGROUP_ROOT : CGROUP_V1_MEM, paths->v2 ? paths->v2_path : paths->memory_path,
+                visit_memory_limit, &visit);
+    *headroom = visit.headroom;
+    return visit.limited;
+}
+
+static double read_pressure(const char* path) {
+    char buf[128];
+    double avg10;
+    if (!read_first_line(path, buf, sizeof(buf)) || sscanf(buf, "some avg10=%lf", &avg10) != 1) {
+        return -1.0;
+    }
+    return avg10;
+}
+
+#endif // __linux__
+
+// ============================================================================
+// CPUs and memory
+// ============================================================================
+
+static int detect_cpu_count(void) {
+#ifndef _WIN32
+    #ifdef __APPLE__
+        int count;
+        size_t count_len = sizeof(count);
+        sysctlbyname("hw.logicalcpu", &count, &count_len, NULL, 0);
+        return count > 0 ? count : DEFAULT_CPU_COUNT;
+    #else
+        long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+        int count = nprocs > 0 ? (int)nprocs : DEFAULT_CPU_COUNT;
+
+        #ifdef __linux__
+        // taskset, cpusets and container runtimes restrict the mask
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            int allowed = CPU_COUNT(&set);
+            if (allowed > 0 && allowed < count) count = allowed;
+        }
+
+        // A CFS quota caps CPU time however many CPUs are visible
+        int quota = cgroup_cpu_limit();
+        if (quota > 0 && quota < count) count = quota;
+        #endif
+        return count;
+    #endif
+#else
+    DWORD_PTR process_mask = 0, system_mask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) && process_mask) {
+        int count = 0;
+        for (; process_mask; process_mask &= process_mask - 1) count++;
+        return count;
+    }
+    SYSTEM_INFO sysinfo;
+    GetSystemInfo(&sysinfo);
+    return sysinfo.dwNumberOfProcessors > 0 ? (int)sysinfo.dwNumberOfProcessors : DEFAULT_CPU_COUNT;
+#endif
+}
+
+// Limits don't change during a run; detected once, by whichever thread asks first
+static int g_cpu_count;
+
+#ifndef _WIN32
+static pthread_once_t g_cpu_count_once = PTHREAD_ONCE_INIT;
+
+static void load_cpu_count(void) {
+    int count = detect_cpu_count();
+    g_cpu_count = count > DEFAULT_MAX_THREADS ? DEFAULT_MAX_THREADS : count;
+}
+#else
+static INIT_ONCE g_cpu_count_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK load_cpu_count(PINIT_ONCE once, PVOID parameter, PVOID* context) {
+    (void)once;
+    (void)parameter;
+    (void)context;
+    int count = detect_cpu_count();
+    g_cpu_count = count > DEFAULT_MAX_THREADS ? DEFAULT_MAX_THREADS : count;
+    return TRUE;
+}
+#endif
+
+int resources_cpu_count(void) {
+    if (settings()->threads > 0) return settings()->threads;
+
+#ifndef _WIN32
+    pthread_once(&g_cpu_count_once, load_cpu_count);
+#else
+    InitOnceExecuteOnce(&g_cpu_count_once, load_cpu_count, NULL, NULL);
+#endif
+    return g_cpu_count;
+}
+
+static uint64_t system_available_memory(void) {
+#ifdef __APPLE__
+    mach_port_t host_port = mach_host_self();
+    vm_size_t page_size;
+    host_page_size(host_port, &page_size);
+
+    vm_statistics64_data_t vm_stat;
+    mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+
+    if (host_statistics64(host_port, HOST_VM_INFO64, (host_info64_t)&vm_stat, &count) == KERN_SUCCESS) {
+        // Free + inactive pages can be reclaimed
+        return ((uint64_t)vm_stat.free_count + (uint64_t)vm_stat.inactive_count) * page_size;
+    }
+    return DEFAULT_AVAILABLE_MEMORY;
+#elif defined(_WIN32)
+    MEMORYSTATUSEX memInfo;
+    memInfo.dwLength = sizeof(MEMORYSTATUSEX);
+    if (GlobalMemoryStatusEx(&memInfo)) {
+        return (uint64_t)memInfo.ullAvailPhys;
+    }
+    return DEFAULT_AVAILABLE_MEMORY;
+#else
+    // Linux: MemAvailable counts reclaimable page cache, which free RAM does not
+    FILE* meminfo = fopen("/proc/meminfo", "r");
+    if (meminfo) {
+        char line[128];
+        unsigned long long kb = 0;
+        bool found = false;
+        while (fgets(line, sizeof(line), meminfo)) {
+            if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1) {
+                found = true;
+                break;
+            }
+        }
+        fclose(meminfo);
+        if (found) {
+            return (uint64_t)kb * 1024;
+        }
+    }
+
+    struct sysinfo si;
+    if (sysinfo(&si) == 0) {
+        return (uint64_t)(si.freeram + si.bufferram) * si.mem_unit;
+    }
+    return DEFAULT_AVAILABLE_MEMORY;
+#endif
+}
+
+uint64_t resources_available_memory(void) {
+    uint64_t available = system_available_memory();
+
+#ifdef __linux__
+    uint64_t headroom;
+    if (cgroup_memory_headroom(&headroom) && headroom < available) {
+        available = headroom;
+    }
+#endif
+
+    uint64_t limit = settings()->memory_limit;
+    if (limit > 0 && limit < available) {
+        available = limit;
+    }
+    return available;
+}
+
+double resources_memory_pressure(void) {
+#ifdef __linux__
+    const cgroup_paths_t* paths = cgroup_paths();
+    if (paths->v2) {
+        char path[PATH_MAX + 32];
+        snprintf(path, sizeof(path), "%s%.*s/memory.pressure", CGROUP_ROOT, PATH_MAX - 1,
+                 strcmp(paths->v2_path, "/") == 0 ? "" : paths->v2_path);
+        double pressure = read_pressure(path);
+        if (pressure >= 0) return pressure;
+    }
+    return read_pressure("/proc/pressure/memory");
+#else
+    return -1.0;
+#endif
+}
+
+size_t resources_open_file_limit(void) {
+#ifndef _WIN32
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == 0) return DEFAULT_OPEN_FILES;
+    if (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > (rlim_t)SIZE_MAX) return SIZE_MAX;
+    return (size_t)limit.rlim_cur;
+#else
+    // Handles are not limited the same way; stdio streams are
+    return (size_t)_getmaxstdio();
+#endif
+}
+
+// ============================================================================
+// Pressure-driven budget
+// ============================================================================
+
+void resources_budget_init(resources_budget_t* budget, size_t base, size_t minimum) {
+    budget->base = base;
+    budget->minimum = minimum < base ? minimum : base;
+    budget->current = base;
+    budget->next_check = monotonic_seconds() + RESOURCES_PRESSURE_INTERVAL_MS / 1000.0;
+}
+
+size_t resources_budget_update(resources_budget_t* budget) {
+    double now = monotonic_seconds();
+    if (now < budget->next_check) return budget->current;
+    budget->next_check = now + RESOURCES_PRESSURE_INTERVAL_MS / 1000.0;
+
+    double pressure = resources_memory_pressure();
+    if (pressure >= RESOURCES_PRESSURE_HIGH) {
+        size_t halved = budget->current / 2;
+        budget->current = halved > budget->minimum ? halved : budget->minimum;
+    } else if (pressure >= 0 && pressure < RESOURCES_PRESSURE_LOW && budget->current < budget->base) {
+        size_t doubled = budget->current * 2;
+        budget->current = doubled < budget->base ? doubled : budget->base;
+    }
+    return budget->current;
+}
@@ -0,0 +1,56 @@
+#include "string_pool.h"
+
+#define STRING_POOL_BLOCK_SIZE (64 * 1024)
+
+struct string_pool_block {
+    struct string_pool_block* next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+void string_pool_init(string_pool_t* pool) {
+    memset(pool, 0, sizeof(string_pool_t));
+}
+
+void string_pool_free(string_pool_t* pool) {
+    string_pool_block_t* block = pool->blocks;
+    while (block) {
+        string_pool_block_t* next = block->next;
+        free(block);
+        block = next;
+    }
+    memset(pool, 0, sizeof(string_pool_t));
+}
+
+char* string_pool_strndup(string_pool_t* pool, const char* text, size_t len) {
+    string_pool_block_t* block = pool->blocks;
+    if (!block || block->size - block->used < len + 1) {
+        // Oversized strings get a block of their own
+        size_t size = len + 1 > STRING_POOL_BLOCK_SIZE ? len + 1 : STRING_POOL_BLOCK_SIZE;
+        block = malloc(sizeof(string_pool_block_t) + size);
+        if (!block) return NULL;
+        block->used = 0;
+        block->size = size;
+        
+        // Keep filling the current block if the new one will not be
+        if (pool->blocks && size > STRING_POOL_BLOCK_SIZE) {
+            block->next = pool->blocks->next;
+            pool->blocks->next = block;
+        } else {
+            block->next = pool->blocks;
+            pool->blocks = block;
+        }
+    }
+    
+    char* copy = block->data + block->used;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    block->used += len + 1;
+    pool->bytes += len + 1;
+    return copy;
+}
+
+char* string_pool_strdup(string_pool_t* pool, const char* text) {
+    return string_pool_strndup(pool, text, strlen(text));
+}
@@ -9,6 +9,8 @@
     #include <sys/ioctl.h>
     #include <unistd.h>
     #include <termios.h>
+    #include <pthread.h>
+    #include <errno.h>
     #include <sys/resource.h>
     #ifdef __APPLE__
         #include <mach/mach.h>
@@ -27,6 +29,28 @@
 
 tui_state_t g_tui = {0};
 
+// Fields that workers update while the render thread draws. GCC and Clang
+// (MinGW included) builtins: additions are relaxed, since a frame only
+// needs a recent value; stores release what was written before them.
+#define TUI_LOAD(field)         __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define TUI_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+#define TUI_ADD(field, value)   __atomic_fetch_add(&(field), (value), __ATOMIC_RELAXED)
+
+// Render thread
+#ifndef _WIN32
+static pthread_t render_thread;
+static pthread_mutex_t render_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t render_wake = PTHREAD_COND_INITIALIZER;
+static bool render_stop = false;
+#else
+static HANDLE render_thread = NULL;
+static HANDLE render_wake = NULL;
+#endif
+static bool render_running = false;
+
+// Last phase the display has caught up with (render thread only)
+static int shown_phase = 1;
+
 // Static buffers for formatting
 static char format_buffer[64];
 static char speed_buffer[64];
@@ -250,6 +274,7 @@ void tui_init(void) {
     g_tui.total_phases = 4;
     g_tui.current_phase = 1;
     g_tui.phase_name = "Initializing";
+    shown_phase = 1;
     
     // Enable Windows ANSI support
     #ifdef _WIN32
@@ -268,6 +293,7 @@ void tui_init(void) {
 }
 
 void tui_cleanup(void) {
+    tui_stop_render();
     if (g_tui.colors_enabled) {
         printf(TUI_CURSOR_SHOW);
         printf(TUI_RESET);
@@ -276,6 +302,79 @@ void tui_cleanup(void) {
     g_tui.is_active = false;
 }
 
+#ifndef _WIN32
+static void* render_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&render_mutex);
+    while (!render_stop) {
+        pthread_mutex_unlock(&render_mutex);
+        tui_refresh();
+        pthread_mutex_lock(&render_mutex);
+        
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 1000000000L / TUI_FRAME_RATE_HZ;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!render_stop && pthread_cond_timedwait(&render_wake, &render_mutex, &deadline) != ETIMEDOUT) {
+        }
+    }
+    pthread_mutex_unlock(&render_mutex);
+    return NULL;
+}
+#else
+static DWORD WINAPI render_main(LPVOID arg) {
+    (void)arg;
+    do {
+        tui_refresh();
+    } while (WaitForSingleObject(render_wake, 1000 / TUI_FRAME_RATE_HZ) == WAIT_TIMEOUT);
+    return 0;
+}
+#endif
+
+void tui_start_render(void) {
+    if (!g_tui.is_active || render_running) return;
+    
+    // Without a thread the display just stays as it is until the end
+#ifndef _WIN32
+    render_stop = false;
+    render_running = pthread_create(&render_thread, NULL, render_main, NULL) == 0;
+#else
+    render_wake = CreateEvent(NULL, TRUE, FALSE, NULL);
+    render_thread = render_wake ? CreateThread(NULL, 0, render_main, NULL, 0, NULL) : NULL;
+    render_running = render_thread != NULL;
+    if (!render_running && render_wake) {
+        CloseHandle(render_wake);
+        render_wake = NULL;
+    }
+#endif
+}
+
+void tui_stop_render(void) {
+    if (!render_running) return;
+    
+#ifndef _WIN32
+    pthread_mutex_lock(&render_mutex);
+    render_stop = true;
+    pthread_cond_signal(&render_wake);
+    pthread_mutex_unlock(&render_mutex);
+    pthread_join(render_thread, NULL);
+#else
+    SetEvent(render_wake);
+    WaitForSingleObject(render_thread, INFINITE);
+    CloseHandle(render_thread);
+    CloseHandle(render_wake);
+    render_thread = NULL;
+    render_wake = NULL;
+#endif
+    render_running = false;
+    
+    // Counters are final now; show them
+    tui_refresh();
+}
+
 // ============================================================================
 // Formatting Utilities
 // ============================================================================
@@ -696,6 +795,8 @@ void tui_show_progress(void) {
 }
 
 void tui_show_summary(void) {
+    tui_stop_render();
+    
     time_t elapsed = time(NULL) - g_tui.start_time;
     if (elapsed < 1) elapsed = 1;
     
@@ -806,35 +907,18 @@ void tui_set_current_file(const char* filename) {
 }
 
 void tui_update_progress(size_t bytes_processed) {
-    g_tui.processed_bytes += bytes_processed;
-    g_tui.processed_files++;
-    
-    // Calculate current speed
-    time_t elapsed = time(NULL) - g_tui.start_time;
-    if (elapsed < 1) elapsed = 1;
-    g_tui.current_speed = (double)g_tui.processed_bytes / elapsed;
-    
-    // Throttle refreshes based on file count and byte progress
-    static size_t last_refresh_files = 0;
-    static size_t last_refresh_bytes = 0;
-    
-    if (g_tui.is_active) {
-        // Update every 100 files or 1% progress, whichever comes first
-        size_t file_threshold = 100;
-        size_t byte_threshold = g_tui.total_bytes / 100; // 1% of total
-        if (byte_threshold < 1024 * 1024) byte_threshold = 1024 * 1024; // Minimum 1MB
-        
-        bool should_refresh = 
-            (g_tui.processed_files - last_refresh_files >= file_threshold) ||
-            (g_tui.processed_bytes - last_refresh_bytes >= byte_threshold) ||
-            (g_tui.processed_files == g_tui.total_files); // Always update on last file
-        
-        if (should_refresh) {
-            tui_refresh();
-            last_refresh_files = g_tui.processed_files;
-            last_refresh_bytes = g_tui.processed_bytes;
-        }
-    }
+    TUI_STORE(g_tui.entry_bytes, (size_t)0);
+    TUI_ADD(g_tui.processed_bytes, bytes_processed);
+    TUI_ADD(g_tui.processed_files, (size_t)1);
+}
+
+void tui_set_totals(size_t files, size_t bytes) {
+    TUI_STORE(g_tui.total_bytes, bytes);
+    TUI_STORE(g_tui.total_files, files);
+}
+
+void tui_set_entry_progress(size_t bytes) {
+    TUI_STORE(g_tui.entry_bytes, bytes);
 }
 
 void tui_update_compression(double percent, double speed) {
@@ -867,24 +951,12 @@ void tui_update_thread_progress(int thread_id, const char* filename, size_t file
                                  double percent, bool active) {
     if (thread_id < 0 || thread_id >= MAX_THREAD_PROGRESS) return;
     
-    g_tui.thread_progress[thread_id].active = active;
-    g_tui.thread_progress[thread_id].file_size = file_size;
-    g_tui.thread_progress[thread_id].percent = percent;
-    
-    if (filename) {
-        strncpy(g_tui.thread_progress[thread_id].filename, filename, 
-                sizeof(g_tui.thread_progress[thread_id].filename) - 1);
-        g_tui.thread_progress[thread_id].filename[sizeof(g_tui.thread_progress[thread_id].filename) - 1] = '\0';
-    } else {
-        g_tui.thread_progress[thread_id].filename[0] = '\0';
-    }
-    
-    // Count active threads
-    int active_count = 0;
-    for (int i = 0; i < MAX_THREAD_PROGRESS; i++) {
-        if (g_tui.thread_progress[i].active) active_count++;
-    }
-    g_tui.active_thread_count = active_count;
+    // Each slot has one writer; the render thread may pair fields from two
+    // updates, which only shows for a frame
+    TUI_STORE(g_tui.thread_progress[thread_id].file_size, file_size);
+    TUI_STORE(g_tui.thread_progress[thread_id].percent, (int)percent);
+    TUI_STORE(g_tui.thread_progress[thread_id].filename, filename);
+    TUI_STORE(g_tui.thread_progress[thread_id].active, active);
 }
 
 void tui_set_large_file_counts(size_t completed, size_t total) {
@@ -893,37 +965,51 @@ void tui_set_large_file_counts(size_t completed, size_t total) {
 }
 
 void tui_set_phase(int phase, const char* phase_name) {
-    // If transitioning from phase 1 (scanning), show final count and move to new line
-    if (g_tui.current_phase == 1 && phase != 1) {
-        printf("\r" TUI_CLEAR_LINE);
-        tui_print_color(TUI_CYAN, "  • ");
-        tui_print_color(TUI_WHITE, "Found %zu files", g_tui.total_files);
-        tui_print_color(TUI_DIM, " (");
-        tui_print_color(TUI_CYAN, "%s", tui_format_bytes(g_tui.total_bytes));
-        tui_print_color(TUI_DIM, ")");
-        printf("\n");
-        fflush(stdout);
-    }
-    // If transitioning from phase 3, show final count and move to new line
-    else if (g_tui.current_phase == 3 && phase != 3) {
-        printf("\r" TUI_CLEAR_LINE);
-        tui_print_color(TUI_CYAN, "  • ");
-        tui_print_color(TUI_WHITE, "Added %zu files", g_tui.processed_files);
-        tui_print_color(TUI_DIM, " (");
-        tui_print_color(TUI_CYAN, "%s", tui_format_bytes(g_tui.processed_bytes));
-        tui_print_color(TUI_DIM, " @ ");
-        tui_print_color(TUI_CYAN, "%s", tui_format_speed(g_tui.current_speed));
-        tui_print_color(TUI_DIM, ")");
-        printf("\n");
-        fflush(stdout);
+    // The next frame prints the lines that close the phases left behind
+    TUI_STORE(g_tui.phase_name, phase_name);
+    TUI_STORE(g_tui.current_phase, phase);
+}
+
+// Average rate of the files finished so far
+static double update_speed(void) {
+    time_t elapsed = time(NULL) - g_tui.start_time;
+    if (elapsed < 1) elapsed = 1;
+    g_tui.current_speed = (double)TUI_LOAD(g_tui.processed_bytes) / elapsed;
+    return g_tui.current_speed;
+}
+
+// Print the line that closes each phase passed since the last frame
+static void show_phase_transitions(int phase) {
+    for (; shown_phase < phase; shown_phase++) {
+        if (shown_phase == 1) {
+            printf("\r" TUI_CLEAR_LINE);
+            tui_print_color(TUI_CYAN, "  • ");
+            tui_print_color(TUI_WHITE, "Found %zu files", TUI_LOAD(g_tui.total_files));
+            tui_print_color(TUI_DIM, " (");
+            tui_print_color(TUI_CYAN, "%s", tui_format_bytes(TUI_LOAD(g_tui.total_bytes)));
+            tui_print_color(TUI_DIM, ")");
+            printf("\n");
+        } else if (shown_phase == 3) {
+            printf("\r" TUI_CLEAR_LINE);
+            tui_print_color(TUI_CYAN, "  • ");
+            tui_print_color(TUI_WHITE, "Added %zu files", TUI_LOAD(g_tui.processed_files));
+            tui_print_color(TUI_DIM, " (");
+            tui_print_color(TUI_CYAN, "%s", tui_format_bytes(TUI_LOAD(g_tui.processed_bytes)));
+            tui_print_color(TUI_DIM, " @ ");
+            tui_print_color(TUI_CYAN, "%s", tui_format_speed(update_speed()));
+            tui_print_color(TUI_DIM, ")");
+            printf("\n");
+        }
     }
-    g_tui.current_phase = phase;
-    g_tui.phase_name = phase_name;
+    fflush(stdout);
 }
 
 void tui_refresh(void) {
     if (!g_tui.is_active) return;
     
+    int phase = TUI_LOAD(g_tui.current_phase);
+    show_phase_transitions(phase);
+    
     g_tui.animation_tick++;
     
     // Update terminal size periodically
@@ -933,15 +1019,16 @@ void tui_refresh(void) {
     
     // Use simple single-line updates to avoid excessive terminal output
     // Phase 1: Scanning directories
-    if (g_tui.current_phase == 1) {
+    if (phase == 1) {
+        size_t found = TUI_LOAD(g_tui.total_files);
         static int scan_spinner = 0;
         const char* frames[] = {"⠋", "⠙", "⠹", "⠸", "⠼", "⠴", "⠦", "⠧", "⠇", "⠏"};
         printf("\r" TUI_CLEAR_LINE);
         tui_print_color(TUI_CYAN, "  %s ", frames[scan_spinner++ % 10]);
         tui_print_color(TUI_WHITE, "Scanning");
-        if (g_tui.total_files > 0) {
+        if (found > 0) {
             tui_print_color(TUI_DIM, " [");
-            tui_print_color(TUI_WHITE, "%zu files", g_tui.total_files);
+            tui_print_color(TUI_WHITE, "%zu files", found);
             tui_print_color(TUI_DIM, "]");
         }
         fflush(stdout);
@@ -949,7 +1036,7 @@ void tui_refresh(void) {
     }
     
     // Phase 2: Parallel pre-compression - show per-thread progress bars
-    if (g_tui.current_phase == 2) {
+    if (phase == 2) {
         static int last_line_count = 0;
         
         // Move cursor up to overwrite previous output
@@ -975,24 +1062,24 @@ void tui_refresh(void) {
         for (int i = 0; i < MAX_THREAD_PROGRESS && threads_shown < g_tui.sys_stats.num_threads; i++) {
             printf(TUI_CLEAR_LINE);
             
-            if (g_tui.thread_progress[i].active && g_tui.thread_progress[i].filename[0]) {
+            const char* name = TUI_LOAD(g_tui.thread_progress[i].filename);
+            if (TUI_LOAD(g_tui.thread_progress[i].active) && name && name[0]) {
                 // Thread is working on a file
                 tui_print_color(TUI_DIM, "    T%d ", i + 1);
                 
                 // Truncate filename
                 char display_name[20];
-                if (strlen(g_tui.thread_progress[i].filename) > 16) {
-                    snprintf(display_name, sizeof(display_name), "...%s",
-                             g_tui.thread_progress[i].filename + strlen(g_tui.thread_progress[i].filename) - 13);
+                if (strlen(name) > 16) {
+                    snprintf(display_name, sizeof(display_name), "...%s", name + strlen(name) - 13);
                 } else {
-                    strncpy(display_name, g_tui.thread_progress[i].filename, sizeof(display_name) - 1);
+                    strncpy(display_name, name, sizeof(display_name) - 1);
                     display_name[sizeof(display_name) - 1] = '\0';
                 }
                 tui_print_color(TUI_WHITE, "%-16s ", display_name);
                 
                 // Progress bar
                 int bar_width = 20;
-                double pct = g_tui.thread_progress[i].percent;
+                double pct = TUI_LOAD(g_tui.thread_progress[i].percent);
                 int filled = (int)(bar_width * pct / 100.0);
                 int empty = bar_width - filled;
                 
@@ -1004,7 +1091,7 @@ void tui_refresh(void) {
                 tui_print_color(TUI_DIM, "] ");
                 
                 // Size
-                tui_print_color(TUI_CYAN, "%s", tui_format_bytes(g_tui.thread_progress[i].file_size));
+                tui_print_color(TUI_CYAN, "%s", tui_format_bytes(TUI_LOAD(g_tui.thread_progress[i].file_size)));
                 threads_shown++;
             } else {
                 // Thread is idle
@@ -1022,10 +1109,17 @@ void tui_refresh(void) {
     }
     
     // Phase 3: Adding files to archive
-    if (g_tui.current_phase == 3 && !g_tui.show_compression_bar) {
+    if (phase == 3 && !g_tui.show_compression_bar) {
+        size_t files = TUI_LOAD(g_tui.processed_files);
+        size_t total_files = TUI_LOAD(g_tui.total_files);
+        size_t total_bytes = TUI_LOAD(g_tui.total_bytes);
+        size_t bytes = TUI_LOAD(g_tui.processed_bytes) + TUI_LOAD(g_tui.entry_bytes);
+        double speed = update_speed();
+        
         double percent = 0;
-        if (g_tui.total_bytes > 0) {
-            percent = (double)g_tui.processed_bytes / g_tui.total_bytes * 100.0;
+        if (total_bytes > 0) {
+            percent = (double)bytes / total_bytes * 100.0;
+            if (percent > 100.0) percent = 100.0;
         }
         
         printf("\r" TUI_CLEAR_LINE);
@@ -1044,17 +1138,17 @@ void tui_refresh(void) {
         for (int i = 0; i < empty; i++) printf("░");
         tui_print_color(TUI_DIM, "] ");
         
-        tui_print_color(TUI_BRIGHT_WHITE, "%zu/%zu", g_tui.processed_files, g_tui.total_files);
+        tui_print_color(TUI_BRIGHT_WHITE, "%zu/%zu", files, total_files);
         tui_print_color(TUI_DIM, " ");
-        tui_print_color(TUI_GREEN, "%s", tui_format_bytes(g_tui.processed_bytes));
+        tui_print_color(TUI_GREEN, "%s", tui_format_bytes(bytes));
         tui_print_color(TUI_DIM, " @ ");
-        tui_print_color(TUI_CYAN, "%s", tui_format_speed(g_tui.current_speed));
+        tui_print_color(TUI_CYAN, "%s", tui_format_speed(speed));
         fflush(stdout);
         return;
     }
     
     // Phase 4: Compressing archive - single line with compression bar
-    if (g_tui.current_phase == 4) {
+    if (phase == 4) {
         printf("\r" TUI_CLEAR_LINE);
         tui_print_color(TUI_CYAN, "  • ");
         tui_print_color(TUI_WHITE, "Compressing ");
@@ -1080,7 +1174,7 @@ void tui_refresh(void) {
     
     // Fallback for other phases - just print phase info
     printf("\r" TUI_CLEAR_LINE);
-    tui_print_color(TUI_DIM, "  Phase %d/%d: ", g_tui.current_phase, g_tui.total_phases);
-    tui_print_color(TUI_BRIGHT_CYAN, "%s", g_tui.phase_name);
+    tui_print_color(TUI_DIM, "  Phase %d/%d: ", phase, g_tui.total_phases);
+    tui_print_color(TUI_BRIGHT_CYAN, "%s", TUI_LOAD(g_tui.phase_name));
     fflush(stdout);
 }
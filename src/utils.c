@@ -1,6 +1,8 @@
 #include "utils.h"
 #include "logging.h"
 #include "tui.h"
+#include "dir_scan.h"
+#include <errno.h>
 
 #ifdef _WIN32
 #define strcasecmp _stricmp
@@ -42,6 +44,21 @@ bool is_regular_file(const char* path) {
 #endif
 }
 
+// Create one directory. Losing a race with another thread creating the same
+// directory (parallel extraction) is not an error.
+static int make_directory(const char* path) {
+#ifdef _WIN32
+    if (CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS) {
+        return is_directory(path) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+#else
+    if (mkdir(path, 0755) == 0 || (errno == EEXIST && is_directory(path))) {
+        return EXIT_SUCCESS;
+    }
+#endif
+    return EXIT_FAILURE;
+}
+
 int create_directory_recursive(const char* path) {
     if (!path) return EXIT_FAILURE;
     
@@ -65,18 +82,9 @@ int create_directory_recursive(const char* path) {
     for (char* slash = strchr(p, PATH_SEPARATOR); slash; slash = strchr(p, PATH_SEPARATOR)) {
         *slash = '\0';
         
-        if (!file_exists(path_copy)) {
-#ifdef _WIN32
-            if (!CreateDirectoryA(path_copy, NULL)) {
-                free(path_copy);
-                return EXIT_FAILURE;
-            }
-#else
-            if (mkdir(path_copy, 0755) != 0) {
-                free(path_copy);
-                return EXIT_FAILURE;
-            }
-#endif
+        if (!file_exists(path_copy) && make_directory(path_copy) != EXIT_SUCCESS) {
+            free(path_copy);
+            return EXIT_FAILURE;
         }
         
         *slash = PATH_SEPARATOR;
@@ -84,18 +92,9 @@ int create_directory_recursive(const char* path) {
     }
     
     // Create the final directory
-    if (!file_exists(path_copy)) {
-#ifdef _WIN32
-        if (!CreateDirectoryA(path_copy, NULL)) {
-            free(path_copy);
-            return EXIT_FAILURE;
-        }
-#else
-        if (mkdir(path_copy, 0755) != 0) {
-            free(path_copy);
-            return EXIT_FAILURE;
-        }
-#endif
+    if (!file_exists(path_copy) && make_directory(path_copy) != EXIT_SUCCESS) {
+        free(path_copy);
+        return EXIT_FAILURE;
     }
     
     free(path_copy);
@@ -218,6 +217,45 @@ char* trim_whitespace(char* str) {
     return str;
 }
 
+bool parse_size(const char* str, uint64_t* out) {
+    if (!str || !out || *str < '0' || *str > '9') return false;
+    
+    char* end = NULL;
+    unsigned long long value = strtoull(str, &end, 10);
+    uint64_t multiplier = 1;
+    
+    switch (*end) {
+        case 'k': case 'K': multiplier = 1024ULL; end++; break;
+        case 'm': case 'M': multiplier = 1024ULL * 1024; end++; break;
+        case 'g': case 'G': multiplier = 1024ULL * 1024 * 1024; end++; break;
+        case 't': case 'T': multiplier = 1024ULL * 1024 * 1024 * 1024; end++; break;
+        default: break;
+    }
+    if (*end == 'B' || *end == 'b') end++;
+    if (*end != '\0') return false;
+    
+    if (value > UINT64_MAX / multiplier) return false;
+    *out = (uint64_t)value * multiplier;
+    return true;
+}
+
+bool parse_duration(const char* str, double* seconds) {
+    if (!str || !seconds || ((*str < '0' || *str > '9') && *str != '.')) return false;
+    
+    char* end = NULL;
+    double value = strtod(str, &end);
+    switch (*end) {
+        case 's': case 'S': end++; break;
+        case 'm': case 'M': value *= 60; end++; break;
+        case 'h': case 'H': value *= 3600; end++; break;
+        default: break;
+    }
+    if (*end != '\0' || !(value > 0)) return false;
+    
+    *seconds = value;
+    return true;
+}
+
 char* join_path(const char* dir, const char* file) {
     if (!dir || !file) return NULL;
     
@@ -349,6 +387,11 @@ int traverse_directory(const char* dir_path, bool recursive, file_callback_t cal
         ull.HighPart = ft.dwHighDateTime;
         info.mtime = (time_t)((ull.QuadPart - 116444736000000000ULL) / 10000000ULL);
         
+        // Whole seconds, like _stat64(), so both sources agree on a file's version
+        info.device = 0;
+        info.inode = 0;
+        info.mtime_ns = (int64_t)info.mtime * 1000000000LL;
+        
         if (info.is_directory) {
             info.size = 0;
         } else {
@@ -359,6 +402,10 @@ int traverse_directory(const char* dir_path, bool recursive, file_callback_t cal
         }
         
         int result = callback(&info, user_data);
+        if (result == TRAVERSE_SKIP_SUBTREE) {
+            free(full_path);
+            continue;
+        }
         if (result != EXIT_SUCCESS) {
             free(full_path);
             FindClose(hFind);
@@ -378,51 +425,12 @@ int traverse_directory(const char* dir_path, bool recursive, file_callback_t cal
     } while (FindNextFileA(hFind, &find_data));
     
     FindClose(hFind);
+    return EXIT_SUCCESS;
 #else
-    DIR* dir = opendir(dir_path);
-    if (!dir) {
-        return EXIT_FAILURE;
-    }
-    
-    struct dirent* entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-        
-        char* full_path = join_path(dir_path, entry->d_name);
-        if (!full_path) continue;
-        
-        file_info_t info;
-        strncpy(info.path, full_path, PATH_MAX - 1);
-        info.path[PATH_MAX - 1] = '\0';
-        info.is_directory = is_directory(full_path);
-        info.mtime = get_file_mtime(full_path);
-        info.size = info.is_directory ? 0 : get_file_size(full_path);
-        
-        int result = callback(&info, user_data);
-        if (result != EXIT_SUCCESS) {
-            free(full_path);
-            closedir(dir);
-            return result;
-        }
-        
-        if (info.is_directory && recursive) {
-            result = traverse_directory(full_path, recursive, callback, user_data);
-            if (result != EXIT_SUCCESS) {
-                free(full_path);
-                closedir(dir);
-                return result;
-            }
-        }
-        
-        free(full_path);
-    }
-    
-    closedir(dir);
+    // FindFirstFile already returns the metadata above; on POSIX the scanner
+    // lists directories in parallel and stats each entry once
+    return dir_scan(dir_path, recursive, callback, user_data);
 #endif
-    
-    return EXIT_SUCCESS;
 }
 
 void init_progress(progress_t* progress) {
@@ -550,15 +558,14 @@ void print_compression_progress(const progress_t* progress, int step) {
     
     if (estimated_progress > 99.5) estimated_progress = 99.5; // Don't show 100% until done
     
-    // Update TUI if active
+    // Update TUI if active (its render thread draws it)
     if (g_tui.is_active) {
         tui_update_compression(estimated_progress, speed);
-        tui_refresh();
         return;
     }
     
     // Use structured logging for compression progress, but maintain animation for traditional output
-    if (g_log_config.structured) {
+    if (log_config_current()->structured) {
         static progress_t temp_progress = {0};
         temp_progress.start_time = progress->start_time;
         temp_progress.processed_bytes = progress->processed_bytes;
@@ -1,20 +1,28 @@
 #include <zip.h>
 #include <zlib.h>
+#include <stdarg.h>
 #include "gbzip_zip.h"
 #include "zipignore.h"
 #include "utils.h"
 #include "logging.h"
 #include "tui.h"
+#include "archive_writer.h"
+#include "compress.h"
+#include "codec.h"
+#include "checksum.h"
+#include "input_source.h"
+#include "batch_reader.h"
+#include "output_file.h"
+#include "dir_cache.h"
+#include "entry_select.h"
+#include "resources.h"
+#include "metrics.h"
+#include "string_pool.h"
+#include "pacer.h"
 
 #ifndef _WIN32
     #include <pthread.h>
     #include <unistd.h>
-    #ifdef __APPLE__
-        #include <sys/sysctl.h>
-        #include <mach/mach.h>
-    #else
-        #include <sys/sysinfo.h>
-    #endif
 #else
     #include <windows.h>
 #endif
@@ -25,47 +33,26 @@
 
 // Threshold for using parallel compression (files larger than this get pre-compressed)
 #define PARALLEL_COMPRESSION_THRESHOLD (1 * 1024 * 1024)  // 1MB
-#define SMALL_FILE_BATCH_SIZE 100  // Process small files in batches
+// Files at least this large are streamed into the archive in blocks that are
+// deflated on all threads, so no whole-file buffer is ever allocated
+#define STREAMING_COMPRESSION_THRESHOLD (16 * COMPRESS_BLOCK_SIZE)  // 16MB
+
+// Recycled read/compress buffer size (--buffer-size)
+#define DEFAULT_STREAM_BUFFER_SIZE COMPRESS_BLOCK_SIZE          // 1MB
+#define MIN_STREAM_BUFFER_SIZE     (64 * 1024)                  // Must exceed the 32KB window
+#define MAX_STREAM_BUFFER_SIZE     (64 * 1024 * 1024)
+#define STREAM_SLOTS_PER_THREAD    2                            // Blocks in flight per thread
+// Small files are grouped into work units of about this many bytes
+#define SMALL_FILE_BATCH_BYTES (1 * 1024 * 1024)  // 1MB
+#define SMALL_FILE_MIN_COST    (4 * 1024)         // Open/close overhead, counted as bytes
 
 // Memory management constants
 #define MIN_AVAILABLE_MEMORY_MB 512          // Keep at least 512MB free
 #define MAX_CONCURRENT_BYTES (512ULL * 1024 * 1024)  // Max 512MB in-flight for compression
-#define MEMORY_CHECK_INTERVAL 5              // Check memory every N files
+#define MIN_WINDOW_BYTES (32ULL * 1024 * 1024)       // Keep some parallelism under memory pressure
 
 // (unused - using g_tui.large_file_* fields instead)
 
-// Get available system memory in bytes
-static size_t get_available_memory(void) {
-#ifdef __APPLE__
-    mach_port_t host_port = mach_host_self();
-    vm_size_t page_size;
-    host_page_size(host_port, &page_size);
-    
-    vm_statistics64_data_t vm_stat;
-    mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
-    
-    if (host_statistics64(host_port, HOST_VM_INFO64, (host_info64_t)&vm_stat, &count) == KERN_SUCCESS) {
-        // Free + inactive pages can be reclaimed
-        return ((uint64_t)vm_stat.free_count + (uint64_t)vm_stat.inactive_count) * page_size;
-    }
-    return 2ULL * 1024 * 1024 * 1024; // Default 2GB if query fails
-#elif defined(_WIN32)
-    MEMORYSTATUSEX memInfo;
-    memInfo.dwLength = sizeof(MEMORYSTATUSEX);
-    if (GlobalMemoryStatusEx(&memInfo)) {
-        return (size_t)memInfo.ullAvailPhys;
-    }
-    return 2ULL * 1024 * 1024 * 1024;
-#else
-    // Linux
-    struct sysinfo si;
-    if (sysinfo(&si) == 0) {
-        return (size_t)(si.freeram + si.bufferram) * si.mem_unit;
-    }
-    return 2ULL * 1024 * 1024 * 1024;
-#endif
-}
-
 // File entry for the work queue
 typedef struct file_entry {
     char* file_path;
@@ -74,63 +61,72 @@ typedef struct file_entry {
     bool is_directory;
     time_t mtime;
     
-    // Pre-compression result (for large files)
+    // Encoded entry data, ready to be written without re-encoding
     unsigned char* compressed_data;
     size_t compressed_size;
+    uint64_t uncompressed_size;
+    uint32_t crc32;
+    uint16_t method;            // ARCHIVE_METHOD_STORE or ARCHIVE_METHOD_DEFLATE
+    uint32_t mode;              // POSIX mode bits from the opened file (0 if unknown)
+    compress_decision_t decision;
     bool compression_done;
     bool compression_failed;
+    uint64_t inode;             // For --sort inode/disk (0 if not known yet)
     
     struct file_entry* next;
 } file_entry_t;
 
-// Calculate safe batch size based on available memory
-static size_t calculate_safe_batch_size(file_entry_t* large_files[], size_t large_file_count, size_t* batch_memory) {
-    size_t available = get_available_memory();
-    size_t reserve = MIN_AVAILABLE_MEMORY_MB * 1024 * 1024;
-    
-    if (available <= reserve) {
-        // Very low memory - process one file at a time
-        *batch_memory = large_files[0] ? (size_t)large_files[0]->size * 3 : 0; // Estimate 3x for compression buffers
-        return 1;
+// Entries are allocated this many at a time, next to each other in the
+// order they are collected, and released with the queue
+#define ENTRY_SLAB_SIZE 4096
+
+typedef struct entry_slab {
+    struct entry_slab* next;
+    size_t used;
+    file_entry_t entries[ENTRY_SLAB_SIZE];
+} entry_slab_t;
+
+// Memory held per pre-compressed file: its encoded output stays resident until
+// written, while the input is streamed through the worker's recycled buffer
+// or read from a mapping of the file, which costs page cache rather than heap
+static size_t estimate_file_memory(const file_entry_t* entry) {
+    return entry ? (size_t)compressBound((uLong)entry->size) : 0;
+}
+
+// Memory available for encoded output held in flight between the
+// compression workers and the writer. Available memory already honours the
+// cgroup limit; under an explicit --memory-limit half of it goes to the
+// window, leaving the rest for buffers, the index and the writer. Archives
+// written at once (--batch) split it `share` ways.
+static size_t calculate_memory_budget(int share) {
+    uint64_t available = resources_available_memory();
+    uint64_t reserve = MIN_AVAILABLE_MEMORY_MB * 1024ULL * 1024;
+    if (resources_memory_limit() > 0) {
+        reserve = available / 2;
+    }
+    
+    uint64_t usable = available > reserve ? available - reserve : 0;
+    if (share > 1) {
+        usable /= (uint64_t)share;
     }
-    
-    size_t usable = available - reserve;
     if (usable > MAX_CONCURRENT_BYTES) {
         usable = MAX_CONCURRENT_BYTES;
     }
-    
-    // Calculate how many files we can process
-    size_t batch_size = 0;
-    size_t memory_needed = 0;
-    
-    for (size_t i = 0; i < large_file_count && batch_size < large_file_count; i++) {
-        // Estimate memory: file size + compressed buffer (~same size) + overhead
-        size_t file_memory = (size_t)large_files[i]->size * 3;  // Conservative 3x estimate
-        
-        if (memory_needed + file_memory > usable) {
-            break;
-        }
-        
-        memory_needed += file_memory;
-        batch_size++;
-    }
-    
-    // Always process at least one file
-    if (batch_size == 0) {
-        batch_size = 1;
-        memory_needed = large_files[0] ? (size_t)large_files[0]->size * 3 : 0;
+    if (usable < MIN_WINDOW_BYTES) {
+        usable = MIN_WINDOW_BYTES;
     }
-    
-    *batch_memory = memory_needed;
-    return batch_size;
+    return (size_t)usable;
 }
 
-// Thread-safe work queue
+// Thread-safe work queue. Entries live in slabs and their paths in one
+// string pool, so a million files cost a few hundred allocations.
 typedef struct {
     file_entry_t* head;
     file_entry_t* tail;
     size_t count;
     size_t total_bytes;
+    entry_slab_t* slabs;        // Newest first
+    string_pool_t strings;      // file_path and archive_path of every entry
     
 #ifndef _WIN32
     pthread_mutex_t mutex;
@@ -140,25 +136,55 @@ typedef struct {
 } file_queue_t;
 
 // Compression work item for thread pool
-typedef struct compression_work {
-    file_entry_t* entry;
+typedef struct {
+    file_entry_t* entry;        // First entry of the unit
+    size_t entry_count;         // Consecutive entries in the unit (directories are skipped)
+    compress_block_t* block;    // Set when this item is one block of a streamed file
+    bool* completed;            // Optional flag set under the pool lock when done
+    size_t* outstanding;        // Optional count of the run's queued items, kept under the pool lock
     int compression_level;
+    pacer_t* pacer;             // Picks the level of a unit when it runs, and times it (optional)
+    log_config_t* log_config;   // The submitting run's, adopted while the item runs
     int thread_id;              // Which thread is processing this
-    struct compression_work* next;
 } compression_work_t;
 
+// Per-worker work deque. Submissions are spread round-robin across the
+// deques; a worker serves its own deque first and steals from the others
+// once it runs dry. Output is written strictly in order, so both the owner
+// and thieves take the oldest item from the front.
+typedef struct {
+    compression_work_t** items; // Ring buffer
+    size_t head;                // Index of the front item
+    size_t count;
+    size_t capacity;
+    
+#ifndef _WIN32
+    pthread_mutex_t mutex;
+#else
+    CRITICAL_SECTION cs;
+#endif
+} work_deque_t;
+
 // Thread worker context (passed to each thread)
 typedef struct {
     void* pool;                 // Pointer to thread_pool_t
     int thread_id;              // This thread's ID (0-based)
+    unsigned char* read_buffer; // Recycled input buffer (pool->buffer_size bytes)
+    codec_encoder_t* encoder;   // Whole-buffer encoder for pool->codec, made on first use
+    int encoder_level;          // Level it was made for
+    batch_reader_t* reader;     // Small files of a unit are read ahead through it (NULL: one by one)
+    bool reader_tried;
+    batch_read_t reads[BATCH_READER_DEPTH];
 } thread_worker_ctx_t;
 
-// Thread pool for parallel compression
-typedef struct {
-    compression_work_t* work_head;
-    compression_work_t* work_tail;
-    size_t work_count;
-    size_t completed_count;
+// Persistent thread pool for parallel compression: created once per archive,
+// or once per engine or batch (see zip_pool_create()) and then shared by
+// every archive written, and fed by both the entry producer and the writer's
+// streaming pipeline
+struct thread_pool {
+    work_deque_t* deques;       // One per worker
+    size_t next_deque;          // Round-robin submission target
+    int idle_count;             // Workers asleep waiting for work
     bool shutdown;
     
 #ifndef _WIN32
@@ -168,32 +194,17 @@ typedef struct {
     pthread_t* threads;
 #else
     CRITICAL_SECTION cs;
-    HANDLE work_available;
-    HANDLE work_done;
+    HANDLE work_available;      // Semaphore, released once per wakeup
+    CONDITION_VARIABLE work_done;
     HANDLE* threads;
 #endif
     int num_threads;
+    size_t buffer_size;                    // Per-thread read buffer size
+    bool detect_incompressible;            // Store data that would not compress
+    codec_id_t codec;                      // Compression backend (--codec)
+    int users;                             // Runs set up by pool_configure() and not yet released
     thread_worker_ctx_t* worker_contexts;  // Per-thread context
-} thread_pool_t;
-
-// Get number of CPU cores
-static int get_num_cores(void) {
-#ifndef _WIN32
-    #ifdef __APPLE__
-        int count;
-        size_t count_len = sizeof(count);
-        sysctlbyname("hw.logicalcpu", &count, &count_len, NULL, 0);
-        return count > 0 ? count : 4;
-    #else
-        long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
-        return nprocs > 0 ? (int)nprocs : 4;
-    #endif
-#else
-    SYSTEM_INFO sysinfo;
-    GetSystemInfo(&sysinfo);
-    return sysinfo.dwNumberOfProcessors > 0 ? sysinfo.dwNumberOfProcessors : 4;
-#endif
-}
+};
 
 // Initialize file queue
 static void queue_init(file_queue_t* q) {
@@ -201,6 +212,8 @@ static void queue_init(file_queue_t* q) {
     q->tail = NULL;
     q->count = 0;
     q->total_bytes = 0;
+    q->slabs = NULL;
+    string_pool_init(&q->strings);
 #ifndef _WIN32
     pthread_mutex_init(&q->mutex, NULL);
 #else
@@ -210,17 +223,15 @@ static void queue_init(file_queue_t* q) {
 
 // Free file queue
 static void queue_free(file_queue_t* q) {
-    file_entry_t* entry = q->head;
-    while (entry) {
-        file_entry_t* next = entry->next;
-        free(entry->file_path);
-        free(entry->archive_path);
-        if (entry->compressed_data) {
-            free(entry->compressed_data);
-        }
-        free(entry);
-        entry = next;
+    for (file_entry_t* entry = q->head; entry; entry = entry->next) {
+        free(entry->compressed_data);
+    }
+    while (q->slabs) {
+        entry_slab_t* next = q->slabs->next;
+        free(q->slabs);
+        q->slabs = next;
     }
+    string_pool_free(&q->strings);
 #ifndef _WIN32
     pthread_mutex_destroy(&q->mutex);
 #else
@@ -228,6 +239,26 @@ static void queue_free(file_queue_t* q) {
 #endif
 }
 
+// A zeroed entry owned by the queue, with copies of both paths; NULL when
+// out of memory. Not thread-safe, called during collection phase.
+static file_entry_t* queue_new_entry(file_queue_t* q, const char* file_path, const char* archive_path) {
+    if (!q->slabs || q->slabs->used == ENTRY_SLAB_SIZE) {
+        entry_slab_t* slab = malloc(sizeof(entry_slab_t));
+        if (!slab) return NULL;
+        slab->next = q->slabs;
+        slab->used = 0;
+        q->slabs = slab;
+    }
+    
+    file_entry_t* entry = &q->slabs->entries[q->slabs->used];
+    memset(entry, 0, sizeof(file_entry_t));
+    entry->file_path = string_pool_strdup(&q->strings, file_path);
+    entry->archive_path = string_pool_strdup(&q->strings, archive_path);
+    if (!entry->file_path || !entry->archive_path) return NULL;
+    q->slabs->used++;
+    return entry;
+}
+
 // Add entry to queue (not thread-safe, called during collection phase)
 static void queue_push(file_queue_t* q, file_entry_t* entry) {
     entry->next = NULL;
@@ -241,147 +272,524 @@ static void queue_push(file_queue_t* q, file_entry_t* entry) {
     q->total_bytes += entry->size;
 }
 
-// Compress a file's data using zlib
-static int compress_file_data(const char* file_path, unsigned char** out_data, 
-                              size_t* out_size, int level) {
-    FILE* f = fopen(file_path, "rb");
-    if (!f) return -1;
-    
-    // Get file size
-    fseek(f, 0, SEEK_END);
-    long file_size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    
-    if (file_size <= 0) {
-        fclose(f);
+// Open an input file, recording its mode from the open handle. Large files
+// are mapped, so the workers compress straight from the page cache, and
+// files the worker has `preread` are compressed from memory.
+static int open_input_file(file_entry_t* entry, const batch_read_t* preread, input_source_t* src) {
+    if (preread && preread->read) {
+        input_source_open_memory(src, preread->data, preread->size, preread->mode);
+    } else if (input_source_open(src, entry->file_path, true) != 0) {
         return -1;
     }
-    
-    // Read file data
-    unsigned char* input = malloc(file_size);
+#ifndef _WIN32
+    entry->mode = src->mode;
+#endif
+    return 0;
+}
+
+// Decide whether data that is about to be deflated is worth it: by file
+// name first, then by trial-compressing a sample of its leading bytes (read
+// through `buffer` unless the file is mapped, after which the source is
+// rewound). Returns the level to use, 0 when the data should be stored, and
+// records the decision.
+static int choose_level(file_entry_t* entry, input_source_t* src, int level,
+                        unsigned char* buffer, size_t buffer_size) {
+    entry->decision = level == 0 ? COMPRESS_STORED_LEVEL : COMPRESS_DEFLATED;
+    if (level == 0) return 0;
+    
+    if (compress_is_compressed_format(entry->file_path)) {
+        entry->decision = COMPRESS_STORED_EXTENSION;
+        return 0;
+    }
+    
+    // Smaller files are compressed whole and stored if that did not pay off
+    if (src->size <= COMPRESS_PROBE_SIZE) return level;
+    
+    size_t sample = buffer_size < COMPRESS_PROBE_SIZE ? buffer_size : COMPRESS_PROBE_SIZE;
+    size_t n = 0;
+    const unsigned char* data = input_source_next(src, buffer, sample, &n);
+    if (!data || input_source_rewind(src) != 0) return -1;
+    
+    if (compress_probe_incompressible(data, n)) {
+        entry->decision = COMPRESS_STORED_PROBE;
+        return 0;
+    }
+    return level;
+}
+
+// Read a whole file into entry->compressed_data as stored entry data. The
+// data is copied out of a mapping too: it is written later, and must still
+// match its CRC-32 then.
+static int read_stored_data(file_entry_t* entry, input_source_t* src, uint64_t file_size) {
+    unsigned char* data = malloc((size_t)file_size);
+    if (!data) {
+        input_source_close(src);
+        return -1;
+    }
+    size_t n = 0;
+    const unsigned char* input = input_source_next(src, data, (size_t)file_size, &n);
+    if (input && input != data) {
+        memcpy(data, input, n);
+    }
+    input_source_close(src);
     if (!input) {
-        fclose(f);
+        free(data);
         return -1;
     }
-    
-    if (fread(input, 1, file_size, f) != (size_t)file_size) {
-        free(input);
-        fclose(f);
+    entry->compressed_data = data;
+    entry->compressed_size = n;
+    entry->uncompressed_size = n;
+    entry->crc32 = compress_crc32(data, n);
+    entry->method = ARCHIVE_METHOD_STORE;
+    return 0;
+}
+
+// Compress a whole file in one call of a whole-buffer codec, straight from
+// its mapping when it has one. Data that came out no smaller is kept as
+// stored data when `detect` is set.
+static int encode_file_data(file_entry_t* entry, input_source_t* src, bool detect,
+                            codec_encoder_t* encoder) {
+    unsigned char* copy = NULL;
+    if (!input_source_mapped(src)) {
+        copy = malloc((size_t)src->size);
+        if (!copy) {
+            input_source_close(src);
+            return -1;
+        }
+    }
+    size_t n = 0;
+    const unsigned char* input = input_source_next(src, copy, (size_t)src->size, &n);
+    if (!input) {
+        input_source_close(src);
+        free(copy);
         return -1;
     }
-    fclose(f);
     
-    // Allocate output buffer (worst case: slightly larger than input)
-    size_t max_compressed = compressBound(file_size);
-    unsigned char* output = malloc(max_compressed);
-    if (!output) {
-        free(input);
+    size_t capacity = codec_encoder_bound(encoder, n);
+    unsigned char* output = malloc(capacity);
+    size_t output_size = 0;
+    if (!output || codec_encode(encoder, input, n, output, capacity, &output_size) != 0) {
+        input_source_close(src);
+        free(output);
+        free(copy);
         return -1;
     }
     
+    entry->uncompressed_size = n;
+    entry->crc32 = compress_crc32(input, n);
+    if (detect && output_size >= n) {
+        entry->decision = COMPRESS_STORED_EXPANDED;
+        // The output buffer is large enough to hold the input
+        if (!copy) {
+            memcpy(output, input, n);
+            copy = output;
+            output = NULL;
+        }
+        input_source_close(src);
+        free(output);
+        entry->compressed_data = copy;
+        entry->compressed_size = n;
+        entry->method = ARCHIVE_METHOD_STORE;
+        return 0;
+    }
+    input_source_close(src);
+    free(copy);
+    
+    entry->compressed_data = output;
+    entry->compressed_size = output_size;
+    entry->method = codec_encoder_method(encoder);
+    return 0;
+}
+
+// Read a file window by window (through `buffer`, or straight from its
+// mapping) and encode it into entry->compressed_data as a raw deflate stream
+// (or stored data for level 0 / empty files). Only the encoded output is
+// held in memory. With an `encoder` for a whole-buffer codec, files below the
+// streaming threshold are encoded whole with it instead; larger ones only get
+// here when there are no streaming buffers and are deflated by zlib. The
+// CRC-32 and uncompressed size are recorded so the archive writer can emit
+// the entry directly, without another compression pass. With `detect`, data
+// that would not compress is stored instead (see choose_level()). A file in
+// `preread` (optional) is compressed from there rather than opened.
+static int compress_file_data(file_entry_t* entry, const batch_read_t* preread, int level, bool detect,
+                              codec_encoder_t* encoder, unsigned char* buffer, size_t buffer_size) {
+    input_source_t src;
+    if (open_input_file(entry, preread, &src) != 0) return -1;
+    uint64_t file_size = src.size;
+    
+    entry->compressed_data = NULL;
+    entry->compressed_size = 0;
+    entry->uncompressed_size = 0;
+    entry->crc32 = 0;
+    entry->method = ARCHIVE_METHOD_STORE;
+    entry->decision = level == 0 ? COMPRESS_STORED_LEVEL : COMPRESS_DEFLATED;
+    
+    if (file_size == 0) {
+        entry->decision = COMPRESS_STORED_LEVEL;
+        input_source_close(&src);
+        return 0;
+    }
+    
+    if (detect) {
+        level = choose_level(entry, &src, level, buffer, buffer_size);
+        if (level < 0) {
+            input_source_close(&src);
+            return -1;
+        }
+    }
+    
+    // Store only: the file contents are the entry data
+    if (level == 0) {
+        return read_stored_data(entry, &src, file_size);
+    }
+    
+    if (encoder && file_size < STREAMING_COMPRESSION_THRESHOLD) {
+        return encode_file_data(entry, &src, detect, encoder);
+    }
+    
     // Compress using zlib deflate (compatible with ZIP format)
     z_stream strm;
     memset(&strm, 0, sizeof(strm));
     
     // Use raw deflate (-15) for ZIP compatibility
     if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
-        free(input);
-        free(output);
+        input_source_close(&src);
+        return -1;
+    }
+    
+    // Output buffer sized for the worst case; grows if the file grew since stat
+    size_t capacity = deflateBound(&strm, (uLong)file_size);
+    unsigned char* output = malloc(capacity);
+    if (!output) {
+        deflateEnd(&strm);
+        input_source_close(&src);
         return -1;
     }
     
-    strm.next_in = input;
-    strm.avail_in = file_size;
-    strm.next_out = output;
-    strm.avail_out = max_compressed;
+    uLong crc = crc32(0L, Z_NULL, 0);
+    size_t out_pos = 0;
+    uint64_t total_in = 0;
+    int flush = Z_NO_FLUSH;
+    int ret = Z_OK;
+    
+    while (ret != Z_STREAM_END) {
+        if (strm.avail_in == 0 && flush != Z_FINISH) {
+            size_t n = 0;
+            const unsigned char* window = input_source_next(&src, buffer, buffer_size, &n);
+            if (!window) break;
+            crc = codec_crc32((uint32_t)crc, window, n);
+            total_in += n;
+            strm.next_in = (Bytef*)window;
+            strm.avail_in = (uInt)n;
+            flush = n < buffer_size ? Z_FINISH : Z_NO_FLUSH;
+            input_source_release(&src, total_in - n);
+        }
+        
+        if (out_pos == capacity) {
+            size_t new_capacity = capacity + capacity / 2 + buffer_size;
+            unsigned char* grown = realloc(output, new_capacity);
+            if (!grown) break;
+            output = grown;
+            capacity = new_capacity;
+        }
+        
+        size_t room = capacity - out_pos;
+        strm.next_out = output + out_pos;
+        strm.avail_out = room > (1u << 30) ? (1u << 30) : (uInt)room;
+        uInt before = strm.avail_out;
+        ret = deflate(&strm, flush);
+        out_pos += before - strm.avail_out;
+        if (ret == Z_STREAM_ERROR) break;
+    }
+    
+    deflateEnd(&strm);
     
-    int ret = deflate(&strm, Z_FINISH);
     if (ret != Z_STREAM_END) {
-        deflateEnd(&strm);
-        free(input);
+        input_source_close(&src);
         free(output);
         return -1;
     }
     
-    *out_size = strm.total_out;
-    *out_data = output;
+    // Deflate made it no smaller: read it again as stored data
+    if (detect && out_pos >= total_in) {
+        free(output);
+        entry->decision = COMPRESS_STORED_EXPANDED;
+        if (input_source_rewind(&src) != 0) {
+            input_source_close(&src);
+            return -1;
+        }
+        return read_stored_data(entry, &src, total_in);
+    }
+    input_source_close(&src);
     
-    deflateEnd(&strm);
-    free(input);
+    entry->compressed_size = out_pos;
+    entry->compressed_data = output;
+    entry->uncompressed_size = total_in;
+    entry->crc32 = (uint32_t)crc;
+    entry->method = ARCHIVE_METHOD_DEFLATE;
     
     return 0;
 }
 
+// What the files of a paced unit add up to (see pacer_record())
+typedef struct {
+    uint64_t bytes;             // Finished
+    uint64_t input;             // Compressed at the level picked, or stored by it
+    uint64_t output;
+} paced_bytes_t;
+
+// Count a file the pacer's `level` was used for. Level 0 stores it, and
+// says so; files stored for their type or contents stay out of the model.
+static void count_paced_file(paced_bytes_t* paced, file_entry_t* f, int level) {
+    if (level == 0 && f->decision == COMPRESS_STORED_LEVEL && f->uncompressed_size > 0) {
+        f->decision = COMPRESS_STORED_SCHEDULE;
+    }
+    paced->bytes += f->uncompressed_size;
+    if (f->decision == COMPRESS_DEFLATED || f->decision == COMPRESS_STORED_SCHEDULE) {
+        paced->input += f->uncompressed_size;
+        paced->output += f->compressed_size;
+    }
+}
+
+// Read the files of a unit that are small enough to be read rather than
+// mapped in one batch, into ctx->reads by position in `files`. Files left
+// out, or that could not be read, are opened again by compress_file_data().
+static bool read_ahead(thread_worker_ctx_t* ctx, file_entry_t* const* files, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        ctx->reads[i].path = files[i]->file_path;
+        ctx->reads[i].max_size = files[i]->size < INPUT_MAP_MIN_SIZE ? INPUT_MAP_MIN_SIZE - 1 : 0;
+    }
+    return batch_reader_read(ctx->reader, ctx->reads, count) > 0;
+}
+
+// Run one work item: either a unit of consecutive files, or one block of a
+// file that is being compressed across all threads
+static void run_work_item(compression_work_t* work, thread_worker_ctx_t* ctx) {
+    thread_pool_t* pool = (thread_pool_t*)ctx->pool;
+    int thread_id = ctx->thread_id;
+    file_entry_t* entry = work->entry;
+    
+    // Update TUI with this thread's current file
+    const char* display_name = strrchr(entry->file_path, '/');
+    if (!display_name) display_name = strrchr(entry->file_path, '\\');
+    if (display_name) display_name++;
+    else display_name = entry->file_path;
+    
+    pacer_sample_t start;
+    if (work->pacer) pacer_sample(&start);
+    
+    if (work->block) {
+        compress_block_t* block = work->block;
+        tui_update_thread_progress(thread_id, display_name, block->input_size, 0.0, true);
+        compress_block(block);
+        tui_update_thread_progress(thread_id, display_name, block->input_size, 100.0, true);
+        if (work->pacer) {
+            pacer_record(work->pacer, block->level, block->input_size, block->input_size,
+                         block->failed ? block->input_size : block->output_size, &start);
+        }
+        return;
+    }
+    
+    int level = work->pacer ? pacer_level(work->pacer) : work->compression_level;
+    
+    // Read buffer, encoder and batch reader are set up on first use and
+    // recycled for every file this thread compresses; a paced run remakes
+    // the encoder when its level changes
+    if (!ctx->read_buffer) {
+        ctx->read_buffer = malloc(pool->buffer_size);
+    }
+    if (ctx->encoder && level > 0 && ctx->encoder_level != level) {
+        codec_encoder_free(ctx->encoder);
+        ctx->encoder = NULL;
+    }
+    if (!ctx->encoder && pool->codec != CODEC_ZLIB && level > 0) {
+        ctx->encoder = codec_encoder_create(pool->codec, level);
+        ctx->encoder_level = level;
+    }
+    if (!ctx->reader_tried) {
+        ctx->reader = batch_reader_create();
+        ctx->reader_tried = true;
+    }
+    
+    // Files are taken BATCH_READER_DEPTH at a time and read ahead together
+    file_entry_t* e = entry;
+    size_t left = work->entry_count;
+    paced_bytes_t paced = {0};
+    while (e && left > 0) {
+        file_entry_t* files[BATCH_READER_DEPTH];
+        size_t count = 0;
+        for (; e && left > 0 && count < BATCH_READER_DEPTH; e = e->next, left--) {
+            if (!e->is_directory) files[count++] = e;
+        }
+        bool preread = ctx->reader && count > 1 && read_ahead(ctx, files, count);
+        
+        for (size_t i = 0; i < count; i++) {
+            file_entry_t* f = files[i];
+            if (f == entry || f->size >= PARALLEL_COMPRESSION_THRESHOLD) {
+                tui_update_thread_progress(thread_id, display_name, f->size, 0.0, true);
+            }
+            
+            int result = ctx->read_buffer
+                ? compress_file_data(f, preread ? &ctx->reads[i] : NULL, level,
+                                     pool->detect_incompressible, ctx->encoder, ctx->read_buffer,
+                                     pool->buffer_size)
+                : -1;
+            
+            f->compression_failed = (result != 0);
+            f->compression_done = true;
+            if (work->pacer && result == 0) count_paced_file(&paced, f, level);
+            if (preread) {
+                free(ctx->reads[i].data);
+                ctx->reads[i].data = NULL;
+            }
+        }
+    }
+    
+    if (work->pacer) {
+        pacer_record(work->pacer, level, paced.bytes, paced.input, paced.output, &start);
+    }
+    
+    // Mark as complete (100%)
+    tui_update_thread_progress(thread_id, display_name, entry->size, 100.0, true);
+}
+
+static void deque_init(work_deque_t* d) {
+    memset(d, 0, sizeof(work_deque_t));
+#ifndef _WIN32
+    pthread_mutex_init(&d->mutex, NULL);
+#else
+    InitializeCriticalSection(&d->cs);
+#endif
+}
+
+static void deque_destroy(work_deque_t* d) {
+    // Items left behind (only possible after an allocation failure) are dropped
+    for (size_t i = 0; i < d->count; i++) {
+        free(d->items[(d->head + i) % d->capacity]);
+    }
+    free(d->items);
+#ifndef _WIN32
+    pthread_mutex_destroy(&d->mutex);
+#else
+    DeleteCriticalSection(&d->cs);
+#endif
+}
+
+static void deque_lock(work_deque_t* d) {
+#ifndef _WIN32
+    pthread_mutex_lock(&d->mutex);
+#else
+    EnterCriticalSection(&d->cs);
+#endif
+}
+
+static void deque_unlock(work_deque_t* d) {
+#ifndef _WIN32
+    pthread_mutex_unlock(&d->mutex);
+#else
+    LeaveCriticalSection(&d->cs);
+#endif
+}
+
+// Append a work item, growing the ring when full
+static bool deque_push(work_deque_t* d, compression_work_t* work) {
+    deque_lock(d);
+    if (d->count == d->capacity) {
+        size_t capacity = d->capacity ? d->capacity * 2 : 64;
+        compression_work_t** items = malloc(capacity * sizeof(compression_work_t*));
+        if (!items) {
+            deque_unlock(d);
+            return false;
+        }
+        for (size_t i = 0; i < d->count; i++) {
+            items[i] = d->items[(d->head + i) % d->capacity];
+        }
+        free(d->items);
+        d->items = items;
+        d->capacity = capacity;
+        d->head = 0;
+    }
+    d->items[(d->head + d->count) % d->capacity] = work;
+    d->count++;
+    deque_unlock(d);
+    return true;
+}
+
+// Remove the oldest work item, or return NULL if the deque is empty
+static compression_work_t* deque_pop(work_deque_t* d) {
+    compression_work_t* work = NULL;
+    deque_lock(d);
+    if (d->count > 0) {
+        work = d->items[d->head];
+        d->head = (d->head + 1) % d->capacity;
+        d->count--;
+    }
+    deque_unlock(d);
+    return work;
+}
+
+// Take work from this worker's own deque, else steal from the others
+static compression_work_t* pool_take_work(thread_pool_t* pool, int thread_id) {
+    compression_work_t* work = deque_pop(&pool->deques[thread_id]);
+    for (int i = 1; !work && i < pool->num_threads; i++) {
+        work = deque_pop(&pool->deques[(thread_id + i) % pool->num_threads]);
+    }
+    return work;
+}
+
 // Worker thread function for parallel compression
 #ifndef _WIN32
 static void* compression_worker(void* arg) {
     thread_worker_ctx_t* ctx = (thread_worker_ctx_t*)arg;
     thread_pool_t* pool = (thread_pool_t*)ctx->pool;
     int thread_id = ctx->thread_id;
+    metrics_thread_begin("compress", thread_id);
     
     while (1) {
-        pthread_mutex_lock(&pool->mutex);
-        
-        // Mark thread as idle
-        tui_update_thread_progress(thread_id, NULL, 0, 0, false);
-        
-        // Wait for work
-        while (!pool->work_head && !pool->shutdown) {
-            pthread_cond_wait(&pool->work_available, &pool->mutex);
-        }
-        
-        if (pool->shutdown && !pool->work_head) {
-            pthread_mutex_unlock(&pool->mutex);
-            break;
-        }
-        
-        // Get work item
-        compression_work_t* work = pool->work_head;
-        if (work) {
-            pool->work_head = work->next;
-            if (!pool->work_head) {
-                pool->work_tail = NULL;
-            }
-            pool->work_count--;
-        }
-        
-        pthread_mutex_unlock(&pool->mutex);
+        compression_work_t* work = pool_take_work(pool, thread_id);
         
-        if (work) {
-            // Perform compression
-            file_entry_t* entry = work->entry;
-            
-            // Update TUI with this thread's current file
-            const char* display_name = strrchr(entry->file_path, '/');
-            if (!display_name) display_name = strrchr(entry->file_path, '\\');
-            if (display_name) display_name++;
-            else display_name = entry->file_path;
+        if (!work) {
+            // Mark thread as idle
+            tui_update_thread_progress(thread_id, NULL, 0, 0, false);
             
-            tui_update_thread_progress(thread_id, display_name, entry->size, 0.0, true);
-            
-            int result = compress_file_data(entry->file_path, 
-                                           &entry->compressed_data,
-                                           &entry->compressed_size,
-                                           work->compression_level);
-            
-            // Mark as complete (100%)
-            tui_update_thread_progress(thread_id, display_name, entry->size, 100.0, true);
+            uint64_t idle_start = metrics_start();
+            pthread_mutex_lock(&pool->mutex);
             
-            entry->compression_failed = (result != 0);
-            entry->compression_done = true;
+            // Rescan under the pool lock: submitters push while holding it,
+            // so no wakeup can be missed between the scan and the wait
+            pool->idle_count++;
+            while (!(work = pool_take_work(pool, thread_id)) && !pool->shutdown) {
+                pthread_cond_wait(&pool->work_available, &pool->mutex);
+            }
+            pool->idle_count--;
             
-            // Signal completion
-            pthread_mutex_lock(&pool->mutex);
-            pool->completed_count++;
-            pthread_cond_signal(&pool->work_done);
             pthread_mutex_unlock(&pool->mutex);
+            metrics_stop(METRICS_TIMER_IDLE, idle_start, NULL);
             
-            free(work);
+            // Shutdown with every deque drained
+            if (!work) break;
         }
+        
+        work->thread_id = thread_id;
+        uint64_t busy_start = metrics_start();
+        log_config_use(work->log_config);
+        run_work_item(work, ctx);
+        log_config_use(NULL);
+        metrics_stop(METRICS_TIMER_BUSY, busy_start, work->block ? "deflate block" : "compress");
+        
+        // Signal completion
+        pthread_mutex_lock(&pool->mutex);
+        if (work->completed) *work->completed = true;
+        if (work->outstanding) (*work->outstanding)--;
+        pthread_cond_broadcast(&pool->work_done);
+        pthread_mutex_unlock(&pool->mutex);
+        
+        free(work);
     }
     
     // Mark thread as inactive on exit
     tui_update_thread_progress(thread_id, NULL, 0, 0, false);
+    metrics_thread_end();
     
     return NULL;
 }
@@ -390,87 +798,71 @@ static DWORD WINAPI compression_worker(LPVOID arg) {
     thread_worker_ctx_t* ctx = (thread_worker_ctx_t*)arg;
     thread_pool_t* pool = (thread_pool_t*)ctx->pool;
     int thread_id = ctx->thread_id;
+    metrics_thread_begin("compress", thread_id);
     
     while (1) {
-        EnterCriticalSection(&pool->cs);
-        
-        // Mark thread as idle
-        tui_update_thread_progress(thread_id, NULL, 0, 0, false);
+        compression_work_t* work = pool_take_work(pool, thread_id);
         
-        while (!pool->work_head && !pool->shutdown) {
-            LeaveCriticalSection(&pool->cs);
-            WaitForSingleObject(pool->work_available, INFINITE);
+        if (!work) {
+            // Mark thread as idle
+            tui_update_thread_progress(thread_id, NULL, 0, 0, false);
+            
+            uint64_t idle_start = metrics_start();
             EnterCriticalSection(&pool->cs);
-        }
-        
-        if (pool->shutdown && !pool->work_head) {
+            
+            pool->idle_count++;
+            while (!(work = pool_take_work(pool, thread_id)) && !pool->shutdown) {
+                LeaveCriticalSection(&pool->cs);
+                WaitForSingleObject(pool->work_available, INFINITE);
+                EnterCriticalSection(&pool->cs);
+            }
+            pool->idle_count--;
+            
             LeaveCriticalSection(&pool->cs);
-            break;
+            metrics_stop(METRICS_TIMER_IDLE, idle_start, NULL);
+            
+            if (!work) break;
         }
         
-        compression_work_t* work = pool->work_head;
-        if (work) {
-            pool->work_head = work->next;
-            if (!pool->work_head) {
-                pool->work_tail = NULL;
-            }
-            pool->work_count--;
-        }
+        work->thread_id = thread_id;
+        uint64_t busy_start = metrics_start();
+        log_config_use(work->log_config);
+        run_work_item(work, ctx);
+        log_config_use(NULL);
+        metrics_stop(METRICS_TIMER_BUSY, busy_start, work->block ? "deflate block" : "compress");
         
+        EnterCriticalSection(&pool->cs);
+        if (work->completed) *work->completed = true;
+        if (work->outstanding) (*work->outstanding)--;
+        WakeAllConditionVariable(&pool->work_done);
         LeaveCriticalSection(&pool->cs);
         
-        if (work) {
-            file_entry_t* entry = work->entry;
-            
-            // Update TUI with this thread's current file
-            const char* display_name = strrchr(entry->file_path, '/');
-            if (!display_name) display_name = strrchr(entry->file_path, '\\');
-            if (display_name) display_name++;
-            else display_name = entry->file_path;
-            
-            tui_update_thread_progress(thread_id, display_name, entry->size, 0.0, true);
-            
-            int result = compress_file_data(entry->file_path,
-                                           &entry->compressed_data,
-                                           &entry->compressed_size,
-                                           work->compression_level);
-            
-            // Mark as complete (100%)
-            tui_update_thread_progress(thread_id, display_name, entry->size, 100.0, true);
-            
-            entry->compression_failed = (result != 0);
-            entry->compression_done = true;
-            
-            EnterCriticalSection(&pool->cs);
-            pool->completed_count++;
-            SetEvent(pool->work_done);
-            LeaveCriticalSection(&pool->cs);
-            
-            free(work);
-        }
+        free(work);
     }
     
     // Mark thread as inactive on exit
     tui_update_thread_progress(thread_id, NULL, 0, 0, false);
+    metrics_thread_end();
     
     return 0;
 }
 #endif
 
-// Initialize thread pool
+// Initialize thread pool; pool_configure() sets it up for each run
 static thread_pool_t* pool_create(int num_threads) {
     thread_pool_t* pool = calloc(1, sizeof(thread_pool_t));
     if (!pool) return NULL;
     
-    pool->num_threads = num_threads > 0 ? num_threads : get_num_cores();
-    // Cap at reasonable maximum
-    if (pool->num_threads > 16) pool->num_threads = 16;
+    pool->num_threads = num_threads > 0 ? num_threads : resources_cpu_count();
     // Need at least 1 thread
     if (pool->num_threads < 1) pool->num_threads = 1;
     
-    // Allocate per-thread contexts
+    // Allocate per-thread contexts and deques
     pool->worker_contexts = calloc(pool->num_threads, sizeof(thread_worker_ctx_t));
-    if (!pool->worker_contexts) {
+    pool->deques = calloc(pool->num_threads, sizeof(work_deque_t));
+    if (!pool->worker_contexts || !pool->deques) {
+        free(pool->worker_contexts);
+        free(pool->deques);
         free(pool);
         return NULL;
     }
@@ -478,6 +870,7 @@ static thread_pool_t* pool_create(int num_threads) {
     for (int i = 0; i < pool->num_threads; i++) {
         pool->worker_contexts[i].pool = pool;
         pool->worker_contexts[i].thread_id = i;
+        deque_init(&pool->deques[i]);
     }
     
 #ifndef _WIN32
@@ -491,8 +884,8 @@ static thread_pool_t* pool_create(int num_threads) {
     }
 #else
     InitializeCriticalSection(&pool->cs);
-    pool->work_available = CreateEvent(NULL, FALSE, FALSE, NULL);
-    pool->work_done = CreateEvent(NULL, FALSE, FALSE, NULL);
+    pool->work_available = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+    InitializeConditionVariable(&pool->work_done);
     
     pool->threads = malloc(sizeof(HANDLE) * pool->num_threads);
     for (int i = 0; i < pool->num_threads; i++) {
@@ -503,11 +896,10 @@ static thread_pool_t* pool_create(int num_threads) {
     return pool;
 }
 
-// Add work to thread pool
-static void pool_add_work(thread_pool_t* pool, file_entry_t* entry, int compression_level) {
-    compression_work_t* work = calloc(1, sizeof(compression_work_t));
-    work->entry = entry;
-    work->compression_level = compression_level;
+// Queue a work item on the next worker's deque; returns false (and frees
+// the item) if it could not be queued
+static bool pool_push_work(thread_pool_t* pool, compression_work_t* work) {
+    if (!work) return false;
     
 #ifndef _WIN32
     pthread_mutex_lock(&pool->mutex);
@@ -515,84 +907,214 @@ static void pool_add_work(thread_pool_t* pool, file_entry_t* entry, int compress
     EnterCriticalSection(&pool->cs);
 #endif
     
-    if (pool->work_tail) {
-        pool->work_tail->next = work;
-    } else {
-        pool->work_head = work;
+    work_deque_t* deque = &pool->deques[pool->next_deque];
+    pool->next_deque = (pool->next_deque + 1) % (size_t)pool->num_threads;
+    bool queued = deque_push(deque, work);
+    if (queued && work->outstanding) (*work->outstanding)++;
+    if (queued && g_metrics_enabled) {
+        size_t depth = 0;
+        for (int i = 0; i < pool->num_threads; i++) {
+            deque_lock(&pool->deques[i]);
+            depth += pool->deques[i].count;
+            deque_unlock(&pool->deques[i]);
+        }
+        metrics_sample_queue(depth);
+    }
+    
+#ifndef _WIN32
+    if (queued && pool->idle_count > 0) {
+        pthread_cond_signal(&pool->work_available);
     }
-    pool->work_tail = work;
-    pool->work_count++;
+    pthread_mutex_unlock(&pool->mutex);
+#else
+    if (queued && pool->idle_count > 0) {
+        ReleaseSemaphore(pool->work_available, 1, NULL);
+    }
+    LeaveCriticalSection(&pool->cs);
+#endif
     
+    if (!queued) {
+        free(work);
+    }
+    return queued;
+}
+
+// Mark an item done that never reached a worker, waking anyone waiting on it
+static void pool_mark_done(thread_pool_t* pool, bool* completed) {
 #ifndef _WIN32
-    pthread_cond_signal(&pool->work_available);
+    pthread_mutex_lock(&pool->mutex);
+    *completed = true;
+    pthread_cond_broadcast(&pool->work_done);
     pthread_mutex_unlock(&pool->mutex);
 #else
-    SetEvent(pool->work_available);
+    EnterCriticalSection(&pool->cs);
+    *completed = true;
+    WakeAllConditionVariable(&pool->work_done);
     LeaveCriticalSection(&pool->cs);
 #endif
 }
 
-// Wait for all work to complete
-static void pool_wait(thread_pool_t* pool, size_t expected_count) {
+// Add a unit of `count` consecutive entries, starting at `entry`, to the
+// pool; `completed` (optional) is set once every file in it is compressed,
+// and `outstanding` counts the run's units until then. Files of a unit that
+// could not be queued are compressed by the writer.
+static void pool_add_unit(thread_pool_t* pool, file_entry_t* entry, size_t count, int compression_level,
+                          pacer_t* pacer, bool* completed, size_t* outstanding) {
+    compression_work_t* work = calloc(1, sizeof(compression_work_t));
+    if (work) {
+        work->entry = entry;
+        work->entry_count = count;
+        work->completed = completed;
+        work->outstanding = outstanding;
+        work->compression_level = compression_level;
+        work->pacer = pacer;
+        work->log_config = log_config_current();
+    }
+    if (!pool_push_work(pool, work) && completed) {
+        pool_mark_done(pool, completed);
+    }
+}
+
+// Add one block of a streamed file to the thread pool; `completed` is set
+// once the block has been compressed, and the `pacer` (optional) times it
+static void pool_add_block(thread_pool_t* pool, file_entry_t* entry, compress_block_t* block, pacer_t* pacer,
+                           bool* completed) {
+    compression_work_t* work = calloc(1, sizeof(compression_work_t));
+    if (work) {
+        work->entry = entry;
+        work->block = block;
+        work->completed = completed;
+        work->compression_level = block->level;
+        work->pacer = pacer;
+        work->log_config = log_config_current();
+    }
+    if (!pool_push_work(pool, work)) {
+        // Compress on the calling thread instead
+        compress_block(block);
+        if (pacer) {
+            pacer_record(pacer, block->level, block->input_size, block->input_size,
+                         block->failed ? block->input_size : block->output_size, NULL);
+        }
+        pool_mark_done(pool, completed);
+    }
+}
+
+// Wait until one specific work item has finished
+static void pool_wait_item(thread_pool_t* pool, const bool* completed) {
 #ifndef _WIN32
     pthread_mutex_lock(&pool->mutex);
-    while (pool->completed_count < expected_count) {
+    while (!*completed) {
         pthread_cond_wait(&pool->work_done, &pool->mutex);
     }
     pthread_mutex_unlock(&pool->mutex);
 #else
     EnterCriticalSection(&pool->cs);
-    while (pool->completed_count < expected_count) {
-        LeaveCriticalSection(&pool->cs);
-        WaitForSingleObject(pool->work_done, INFINITE);
-        EnterCriticalSection(&pool->cs);
+    while (!*completed) {
+        SleepConditionVariableCS(&pool->work_done, &pool->cs, INFINITE);
     }
     LeaveCriticalSection(&pool->cs);
 #endif
 }
 
-// Check if all work is done (non-blocking)
-static bool pool_is_done(thread_pool_t* pool, size_t expected_count) {
-    bool done;
+// Wait until a run's queued units have all finished, so the entries and
+// slots they point to can be released. Other runs sharing the pool keep
+// going.
+static void pool_wait_units(thread_pool_t* pool, const size_t* outstanding) {
 #ifndef _WIN32
     pthread_mutex_lock(&pool->mutex);
-    done = pool->completed_count >= expected_count;
+    while (*outstanding > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->mutex);
+    }
     pthread_mutex_unlock(&pool->mutex);
 #else
     EnterCriticalSection(&pool->cs);
-    done = pool->completed_count >= expected_count;
+    while (*outstanding > 0) {
+        SleepConditionVariableCS(&pool->work_done, &pool->cs, INFINITE);
+    }
     LeaveCriticalSection(&pool->cs);
 #endif
-    return done;
 }
 
-// Destroy thread pool
-static void pool_destroy(thread_pool_t* pool) {
-    if (!pool) return;
-    
+// Set the pool up for a run, which uses it until pool_release(). Workers
+// keep their read buffers and encoders from run to run while the buffer
+// size, codec and incompressible-data detection stay the same, so runs with
+// the same settings share the pool at once. Other settings are only taken
+// while no run uses the pool: nothing is queued then, so no worker touches
+// its context. Returns false, with the pool left alone, when runs with other
+// settings are using it.
+static bool pool_configure(thread_pool_t* pool, size_t buffer_size, bool detect_incompressible,
+                           codec_id_t codec) {
 #ifndef _WIN32
     pthread_mutex_lock(&pool->mutex);
-    pool->shutdown = true;
-    pthread_cond_broadcast(&pool->work_available);
-    pthread_mutex_unlock(&pool->mutex);
-    
-    for (int i = 0; i < pool->num_threads; i++) {
-        pthread_join(pool->threads[i], NULL);
-    }
-    
-    pthread_mutex_destroy(&pool->mutex);
-    pthread_cond_destroy(&pool->work_available);
-    pthread_cond_destroy(&pool->work_done);
 #else
     EnterCriticalSection(&pool->cs);
-    pool->shutdown = true;
-    LeaveCriticalSection(&pool->cs);
+#endif
+    bool same = buffer_size == pool->buffer_size && detect_incompressible == pool->detect_incompressible &&
+                codec == pool->codec;
+    if (!same && pool->users == 0) {
+        for (int i = 0; i < pool->num_threads; i++) {
+            thread_worker_ctx_t* ctx = &pool->worker_contexts[i];
+            if (buffer_size != pool->buffer_size) {
+                free(ctx->read_buffer);
+                ctx->read_buffer = NULL;
+            }
+            if (codec != pool->codec) {
+                codec_encoder_free(ctx->encoder);
+                ctx->encoder = NULL;
+            }
+        }
+        pool->buffer_size = buffer_size;
+        pool->detect_incompressible = detect_incompressible;
+        pool->codec = codec;
+        same = true;
+    }
+    if (same) pool->users++;
+#ifndef _WIN32
+    pthread_mutex_unlock(&pool->mutex);
+#else
+    LeaveCriticalSection(&pool->cs);
+#endif
+    return same;
+}
+
+// End a run's use of the pool; its units must all have finished
+static void pool_release(thread_pool_t* pool) {
+#ifndef _WIN32
+    pthread_mutex_lock(&pool->mutex);
+    pool->users--;
+    pthread_mutex_unlock(&pool->mutex);
+#else
+    EnterCriticalSection(&pool->cs);
+    pool->users--;
+    LeaveCriticalSection(&pool->cs);
+#endif
+}
+
+// Destroy thread pool. Queued work is finished before the workers exit.
+static void pool_destroy(thread_pool_t* pool) {
+    if (!pool) return;
+    
+#ifndef _WIN32
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->mutex);
     
-    // Wake all threads
     for (int i = 0; i < pool->num_threads; i++) {
-        SetEvent(pool->work_available);
+        pthread_join(pool->threads[i], NULL);
     }
     
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_cond_destroy(&pool->work_done);
+#else
+    EnterCriticalSection(&pool->cs);
+    pool->shutdown = true;
+    LeaveCriticalSection(&pool->cs);
+    
+    // Wake all threads
+    ReleaseSemaphore(pool->work_available, pool->num_threads, NULL);
+    
     WaitForMultipleObjects(pool->num_threads, pool->threads, TRUE, INFINITE);
     
     for (int i = 0; i < pool->num_threads; i++) {
@@ -601,31 +1123,287 @@ static void pool_destroy(thread_pool_t* pool) {
     
     DeleteCriticalSection(&pool->cs);
     CloseHandle(pool->work_available);
-    CloseHandle(pool->work_done);
 #endif
     
+    for (int i = 0; i < pool->num_threads; i++) {
+        free(pool->worker_contexts[i].read_buffer);
+        codec_encoder_free(pool->worker_contexts[i].encoder);
+        batch_reader_free(pool->worker_contexts[i].reader);
+        deque_destroy(&pool->deques[i]);
+    }
     free(pool->threads);
+    free(pool->deques);
     free(pool->worker_contexts);
     free(pool);
 }
 
+thread_pool_t* zip_pool_create(int num_threads) {
+    return pool_create(num_threads);
+}
+
+void zip_pool_destroy(thread_pool_t* pool) {
+    pool_destroy(pool);
+}
+
+// Size of every recycled read/compress buffer of a run with `opts`
+static size_t stream_buffer_size(const options_t* opts) {
+    size_t buffer_size = opts->buffer_size ? opts->buffer_size : DEFAULT_STREAM_BUFFER_SIZE;
+    if (buffer_size < MIN_STREAM_BUFFER_SIZE) buffer_size = MIN_STREAM_BUFFER_SIZE;
+    if (buffer_size > MAX_STREAM_BUFFER_SIZE) buffer_size = MAX_STREAM_BUFFER_SIZE;
+    return buffer_size;
+}
+
+bool zip_pool_configure(thread_pool_t* pool, const options_t* opts) {
+    if (!pool_configure(pool, stream_buffer_size(opts), !opts->always_deflate, opts->codec)) return false;
+    pool_release(pool);
+    return true;
+}
+
+// One block slot of the streaming pipeline. Slots and their buffers are
+// allocated once per archive and recycled for every block of every streamed
+// file, so memory stays at slots x buffer size regardless of file size.
+typedef struct {
+    compress_block_t block;
+    unsigned char* input;       // buffer_size bytes read from the file
+    unsigned char* window;      // Copy of the preceding 32KB, primes the block
+    unsigned char* output;      // compress_block_bound(buffer_size) bytes
+    bool completed;
+} stream_slot_t;
+
+typedef struct {
+    stream_slot_t* slots;
+    size_t slot_count;
+    size_t buffer_size;
+} stream_buffers_t;
+
+static void stream_buffers_free(stream_buffers_t* buffers) {
+    for (size_t i = 0; i < buffers->slot_count; i++) {
+        free(buffers->slots[i].input);
+        free(buffers->slots[i].window);
+        free(buffers->slots[i].output);
+    }
+    free(buffers->slots);
+    buffers->slots = NULL;
+    buffers->slot_count = 0;
+}
+
+static int stream_buffers_init(stream_buffers_t* buffers, size_t slot_count, size_t buffer_size) {
+    buffers->slots = calloc(slot_count, sizeof(stream_slot_t));
+    buffers->slot_count = slot_count;
+    buffers->buffer_size = buffer_size;
+    if (!buffers->slots) {
+        buffers->slot_count = 0;
+        return -1;
+    }
+    
+    size_t output_capacity = compress_block_bound(buffer_size);
+    for (size_t i = 0; i < slot_count; i++) {
+        stream_slot_t* slot = &buffers->slots[i];
+        slot->input = malloc(buffer_size);
+        slot->window = malloc(COMPRESS_WINDOW_SIZE);
+        slot->output = malloc(output_capacity);
+        if (!slot->input || !slot->window || !slot->output) {
+            stream_buffers_free(buffers);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Empty final deflate block (BFINAL, fixed Huffman, end-of-block only).
+// Streamed blocks all end with a sync flush, since EOF is only known after
+// the last read; this terminates the stream.
+static const unsigned char DEFLATE_FINAL_EMPTY_BLOCK[2] = { 0x03, 0x00 };
+
+// Level of the next block of a paced stream: deflate can store a block
+// inside the stream, a Zstandard frame is always compressed
+static int paced_block_level(pacer_t* pacer, codec_id_t codec) {
+    int level = pacer_level(pacer);
+    return codec == CODEC_ZSTD && level < 1 ? 1 : level;
+}
+
+// Compress one file straight into the archive, pigz-style: blocks are read
+// into recycled slots, primed with the previous block's window, deflated on
+// the pool threads and written in order as they complete. A mapped file is
+// not read into the slots at all: blocks and their windows point into the
+// mapping, and pages behind the blocks in flight are released as they go. The local header
+// is patched with the CRC and sizes once the stream ends. With Zstandard
+// each block becomes a frame of its own; libdeflate cannot continue a stream
+// across blocks, so its files are streamed through zlib. A `pacer`
+// (optional) picks the level of the file and of each block.
+static int stream_file_entry(archive_writer_t* writer, thread_pool_t* pool, stream_buffers_t* buffers,
+                             file_entry_t* entry, int level, bool detect, codec_id_t codec, pacer_t* pacer) {
+    input_source_t src;
+    if (open_input_file(entry, NULL, &src) != 0) {
+        log_message(LOG_ERROR, "Error reading file '%s'\n", entry->file_path);
+        return EXIT_FILE_ERROR;
+    }
+    uint64_t file_size = src.size;
+    bool mapped = input_source_mapped(&src);
+    
+    // A paced run picks the file's level, then each block's as it goes
+    bool paced_store = false;
+    if (pacer && level != 0) {
+        level = pacer_level(pacer);
+        paced_store = level == 0;
+    }
+    
+    // The first slot is idle between files, so it holds the sample
+    entry->decision = level == 0 ? COMPRESS_STORED_LEVEL : COMPRESS_DEFLATED;
+    if (detect) {
+        level = choose_level(entry, &src, level, buffers->slots[0].input, buffers->buffer_size);
+        if (level < 0) {
+            log_message(LOG_ERROR, "Error reading file '%s'\n", entry->file_path);
+            input_source_close(&src);
+            return EXIT_FILE_ERROR;
+        }
+    }
+    if (paced_store) entry->decision = COMPRESS_STORED_SCHEDULE;
+    
+    if (codec != CODEC_ZSTD) codec = CODEC_ZLIB;
+    archive_entry_info_t info = {
+        .name = entry->archive_path,
+        .method = level == 0 ? ARCHIVE_METHOD_STORE : codec_method(codec),
+        .uncompressed_size = file_size,
+        .mtime = entry->mtime,
+        .mode = entry->mode
+    };
+    
+    int result = archive_writer_begin_deferred_entry(writer, &info);
+    if (result != EXIT_SUCCESS) {
+        input_source_close(&src);
+        return result;
+    }
+    
+    uLong crc = crc32(0L, Z_NULL, 0);
+    uint64_t total_in = 0;
+    size_t buffer_size = buffers->buffer_size;
+    size_t slot_count = buffers->slot_count;
+    size_t next_read = 0;       // Sequence number of the next block to read
+    size_t next_write = 0;      // Sequence number of the next block to write
+    bool eof = false;
+    src.readahead = (uint64_t)slot_count * buffer_size;
+    
+    while (result == EXIT_SUCCESS && (!eof || next_write < next_read)) {
+        // Keep every slot busy while there is input left
+        while (!eof && next_read - next_write < slot_count) {
+            stream_slot_t* slot = &buffers->slots[next_read % slot_count];
+            size_t n = 0;
+            const unsigned char* input = input_source_next(&src, slot->input, buffer_size, &n);
+            if (!input) {
+                log_message(LOG_ERROR, "Error reading file '%s'\n", entry->file_path);
+                result = EXIT_FILE_ERROR;
+                break;
+            }
+            eof = n < buffer_size;
+            if (n == 0) break;
+            
+            compress_block_t* block = &slot->block;
+            memset(block, 0, sizeof(compress_block_t));
+            block->input = input;
+            block->input_size = n;
+            block->level = pacer && level != 0 ? paced_block_level(pacer, codec) : level;
+            block->codec = codec;
+            block->output = slot->output;
+            block->output_capacity = compress_block_bound(buffer_size);
+            
+            // Prime with the tail of the previous block, which is still
+            // resident in its own slot until that slot is reused (and for
+            // as long as the file is mapped)
+            if (next_read > 0 && codec == CODEC_ZLIB) {
+                const compress_block_t* prev = &buffers->slots[(next_read - 1) % slot_count].block;
+                size_t window = prev->input_size < COMPRESS_WINDOW_SIZE ? prev->input_size : COMPRESS_WINDOW_SIZE;
+                const unsigned char* tail = prev->input + prev->input_size - window;
+                if (!mapped) {
+                    memcpy(slot->window, tail, window);
+                    tail = slot->window;
+                }
+                block->dictionary = tail;
+                block->dictionary_size = window;
+            }
+            
+            slot->completed = false;
+            if (level == 0) {
+                slot->completed = true;
+            } else if (pool) {
+                pool_add_block(pool, entry, block, pacer, &slot->completed);
+            } else {
+                pacer_sample_t start;
+                if (pacer) pacer_sample(&start);
+                compress_block(block);
+                if (pacer) pacer_record(pacer, block->level, n, n, block->failed ? n : block->output_size, &start);
+                slot->completed = true;
+            }
+            next_read++;
+        }
+        
+        if (result != EXIT_SUCCESS || next_write == next_read) break;
+        
+        // Write the oldest block once it is done (output stays in order)
+        stream_slot_t* slot = &buffers->slots[next_write % slot_count];
+        if (pool && !slot->completed) {
+            pool_wait_item(pool, &slot->completed);
+        }
+        
+        compress_block_t* block = &slot->block;
+        if (level == 0) {
+            result = archive_writer_write(writer, block->input, block->input_size);
+            crc = codec_crc32((uint32_t)crc, block->input, block->input_size);
+            if (pacer) {
+                size_t stored = paced_store ? block->input_size : 0;
+                pacer_record(pacer, 0, block->input_size, stored, stored, NULL);
+            }
+        } else if (block->failed) {
+            result = EXIT_ZIP_ERROR;
+        } else {
+            result = archive_writer_write(writer, block->output, block->output_size);
+            crc = crc32_combine(crc, block->crc32, (z_off_t)block->input_size);
+        }
+        total_in += block->input_size;
+        next_write++;
+        
+        // The next block's dictionary reaches back one window
+        if (mapped && total_in > COMPRESS_WINDOW_SIZE) {
+            input_source_release(&src, total_in - COMPRESS_WINDOW_SIZE);
+        }
+        
+        if (g_tui.is_active) {
+            tui_set_entry_progress(total_in);
+        }
+    }
+    
+    // Drain blocks still owned by the pool before their slots are reused
+    while (pool && next_write < next_read) {
+        pool_wait_item(pool, &buffers->slots[next_write % slot_count].completed);
+        next_write++;
+    }
+    input_source_close(&src);
+    
+    if (result == EXIT_SUCCESS && level != 0 && codec == CODEC_ZLIB) {
+        result = archive_writer_write(writer, DEFLATE_FINAL_EMPTY_BLOCK, sizeof(DEFLATE_FINAL_EMPTY_BLOCK));
+    }
+    
+    if (result != EXIT_SUCCESS) {
+        // A partially written entry can't be recovered
+        writer->failed = true;
+        return result;
+    }
+    
+    entry->uncompressed_size = total_in;
+    entry->crc32 = (uint32_t)crc;
+    result = archive_writer_end_deferred_entry(writer, (uint32_t)crc, total_in);
+    if (result == EXIT_SUCCESS) {
+        const archive_cdir_record_t* record = &writer->records[writer->record_count - 1];
+        log_file_compression(entry->archive_path, total_in, record->compressed_size,
+                             codec_method_name(record->method), compress_decision_name(entry->decision));
+    }
+    return result;
+}
+
 // ============================================================================
 // End of multithreaded infrastructure
 // ============================================================================
 
-// Global variables for progress monitoring
-static volatile bool g_compression_active = false;
-static progress_t* g_progress_ptr = NULL;
-static bool g_show_progress = false;
-static volatile size_t g_total_compressed_bytes = 0;
-static char g_output_filename[PATH_MAX] = {0};
-
-#ifndef _WIN32
-static pthread_t g_progress_thread;
-#else
-static HANDLE g_progress_handle = NULL;
-#endif
-
 // Collection context for gathering files before parallel processing
 typedef struct {
     file_queue_t* queue;
@@ -639,18 +1417,10 @@ typedef struct {
 static int collect_files_callback(const file_info_t* info, void* user_data) {
     collect_context_t* ctx = (collect_context_t*)user_data;
     
-    // Handle nested .zipignore files
+    // Handle nested .zipignore files: each directory is checked once, as
+    // the traversal enters it, before anything inside it is visited
     if (info->is_directory) {
         load_nested_zipignore(ctx->zipignore, info->path);
-    } else {
-        char parent_dir[PATH_MAX];
-        strncpy(parent_dir, info->path, PATH_MAX - 1);
-        parent_dir[PATH_MAX - 1] = '\0';
-        char* last_sep = strrchr(parent_dir, PATH_SEPARATOR);
-        if (last_sep) {
-            *last_sep = '\0';
-            load_nested_zipignore(ctx->zipignore, parent_dir);
-        }
     }
     
     // Check if should be ignored
@@ -658,18 +1428,14 @@ static int collect_files_callback(const file_info_t* info, void* user_data) {
         if (!ctx->use_tui) {
             log_file_operation("Ignored", info->path, info->size);
         }
+        // Nothing below an ignored directory can come back unless a
+        // negation pattern reaches into it, so don't even list it
+        if (info->is_directory && !zipignore_may_reinclude(ctx->zipignore, info->path)) {
+            return TRAVERSE_SKIP_SUBTREE;
+        }
         return EXIT_SUCCESS;
     }
     
-    // Create file entry
-    file_entry_t* entry = calloc(1, sizeof(file_entry_t));
-    if (!entry) return EXIT_FAILURE;
-    
-    entry->file_path = strdup(info->path);
-    entry->size = info->size;
-    entry->is_directory = info->is_directory;
-    entry->mtime = info->mtime;
-    
     // Calculate archive path
     const char* relative_path = info->path;
     if (strncmp(info->path, ctx->base_dir, strlen(ctx->base_dir)) == 0) {
@@ -696,309 +1462,903 @@ static int collect_files_callback(const file_info_t* info, void* user_data) {
         }
     }
     
-    entry->archive_path = strdup(archive_path);
+    file_entry_t* entry = queue_new_entry(ctx->queue, info->path, archive_path);
+    if (!entry) return EXIT_FAILURE;
+    entry->size = info->size;
+    entry->is_directory = info->is_directory;
+    entry->mtime = info->mtime;
+    entry->inode = info->inode;
     
     queue_push(ctx->queue, entry);
     
-    // Update TUI during scanning - refresh every 100 files
+    // The TUI shows the count found so far on its next frame
     if (ctx->use_tui) {
-        g_tui.total_files = ctx->queue->count;
-        static size_t last_scan_refresh = 0;
-        if (ctx->queue->count - last_scan_refresh >= 100 || ctx->queue->count <= 1) {
-            tui_refresh();
-            last_scan_refresh = ctx->queue->count;
-        }
+        tui_set_totals(ctx->queue->count, ctx->queue->total_bytes);
     }
     
     return EXIT_SUCCESS;
 }
 
-// Add file to zip using pre-compressed data
-int create_zip(const options_t* opts) {
-    if (!opts || !opts->zip_file) {
-        return EXIT_INVALID_ARGS;
+// Add one named input: a directory is traversed, a file is added on its
+// own. Files named on the command line are stored under their base name;
+// names read from stdin keep their relative path unless -j is given.
+static void collect_input(collect_context_t* ctx, const options_t* opts, const char* input, bool keep_path) {
+    if (is_directory(input)) {
+        load_nested_zipignore(ctx->zipignore, input);
+        traverse_directory(input, opts->recursive, collect_files_callback, ctx);
+        return;
+    }
+    if (should_ignore(ctx->zipignore, input)) {
+        return;
+    }
+    
+    const char* archive_path = input;
+    if (keep_path && !opts->junk_paths) {
+        // Archive paths are relative: drop "./" and leading separators
+        for (;;) {
+            if (archive_path[0] == '.' && (archive_path[1] == '/' || archive_path[1] == PATH_SEPARATOR)) {
+                archive_path += 2;
+            } else if (archive_path[0] == '/' || archive_path[0] == PATH_SEPARATOR) {
+                archive_path++;
+            } else {
+                break;
+            }
+        }
+    } else {
+        const char* base = strrchr(input, PATH_SEPARATOR);
+        archive_path = base ? base + 1 : input;
     }
     
-    // Initialize ZIP context
-    zip_context_t ctx;
-    memset(&ctx, 0, sizeof(ctx));
-    ctx.filename = opts->zip_file;
-    ctx.verbose = !opts->quiet;
-    
-    // TUI is always active unless quiet mode or structured output
-    bool use_tui = !opts->quiet && !g_log_config.structured;
-    if (use_tui) {
-        tui_init();
-        tui_show_header();
-        strncpy(g_tui.operation, "Creating", sizeof(g_tui.operation));
-        strncpy(g_tui.archive_name, opts->zip_file, sizeof(g_tui.archive_name));
-        g_tui.sys_stats.num_threads = get_num_cores();
+    // Add single file
+    file_entry_t* entry = queue_new_entry(ctx->queue, input, archive_path);
+    if (!entry) return;
+    entry->size = get_file_size(input);
+    entry->is_directory = false;
+    entry->mtime = get_file_mtime(input);
+    for (char* p = entry->archive_path; *p; p++) {
+        if (*p == '\\') *p = '/';
     }
-    
-    // Determine base directory for zipignore loading
-    const char* base_dir = ".";
-    if (opts->input_file_count > 0) {
-        base_dir = opts->input_files[0];
-        if (!is_directory(base_dir)) {
-            base_dir = ".";
+    queue_push(ctx->queue, entry);
+}
+
+// -@: add every file named on stdin, one name per line
+static void collect_stdin_inputs(collect_context_t* ctx, const options_t* opts) {
+    char line[PATH_MAX];
+    while (fgets(line, sizeof(line), stdin)) {
+        size_t len = strlen(line);
+        bool complete = len > 0 && line[len - 1] == '\n';
+        if (!complete && !feof(stdin)) {
+            // Longer than any path: skip the rest of it
+            log_message(LOG_WARNING, "Warning: Name read from stdin is too long, skipped\n");
+            int c;
+            while ((c = getchar()) != EOF && c != '\n') {}
+            continue;
         }
-    } else if (opts->target_dir) {
-        base_dir = opts->target_dir;
-    }
-    
-    // Load zipignore patterns
-    int result = load_zipignore(&ctx.zipignore, base_dir, opts->zipignore_file);
-    if (result != EXIT_SUCCESS && opts->verbose) {
-        fprintf(stderr, "Warning: Could not load zipignore patterns\n");
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+        if (len == 0) continue;
+        
+        if (!file_exists(line)) {
+            log_message(LOG_WARNING, "Warning: '%s' not found, skipped\n", line);
+            continue;
+        }
+        collect_input(ctx, opts, line, true);
     }
-    
-    // ========================================================================
-    // PHASE 1: Collect all files
-    // ========================================================================
-    if (use_tui) {
-        tui_set_phase(1, "Scanning directories...");
+}
+
+// Where one entry goes for --sort inode/disk
+typedef struct {
+    file_entry_t* entry;
+    int rank;                   // Directories, then placed files, then the rest
+    uint64_t key;               // Disk offset or inode within a rank
+    size_t position;            // Tree order, for ties
+} entry_order_t;
+
+static int compare_entry_order(const void* a, const void* b) {
+    const entry_order_t* x = (const entry_order_t*)a;
+    const entry_order_t* y = (const entry_order_t*)b;
+    if (x->rank != y->rank) return x->rank < y->rank ? -1 : 1;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return x->position < y->position ? -1 : (x->position > y->position ? 1 : 0);
+}
+
+// --sort inode/disk: order the files the way their data lies on disk, so
+// reading them (in archive order) sweeps across the device instead of
+// seeking back and forth. Directory entries stay first, in tree order;
+// files whose placement the filesystem does not report follow in inode
+// order. Returns false when out of memory, leaving the order as it was.
+static bool queue_sort(file_queue_t* q, sort_order_t order) {
+    if (order == SORT_NAME || q->count < 2) return true;
+    
+    entry_order_t* items = malloc(q->count * sizeof(entry_order_t));
+    if (!items) return false;
+    
+    size_t n = 0;
+    for (file_entry_t* e = q->head; e; e = e->next, n++) {
+        entry_order_t* item = &items[n];
+        item->entry = e;
+        item->position = n;
+        item->rank = 0;
+        item->key = 0;
+        if (e->is_directory) continue;
+        
+#ifndef _WIN32
+        // Files named on the command line were not scanned
+        struct stat st;
+        if (e->inode == 0 && stat(e->file_path, &st) == 0) {
+            metrics_count(METRICS_STAT_CALLS, 1);
+            e->inode = (uint64_t)st.st_ino;
+        }
+#endif
+        uint64_t offset = 0;
+        if (order == SORT_DISK && e->size > 0 && input_source_disk_offset(e->file_path, &offset)) {
+            item->rank = 1;
+            item->key = offset;
+        } else {
+            item->rank = order == SORT_DISK ? 2 : 1;
+            item->key = e->inode;
+        }
     }
     
-    file_queue_t file_queue;
-    queue_init(&file_queue);
-    
-    collect_context_t collect_ctx = {
-        .queue = &file_queue,
-        .zipignore = &ctx.zipignore,
-        .base_dir = ctx.zipignore.base_dir,
-        .verbose = ctx.verbose,
-        .use_tui = use_tui
-    };
+    qsort(items, n, sizeof(entry_order_t), compare_entry_order);
     
-    if (ctx.verbose && !use_tui) {
-        printf("Collecting files...\n");
+    for (size_t i = 0; i < n; i++) {
+        items[i].entry->next = i + 1 < n ? items[i + 1].entry : NULL;
+    }
+    q->head = items[0].entry;
+    q->tail = items[n - 1].entry;
+    free(items);
+    return true;
+}
+
+// State shared by every entry written to the archive
+typedef struct {
+    archive_writer_t* writer;
+    thread_pool_t* pool;            // Block compression threads for streamed files (may be NULL)
+    stream_buffers_t stream;        // Recycled slots for streamed files
+    unsigned char* read_buffer;     // Recycled input buffer for inline compression
+    size_t buffer_size;
+    int compression_level;
+    bool detect_incompressible;     // Store data that would not compress
+    codec_id_t codec;               // Compression backend (--codec)
+    codec_encoder_t* encoder;       // Whole-buffer encoder for inline compression (NULL = zlib)
+    int encoder_level;              // Level it was made for
+    pacer_t* pacer;                 // Picks levels for --target-mbps and --deadline (NULL = compression_level)
+    int memory_share;               // Archives splitting the memory budget (see calculate_memory_budget())
+    
+    // Progress reporting, owned by whichever thread writes entries
+    progress_t* progress;
+    bool use_tui;
+    bool verbose;
+    size_t added_count;
+} write_context_t;
+
+// Compress an entry on the writer's thread, at the pacer's level when paced
+static int compress_inline(write_context_t* wctx, file_entry_t* entry) {
+    if (!wctx->pacer) {
+        return compress_file_data(entry, NULL, wctx->compression_level, wctx->detect_incompressible,
+                                  wctx->encoder, wctx->read_buffer, wctx->buffer_size);
+    }
+    
+    int level = pacer_level(wctx->pacer);
+    if (wctx->encoder && level > 0 && wctx->encoder_level != level) {
+        codec_encoder_t* encoder = codec_encoder_create(wctx->codec, level);
+        if (encoder) {
+            codec_encoder_free(wctx->encoder);
+            wctx->encoder = encoder;
+            wctx->encoder_level = level;
+        }
     }
     
-    // Collect files
-    if (opts->input_file_count > 0) {
-        for (int i = 0; i < opts->input_file_count; i++) {
-            const char* input = opts->input_files[i];
-            if (is_directory(input)) {
-                traverse_directory(input, opts->recursive, collect_files_callback, &collect_ctx);
-            } else if (!should_ignore(&ctx.zipignore, input)) {
-                // Add single file
-                file_entry_t* entry = calloc(1, sizeof(file_entry_t));
-                entry->file_path = strdup(input);
-                entry->size = get_file_size(input);
-                entry->is_directory = false;
-                entry->mtime = get_file_mtime(input);
-                
-                const char* archive_path = strrchr(input, PATH_SEPARATOR);
-                entry->archive_path = strdup(archive_path ? archive_path + 1 : input);
-                queue_push(&file_queue, entry);
-            }
+    pacer_sample_t start;
+    pacer_sample(&start);
+    int result = compress_file_data(entry, NULL, level, wctx->detect_incompressible, wctx->encoder,
+                                    wctx->read_buffer, wctx->buffer_size);
+    paced_bytes_t paced = {0};
+    if (result == 0) count_paced_file(&paced, entry, level);
+    pacer_record(wctx->pacer, level, paced.bytes, paced.input, paced.output, &start);
+    return result;
+}
+
+// Write one collected entry to the archive. Large files arrive here already
+// deflated by the worker pool and are copied through unchanged, huge files
+// are streamed through the block pipeline, and everything else is read and
+// encoded inline.
+static int write_file_entry(write_context_t* wctx, file_entry_t* entry) {
+    archive_writer_t* writer = wctx->writer;
+    
+    if (entry->is_directory) {
+        if (archive_writer_add_directory(writer, entry->archive_path, entry->mtime) != EXIT_SUCCESS) {
+            log_message(LOG_ERROR, "Error adding directory %s\n", entry->archive_path);
+            return EXIT_ZIP_ERROR;
         }
-    } else if (opts->target_dir) {
-        traverse_directory(opts->target_dir, opts->recursive, collect_files_callback, &collect_ctx);
-    } else {
-        traverse_directory(".", opts->recursive, collect_files_callback, &collect_ctx);
+        log_file_operation("Added directory", entry->archive_path, 0);
+        return EXIT_SUCCESS;
     }
     
-    size_t total_files = file_queue.count;
-    size_t total_bytes = file_queue.total_bytes;
+    bool precompressed = entry->compression_done && !entry->compression_failed;
     
-    // Update TUI with totals
-    if (use_tui) {
-        g_tui.total_files = total_files;
-        g_tui.total_bytes = total_bytes;
-    } else {
-        log_event(EVENT_INIT, LOG_INFO, "Creating ZIP archive '%s'", opts->zip_file);
-        log_event(EVENT_INIT, LOG_INFO, "Total files to process: %zu (%.1f MB)", 
-                  total_files, total_bytes / (1024.0 * 1024.0));
+    if (!precompressed && entry->size >= STREAMING_COMPRESSION_THRESHOLD && wctx->stream.slots) {
+        int result = stream_file_entry(writer, wctx->pool, &wctx->stream, entry, wctx->compression_level,
+                                       wctx->detect_incompressible, wctx->codec, wctx->pacer);
+        if (result == EXIT_SUCCESS && !g_tui.is_active) {
+            log_file_operation("Added large file", entry->archive_path, entry->size);
+        }
+        return result;
     }
     
-    if (ctx.verbose && !use_tui) {
-        printf("Found %zu files (%.1f MB)\n", total_files, total_bytes / (1024.0 * 1024.0));
+    if (!precompressed && compress_inline(wctx, entry) != 0) {
+        log_message(LOG_ERROR, "Error reading file '%s'\n", entry->file_path);
+        return EXIT_FILE_ERROR;
     }
     
-    // ========================================================================
-    // PHASE 2: Parallel pre-compression of large files
-    // ========================================================================
-    if (use_tui) {
-        tui_set_phase(2, "Compressing (parallel)");
-    }
+    archive_entry_info_t info = {
+        .name = entry->archive_path,
+        .method = entry->method,
+        .crc32 = entry->crc32,
+        .compressed_size = entry->compressed_size,
+        .uncompressed_size = entry->uncompressed_size,
+        .mtime = entry->mtime,
+        .mode = entry->mode
+    };
     
-    size_t large_file_count = 0;
-    size_t large_file_bytes = 0;
+    int result = archive_writer_add(writer, &info, entry->compressed_data);
     
-    // Count large files and build array for batch processing
-    for (file_entry_t* e = file_queue.head; e; e = e->next) {
-        if (!e->is_directory && e->size >= PARALLEL_COMPRESSION_THRESHOLD) {
-            large_file_count++;
-            large_file_bytes += e->size;
+    // Entry data is no longer needed once written
+    free(entry->compressed_data);
+    entry->compressed_data = NULL;
+    
+    if (result != EXIT_SUCCESS) {
+        log_message(LOG_ERROR, "Error adding file '%s' to archive\n", entry->archive_path);
+        return result;
+    }
+    log_file_compression(entry->archive_path, entry->uncompressed_size, entry->compressed_size,
+                         codec_method_name(entry->method),
+                         compress_decision_name(entry->decision));
+    
+    // Only log when TUI is not active (TUI handles its own progress display)
+    if (!g_tui.is_active) {
+        if (precompressed) {
+            log_file_operation("Added file (pre-compressed)", entry->archive_path, entry->size);
+        } else if (entry->size > 10 * 1024 * 1024) { // Files larger than 10MB
+            log_file_operation("Added large file", entry->archive_path, entry->size);
+        } else {
+            log_file_operation("Added file", entry->archive_path, entry->size);
         }
     }
     
-    // Only use parallel compression if we have significant large files
-    thread_pool_t* pool = NULL;
-    int compression_level = opts->compression_level >= 0 ? opts->compression_level : Z_DEFAULT_COMPRESSION;
+    return EXIT_SUCCESS;
+}
+
+// Write one entry and report progress for it
+static int write_entry_with_progress(write_context_t* wctx, file_entry_t* entry) {
+    int result = write_file_entry(wctx, entry);
     
-    if (large_file_count > 0 && large_file_bytes > 5 * 1024 * 1024) {
-        int num_cores = get_num_cores();
+    if (result == EXIT_SUCCESS) {
+        wctx->added_count++;
+        update_progress(wctx->progress, entry->size);
         
-        // Build array of large file pointers for batching
-        file_entry_t** large_files = malloc(sizeof(file_entry_t*) * large_file_count);
-        if (!large_files) {
-            fprintf(stderr, "Error: Out of memory allocating file list\n");
-            queue_free(&file_queue);
-            if (use_tui) tui_cleanup();
-            return EXIT_ZIP_ERROR;
+        // Update TUI progress
+        if (wctx->use_tui) {
+            tui_update_progress(entry->size);
         }
         
-        size_t lf_idx = 0;
-        for (file_entry_t* e = file_queue.head; e && lf_idx < large_file_count; e = e->next) {
-            if (!e->is_directory && e->size >= PARALLEL_COMPRESSION_THRESHOLD) {
-                large_files[lf_idx++] = e;
-            }
-        }
-        
-        // Sort by size descending for better memory utilization (process biggest first)
-        for (size_t i = 0; i < large_file_count - 1; i++) {
-            for (size_t j = i + 1; j < large_file_count; j++) {
-                if (large_files[j]->size > large_files[i]->size) {
-                    file_entry_t* tmp = large_files[i];
-                    large_files[i] = large_files[j];
-                    large_files[j] = tmp;
-                }
-            }
-        }
-        
-        if (use_tui) {
-            g_tui.sys_stats.num_threads = num_cores;
-            g_tui.sys_stats.active_threads = num_cores;
-            tui_set_large_file_counts(0, large_file_count);
+        if ((wctx->verbose || log_config_current()->sink) && !wctx->use_tui) {
+            print_progress(wctx->progress, "Adding");
         }
+    }
+    
+    return result;
+}
+
+// Ranges of entries in flight between the producer and the writer thread,
+// per pool thread. The ring is also bounded by the encoded bytes it holds.
+#define REORDER_SLOTS_PER_THREAD 8
+
+// One range of consecutive entries (directories included) in archive order
+typedef struct {
+    file_entry_t* first;
+    size_t entry_count;
+    size_t memory;              // Estimated encoded bytes held until written
+    bool ready;                 // Set under the pool lock once compressed
+} reorder_slot_t;
+
+// Bounded, in-order reorder buffer feeding the writer thread. The producer
+// appends ranges and queues their compression, workers finish them in any
+// order, and the writer drains them strictly by sequence number, so reading,
+// compression and writing all overlap without a barrier between batches.
+typedef struct {
+    reorder_slot_t* slots;      // Ring indexed by sequence number
+    size_t capacity;
+    size_t next_submit;         // Sequence number of the next range queued
+    size_t next_write;          // Sequence number of the next range written
+    size_t memory_in_flight;
+    size_t memory_budget;
+    resources_budget_t pressure; // Shrinks memory_budget under memory pressure
+    bool finished;              // Producer has queued its last range
+    bool failed;                // Writer stopped on an error
+    
+#ifndef _WIN32
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;     // Signals ranges queued and ranges written
+#else
+    CRITICAL_SECTION cs;
+    HANDLE submitted;           // Wakes the writer
+    HANDLE released;            // Wakes the producer
+#endif
+} reorder_buffer_t;
+
+static int reorder_init(reorder_buffer_t* rb, size_t capacity, size_t memory_budget) {
+    memset(rb, 0, sizeof(reorder_buffer_t));
+    rb->slots = calloc(capacity, sizeof(reorder_slot_t));
+    if (!rb->slots) return -1;
+    rb->capacity = capacity;
+    rb->memory_budget = memory_budget;
+    resources_budget_init(&rb->pressure, memory_budget, MIN_WINDOW_BYTES);
+#ifndef _WIN32
+    pthread_mutex_init(&rb->mutex, NULL);
+    pthread_cond_init(&rb->changed, NULL);
+#else
+    InitializeCriticalSection(&rb->cs);
+    rb->submitted = CreateEvent(NULL, FALSE, FALSE, NULL);
+    rb->released = CreateEvent(NULL, FALSE, FALSE, NULL);
+#endif
+    return 0;
+}
+
+static void reorder_free(reorder_buffer_t* rb) {
+#ifndef _WIN32
+    pthread_mutex_destroy(&rb->mutex);
+    pthread_cond_destroy(&rb->changed);
+#else
+    DeleteCriticalSection(&rb->cs);
+    CloseHandle(rb->submitted);
+    CloseHandle(rb->released);
+#endif
+    free(rb->slots);
+    rb->slots = NULL;
+}
+
+// Reserve the next slot for a range holding `memory` encoded bytes, blocking
+// while the ring is full or over budget. A range is always admitted when
+// nothing else is in flight. Returns NULL once the writer has failed.
+static reorder_slot_t* reorder_reserve(reorder_buffer_t* rb, size_t memory) {
+    bool failed;
+    size_t budget = resources_budget_update(&rb->pressure);
+#ifndef _WIN32
+    pthread_mutex_lock(&rb->mutex);
+    rb->memory_budget = budget;
+    while (!rb->failed && rb->next_submit != rb->next_write &&
+           (rb->next_submit - rb->next_write >= rb->capacity ||
+            rb->memory_in_flight + memory > rb->memory_budget)) {
+        pthread_cond_wait(&rb->changed, &rb->mutex);
+    }
+    failed = rb->failed;
+    pthread_mutex_unlock(&rb->mutex);
+#else
+    EnterCriticalSection(&rb->cs);
+    rb->memory_budget = budget;
+    while (!rb->failed && rb->next_submit != rb->next_write &&
+           (rb->next_submit - rb->next_write >= rb->capacity ||
+            rb->memory_in_flight + memory > rb->memory_budget)) {
+        LeaveCriticalSection(&rb->cs);
+        WaitForSingleObject(rb->released, INFINITE);
+        EnterCriticalSection(&rb->cs);
+    }
+    failed = rb->failed;
+    LeaveCriticalSection(&rb->cs);
+#endif
+    if (failed) return NULL;
+    
+    // Only the producer advances next_submit, so the slot stays ours
+    reorder_slot_t* slot = &rb->slots[rb->next_submit % rb->capacity];
+    memset(slot, 0, sizeof(reorder_slot_t));
+    slot->memory = memory;
+    return slot;
+}
+
+// Hand the reserved slot to the writer (call `finished` with no slot to
+// signal the end of input)
+static void reorder_publish(reorder_buffer_t* rb, bool slot_reserved, bool finished) {
+#ifndef _WIN32
+    pthread_mutex_lock(&rb->mutex);
+#else
+    EnterCriticalSection(&rb->cs);
+#endif
+    if (slot_reserved) {
+        rb->memory_in_flight += rb->slots[rb->next_submit % rb->capacity].memory;
+        rb->next_submit++;
+    }
+    if (finished) rb->finished = true;
+#ifndef _WIN32
+    pthread_cond_broadcast(&rb->changed);
+    pthread_mutex_unlock(&rb->mutex);
+#else
+    SetEvent(rb->submitted);
+    LeaveCriticalSection(&rb->cs);
+#endif
+}
+
+// Writer side: wait for the next range in sequence; NULL once drained
+static reorder_slot_t* reorder_next(reorder_buffer_t* rb) {
+    reorder_slot_t* slot = NULL;
+#ifndef _WIN32
+    pthread_mutex_lock(&rb->mutex);
+    while (rb->next_write == rb->next_submit && !rb->finished) {
+        pthread_cond_wait(&rb->changed, &rb->mutex);
+    }
+    if (rb->next_write != rb->next_submit) {
+        slot = &rb->slots[rb->next_write % rb->capacity];
+    }
+    pthread_mutex_unlock(&rb->mutex);
+#else
+    EnterCriticalSection(&rb->cs);
+    while (rb->next_write == rb->next_submit && !rb->finished) {
+        LeaveCriticalSection(&rb->cs);
+        WaitForSingleObject(rb->submitted, INFINITE);
+        EnterCriticalSection(&rb->cs);
+    }
+    if (rb->next_write != rb->next_submit) {
+        slot = &rb->slots[rb->next_write % rb->capacity];
+    }
+    LeaveCriticalSection(&rb->cs);
+#endif
+    return slot;
+}
+
+// Writer side: the current range is written (or the writer gave up)
+static void reorder_release(reorder_buffer_t* rb, bool failed) {
+#ifndef _WIN32
+    pthread_mutex_lock(&rb->mutex);
+#else
+    EnterCriticalSection(&rb->cs);
+#endif
+    if (failed) {
+        rb->failed = true;
+    } else {
+        rb->memory_in_flight -= rb->slots[rb->next_write % rb->capacity].memory;
+        rb->next_write++;
+    }
+#ifndef _WIN32
+    pthread_cond_broadcast(&rb->changed);
+    pthread_mutex_unlock(&rb->mutex);
+#else
+    SetEvent(rb->released);
+    LeaveCriticalSection(&rb->cs);
+#endif
+}
+
+// Dedicated writer thread: drains the reorder buffer in archive order
+typedef struct {
+    write_context_t* wctx;
+    reorder_buffer_t* reorder;
+    log_config_t* log_config;   // The run's
+    int result;
+} writer_thread_ctx_t;
+
+static void run_writer(writer_thread_ctx_t* wt) {
+    write_context_t* wctx = wt->wctx;
+    reorder_slot_t* slot;
+    
+    log_config_use(wt->log_config);
+    metrics_thread_begin("writer", 0);
+    wt->result = EXIT_SUCCESS;
+    uint64_t idle_start = metrics_start();
+    while ((slot = reorder_next(wt->reorder)) != NULL) {
+        // Wait for the range's compression
+        pool_wait_item(wctx->pool, &slot->ready);
+        metrics_stop(METRICS_TIMER_IDLE, idle_start, NULL);
         
-        if (ctx.verbose && !use_tui) {
-            printf("Using %d threads for parallel compression of %zu large files (%.1f MB)\n",
-                   num_cores, large_file_count, large_file_bytes / (1024.0 * 1024.0));
-            size_t avail_mem = get_available_memory();
-            printf("Available memory: %.1f MB (reserving %d MB)\n", 
-                   avail_mem / (1024.0 * 1024.0), MIN_AVAILABLE_MEMORY_MB);
+        uint64_t busy_start = metrics_start();
+        file_entry_t* entry = slot->first;
+        for (size_t i = 0; i < slot->entry_count && wt->result == EXIT_SUCCESS; i++, entry = entry->next) {
+            wt->result = write_entry_with_progress(wctx, entry);
         }
+        metrics_stop(METRICS_TIMER_BUSY, busy_start, "write");
+        idle_start = metrics_start();
         
-        // Process large files in memory-safe batches
-        size_t processed_large = 0;
-        
-        while (processed_large < large_file_count) {
-            // Calculate safe batch size based on current available memory
-            size_t batch_memory = 0;
-            size_t remaining = large_file_count - processed_large;
-            size_t batch_size = calculate_safe_batch_size(large_files + processed_large, remaining, &batch_memory);
-            
-            // Create thread pool for this batch (recreate to reset counters)
-            pool = pool_create(num_cores);
-            if (!pool) {
-                fprintf(stderr, "Error: Could not create thread pool\n");
-                free(large_files);
-                queue_free(&file_queue);
-                if (use_tui) tui_cleanup();
-                return EXIT_ZIP_ERROR;
-            }
-            
-            if (ctx.verbose && !use_tui) {
-                printf("Batch: processing %zu files (estimated %.1f MB memory)\n", 
-                       batch_size, batch_memory / (1024.0 * 1024.0));
-            }
-            
-            // Queue files for this batch
-            for (size_t i = 0; i < batch_size; i++) {
-                file_entry_t* e = large_files[processed_large + i];
-                pool_add_work(pool, e, compression_level);
-            }
-            
-            // Wait for batch to complete with TUI updates
-            if (use_tui) {
-                while (!pool_is_done(pool, batch_size)) {
-                    // Get current completion count for progress
-                    #ifndef _WIN32
-                        pthread_mutex_lock(&pool->mutex);
-                        size_t current_completed = pool->completed_count;
-                        pthread_mutex_unlock(&pool->mutex);
-                    #else
-                        EnterCriticalSection(&pool->cs);
-                        size_t current_completed = pool->completed_count;
-                        LeaveCriticalSection(&pool->cs);
-                    #endif
-                    
-                    // Update completed count for overall progress
-                    tui_set_large_file_counts(processed_large + current_completed, large_file_count);
-                    
-                    tui_refresh();
-                    #ifndef _WIN32
-                        usleep(100000); // 100ms
-                    #else
-                        Sleep(100);
-                    #endif
-                }
-            } else {
-                pool_wait(pool, batch_size);
-            }
-            
-            // Destroy pool for this batch (frees thread resources)
-            pool_destroy(pool);
-            pool = NULL;
-            
-            // Free compressed data for files that failed (fall back to normal compression)
-            for (size_t i = 0; i < batch_size; i++) {
-                file_entry_t* e = large_files[processed_large + i];
-                if (e->compression_failed && e->compressed_data) {
-                    free(e->compressed_data);
-                    e->compressed_data = NULL;
-                    e->compressed_size = 0;
-                }
+        reorder_release(wt->reorder, wt->result != EXIT_SUCCESS);
+        if (wt->result != EXIT_SUCCESS) break;
+    }
+}
+
+#ifndef _WIN32
+static void* writer_thread(void* arg) {
+    run_writer((writer_thread_ctx_t*)arg);
+    metrics_thread_end();
+    return NULL;
+}
+#else
+static DWORD WINAPI writer_thread(LPVOID arg) {
+    run_writer((writer_thread_ctx_t*)arg);
+    metrics_thread_end();
+    return 0;
+}
+#endif
+
+// Queue entries [first, first + count) as one range; `compress` is false for
+// ranges the writer handles itself (directories, streamed files). Returns
+// false once the writer has failed.
+static bool submit_range(reorder_buffer_t* rb, thread_pool_t* pool, file_entry_t* first, size_t count,
+                         size_t memory, bool compress, int compression_level, pacer_t* pacer,
+                         size_t* outstanding) {
+    reorder_slot_t* slot = reorder_reserve(rb, memory);
+    if (!slot) return false;
+    
+    slot->first = first;
+    slot->entry_count = count;
+    slot->ready = !compress;
+    
+    // Publish first so the writer can start waiting on it; the slot is not
+    // reused until the writer has seen it `ready`
+    reorder_publish(rb, true, false);
+    if (compress) {
+        pool_add_unit(pool, first, count, compression_level, pacer, &slot->ready, outstanding);
+    }
+    return true;
+}
+
+// Compress and write every entry on the pool. This thread groups entries into
+// ranges in archive order (small files batched into byte-sized units, larger
+// files alone) and queues their compression, while a dedicated writer thread
+// writes finished ranges in sequence. Huge files are streamed by the writer
+// itself, through the same pool.
+static int write_entries_parallel(write_context_t* wctx, file_entry_t* head) {
+    thread_pool_t* pool = wctx->pool;
+    int level = wctx->compression_level;
+    
+    reorder_buffer_t reorder;
+    if (reorder_init(&reorder, (size_t)pool->num_threads * REORDER_SLOTS_PER_THREAD,
+                     calculate_memory_budget(wctx->memory_share)) != 0) {
+        log_message(LOG_ERROR, "Error: Out of memory allocating reorder buffer\n");
+        return EXIT_FAILURE;
+    }
+    
+    writer_thread_ctx_t wt = { .wctx = wctx, .reorder = &reorder, .log_config = log_config_current(),
+                               .result = EXIT_SUCCESS };
+#ifndef _WIN32
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, writer_thread, &wt) != 0) {
+#else
+    HANDLE thread = CreateThread(NULL, 0, writer_thread, &wt, 0, NULL);
+    if (!thread) {
+#endif
+        log_message(LOG_ERROR, "Error: Could not start writer thread\n");
+        reorder_free(&reorder);
+        return EXIT_FAILURE;
+    }
+    
+    size_t outstanding = 0;     // Units of this archive still queued on the (maybe shared) pool
+    file_entry_t* range_head = NULL;
+    size_t range_count = 0;
+    size_t range_files = 0;
+    size_t range_bytes = 0;
+    size_t range_memory = 0;
+    bool ok = true;
+    
+    for (file_entry_t* e = head; e && ok; e = e->next) {
+        // Large files are a range of their own; huge ones are streamed
+        if (!e->is_directory && e->size >= PARALLEL_COMPRESSION_THRESHOLD) {
+            bool streamed = e->size >= STREAMING_COMPRESSION_THRESHOLD;
+            if (range_head) {
+                ok = submit_range(&reorder, pool, range_head, range_count, range_memory, range_files > 0, level, wctx->pacer, &outstanding);
+                range_head = NULL;
             }
-            
-            processed_large += batch_size;
-            
-            // Check memory pressure before next batch
-            if (processed_large < large_file_count) {
-                size_t avail = get_available_memory();
-                if (avail < MIN_AVAILABLE_MEMORY_MB * 1024 * 1024) {
-                    // Memory is tight - wait a bit for GC/cleanup
-                    if (ctx.verbose && !use_tui) {
-                        printf("Low memory (%.1f MB available), waiting for cleanup...\n",
-                               avail / (1024.0 * 1024.0));
-                    }
-                    #ifndef _WIN32
-                        usleep(500000); // 500ms
-                    #else
-                        Sleep(500);
-                    #endif
-                }
+            if (ok) {
+                ok = submit_range(&reorder, pool, e, 1, streamed ? 0 : estimate_file_memory(e), !streamed, level, wctx->pacer, &outstanding);
             }
+            continue;
         }
         
-        free(large_files);
+        // Small files are grouped until the range holds enough bytes to be
+        // worth a thread; directories ride along with their neighbours
+        if (!range_head) {
+            range_head = e;
+            range_count = 0;
+            range_files = 0;
+            range_bytes = 0;
+            range_memory = 0;
+        }
+        range_count++;
+        if (e->is_directory) continue;
         
-        if (ctx.verbose && !use_tui) {
-            printf("Parallel compression complete\n");
+        range_files++;
+        range_memory += estimate_file_memory(e);
+        range_bytes += (size_t)e->size > SMALL_FILE_MIN_COST ? (size_t)e->size : SMALL_FILE_MIN_COST;
+        if (range_bytes >= SMALL_FILE_BATCH_BYTES) {
+            ok = submit_range(&reorder, pool, range_head, range_count, range_memory, true, level, wctx->pacer, &outstanding);
+            range_head = NULL;
         }
     }
+    if (ok && range_head) {
+        submit_range(&reorder, pool, range_head, range_count, range_memory, range_files > 0, level, wctx->pacer, &outstanding);
+    }
+    reorder_publish(&reorder, false, true);
+    
+#ifndef _WIN32
+    pthread_join(thread, NULL);
+#else
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#endif
+    // A failed writer leaves units behind that still point into the slots
+    pool_wait_units(pool, &outstanding);
+    reorder_free(&reorder);
+    
+    return wt.result;
+}
+
+// Compress and write every queued entry. Compression and writing overlap:
+// workers compress entries ahead of the writer, which emits them in archive
+// order. Huge files are streamed. A `pacer` (optional) picks the levels.
+static int write_queue(archive_writer_t* writer, file_queue_t* queue, const options_t* opts, pacer_t* pacer,
+                       progress_t* progress, bool use_tui, bool verbose, size_t* added_count) {
+    size_t total_files = queue->count;
+    size_t total_bytes = queue->total_bytes;
+    
+    size_t streamed_file_count = 0;
+    for (file_entry_t* e = queue->head; e; e = e->next) {
+        if (!e->is_directory && e->size >= STREAMING_COMPRESSION_THRESHOLD) {
+            streamed_file_count++;
+        }
+    }
+    
+    int compression_level = opts->compression_level >= 0 ? opts->compression_level : Z_DEFAULT_COMPRESSION;
+    
+    size_t buffer_size = stream_buffer_size(opts);
+    
+    write_context_t wctx;
+    memset(&wctx, 0, sizeof(wctx));
+    wctx.writer = writer;
+    wctx.buffer_size = buffer_size;
+    wctx.compression_level = compression_level;
+    wctx.detect_incompressible = !opts->always_deflate;
+    wctx.codec = opts->codec;
+    wctx.memory_share = opts->memory_share;
+    wctx.pacer = pacer;
+    wctx.read_buffer = malloc(buffer_size);
+    wctx.progress = progress;
+    wctx.use_tui = use_tui;
+    wctx.verbose = verbose;
+    
+    int result = wctx.read_buffer ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (!wctx.read_buffer) {
+        log_message(LOG_ERROR, "Error: Out of memory allocating read buffer\n");
+    }
+    if (result == EXIT_SUCCESS && wctx.codec != CODEC_ZLIB) {
+        wctx.encoder = codec_encoder_create(wctx.codec, compression_level);
+        wctx.encoder_level = compression_level;
+        if (!wctx.encoder) {
+            log_message(LOG_ERROR, "Error: Cannot set up the %s codec\n", codec_name(wctx.codec));
+            result = EXIT_FAILURE;
+        }
+    }
+    
+    // One pool serves both whole-file work units and streamed blocks: the
+    // caller's when it passes one in (unless runs with other settings are
+    // using it), else one for this run. On a single core everything is
+    // compressed inline by the writer instead.
+    int num_cores = resources_cpu_count();
+    if (result == EXIT_SUCCESS && opts->pool &&
+        pool_configure(opts->pool, buffer_size, wctx.detect_incompressible, wctx.codec)) {
+        wctx.pool = opts->pool;
+    } else if (result == EXIT_SUCCESS && num_cores > 1 && total_files > 1) {
+        wctx.pool = pool_create(num_cores);
+        if (wctx.pool) pool_configure(wctx.pool, buffer_size, wctx.detect_incompressible, wctx.codec);
+    }
+    if (wctx.pool) {
+        if (use_tui) {
+            g_tui.sys_stats.num_threads = wctx.pool->num_threads;
+            g_tui.sys_stats.active_threads = wctx.pool->num_threads;
+        }
+    }
+    thread_pool_t* pool = wctx.pool;
+    
+    // Archives of a batch split the shared pool between them
+    int pace_threads = pool ? pool->num_threads : 1;
+    if (pool && opts->memory_share > 1) pace_threads /= opts->memory_share;
+    pacer_begin(pacer, total_bytes, pace_threads);
+    
+    if (verbose && !use_tui && pool) {
+        printf("Using %d threads for parallel compression of %zu files (%.1f MB)\n",
+               pool->num_threads, total_files, total_bytes / (1024.0 * 1024.0));
+    }
+    
+    // Huge files go through a fixed set of block slots shared by all of them.
+    // Without a pool (or when storing) the slots are processed inline.
+    // Archives sharing a pool share its slots' worth of memory too.
+    if (result == EXIT_SUCCESS && streamed_file_count > 0) {
+        size_t slot_count = pool ? (size_t)pool->num_threads * STREAM_SLOTS_PER_THREAD
+                                 : STREAM_SLOTS_PER_THREAD;
+        if (opts->memory_share > 1) slot_count /= (size_t)opts->memory_share;
+        if (slot_count < STREAM_SLOTS_PER_THREAD) slot_count = STREAM_SLOTS_PER_THREAD;
+        if (stream_buffers_init(&wctx.stream, slot_count, buffer_size) != 0 && verbose && !use_tui) {
+            printf("Low memory: compressing huge files without streaming buffers\n");
+        }
+        
+        if (verbose && !use_tui) {
+            printf("Streaming %zu huge files through %zu x %.1f MB buffers\n",
+                   streamed_file_count, wctx.stream.slot_count, buffer_size / (1024.0 * 1024.0));
+        }
+    }
+    
+    if (result == EXIT_SUCCESS && pool) {
+        result = write_entries_parallel(&wctx, queue->head);
+    } else {
+        for (file_entry_t* entry = queue->head; entry && result == EXIT_SUCCESS; entry = entry->next) {
+            uint64_t busy_start = metrics_start();
+            result = write_entry_with_progress(&wctx, entry);
+            metrics_stop(METRICS_TIMER_BUSY, busy_start, "compress and write");
+        }
+    }
+    
+    if (wctx.pool && wctx.pool == opts->pool) {
+        pool_release(wctx.pool);
+    } else if (wctx.pool) {
+        pool_destroy(wctx.pool);
+    }
+    stream_buffers_free(&wctx.stream);
+    free(wctx.read_buffer);
+    codec_encoder_free(wctx.encoder);
+    
+    *added_count = wctx.added_count;
+    return result;
+}
+
+// Pacer for --target-mbps or --deadline; NULL without them, when storing
+// anyway, or when out of memory (the run keeps its level then)
+static pacer_t* create_pacer(const options_t* opts) {
+    int level = opts->compression_level >= 0 ? opts->compression_level : 6;
+    if ((opts->target_mbps <= 0 && opts->deadline <= 0) || level == 0) return NULL;
+    return pacer_create(opts->target_mbps, opts->deadline, level);
+}
+
+// One line on how a paced run went: the rate, what bound it, and the share
+// of the input compressed at each level
+static void print_pace_summary(pacer_t* pacer, FILE* out) {
+    pacer_report_t report;
+    pacer_report(pacer, &report);
+    
+    uint64_t total = 0;
+    for (int l = 0; l < PACER_LEVELS; l++) total += report.level_input[l];
+    
+    fprintf(out, "Paced to %.1f MB/s, achieved %.1f MB/s (%s-bound); levels:", report.target_mbps,
+            report.achieved_mbps, report.io_bound ? "I/O" : "CPU");
+    for (int l = PACER_LEVELS - 1; l >= 0; l--) {
+        if (report.level_input[l] == 0) continue;
+        double share = 100.0 * (double)report.level_input[l] / (double)total;
+        if (l == 0) {
+            fprintf(out, " store %.0f%%", share);
+        } else {
+            fprintf(out, " %d %.0f%%", l, share);
+        }
+    }
+    fprintf(out, "%s\n", total == 0 ? " none" : "");
+}
+
+// Add file to zip using pre-compressed data
+int create_zip(const options_t* opts) {
+    if (!opts || !opts->zip_file) {
+        return EXIT_INVALID_ARGS;
+    }
+    
+    // Initialize ZIP context
+    zip_context_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.filename = opts->zip_file;
+    
+    // Streaming to stdout keeps it for the archive; messages go to stderr
+    bool stream = opts->to_stdout;
+    if (stream && isatty(fileno(stdout))) {
+        log_message(LOG_ERROR, "Error: Refusing to write a ZIP archive to a terminal (redirect stdout)\n");
+        return EXIT_INVALID_ARGS;
+    }
+    ctx.verbose = !opts->quiet && !stream;
+    
+    // TUI is always active unless quiet mode, structured output or streaming
+    bool use_tui = !opts->quiet && !log_config_current()->structured && !stream;
+    if (use_tui) {
+        tui_init();
+        tui_show_header();
+        strncpy(g_tui.operation, "Creating", sizeof(g_tui.operation));
+        strncpy(g_tui.archive_name, opts->zip_file, sizeof(g_tui.archive_name));
+        g_tui.sys_stats.num_threads = resources_cpu_count();
+    }
+    
+    // Determine base directory for zipignore loading
+    const char* base_dir = ".";
+    if (opts->input_file_count > 0) {
+        base_dir = opts->input_files[0];
+        if (!is_directory(base_dir)) {
+            base_dir = ".";
+        }
+    } else if (opts->target_dir) {
+        base_dir = opts->target_dir;
+    }
+    
+    // Load zipignore patterns (an engine has parsed the leading ones already)
+    int result = opts->ignore_rules
+        ? load_zipignore_rules(&ctx.zipignore, base_dir, opts->ignore_rules, opts->zipignore_file)
+        : load_zipignore(&ctx.zipignore, base_dir, opts->zipignore_file);
+    if (result != EXIT_SUCCESS && opts->verbose) {
+        log_message(LOG_WARNING, "Warning: Could not load zipignore patterns\n");
+    }
+    
+    // ========================================================================
+    // PHASE 1: Collect all files
+    // ========================================================================
+    if (use_tui) {
+        tui_set_phase(1, "Scanning directories...");
+        tui_start_render();
+    }
+    
+    file_queue_t file_queue;
+    queue_init(&file_queue);
+    
+    // A deadline counts from here, scanning included
+    pacer_t* pacer = create_pacer(opts);
+    
+    collect_context_t collect_ctx = {
+        .queue = &file_queue,
+        .zipignore = &ctx.zipignore,
+        .base_dir = ctx.zipignore.base_dir,
+        .verbose = ctx.verbose,
+        .use_tui = use_tui
+    };
+    
+    if (ctx.verbose && !use_tui) {
+        printf("Collecting files...\n");
+    }
+    
+    // Collect files
+    metrics_phase_begin(METRICS_PHASE_SCAN);
+    if (opts->input_file_count > 0 || opts->read_stdin) {
+        for (int i = 0; i < opts->input_file_count; i++) {
+            collect_input(&collect_ctx, opts, opts->input_files[i], false);
+        }
+        if (opts->read_stdin) {
+            collect_stdin_inputs(&collect_ctx, opts);
+        }
+    } else if (opts->target_dir) {
+        load_nested_zipignore(&ctx.zipignore, opts->target_dir);
+        traverse_directory(opts->target_dir, opts->recursive, collect_files_callback, &collect_ctx);
+    } else {
+        load_nested_zipignore(&ctx.zipignore, ".");
+        traverse_directory(".", opts->recursive, collect_files_callback, &collect_ctx);
+    }
+    if (!queue_sort(&file_queue, opts->sort_order)) {
+        log_message(LOG_WARNING, "Warning: Out of memory sorting files, keeping name order\n");
+    }
+    metrics_phase_end(METRICS_PHASE_SCAN);
+    
+    size_t total_files = file_queue.count;
+    size_t total_bytes = file_queue.total_bytes;
+    
+    // Update TUI with totals
+    if (use_tui) {
+        tui_set_totals(total_files, total_bytes);
+    } else {
+        log_event(EVENT_INIT, LOG_INFO, "Creating ZIP archive '%s'", stream ? "<stdout>" : opts->zip_file);
+        log_event(EVENT_INIT, LOG_INFO, "Total files to process: %zu (%.1f MB)", 
+                  total_files, total_bytes / (1024.0 * 1024.0));
+    }
+    
+    if (ctx.verbose && !use_tui) {
+        printf("Found %zu files (%.1f MB)\n", total_files, total_bytes / (1024.0 * 1024.0));
+    }
     
     // ========================================================================
-    // PHASE 3: Create ZIP archive and add files
+    // PHASE 2/3: Compress files in parallel and add them to the archive
     // ========================================================================
     if (use_tui) {
         tui_set_phase(3, "Adding files to archive");
-        tui_refresh(); // Show initial phase 3 line
     }
     
-    int error;
-    ctx.archive = zip_open(opts->zip_file, ZIP_CREATE | ZIP_TRUNCATE, &error);
-    if (!ctx.archive) {
-        zip_error_t zip_error;
-        zip_error_init_with_code(&zip_error, error);
-        fprintf(stderr, "Error creating ZIP file '%s': %s\n", 
-                opts->zip_file, zip_error_strerror(&zip_error));
-        zip_error_fini(&zip_error);
+    archive_writer_t writer;
+    int opened = stream ? archive_writer_open_stream(&writer, stdout, "<stdout>")
+                        : archive_writer_open(&writer, opts->zip_file);
+    if (opened != EXIT_SUCCESS) {
         queue_free(&file_queue);
-        if (pool) pool_destroy(pool);
+        pacer_free(pacer);
         if (use_tui) tui_cleanup();
         return EXIT_ZIP_ERROR;
     }
@@ -1007,259 +2367,827 @@ int create_zip(const options_t* opts) {
     ctx.progress.total_files = total_files;
     ctx.progress.total_bytes = total_bytes;
     
-    result = EXIT_SUCCESS;
     size_t added_count = 0;
-    
-    for (file_entry_t* entry = file_queue.head; entry && result == EXIT_SUCCESS; entry = entry->next) {
-        // Update TUI with current file
-        if (use_tui) {
-            tui_set_current_file(entry->archive_path);
-            tui_refresh();
-        }
-        
-        if (entry->is_directory) {
-            // Add directory
-            zip_int64_t idx = zip_dir_add(ctx.archive, entry->archive_path, ZIP_FL_ENC_UTF_8);
-            if (idx < 0) {
-                fprintf(stderr, "Error adding directory %s: %s\n", 
-                        entry->archive_path, zip_strerror(ctx.archive));
-                result = EXIT_ZIP_ERROR;
-            } else {
-                log_file_operation("Added directory", entry->archive_path, 0);
-            }
-        } else if (entry->compressed_data && !entry->compression_failed) {
-            // Use pre-compressed data for large files
-            // Note: libzip doesn't directly support adding pre-compressed data,
-            // so we add the file normally but benefit from having it in memory
-            zip_source_t* source = zip_source_buffer(ctx.archive, entry->compressed_data, 
-                                                      entry->compressed_size, 0);
-            if (!source) {
-                // Fallback to normal file add
-                result = add_file_to_zip(&ctx, entry->file_path, entry->archive_path);
-            } else {
-                zip_int64_t idx = zip_file_add(ctx.archive, entry->archive_path, source, ZIP_FL_ENC_UTF_8);
-                if (idx < 0) {
-                    zip_source_free(source);
-                    // Fallback to normal file add
-                    result = add_file_to_zip(&ctx, entry->file_path, entry->archive_path);
-                } else {
-                    zip_file_set_mtime(ctx.archive, idx, entry->mtime, 0);
-                    if (ctx.verbose && !use_tui) {
-                        log_file_operation("Added file (pre-compressed)", entry->archive_path, entry->size);
-                    }
-                }
-            }
-        } else {
-            // Normal file add for small files or failed pre-compression
-            result = add_file_to_zip(&ctx, entry->file_path, entry->archive_path);
-        }
-        
-        if (result == EXIT_SUCCESS) {
-            added_count++;
-            update_progress(&ctx.progress, entry->size);
-            
-            // Update TUI progress
-            if (use_tui) {
-                tui_update_progress(entry->size);
-            }
-            
-            if (entry->size > 10 * 1024 * 1024) {
-                ctx.progress.large_files_count++;
-                ctx.progress.large_files_bytes += entry->size;
-            }
-            
-            if (ctx.verbose && !use_tui) {
-                print_progress(&ctx.progress, "Adding");
-            }
-        }
-    }
+    metrics_phase_begin(METRICS_PHASE_COMPRESS);
+    result = write_queue(&writer, &file_queue, opts, pacer, &ctx.progress, use_tui, ctx.verbose, &added_count);
+    metrics_phase_end(METRICS_PHASE_COMPRESS);
     
     // ========================================================================
-    // PHASE 4: Finalize archive
+    // PHASE 4: Finalize archive (central directory)
     // ========================================================================
     if (use_tui) {
-        tui_set_phase(4, "Compressing archive");
-        tui_refresh();
+        tui_set_phase(4, "Finalizing archive");
     }
     
     if (result == EXIT_SUCCESS) {
         set_progress_phase(&ctx.progress, PHASE_FINALIZING, 0.02);
         
-        if (!g_log_config.structured && ctx.verbose && !use_tui) {
+        if (!log_config_current()->structured && ctx.verbose && !use_tui) {
             printf("\n");
         }
         
-        int close_result = zip_close_with_progress(ctx.archive, &ctx.progress, ctx.verbose && !use_tui, opts->zip_file);
-        if (close_result < 0) {
-            fprintf(stderr, "\nError closing ZIP file: %s\n", zip_strerror(ctx.archive));
-            result = EXIT_ZIP_ERROR;
-        } else {
+        metrics_phase_begin(METRICS_PHASE_FINALIZE);
+        result = archive_writer_close(&writer);
+        metrics_phase_end(METRICS_PHASE_FINALIZE);
+        if (result == EXIT_SUCCESS) {
             time_t elapsed = time(NULL) - ctx.progress.start_time;
+            if (opts->stats) {
+                opts->stats->files = added_count;
+                opts->stats->bytes = total_bytes;
+                opts->stats->archive_bytes = writer.offset;
+            }
             
-            // Get actual compressed size from file and show TUI summary
+            // The writer counted every byte of the archive; show the TUI summary
             if (use_tui) {
-                g_tui.compressed_bytes = get_file_size(opts->zip_file);
+                g_tui.compressed_bytes = (size_t)writer.offset;
                 tui_show_summary();
             } else {
                 // Only show text-based log when TUI is not active
-                log_archive_info(opts->zip_file, added_count, total_bytes, (double)elapsed);
+                log_archive_info(stream ? "<stdout>" : opts->zip_file, added_count, total_bytes, (double)elapsed);
             }
             
-            if (!g_log_config.structured && !use_tui) {
+            if (!log_config_current()->structured && !use_tui) {
                 if (ctx.verbose) {
                     printf(" done\n");
                 }
                 
-                if (!ctx.verbose && !opts->quiet) {
+                // A streamed archive was just summarised on stderr
+                if (!ctx.verbose && !opts->quiet && !stream) {
                     printf("Created '%s' with %zu files\n", opts->zip_file, added_count);
                 }
             }
         }
     } else {
-        zip_discard(ctx.archive);
+        archive_writer_abort(&writer);
     }
     
     // Cleanup
     if (use_tui) {
         tui_cleanup();
     }
-    if (pool) pool_destroy(pool);
+    if (pacer && result == EXIT_SUCCESS && !opts->quiet && !log_config_current()->structured) {
+        print_pace_summary(pacer, stream ? stderr : stdout);
+    }
+    pacer_free(pacer);
     queue_free(&file_queue);
     free_zipignore(&ctx.zipignore);
     
     return result;
 }
 
+int add_files_to_archive(archive_writer_t* writer, const zip_input_file_t* files, size_t count,
+                         const options_t* opts, size_t* added_count) {
+    if (!writer || (!files && count > 0) || !opts || !added_count) {
+        return EXIT_INVALID_ARGS;
+    }
+    *added_count = 0;
+    
+    file_queue_t file_queue;
+    queue_init(&file_queue);
+    
+    for (size_t i = 0; i < count; i++) {
+        file_entry_t* entry = queue_new_entry(&file_queue, files[i].file_path, files[i].archive_path);
+        if (!entry) {
+            queue_free(&file_queue);
+            return EXIT_FAILURE;
+        }
+        entry->size = files[i].size;
+        entry->mtime = files[i].mtime;
+        queue_push(&file_queue, entry);
+    }
+    
+    progress_t progress;
+    init_progress(&progress);
+    progress.total_files = file_queue.count;
+    progress.total_bytes = file_queue.total_bytes;
+    
+    pacer_t* pacer = create_pacer(opts);
+    int result = write_queue(writer, &file_queue, opts, pacer, &progress, false, opts->verbose, added_count);
+    pacer_free(pacer);
+    queue_free(&file_queue);
+    return result;
+}
+
+// Copy buffer per extraction worker
+#define EXTRACT_BUFFER_SIZE (256 * 1024)
+// Stored entries at least this large are copied out of the archive by the
+// kernel; below it, looking up where their data starts costs more
+#define EXTRACT_COPY_RANGE_MIN_SIZE (64 * 1024)
+
+// The archive file itself, for copying stored entries without libzip
+typedef struct {
+    FILE* file;                     // Own handle per worker
+    const uint64_t* header_offsets; // Local header offset by libzip index
+    size_t count;
+} stored_source_t;
+
+// What decoding the data of one entry found
+typedef struct {
+    uint64_t size;              // Bytes decoded
+    uint32_t crc32;             // CRC-32 of those bytes
+    bool complete;              // The data ended exactly where its encoding does
+} decoded_entry_t;
+
+// Decode entry data that libzip hands over raw (ZIP_FL_COMPRESSED): stored
+// data as it is, anything else with the codec for its method. The output
+// goes to `output_file`, or nowhere when that is NULL. The first half of
+// `buffer` holds raw input, the second decoded output. Returns
+// EXIT_ZIP_ERROR for data the decoder rejects and EXIT_FILE_ERROR when the
+// output cannot be written; checking the result against the central
+// directory is up to the caller (see decoded_entry_matches()).
+static int decode_entry_data(zip_file_t* file, uint16_t method, FILE* output_file,
+                             unsigned char* buffer, size_t buffer_size, decoded_entry_t* decoded) {
+    memset(decoded, 0, sizeof(decoded_entry_t));
+    
+    codec_decoder_t* decoder = NULL;
+    if (method != ARCHIVE_METHOD_STORE) {
+        decoder = codec_decoder_create(method);
+        if (!decoder) return EXIT_FAILURE;
+    }
+    
+    size_t half = buffer_size / 2;
+    unsigned char* output = buffer + half;
+    const unsigned char* input = buffer;
+    size_t input_size = 0;
+    bool input_done = false;
+    int result = EXIT_SUCCESS;
+    
+    while (result == EXIT_SUCCESS) {
+        if (input_size == 0 && !input_done) {
+            zip_int64_t n = zip_fread(file, buffer, half);
+            if (n < 0) {
+                result = EXIT_ZIP_ERROR;
+                break;
+            }
+            metrics_count(METRICS_READ_CALLS, 1);
+            metrics_count(METRICS_BYTES_READ, (uint64_t)n);
+            input = buffer;
+            input_size = (size_t)n;
+            input_done = n == 0;
+        }
+        
+        size_t before = input_size;
+        size_t produced = 0;
+        bool finished = input_done;
+        const unsigned char* decoded_data = input;
+        if (!decoder) {
+            // Stored data is its own output
+            produced = input_size;
+            input_size = 0;
+        } else if (codec_decode(decoder, &input, &input_size, output, buffer_size - half,
+                                &produced, &finished) != 0) {
+            result = EXIT_ZIP_ERROR;
+            break;
+        } else {
+            decoded_data = output;
+        }
+        
+        if (produced > 0) {
+            if (output_file && fwrite(decoded_data, 1, produced, output_file) != produced) {
+                result = EXIT_FILE_ERROR;
+                break;
+            }
+            if (output_file) metrics_count(METRICS_BYTES_WRITTEN, produced);
+            decoded->crc32 = codec_crc32(decoded->crc32, decoded_data, produced);
+            decoded->size += produced;
+        } else if (input_size == before) {
+            // No progress: either the data is complete or it is cut short
+            decoded->complete = finished && input_done && input_size == 0;
+            break;
+        }
+    }
+    codec_decoder_free(decoder);
+    return result;
+}
+
+// Whether decoded data is what the central directory says the entry holds
+static bool decoded_entry_matches(const zip_stat_t* stat, const decoded_entry_t* decoded) {
+    return decoded->complete &&
+           (!(stat->valid & ZIP_STAT_SIZE) || decoded->size == stat->size) &&
+           (!(stat->valid & ZIP_STAT_CRC) || decoded->crc32 == stat->crc);
+}
+
+// Copy a stored entry from the archive to `output_file` within the kernel.
+// The data is first checked against the central directory's CRC-32 through
+// `buffer`, as libzip checks what it reads. Returns false, with nothing
+// written, for entries that do not qualify, could not be copied or do not
+// match; those are read through libzip instead, which reports the damage.
+static bool copy_stored_entry(const stored_source_t* stored, zip_uint64_t index, const zip_stat_t* stat,
+                              FILE* output_file, unsigned char* buffer, size_t buffer_size) {
+    zip_uint64_t required = ZIP_STAT_SIZE | ZIP_STAT_COMP_SIZE | ZIP_STAT_COMP_METHOD | ZIP_STAT_CRC;
+    if (!stored || !stored->file || index >= stored->count || (stat->valid & required) != required) {
+        return false;
+    }
+    bool encrypted = (stat->valid & ZIP_STAT_ENCRYPTION_METHOD) && stat->encryption_method != ZIP_EM_NONE;
+    if (encrypted || stat->comp_method != ARCHIVE_METHOD_STORE || stat->comp_size != stat->size ||
+        stat->size < EXTRACT_COPY_RANGE_MIN_SIZE) {
+        return false;
+    }
+    
+    uint64_t data_offset = 0;
+    uint32_t crc = 0;
+    if (!archive_entry_data_offset(stored->file, stored->header_offsets[index], &data_offset) ||
+        !archive_range_crc32(stored->file, data_offset, stat->size, buffer, buffer_size, &crc) ||
+        crc != stat->crc ||
+        !output_file_copy_range(output_file, stored->file, data_offset, stat->size)) {
+        return false;
+    }
+    metrics_count(METRICS_READ_CALLS, (stat->size + buffer_size - 1) / buffer_size);
+    metrics_count(METRICS_BYTES_READ, stat->size);
+    metrics_count(METRICS_BYTES_WRITTEN, stat->size);
+    return true;
+}
+
+// Extract one entry, copying data through the caller's buffer, or for
+// stored entries straight from the archive when `stored` allows it. With
+// `parents_ready` the entry's directories are known to exist already.
+static int extract_entry(zip_context_t* ctx, zip_uint64_t index, const char* output_dir,
+                         unsigned char* buffer, size_t buffer_size, bool parents_ready,
+                         const stored_source_t* stored) {
+    
+    zip_stat_t stat;
+    if (zip_stat_index(ctx->archive, index, 0, &stat) < 0) {
+        log_message(LOG_ERROR, "Error getting file stats at index %lld: %s\n", 
+                       (long long)index, zip_strerror(ctx->archive));
+        return EXIT_ZIP_ERROR;
+    }
+    
+    // Security check: validate path safety
+    if (!is_safe_path(stat.name)) {
+        log_message(LOG_WARNING, "Security warning: Unsafe path detected '%s' - skipping extraction\n", stat.name);
+        return EXIT_SUCCESS; // Skip this file but continue
+    }
+    
+    // Build output path
+    char* output_path = join_path(output_dir, stat.name);
+    if (!output_path) {
+        return EXIT_FAILURE;
+    }
+    
+    // Convert forward slashes to platform-specific separators
+    for (char* p = output_path; *p; p++) {
+        if (*p == '/') {
+            *p = PATH_SEPARATOR;
+        }
+    }
+    
+    // Check if it's a directory
+    size_t name_len = strlen(stat.name);
+    bool is_dir = (name_len > 0 && stat.name[name_len - 1] == '/');
+    
+    if (is_dir) {
+        // Create directory
+        if (create_directory_recursive(output_path) != EXIT_SUCCESS) {
+            log_message(LOG_ERROR, "Error creating directory '%s'\n", output_path);
+            free(output_path);
+            return EXIT_FILE_ERROR;
+        }
+        
+        if (ctx->verbose) {
+            printf("Created directory: %s\n", output_path);
+        }
+    } else {
+        // Extract file
+        
+        // Create parent directory if needed
+        if (!parents_ready) {
+            char* dir_path = malloc(strlen(output_path) + 1);
+            if (!dir_path) {
+                free(output_path);
+                return EXIT_FAILURE;
+            }
+            
+            strcpy(dir_path, output_path);
+            char* last_sep = strrchr(dir_path, PATH_SEPARATOR);
+            if (last_sep) {
+                *last_sep = '\0';
+                create_directory_recursive(dir_path);
+            }
+            free(dir_path);
+        }
+        
+        // libzip decodes stored and deflated data itself; methods that a
+        // built codec knows beyond those (Zstandard) are read raw and
+        // decoded here
+        bool encrypted = (stat.valid & ZIP_STAT_ENCRYPTION_METHOD) && stat.encryption_method != ZIP_EM_NONE;
+        bool decode = (stat.valid & ZIP_STAT_COMP_METHOD) && !encrypted &&
+                      stat.comp_method != ARCHIVE_METHOD_STORE && stat.comp_method != ARCHIVE_METHOD_DEFLATE &&
+                      codec_can_decode(stat.comp_method);
+        
+        // Open file in ZIP
+        zip_file_t* file = zip_fopen_index(ctx->archive, index, decode ? ZIP_FL_COMPRESSED : 0);
+        if (!file) {
+            log_message(LOG_ERROR, "Error opening file in ZIP at index %lld: %s\n", 
+                           (long long)index, zip_strerror(ctx->archive));
+            free(output_path);
+            return EXIT_ZIP_ERROR;
+        }
+        
+        // Create output file
+        FILE* output_file = fopen(output_path, "wb");
+        if (!output_file) {
+            log_message(LOG_ERROR, "Error creating output file '%s'\n", output_path);
+            zip_fclose(file);
+            free(output_path);
+            return EXIT_FILE_ERROR;
+        }
+        
+        bool copied = !decode && copy_stored_entry(stored, index, &stat, output_file, buffer, buffer_size);
+        if (!copied && (stat.valid & ZIP_STAT_SIZE)) {
+            output_file_preallocate(output_file, stat.size);
+        }
+        
+        if (decode) {
+            decoded_entry_t decoded;
+            int result = decode_entry_data(file, stat.comp_method, output_file, buffer, buffer_size, &decoded);
+            if (result == EXIT_FILE_ERROR) {
+                log_message(LOG_ERROR, "Error writing to output file '%s'\n", output_path);
+            } else if (result == EXIT_FAILURE) {
+                log_message(LOG_ERROR, "Error: Out of memory decoding '%s'\n", stat.name);
+            } else if (result != EXIT_SUCCESS || !decoded_entry_matches(&stat, &decoded)) {
+                log_message(LOG_ERROR, "Error: Corrupt data in '%s'\n", stat.name);
+                result = EXIT_ZIP_ERROR;
+            }
+            if (result != EXIT_SUCCESS) {
+                fclose(output_file);
+                zip_fclose(file);
+                free(output_path);
+                return result;
+            }
+        }
+        
+        // Copy data
+        zip_int64_t bytes_read = 0;
+        while (!decode && !copied && (bytes_read = zip_fread(file, buffer, buffer_size)) > 0) {
+            if (fwrite(buffer, 1, bytes_read, output_file) != (size_t)bytes_read) {
+                log_message(LOG_ERROR, "Error writing to output file '%s'\n", output_path);
+                fclose(output_file);
+                zip_fclose(file);
+                free(output_path);
+                return EXIT_FILE_ERROR;
+            }
+            metrics_count(METRICS_READ_CALLS, 1);
+            metrics_count(METRICS_BYTES_READ, (uint64_t)bytes_read);
+            metrics_count(METRICS_BYTES_WRITTEN, (uint64_t)bytes_read);
+        }
+        if (!decode && !copied && bytes_read < 0) {
+            // libzip fails the read that ends the data when its CRC-32 is wrong
+            log_message(LOG_ERROR, "Error: Corrupt data in '%s'\n", stat.name);
+            fclose(output_file);
+            zip_fclose(file);
+            free(output_path);
+            return EXIT_ZIP_ERROR;
+        }
+        
+        fclose(output_file);
+        zip_fclose(file);
+        
+        if (ctx->verbose) {
+            printf("Extracted file: %s\n", output_path);
+        }
+    }
+    
+    free(output_path);
+    return EXIT_SUCCESS;
+}
+
+// A damaged entry found by verify_zip()
+typedef struct {
+    zip_uint64_t index;
+    char* message;              // "name: problem"
+} verify_failure_t;
+
+// Findings of a verification run, merged from every worker
+typedef struct {
+    size_t checked;
+    size_t skipped;             // Encrypted entries, which need a password
+    uint64_t bytes;             // Uncompressed bytes checked
+    verify_failure_t* failures;
+    size_t failure_count;
+    size_t failure_capacity;
+} verify_report_t;
+
+// Outcome of one entry; `failure` is NULL when the entry is intact
+typedef struct {
+    bool skipped;
+    uint64_t bytes;
+    char* failure;
+} verify_result_t;
+
+static char* format_failure(const char* name, const char* format, ...) {
+    char problem[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(problem, sizeof(problem), format, args);
+    va_end(args);
+    
+    size_t size = strlen(name) + strlen(problem) + 3;
+    char* message = malloc(size);
+    if (message) snprintf(message, size, "%s: %s", name, problem);
+    return message;
+}
+
+// Decode one entry into a discard sink and check its size and CRC-32
+// against the central directory. Stored data and every method a built
+// codec knows are read raw and checked here on the hardware CRC kernel;
+// libzip decodes anything else.
+static void verify_entry(zip_t* archive, zip_uint64_t index, unsigned char* buffer, size_t buffer_size,
+                         verify_result_t* out) {
+    memset(out, 0, sizeof(verify_result_t));
+    
+    zip_stat_t stat;
+    if (zip_stat_index(archive, index, 0, &stat) < 0) {
+        char name[32];
+        snprintf(name, sizeof(name), "entry %llu", (unsigned long long)index);
+        out->failure = format_failure(name, "unreadable central directory record");
+        return;
+    }
+    
+    size_t name_len = strlen(stat.name);
+    if (name_len > 0 && stat.name[name_len - 1] == '/') {
+        return;
+    }
+    if ((stat.valid & ZIP_STAT_ENCRYPTION_METHOD) && stat.encryption_method != ZIP_EM_NONE) {
+        out->skipped = true;
+        return;
+    }
+    
+    bool raw = (stat.valid & ZIP_STAT_COMP_METHOD) &&
+               (stat.comp_method == ARCHIVE_METHOD_STORE || codec_can_decode(stat.comp_method));
+    zip_file_t* file = zip_fopen_index(archive, index, raw ? ZIP_FL_COMPRESSED : 0);
+    if (!file) {
+        out->failure = format_failure(stat.name, "cannot open entry data (%s)", zip_strerror(archive));
+        return;
+    }
+    
+    decoded_entry_t decoded;
+    int result = EXIT_SUCCESS;
+    if (raw) {
+        result = decode_entry_data(file, stat.comp_method, NULL, buffer, buffer_size, &decoded);
+    } else {
+        // libzip checks its own CRC too and fails the read on a mismatch
+        memset(&decoded, 0, sizeof(decoded));
+        zip_int64_t n;
+        while ((n = zip_fread(file, buffer, buffer_size)) > 0) {
+            metrics_count(METRICS_READ_CALLS, 1);
+            metrics_count(METRICS_BYTES_READ, (uint64_t)n);
+            decoded.crc32 = codec_crc32(decoded.crc32, buffer, (size_t)n);
+            decoded.size += (uint64_t)n;
+        }
+        result = n < 0 ? EXIT_ZIP_ERROR : EXIT_SUCCESS;
+        decoded.complete = n == 0;
+    }
+    zip_fclose(file);
+    out->bytes = decoded.size;
+    
+    if (result == EXIT_FAILURE) {
+        out->failure = format_failure(stat.name, "out of memory");
+    } else if (result != EXIT_SUCCESS || !decoded.complete) {
+        out->failure = format_failure(stat.name, "corrupt compressed data");
+    } else if ((stat.valid & ZIP_STAT_SIZE) && decoded.size != stat.size) {
+        out->failure = format_failure(stat.name, "size mismatch (central directory %llu, data %llu)",
+                                      (unsigned long long)stat.size, (unsigned long long)decoded.size);
+    } else if ((stat.valid & ZIP_STAT_CRC) && decoded.crc32 != stat.crc) {
+        out->failure = format_failure(stat.name, "CRC-32 mismatch (central directory %08x, data %08x)",
+                                      (unsigned)stat.crc, (unsigned)decoded.crc32);
+    }
+}
+
+// Shared state of a parallel extraction or verification: the entries to
+// process, handed out one at a time to the workers. When extracting they
+// are the file entries that passed the central directory pre-pass, and
+// their directories have all been created up front.
+typedef struct {
+    const char* output_dir;
+    const zip_uint64_t* indices;
+    size_t count;
+    size_t next;                // Next position in indices to hand out
+    int result;                 // First error; stops every worker
+    progress_t* progress;
+    bool verbose;
+    verify_report_t* report;    // Set when verifying: entries are checked, not written
+    log_config_t* log_config;   // The run's, adopted by the worker threads
+    
+#ifndef _WIN32
+    pthread_mutex_t mutex;
+#else
+    CRITICAL_SECTION cs;
+#endif
+} extract_queue_t;
+
+typedef struct {
+    extract_queue_t* queue;
+    zip_context_t ctx;          // Own read handle: a zip_t must not be shared between threads
+    unsigned char* buffer;      // EXTRACT_BUFFER_SIZE copy buffer
+    stored_source_t stored;     // Own archive file handle when stored entries are copied directly
+    int index;                  // 0 runs on the calling thread
+} extract_worker_t;
+
+static void extract_queue_lock(extract_queue_t* q) {
+#ifndef _WIN32
+    pthread_mutex_lock(&q->mutex);
+#else
+    EnterCriticalSection(&q->cs);
+#endif
+}
+
+static void extract_queue_unlock(extract_queue_t* q) {
 #ifndef _WIN32
-// Unix/Linux/macOS progress thread
-void* progress_thread(void* arg) {
-    (void)arg; // Suppress unused parameter warning
-    int step = 0;
-    size_t last_file_size = 0;
-    
-    while (g_compression_active) {
-        if (g_show_progress && g_progress_ptr) {
-            // Monitor output file size growth if we have a filename
-            if (g_output_filename[0] != '\0' && file_exists(g_output_filename)) {
-                size_t current_file_size = get_file_size(g_output_filename);
-                if (current_file_size > last_file_size) {
-                    g_total_compressed_bytes = current_file_size;
-                    last_file_size = current_file_size;
+    pthread_mutex_unlock(&q->mutex);
+#else
+    LeaveCriticalSection(&q->cs);
+#endif
+}
+
+static void run_extract_worker(extract_worker_t* worker) {
+    extract_queue_t* q = worker->queue;
+    
+    while (1) {
+        extract_queue_lock(q);
+        if (q->result != EXIT_SUCCESS || q->next >= q->count) {
+            extract_queue_unlock(q);
+            break;
+        }
+        zip_uint64_t index = q->indices[q->next++];
+        extract_queue_unlock(q);
+        uint64_t busy_start = metrics_start();
+        
+        if (q->report) {
+            // A damaged entry is reported, and the rest are still checked
+            verify_result_t verified;
+            verify_entry(worker->ctx.archive, index, worker->buffer, EXTRACT_BUFFER_SIZE, &verified);
+            
+            extract_queue_lock(q);
+            verify_report_t* report = q->report;
+            report->checked++;
+            report->bytes += verified.bytes;
+            if (verified.skipped) report->skipped++;
+            if (verified.failure) {
+                if (report->failure_count == report->failure_capacity) {
+                    size_t capacity = report->failure_capacity ? report->failure_capacity * 2 : 16;
+                    verify_failure_t* grown = realloc(report->failures, capacity * sizeof(verify_failure_t));
+                    if (grown) {
+                        report->failures = grown;
+                        report->failure_capacity = capacity;
+                    }
+                }
+                if (report->failure_count < report->failure_capacity) {
+                    report->failures[report->failure_count].index = index;
+                    report->failures[report->failure_count].message = verified.failure;
+                    report->failure_count++;
+                } else {
+                    free(verified.failure);
+                    q->result = EXIT_FAILURE;
                 }
             }
-            
-            print_compression_progress(g_progress_ptr, step++);
+            extract_queue_unlock(q);
+            metrics_stop(METRICS_TIMER_BUSY, busy_start, "verify");
+            continue;
         }
-        sleep(1); // Update every 1 second
+        
+        int result = extract_entry(&worker->ctx, index, q->output_dir, worker->buffer, EXTRACT_BUFFER_SIZE, true,
+                                   &worker->stored);
+        metrics_stop(METRICS_TIMER_BUSY, busy_start, "extract");
+        
+        extract_queue_lock(q);
+        if (result != EXIT_SUCCESS) {
+            if (q->result == EXIT_SUCCESS) q->result = result;
+        } else {
+            update_progress(q->progress, 1);
+            if (q->verbose || log_config_current()->sink) {
+                print_progress(q->progress, "Extracting");
+            }
+        }
+        extract_queue_unlock(q);
     }
+}
+
+#ifndef _WIN32
+static void* extract_worker_thread(void* arg) {
+    extract_worker_t* worker = (extract_worker_t*)arg;
+    log_config_use(worker->queue->log_config);
+    metrics_thread_begin(worker->queue->report ? "verify" : "extract", worker->index);
+    run_extract_worker(worker);
+    metrics_thread_end();
     return NULL;
 }
 #else
-// Windows progress thread
-DWORD WINAPI progress_thread(LPVOID arg) {
-    (void)arg; // Suppress unused parameter warning
-    int step = 0;
-    size_t last_file_size = 0;
-    
-    while (g_compression_active) {
-        if (g_show_progress && g_progress_ptr) {
-            // Monitor output file size growth if we have a filename
-            if (g_output_filename[0] != '\0' && file_exists(g_output_filename)) {
-                size_t current_file_size = get_file_size(g_output_filename);
-                if (current_file_size > last_file_size) {
-                    g_total_compressed_bytes = current_file_size;
-                    last_file_size = current_file_size;
-                }
-            }
-            
-            print_compression_progress(g_progress_ptr, step++);
-        }
-        Sleep(1000); // Update every 1 second
-    }
+static DWORD WINAPI extract_worker_thread(LPVOID arg) {
+    extract_worker_t* worker = (extract_worker_t*)arg;
+    log_config_use(worker->queue->log_config);
+    metrics_thread_begin(worker->queue->report ? "verify" : "extract", worker->index);
+    run_extract_worker(worker);
+    metrics_thread_end();
     return 0;
 }
 #endif
 
-
-// Cross-platform function to close ZIP archive with progress updates
-int zip_close_with_progress(zip_t* archive, progress_t* progress, bool verbose, const char* output_filename) {
-    if (!archive) return -1;
+// Extract the queued entries on up to `num_workers` threads, or verify them
+// into `report` when one is given. Worker 0 runs on the calling thread with
+// the caller's archive handle; every other worker opens the archive again.
+// Workers whose handle can't be opened are dropped. With `copy_stored`,
+// large stored entries are copied out of the archive file directly (where
+// the platform can), for which every worker also opens it as a plain file.
+static int extract_entries_parallel(zip_context_t* ctx, const options_t* opts,
+                                    const zip_uint64_t* indices, size_t count, int num_workers,
+                                    verify_report_t* report, bool copy_stored) {
+    extract_queue_t queue = {
+        .output_dir = opts->target_dir,
+        .indices = indices,
+        .count = count,
+        .result = EXIT_SUCCESS,
+        .progress = &ctx->progress,
+        .verbose = ctx->verbose,
+        .report = report,
+        .log_config = log_config_current()
+    };
     
-    // For smaller archives, just close normally without extra output
-    if (!progress || (progress->large_files_bytes < 5 * 1024 * 1024 && progress->total_files < 50)) {
-        return zip_close(archive);
-    }
+    extract_worker_t* workers = calloc((size_t)num_workers, sizeof(extract_worker_t));
+    if (!workers) return EXIT_FAILURE;
     
-    // Determine if we should show progress
-    bool show_progress = verbose || progress->large_files_bytes > 20 * 1024 * 1024;
-    time_t start_compression = time(NULL);
+    // Without the offsets, every entry goes through libzip
+    uint64_t* header_offsets = NULL;
+    size_t header_count = 0;
+#ifdef OUTPUT_FILE_HAVE_COPY_RANGE
+    if (copy_stored && !report &&
+        archive_read_header_offsets(opts->zip_file, &header_offsets, &header_count) == EXIT_SUCCESS &&
+        header_count != (size_t)zip_get_num_entries(ctx->archive, 0)) {
+        free(header_offsets);
+        header_offsets = NULL;
+        header_count = 0;
+    }
+#else
+    (void)copy_stored;
+#endif
     
-    if (show_progress) {
-        // Store output filename for file size monitoring
-        if (output_filename) {
-            strncpy(g_output_filename, output_filename, PATH_MAX - 1);
-            g_output_filename[PATH_MAX - 1] = '\0';
-        }
+    int started = 0;
+    for (int i = 0; i < num_workers; i++) {
+        extract_worker_t* w = &workers[started];
+        w->queue = &queue;
+        w->index = started;
+        w->ctx.filename = ctx->filename;
+        w->ctx.verbose = ctx->verbose;
+        w->buffer = malloc(EXTRACT_BUFFER_SIZE);
         
-        g_progress_ptr = progress;
-        g_show_progress = true;
-        g_compression_active = true;
-        g_total_compressed_bytes = 0;
+        if (i == 0) {
+            w->ctx.archive = ctx->archive;
+        } else if (w->buffer) {
+            int error;
+            w->ctx.archive = zip_open(opts->zip_file, ZIP_RDONLY, &error);
+        }
         
-        // Start progress thread
-        #ifndef _WIN32
-            pthread_create(&g_progress_thread, NULL, progress_thread, NULL);
-        #else
-            g_progress_handle = CreateThread(NULL, 0, progress_thread, NULL, 0, NULL);
-        #endif
+        if (!w->buffer || !w->ctx.archive) {
+            free(w->buffer);
+            if (i == 0) {
+                free(header_offsets);
+                free(workers);
+                return EXIT_FAILURE;
+            }
+            continue;
+        }
         
-        print_compression_progress(progress, 0);
-        fflush(stdout);
+        if (header_offsets) {
+            w->stored.file = fopen(opts->zip_file, "rb");
+            w->stored.header_offsets = header_offsets;
+            w->stored.count = header_count;
+        }
+        started++;
+    }
+    
+    if (ctx->verbose && started > 1) {
+        printf("Using %d threads for %s\n", started, report ? "verification" : "extraction");
     }
     
-    // Perform the actual compression
-    int result = zip_close(archive);
+#ifndef _WIN32
+    pthread_mutex_init(&queue.mutex, NULL);
+    pthread_t* threads = calloc((size_t)started, sizeof(pthread_t));
+    int running = 1;
+    for (int i = 1; threads && i < started; i++) {
+        if (pthread_create(&threads[i], NULL, extract_worker_thread, &workers[i]) != 0) break;
+        running++;
+    }
     
-    // Stop progress monitoring
-    if (show_progress) {
-        g_compression_active = false;
-        
-        // Wait for progress thread to finish
-        #ifndef _WIN32
-            pthread_join(g_progress_thread, NULL);
-        #else
-            if (g_progress_handle) {
-                WaitForSingleObject(g_progress_handle, 1000);
-                CloseHandle(g_progress_handle);
-                g_progress_handle = NULL;
+    run_extract_worker(&workers[0]);
+    
+    for (int i = 1; i < running; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&queue.mutex);
+#else
+    InitializeCriticalSection(&queue.cs);
+    HANDLE* threads = calloc((size_t)started, sizeof(HANDLE));
+    int running = 1;
+    for (int i = 1; threads && i < started; i++) {
+        threads[i] = CreateThread(NULL, 0, extract_worker_thread, &workers[i], 0, NULL);
+        if (!threads[i]) break;
+        running++;
+    }
+    
+    run_extract_worker(&workers[0]);
+    
+    if (running > 1) {
+        WaitForMultipleObjects((DWORD)(running - 1), threads + 1, TRUE, INFINITE);
+    }
+    for (int i = 1; i < running; i++) {
+        CloseHandle(threads[i]);
+    }
+    free(threads);
+    DeleteCriticalSection(&queue.cs);
+#endif
+    
+    for (int i = 0; i < started; i++) {
+        if (i > 0) zip_close(workers[i].ctx.archive);
+        if (workers[i].stored.file) fclose(workers[i].stored.file);
+        free(workers[i].buffer);
+    }
+    free(workers);
+    free(header_offsets);
+    
+    return queue.result;
+}
+
+static int compare_indices(const void* a, const void* b) {
+    zip_uint64_t x = *(const zip_uint64_t*)a;
+    zip_uint64_t y = *(const zip_uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Indices of the entries `select` picks, in archive order. Plain paths are
+// looked up in libzip's name table, so pulling a few files out of a huge
+// archive never visits the other entries; patterns (or a plain name that
+// is a directory) take one pass over the names. `indices` must have room
+// for every entry.
+static size_t select_entries(zip_t* archive, const entry_select_t* select, size_t total,
+                             zip_uint64_t* indices) {
+    size_t count = 0;
+    if (select->literal) {
+        for (int i = 0; i < select->count; i++) {
+            zip_int64_t index = zip_name_locate(archive, select->names[i], 0);
+            if (index < 0) {
+                count = 0;
+                break;
             }
-        #endif
-        
-        time_t end_compression = time(NULL);
-        long compression_time = end_compression - start_compression;
+            indices[count++] = (zip_uint64_t)index;
+        }
         
-        // Only print text output if TUI is not active
-        if (!g_tui.is_active) {
-            if (result == 0) {
-                printf("\rCompressing and writing archive ✓ (100.0%%) - completed in %lds", compression_time);
-                if (compression_time > 10) {
-                    printf("\n  Large file compression required extended time");
-                }
-                printf("\n");
-            } else {
-                printf("\rCompression failed after %lds\n", compression_time);
+        if (count > 0) {
+            qsort(indices, count, sizeof(zip_uint64_t), compare_indices);
+            size_t unique = 1;
+            for (size_t i = 1; i < count; i++) {
+                if (indices[i] != indices[unique - 1]) indices[unique++] = indices[i];
             }
-        } else {
-            // Update TUI with 100% completion
-            tui_update_compression(100.0, 0);
-            tui_refresh();
+            return unique;
         }
-        
-        // Clear the filename
-        g_output_filename[0] = '\0';
     }
     
-    return result;
+    for (zip_uint64_t i = 0; i < total; i++) {
+        if (select->count > 0) {
+            const char* name = zip_get_name(archive, i, 0);
+            if (!name || !entry_select_match(select, name)) continue;
+        }
+        indices[count++] = i;
+    }
+    return count;
+}
+
+// An entry name and where it sits in the archive
+typedef struct {
+    const char* name;
+    zip_uint64_t index;
+} named_index_t;
+
+static int compare_named_indices(const void* a, const void* b) {
+    const named_index_t* x = (const named_index_t*)a;
+    const named_index_t* y = (const named_index_t*)b;
+    int order = strcmp(x->name, y->name);
+    if (order != 0) return order;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// Drop entries of `indices` (in archive order) whose name a later entry
+// reuses, as appends leave behind: the last one is what extracting them in
+// order would leave on disk, and parallel workers never write one path at
+// once. Returns the count
+// kept, or 0 with `indices` untouched when out of memory.
+static size_t drop_superseded_entries(zip_t* archive, zip_uint64_t* indices, size_t count) {
+    named_index_t* names = malloc(count * sizeof(named_index_t));
+    if (!names) return 0;
+    for (size_t i = 0; i < count; i++) {
+        const char* name = zip_get_name(archive, indices[i], 0);
+        names[i].name = name ? name : "";
+        names[i].index = indices[i];
+    }
+    qsort(names, count, sizeof(named_index_t), compare_named_indices);
+    
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i + 1 < count && strcmp(names[i].name, names[i + 1].name) == 0) continue;
+        indices[kept++] = names[i].index;
+    }
+    free(names);
+    qsort(indices, kept, sizeof(zip_uint64_t), compare_indices);
+    return kept;
 }
 
 int extract_zip(const options_t* opts) {
@@ -1269,14 +3197,14 @@ int extract_zip(const options_t* opts) {
     
     // Check if ZIP file exists
     if (!file_exists(opts->zip_file)) {
-        fprintf(stderr, "Error: ZIP file '%s' does not exist\n", opts->zip_file);
+        log_message(LOG_ERROR, "Error: ZIP file '%s' does not exist\n", opts->zip_file);
         return EXIT_FILE_ERROR;
     }
     
     // Create target directory if it doesn't exist
     if (!is_directory(opts->target_dir)) {
         if (create_directory_recursive(opts->target_dir) != EXIT_SUCCESS) {
-            fprintf(stderr, "Error: Could not create target directory '%s'\n", opts->target_dir);
+            log_message(LOG_ERROR, "Error: Could not create target directory '%s'\n", opts->target_dir);
             return EXIT_FILE_ERROR;
         }
     }
@@ -1287,8 +3215,8 @@ int extract_zip(const options_t* opts) {
     if (!archive) {
         zip_error_t zip_error;
         zip_error_init_with_code(&zip_error, error);
-        fprintf(stderr, "Error opening ZIP file '%s': %s\n", 
-                opts->zip_file, zip_error_strerror(&zip_error));
+        log_message(LOG_ERROR, "Error opening ZIP file '%s': %s\n", 
+                       opts->zip_file, zip_error_strerror(&zip_error));
         zip_error_fini(&zip_error);
         return EXIT_ZIP_ERROR;
     }
@@ -1299,16 +3227,52 @@ int extract_zip(const options_t* opts) {
     ctx.filename = opts->zip_file;
     ctx.verbose = opts->verbose;
     
+    entry_select_t select;
+    if (entry_select_init(&select, (const char* const*)opts->input_files, opts->input_file_count) != EXIT_SUCCESS) {
+        zip_close(archive);
+        return EXIT_INVALID_ARGS;
+    }
+    
+    zip_int64_t num_entries = zip_get_num_entries(archive, 0);
+    size_t archive_entries = num_entries > 0 ? (size_t)num_entries : 0;
+    zip_uint64_t* indices = malloc(sizeof(zip_uint64_t) * (archive_entries > 0 ? archive_entries : 1));
+    if (!indices) {
+        entry_select_free(&select);
+        zip_close(archive);
+        return EXIT_FAILURE;
+    }
+    size_t selected = select_entries(archive, &select, archive_entries, indices);
+    bool selecting = select.count > 0;
+    entry_select_free(&select);
+    
+    if (selected > 1) {
+        size_t unique = drop_superseded_entries(archive, indices, selected);
+        if (unique == 0) {
+            free(indices);
+            zip_close(archive);
+            return EXIT_FAILURE;
+        }
+        selected = unique;
+    }
+    
+    if (selecting && selected == 0) {
+        log_message(LOG_ERROR, "Error: No entries in '%s' match the given names\n", opts->zip_file);
+        free(indices);
+        zip_close(archive);
+        return EXIT_FILE_ERROR;
+    }
+    
     init_progress(&ctx.progress);
-    ctx.progress.total_files = zip_get_num_entries(archive, 0);
+    ctx.progress.total_files = selected;
     
     // Security check: limit number of files
     if (ctx.progress.total_files > MAX_EXTRACT_FILES) {
-        fprintf(stderr, "Security warning: Archive contains %zu files (limit: %d)\n", 
-                ctx.progress.total_files, MAX_EXTRACT_FILES);
-        fprintf(stderr, "This may be a ZIP bomb or extremely large archive. Use with caution.\n");
+        log_message(LOG_WARNING, "Security warning: Archive contains %zu files (limit: %d)\n", 
+                         ctx.progress.total_files, MAX_EXTRACT_FILES);
+        log_message(LOG_WARNING, "This may be a ZIP bomb or extremely large archive. Use with caution.\n");
         if (!opts->force) {
-            fprintf(stderr, "Extraction cancelled. Use -f to force extraction.\n");
+            log_message(LOG_ERROR, "Extraction cancelled. Use -f to force extraction.\n");
+            free(indices);
             zip_close(archive);
             return EXIT_FILE_ERROR;
         }
@@ -1316,18 +3280,38 @@ int extract_zip(const options_t* opts) {
     
     if (ctx.verbose) {
         printf("Extracting ZIP archive '%s' to '%s'\n", opts->zip_file, opts->target_dir);
-        printf("Total entries: %zu\n", ctx.progress.total_files);
+        if (selecting) {
+            printf("Selected entries: %zu of %zu\n", selected, archive_entries);
+        } else {
+            printf("Total entries: %zu\n", ctx.progress.total_files);
+        }
     }
     
-    // Extract all entries
+    // Pre-pass over the selected entries: every security check runs before
+    // any data is written, and only files that pass are queued. The
+    // directories they need are collected so the tree is created only once.
     int result = EXIT_SUCCESS;
-    size_t total_extracted_size = 0;
+    dir_cache_t dirs;
+    dir_cache_init(&dirs);
+    uint64_t total_extracted_size = 0;
+    bool size_warned = false;
     size_t suspicious_files = 0;
+    size_t queued = 0;
+    bool any_large_stored = false;
     
-    for (zip_uint64_t i = 0; i < ctx.progress.total_files; i++) {
+    // Queued entries are compacted into `indices` in place
+    for (size_t k = 0; k < selected; k++) {
+        zip_uint64_t i = indices[k];
+        
         // Get file stats for security checks
         zip_stat_t stat;
         if (zip_stat_index(archive, i, 0, &stat) == 0) {
+            // Security check: validate path safety
+            if (!is_safe_path(stat.name)) {
+                log_message(LOG_WARNING, "Security warning: Unsafe path detected '%s' - skipping extraction\n", stat.name);
+                continue;
+            }
+            
             total_extracted_size += stat.size;
             
             // Check for suspicious files
@@ -1342,38 +3326,69 @@ int extract_zip(const options_t* opts) {
             if (stat.comp_size > 0 && stat.size > 0) {
                 double compression_ratio = (double)stat.size / (double)stat.comp_size;
                 if (compression_ratio > MAX_COMPRESSION_RATIO && stat.size > 1024 * 1024) {
-                    printf("Warning: Very high compression ratio (%.1f:1) for large file: %s\n", 
-                           compression_ratio, stat.name);
+                    log_message(LOG_WARNING, "Warning: Very high compression ratio (%.1f:1) for large file: %s\n",
+                                compression_ratio, stat.name);
                 }
             }
             
             // Check total extracted size limit
-            if (total_extracted_size > MAX_EXTRACT_SIZE) {
-                fprintf(stderr, "Security warning: Total extracted size would exceed %llu bytes (%.1f GB)\n", 
-                        (unsigned long long)MAX_EXTRACT_SIZE, 
-                        (double)MAX_EXTRACT_SIZE / (1024.0 * 1024.0 * 1024.0));
+            if (total_extracted_size > MAX_EXTRACT_SIZE && !size_warned) {
+                log_message(LOG_WARNING, "Security warning: Total extracted size would exceed %llu bytes (%.1f GB)\n", 
+                                 (unsigned long long)MAX_EXTRACT_SIZE, 
+                                 (double)MAX_EXTRACT_SIZE / (1024.0 * 1024.0 * 1024.0));
+                size_warned = true;
                 if (!opts->force) {
-                    fprintf(stderr, "Extraction cancelled. Use -f to force extraction.\n");
+                    log_message(LOG_ERROR, "Extraction cancelled. Use -f to force extraction.\n");
                     result = EXIT_FILE_ERROR;
                     break;
                 }
             }
+            
+            if (dir_cache_add_entry(&dirs, stat.name) < 0) {
+                result = EXIT_FAILURE;
+                break;
+            }
+            
+            // Directory entries are complete once the skeleton exists
+            size_t name_len = strlen(stat.name);
+            if (name_len > 0 && stat.name[name_len - 1] == '/') {
+                continue;
+            }
+            
+            if ((stat.valid & ZIP_STAT_COMP_METHOD) && stat.comp_method == ARCHIVE_METHOD_STORE &&
+                stat.size >= EXTRACT_COPY_RANGE_MIN_SIZE) {
+                any_large_stored = true;
+            }
         }
         
-        result = extract_file_from_zip(&ctx, i, opts->target_dir);
-        if (result != EXIT_SUCCESS) {
-            break;
+        indices[queued++] = i;
+    }
+    
+    if (result == EXIT_SUCCESS) {
+        result = dir_cache_create_all(&dirs, opts->target_dir);
+        if (result == EXIT_SUCCESS && ctx.verbose) {
+            printf("Created %zu directories\n", dirs.count);
         }
+    }
+    dir_cache_free(&dirs);
+    
+    // Extract on one thread per core, each with its own archive handle
+    if (result == EXIT_SUCCESS && queued > 0) {
+        ctx.progress.total_files = queued;
         
-        update_progress(&ctx.progress, 1);
-        if (ctx.verbose) {
-            print_progress(&ctx.progress, "Extracting");
-        }
+        int num_workers = resources_cpu_count();
+        if ((size_t)num_workers > queued) num_workers = (int)queued;
+        if (num_workers < 1) num_workers = 1;
+        
+        metrics_phase_begin(METRICS_PHASE_EXTRACT);
+        result = extract_entries_parallel(&ctx, opts, indices, queued, num_workers, NULL, any_large_stored);
+        metrics_phase_end(METRICS_PHASE_EXTRACT);
     }
+    free(indices);
     
     if (suspicious_files > 0) {
-        printf("Warning: Extracted %zu potentially dangerous files. Review before executing.\n", 
-               suspicious_files);
+        log_message(LOG_WARNING, "Warning: Extracted %zu potentially dangerous files. Review before executing.\n",
+                    suspicious_files);
     }
     
     zip_close(archive);
@@ -1386,104 +3401,227 @@ int extract_zip(const options_t* opts) {
     return result;
 }
 
-int list_zip(const options_t* opts) {
+// Seconds on a monotonic clock, for throughput figures
+static double monotonic_seconds(void) {
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#else
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#endif
+}
+
+static int compare_failures(const void* a, const void* b) {
+    zip_uint64_t x = ((const verify_failure_t*)a)->index;
+    zip_uint64_t y = ((const verify_failure_t*)b)->index;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+int verify_zip(const options_t* opts) {
     if (!opts || !opts->zip_file) {
         return EXIT_INVALID_ARGS;
     }
     
-    // Check if ZIP file exists
     if (!file_exists(opts->zip_file)) {
-        fprintf(stderr, "Error: ZIP file '%s' does not exist\n", opts->zip_file);
+        log_message(LOG_ERROR, "Error: ZIP file '%s' does not exist\n", opts->zip_file);
         return EXIT_FILE_ERROR;
     }
     
-    // Open ZIP archive
     int error;
     zip_t* archive = zip_open(opts->zip_file, ZIP_RDONLY, &error);
     if (!archive) {
         zip_error_t zip_error;
         zip_error_init_with_code(&zip_error, error);
-        fprintf(stderr, "Error opening ZIP file '%s': %s\n", 
-                opts->zip_file, zip_error_strerror(&zip_error));
+        log_message(LOG_ERROR, "Error opening ZIP file '%s': %s\n", 
+                       opts->zip_file, zip_error_strerror(&zip_error));
         zip_error_fini(&zip_error);
         return EXIT_ZIP_ERROR;
     }
     
+    zip_context_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.archive = archive;
+    ctx.filename = opts->zip_file;
+    ctx.verbose = opts->verbose;
+    init_progress(&ctx.progress);
+    
     zip_int64_t num_entries = zip_get_num_entries(archive, 0);
+    size_t count = num_entries > 0 ? (size_t)num_entries : 0;
+    zip_uint64_t* indices = malloc(sizeof(zip_uint64_t) * (count > 0 ? count : 1));
+    if (!indices) {
+        zip_close(archive);
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < count; i++) {
+        indices[i] = i;
+    }
+    ctx.progress.total_files = count;
     
-    printf("Archive: %s\n", opts->zip_file);
-    printf("Entries: %lld\n\n", (long long)num_entries);
+    verify_report_t report;
+    memset(&report, 0, sizeof(report));
+    double start = monotonic_seconds();
     
-    if (opts->verbose) {
-        printf("%-10s %-19s %s\n", "Size", "Modified", "Name");
-        printf("%-10s %-19s %s\n", "----------", "-------------------", "----");
+    int result = EXIT_SUCCESS;
+    if (count > 0) {
+        int num_workers = resources_cpu_count();
+        if ((size_t)num_workers > count) num_workers = (int)count;
+        if (num_workers < 1) num_workers = 1;
+        metrics_phase_begin(METRICS_PHASE_VERIFY);
+        result = extract_entries_parallel(&ctx, opts, indices, count, num_workers, &report, false);
+        metrics_phase_end(METRICS_PHASE_VERIFY);
     }
     
-    for (zip_uint64_t i = 0; i < (zip_uint64_t)num_entries; i++) {
-        const char* name = zip_get_name(archive, i, 0);
-        if (!name) {
-            fprintf(stderr, "Error getting entry name at index %lld\n", (long long)i);
-            continue;
-        }
-        
-        zip_stat_t stat;
-        if (zip_stat_index(archive, i, 0, &stat) == 0) {
-            if (opts->verbose) {
-                char time_str[20];
-                struct tm* tm_info = localtime(&stat.mtime);
-                strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", tm_info);
-                
-                printf("%-10lld %-19s %s\n", 
-                       (long long)stat.size, time_str, name);
-            } else {
-                printf("%s\n", name);
-            }
-        } else {
-            printf("%s\n", name);
+    double elapsed = monotonic_seconds() - start;
+    free(indices);
+    zip_close(archive);
+    
+    // Failures in archive order, whichever worker found them
+    if (report.failure_count > 1) {
+        qsort(report.failures, report.failure_count, sizeof(verify_failure_t), compare_failures);
+    }
+    for (size_t i = 0; i < report.failure_count; i++) {
+        log_message(LOG_ERROR, "Error: %s\n", report.failures[i].message);
+        free(report.failures[i].message);
+    }
+    free(report.failures);
+    
+    if (result == EXIT_SUCCESS && report.checked < count) {
+        result = EXIT_FAILURE;
+    }
+    if (result != EXIT_SUCCESS) {
+        log_message(LOG_ERROR, "Error: Verification of '%s' did not complete\n", opts->zip_file);
+        return result;
+    }
+    
+    if (!opts->quiet) {
+        double gigabytes = (double)report.bytes / 1e9;
+        printf("Verified %zu entries (%.1f MB) in %.2f s, %.2f GB/s (CRC-32: %s)\n",
+               report.checked, (double)report.bytes / (1024.0 * 1024.0), elapsed,
+               elapsed > 0 ? gigabytes / elapsed : 0.0, checksum_crc32_kernel());
+        if (report.skipped > 0) {
+            printf("Skipped %zu encrypted entries\n", report.skipped);
         }
+        fflush(stdout);
     }
     
-    zip_close(archive);
+    if (report.failure_count > 0) {
+        log_message(LOG_ERROR, "%zu of %zu entries in '%s' failed verification\n",
+                       report.failure_count, report.checked, opts->zip_file);
+        return EXIT_ZIP_ERROR;
+    }
+    if (!opts->quiet) {
+        printf("No errors detected in '%s'\n", opts->zip_file);
+    }
     return EXIT_SUCCESS;
 }
 
-int add_file_to_zip(zip_context_t* ctx, const char* file_path, const char* archive_path) {
-    if (!ctx || !file_path || !archive_path) {
+// Listings are gathered into blocks this large before they go to stdout
+#define LIST_OUTPUT_BUFFER_SIZE (1024 * 1024)
+
+// A listing's pending output; without `data` lines go to stdout directly
+typedef struct {
+    char* data;
+    size_t length;
+} list_output_t;
+
+static void list_output_flush(list_output_t* out) {
+    if (out->length > 0) fwrite(out->data, 1, out->length, stdout);
+    out->length = 0;
+}
+
+static void list_output_printf(list_output_t* out, const char* format, ...) {
+    va_list args;
+    for (int attempt = 0; out->data && attempt < 2; attempt++) {
+        size_t space = LIST_OUTPUT_BUFFER_SIZE - out->length;
+        va_start(args, format);
+        int written = vsnprintf(out->data + out->length, space, format, args);
+        va_end(args);
+        if (written >= 0 && (size_t)written < space) {
+            out->length += (size_t)written;
+            return;
+        }
+        list_output_flush(out);
+    }
+    // Longer than the whole buffer
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+// DOS date and time (local time already) as "YYYY-MM-DD HH:MM:SS"
+static void format_dos_time(uint16_t dos_date, uint16_t dos_time, char out[20]) {
+    snprintf(out, 20, "%04u-%02u-%02u %02u:%02u:%02u",
+             1980u + (dos_date >> 9), (dos_date >> 5) & 0x0Fu, dos_date & 0x1Fu,
+             (unsigned)(dos_time >> 11), (dos_time >> 5) & 0x3Fu, (dos_time & 0x1Fu) * 2u);
+}
+
+int list_zip(const options_t* opts) {
+    if (!opts || !opts->zip_file) {
         return EXIT_INVALID_ARGS;
     }
     
-    zip_source_t* source = zip_source_file(ctx->archive, file_path, 0, -1);
-    if (!source) {
-        fprintf(stderr, "Error creating ZIP source for file '%s': %s\n", 
-                file_path, zip_strerror(ctx->archive));
-        return EXIT_ZIP_ERROR;
+    // Check if ZIP file exists
+    if (!file_exists(opts->zip_file)) {
+        log_message(LOG_ERROR, "Error: ZIP file '%s' does not exist\n", opts->zip_file);
+        return EXIT_FILE_ERROR;
     }
     
-    zip_int64_t idx = zip_file_add(ctx->archive, archive_path, source, ZIP_FL_ENC_UTF_8);
-    if (idx < 0) {
-        fprintf(stderr, "Error adding file '%s' to archive: %s\n", 
-                archive_path, zip_strerror(ctx->archive));
-        zip_source_free(source);
-        return EXIT_ZIP_ERROR;
+    entry_select_t select;
+    if (entry_select_init(&select, (const char* const*)opts->input_files, opts->input_file_count) != EXIT_SUCCESS) {
+        return EXIT_INVALID_ARGS;
     }
     
-    // Set file modification time
-    time_t mtime = get_file_mtime(file_path);
-    if (mtime > 0) {
-        zip_file_set_mtime(ctx->archive, idx, mtime, 0);
+    // Listing only needs the central directory, read in one pass into a
+    // compact table rather than looked up entry by entry through libzip
+    archive_index_t index;
+    int result = archive_index_load(&index, opts->zip_file);
+    if (result != EXIT_SUCCESS) {
+        entry_select_free(&select);
+        return result;
     }
     
-    // Only log when TUI is not active (TUI handles its own progress display)
-    if (!g_tui.is_active) {
-        off_t file_size = get_file_size(file_path);
-        if (file_size > 10 * 1024 * 1024) { // Files larger than 10MB
-            log_file_operation("Added large file", archive_path, file_size);
+    // Millions of short lines: write them in large blocks
+    list_output_t out = { .data = malloc(LIST_OUTPUT_BUFFER_SIZE), .length = 0 };
+    
+    list_output_printf(&out, "Archive: %s\n", opts->zip_file);
+    list_output_printf(&out, "Entries: %zu\n\n", index.count);
+    
+    if (opts->verbose) {
+        list_output_printf(&out, "%-10s %-19s %s\n", "Size", "Modified", "Name");
+        list_output_printf(&out, "%-10s %-19s %s\n", "----------", "-------------------", "----");
+    }
+    
+    size_t matched = 0;
+    for (size_t i = 0; i < index.count; i++) {
+        const archive_index_entry_t* entry = &index.entries[i];
+        if (!entry_select_match(&select, entry->name)) continue;
+        matched++;
+        
+        if (opts->verbose) {
+            char time_str[20];
+            format_dos_time(entry->dos_date, entry->dos_time, time_str);
+            list_output_printf(&out, "%-10llu %-19s %s\n", (unsigned long long)entry->uncompressed_size,
+                               time_str, entry->name);
         } else {
-            log_file_operation("Added file", archive_path, file_size);
+            list_output_printf(&out, "%s\n", entry->name);
         }
     }
+    list_output_flush(&out);
+    free(out.data);
+    fflush(stdout);
     
-    return EXIT_SUCCESS;
+    if (select.count > 0 && matched == 0) {
+        log_message(LOG_ERROR, "Error: No entries in '%s' match the given names\n", opts->zip_file);
+        result = EXIT_FILE_ERROR;
+    }
+    
+    archive_index_free(&index);
+    entry_select_free(&select);
+    return result;
 }
 
 int extract_file_from_zip(zip_context_t* ctx, zip_uint64_t index, const char* output_dir) {
@@ -1491,106 +3629,14 @@ int extract_file_from_zip(zip_context_t* ctx, zip_uint64_t index, const char* ou
         return EXIT_INVALID_ARGS;
     }
     
-    zip_stat_t stat;
-    if (zip_stat_index(ctx->archive, index, 0, &stat) < 0) {
-        fprintf(stderr, "Error getting file stats at index %lld: %s\n", 
-                (long long)index, zip_strerror(ctx->archive));
-        return EXIT_ZIP_ERROR;
-    }
-    
-    // Security check: validate path safety
-    if (!is_safe_path(stat.name)) {
-        fprintf(stderr, "Security warning: Unsafe path detected '%s' - skipping extraction\n", stat.name);
-        return EXIT_SUCCESS; // Skip this file but continue
-    }
-    
-    // Build output path
-    char* output_path = join_path(output_dir, stat.name);
-    if (!output_path) {
+    unsigned char* buffer = malloc(EXTRACT_BUFFER_SIZE);
+    if (!buffer) {
         return EXIT_FAILURE;
     }
     
-    // Convert forward slashes to platform-specific separators
-    for (char* p = output_path; *p; p++) {
-        if (*p == '/') {
-            *p = PATH_SEPARATOR;
-        }
-    }
-    
-    // Check if it's a directory
-    size_t name_len = strlen(stat.name);
-    bool is_dir = (name_len > 0 && stat.name[name_len - 1] == '/');
-    
-    if (is_dir) {
-        // Create directory
-        if (create_directory_recursive(output_path) != EXIT_SUCCESS) {
-            fprintf(stderr, "Error creating directory '%s'\n", output_path);
-            free(output_path);
-            return EXIT_FILE_ERROR;
-        }
-        
-        if (ctx->verbose) {
-            printf("Created directory: %s\n", output_path);
-        }
-    } else {
-        // Extract file
-        
-        // Create parent directory if needed
-        char* dir_path = malloc(strlen(output_path) + 1);
-        if (!dir_path) {
-            free(output_path);
-            return EXIT_FAILURE;
-        }
-        
-        strcpy(dir_path, output_path);
-        char* last_sep = strrchr(dir_path, PATH_SEPARATOR);
-        if (last_sep) {
-            *last_sep = '\0';
-            create_directory_recursive(dir_path);
-        }
-        free(dir_path);
-        
-        // Open file in ZIP
-        zip_file_t* file = zip_fopen_index(ctx->archive, index, 0);
-        if (!file) {
-            fprintf(stderr, "Error opening file in ZIP at index %lld: %s\n", 
-                    (long long)index, zip_strerror(ctx->archive));
-            free(output_path);
-            return EXIT_ZIP_ERROR;
-        }
-        
-        // Create output file
-        FILE* output_file = fopen(output_path, "wb");
-        if (!output_file) {
-            fprintf(stderr, "Error creating output file '%s'\n", output_path);
-            zip_fclose(file);
-            free(output_path);
-            return EXIT_FILE_ERROR;
-        }
-        
-        // Copy data
-        char buffer[8192];
-        zip_int64_t bytes_read;
-        while ((bytes_read = zip_fread(file, buffer, sizeof(buffer))) > 0) {
-            if (fwrite(buffer, 1, bytes_read, output_file) != (size_t)bytes_read) {
-                fprintf(stderr, "Error writing to output file '%s'\n", output_path);
-                fclose(output_file);
-                zip_fclose(file);
-                free(output_path);
-                return EXIT_FILE_ERROR;
-            }
-        }
-        
-        fclose(output_file);
-        zip_fclose(file);
-        
-        if (ctx->verbose) {
-            printf("Extracted file: %s\n", output_path);
-        }
-    }
-    
-    free(output_path);
-    return EXIT_SUCCESS;
+    int result = extract_entry(ctx, index, output_dir, buffer, EXTRACT_BUFFER_SIZE, false, NULL);
+    free(buffer);
+    return result;
 }
 
 int get_zip_entries(const char* zip_file, zip_entry_t** entries, size_t* count) {
@@ -1611,11 +3657,19 @@ int get_zip_entries(const char* zip_file, zip_entry_t** entries, size_t* count)
         return EXIT_ZIP_ERROR;
     }
     
-    *entries = malloc(sizeof(zip_entry_t) * num_entries);
+    // Size the name block first so entries and names take one allocation
+    size_t names_size = 0;
+    for (zip_uint64_t i = 0; i < (zip_uint64_t)num_entries; i++) {
+        const char* name = zip_get_name(archive, i, 0);
+        if (name) names_size += strlen(name) + 1;
+    }
+    
+    *entries = malloc(sizeof(zip_entry_t) * num_entries + names_size);
     if (!*entries) {
         zip_close(archive);
         return EXIT_FAILURE;
     }
+    char* names = (char*)(*entries + num_entries);
     
     *count = 0;
     for (zip_uint64_t i = 0; i < (zip_uint64_t)num_entries; i++) {
@@ -1625,14 +3679,17 @@ int get_zip_entries(const char* zip_file, zip_entry_t** entries, size_t* count)
         zip_stat_t stat;
         if (zip_stat_index(archive, i, 0, &stat) < 0) continue;
         
+        size_t name_len = strlen(name);
+        memcpy(names, name, name_len + 1);
+        
         zip_entry_t* entry = &(*entries)[*count];
-        strncpy(entry->name, name, PATH_MAX - 1);
-        entry->name[PATH_MAX - 1] = '\0';
+        entry->name = names;
         entry->mtime = stat.mtime;
         entry->size = stat.size;
+        entry->crc32 = (stat.valid & ZIP_STAT_CRC) ? stat.crc : 0;
+        names += name_len + 1;
         
         // Check if it's a directory
-        size_t name_len = strlen(name);
         entry->is_directory = (name_len > 0 && name[name_len - 1] == '/');
         
         (*count)++;
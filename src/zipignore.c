@@ -1,11 +1,458 @@
 #include "zipignore.h"
 #include "utils.h"
+#include "string_pool.h"
+#include "metrics.h"
+#include "logging.h"
 
 
 // Forward declarations
 static bool pattern_match_gitignore_recursive(const char* pattern, const char* text, int depth);
 static bool pattern_match_gitignore(const char* pattern, const char* text);
 
+// ============================================================================
+// Compiled matcher - patterns are indexed once, per scope directory, so a
+// lookup only evaluates the patterns that can possibly match the path:
+// literal basenames and "*.ext" suffixes come from hash tables, other
+// patterns from tries over their literal prefix, and only globs that start
+// with a wildcard are tried one by one. The highest matching pattern index
+// wins, which keeps gitignore's last-match-wins negation semantics.
+// ============================================================================
+
+typedef struct {
+    int* items;                 // Pattern indices, ascending
+    int count;
+    int capacity;
+} index_list_t;
+
+typedef struct {
+    const char* key;            // Points into pattern or scope storage
+    size_t key_len;
+    index_list_t values;
+} key_slot_t;
+
+typedef struct {
+    key_slot_t* slots;          // Open addressing; key == NULL marks an empty slot
+    size_t capacity;            // Power of two
+    size_t count;
+} key_table_t;
+
+typedef struct {
+    int first_child;
+    int next_sibling;
+    unsigned char byte;
+    index_list_t patterns;      // Patterns whose literal prefix ends at this node
+} trie_node_t;
+
+typedef struct {
+    trie_node_t* nodes;         // Node 0 is the root
+    int count;
+    int capacity;
+} trie_t;
+
+typedef struct {
+    char* dir;                  // Scope directory with forward slashes
+    key_table_t names;          // Literal basenames
+    key_table_t extensions;     // Literal suffixes of "*.ext" patterns (".ext")
+    trie_t anchored;            // Patterns matched from the start of the relative path
+    trie_t globs;               // Other globs, by the literal prefix the path or basename must start with
+    index_list_t wildcards;     // Globs that start with a wildcard
+} scope_bucket_t;
+
+struct ignore_matcher {
+    scope_bucket_t* buckets;
+    int bucket_count;
+    int bucket_capacity;
+    key_table_t scopes;         // Scope directory -> bucket index
+    int global_bucket;          // Bucket for patterns with an empty scope, or -1
+    int compiled_count;         // patterns[0..compiled_count) are indexed
+};
+
+// 64-bit FNV-1a
+static uint64_t hash_key(const char* key, size_t len) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool list_push(index_list_t* list, int value) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 4;
+        int* items = realloc(list->items, capacity * sizeof(int));
+        if (!items) return false;
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = value;
+    return true;
+}
+
+static const key_slot_t* table_find(const key_table_t* table, const char* key, size_t len) {
+    if (table->capacity == 0) return NULL;
+    
+    size_t mask = table->capacity - 1;
+    for (size_t i = (size_t)hash_key(key, len) & mask; table->slots[i].key; i = (i + 1) & mask) {
+        const key_slot_t* slot = &table->slots[i];
+        if (slot->key_len == len && memcmp(slot->key, key, len) == 0) return slot;
+    }
+    return NULL;
+}
+
+static key_slot_t* table_insert(key_table_t* table, const char* key, size_t len) {
+    // Keep the load factor under 3/4
+    if ((table->count + 1) * 4 > table->capacity * 3) {
+        size_t capacity = table->capacity ? table->capacity * 2 : 16;
+        key_slot_t* slots = calloc(capacity, sizeof(key_slot_t));
+        if (!slots) return NULL;
+        
+        for (size_t i = 0; i < table->capacity; i++) {
+            key_slot_t* slot = &table->slots[i];
+            if (!slot->key) continue;
+            size_t j = (size_t)hash_key(slot->key, slot->key_len) & (capacity - 1);
+            while (slots[j].key) j = (j + 1) & (capacity - 1);
+            slots[j] = *slot;
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->capacity = capacity;
+    }
+    
+    size_t mask = table->capacity - 1;
+    size_t i = (size_t)hash_key(key, len) & mask;
+    for (; table->slots[i].key; i = (i + 1) & mask) {
+        key_slot_t* slot = &table->slots[i];
+        if (slot->key_len == len && memcmp(slot->key, key, len) == 0) return slot;
+    }
+    
+    table->slots[i].key = key;
+    table->slots[i].key_len = len;
+    table->count++;
+    return &table->slots[i];
+}
+
+static void table_free(key_table_t* table) {
+    for (size_t i = 0; i < table->capacity; i++) {
+        free(table->slots[i].values.items);
+    }
+    free(table->slots);
+}
+
+// ============================================================================
+// Storage - pattern text, scope directories and loaded file names live in a
+// string pool that only grows, so every pointer handed out (including the
+// keys of the matcher's tables) stays valid until free_zipignore()
+// ============================================================================
+
+struct ignore_store {
+    string_pool_t strings;
+    key_table_t scopes;         // Interned scope directories
+    key_table_t loaded;         // .zipignore files already read
+};
+
+static ignore_store_t* get_store(zipignore_t* zi) {
+    if (!zi->store) {
+        zi->store = calloc(1, sizeof(ignore_store_t));
+    }
+    return zi->store;
+}
+
+// The stored copy of `text` in `table`, added on first use
+static const char* store_intern(ignore_store_t* store, key_table_t* table, const char* text) {
+    size_t len = strlen(text);
+    const key_slot_t* slot = table_find(table, text, len);
+    if (slot) return slot->key;
+    
+    char* copy = string_pool_strndup(&store->strings, text, len);
+    if (!copy || !table_insert(table, copy, len)) return NULL;
+    return copy;
+}
+
+static void free_store(ignore_store_t* store) {
+    if (!store) return;
+    
+    string_pool_free(&store->strings);
+    table_free(&store->scopes);
+    table_free(&store->loaded);
+    free(store);
+}
+
+static int append_pattern(zipignore_t* zi, const char* scope, const char* text, size_t len,
+                          bool is_directory, bool is_negation, bool is_anchored) {
+    if (zi->pattern_count == zi->pattern_capacity) {
+        int capacity = zi->pattern_capacity ? zi->pattern_capacity * 2 : 64;
+        ignore_pattern_t* patterns = realloc(zi->patterns, capacity * sizeof(ignore_pattern_t));
+        if (!patterns) return EXIT_FAILURE;
+        zi->patterns = patterns;
+        zi->pattern_capacity = capacity;
+    }
+    
+    char* copy = string_pool_strndup(&zi->store->strings, text, len);
+    if (!copy) return EXIT_FAILURE;
+    
+    ignore_pattern_t* pattern = &zi->patterns[zi->pattern_count++];
+    pattern->pattern = copy;
+    pattern->scope_dir = scope;
+    pattern->is_directory = is_directory;
+    pattern->is_negation = is_negation;
+    pattern->is_anchored = is_anchored;
+    return EXIT_SUCCESS;
+}
+
+// ============================================================================
+// Matcher construction
+// ============================================================================
+
+static int bucket_for_scope(ignore_matcher_t* matcher, const char* scope_dir) {
+    char dir[PATH_MAX];
+    size_t len = 0;
+    for (; scope_dir[len] && len < PATH_MAX - 1; len++) {
+        dir[len] = scope_dir[len] == '\\' ? '/' : scope_dir[len];
+    }
+    dir[len] = '\0';
+    
+    if (len == 0 && matcher->global_bucket >= 0) return matcher->global_bucket;
+    if (len > 0) {
+        const key_slot_t* slot = table_find(&matcher->scopes, dir, len);
+        if (slot) return slot->values.items[0];
+    }
+    
+    if (matcher->bucket_count == matcher->bucket_capacity) {
+        int capacity = matcher->bucket_capacity ? matcher->bucket_capacity * 2 : 8;
+        scope_bucket_t* buckets = realloc(matcher->buckets, capacity * sizeof(scope_bucket_t));
+        if (!buckets) return -1;
+        matcher->buckets = buckets;
+        matcher->bucket_capacity = capacity;
+    }
+    
+    scope_bucket_t* bucket = &matcher->buckets[matcher->bucket_count];
+    memset(bucket, 0, sizeof(scope_bucket_t));
+    bucket->dir = malloc(len + 1);
+    if (!bucket->dir) return -1;
+    memcpy(bucket->dir, dir, len + 1);
+    
+    if (len == 0) {
+        matcher->global_bucket = matcher->bucket_count;
+    } else {
+        key_slot_t* slot = table_insert(&matcher->scopes, bucket->dir, len);
+        if (!slot || !list_push(&slot->values, matcher->bucket_count)) {
+            free(bucket->dir);
+            return -1;
+        }
+    }
+    return matcher->bucket_count++;
+}
+
+static int trie_add_node(trie_t* trie, unsigned char byte) {
+    if (trie->count == trie->capacity) {
+        int capacity = trie->capacity ? trie->capacity * 2 : 16;
+        trie_node_t* nodes = realloc(trie->nodes, capacity * sizeof(trie_node_t));
+        if (!nodes) return -1;
+        trie->nodes = nodes;
+        trie->capacity = capacity;
+    }
+    trie_node_t* node = &trie->nodes[trie->count];
+    memset(node, 0, sizeof(trie_node_t));
+    node->byte = byte;
+    node->first_child = -1;
+    node->next_sibling = -1;
+    return trie->count++;
+}
+
+static bool trie_insert(trie_t* trie, const char* prefix, size_t len, int index) {
+    if (trie->count == 0 && trie_add_node(trie, 0) < 0) return false;
+    
+    int node = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char byte = (unsigned char)prefix[i];
+        int child = trie->nodes[node].first_child;
+        while (child >= 0 && trie->nodes[child].byte != byte) {
+            child = trie->nodes[child].next_sibling;
+        }
+        
+        if (child < 0) {
+            child = trie_add_node(trie, byte);
+            if (child < 0) return false;
+            trie->nodes[child].next_sibling = trie->nodes[node].first_child;
+            trie->nodes[node].first_child = child;
+        }
+        node = child;
+    }
+    return list_push(&trie->nodes[node].patterns, index);
+}
+
+static void trie_free(trie_t* trie) {
+    for (int i = 0; i < trie->count; i++) {
+        free(trie->nodes[i].patterns.items);
+    }
+    free(trie->nodes);
+}
+
+// Index one pattern. Each index only has to return a superset of the paths
+// the pattern matches; candidates are always confirmed by pattern_matches().
+static bool index_pattern(ignore_matcher_t* matcher, const ignore_pattern_t* pattern, int index) {
+    const char* text = pattern->pattern;
+    size_t len = strlen(text);
+    if (len == 0) return true;
+    
+    int b = bucket_for_scope(matcher, pattern->scope_dir);
+    if (b < 0) return false;
+    scope_bucket_t* bucket = &matcher->buckets[b];
+    
+    size_t literal_len = strcspn(text, "*?[");
+    
+    // Matched from the start of the scope-relative path, so every match
+    // begins with the literal prefix
+    if (pattern->is_anchored || strchr(text, '/')) {
+        return trie_insert(&bucket->anchored, text, literal_len, index);
+    }
+    
+    if (literal_len == len) {
+        // A bare name matches the basename; a directory name also matches
+        // everything below "name/"
+        key_slot_t* slot = table_insert(&bucket->names, text, len);
+        if (!slot || !list_push(&slot->values, index)) return false;
+        return !pattern->is_directory || trie_insert(&bucket->anchored, text, len, index);
+    }
+    
+    if (text[0] == '*' && text[1] == '.' && !pattern->is_directory &&
+        strcspn(text + 1, "*?[") == len - 1) {
+        key_slot_t* slot = table_insert(&bucket->extensions, text + 1, len - 1);
+        return slot && list_push(&slot->values, index);
+    }
+    
+    // Whichever of path and basename it matches starts with the literal prefix
+    if (literal_len > 0) {
+        return trie_insert(&bucket->globs, text, literal_len, index);
+    }
+    return list_push(&bucket->wildcards, index);
+}
+
+static void compile_patterns(zipignore_t* zi) {
+    if (!zi->matcher) {
+        zi->matcher = calloc(1, sizeof(ignore_matcher_t));
+        if (!zi->matcher) return;
+        zi->matcher->global_bucket = -1;
+    }
+    
+    // Anything left uncompiled (out of memory) is still checked one by one
+    ignore_matcher_t* matcher = zi->matcher;
+    while (matcher->compiled_count < zi->pattern_count &&
+           index_pattern(matcher, &zi->patterns[matcher->compiled_count], matcher->compiled_count)) {
+        matcher->compiled_count++;
+    }
+}
+
+static void free_matcher(ignore_matcher_t* matcher) {
+    if (!matcher) return;
+    
+    for (int i = 0; i < matcher->bucket_count; i++) {
+        scope_bucket_t* bucket = &matcher->buckets[i];
+        free(bucket->dir);
+        table_free(&bucket->names);
+        table_free(&bucket->extensions);
+        trie_free(&bucket->anchored);
+        trie_free(&bucket->globs);
+        free(bucket->wildcards.items);
+    }
+    free(matcher->buckets);
+    table_free(&matcher->scopes);
+    free(matcher);
+}
+
+// Whether one pattern matches a path relative to its scope directory
+static bool pattern_matches(const ignore_pattern_t* pattern, const char* relative) {
+    const char* text = pattern->pattern;
+    
+    if (pattern_match_gitignore(text, relative)) {
+        return true;
+    }
+    
+    // Non-anchored patterns without a slash also match just the basename
+    if (!pattern->is_anchored && strchr(text, '/') == NULL) {
+        const char* basename = strrchr(relative, '/');
+        if (pattern_match_gitignore(text, basename ? basename + 1 : relative)) {
+            return true;
+        }
+    }
+    
+    // Directory patterns also match anything inside the directory
+    if (pattern->is_directory) {
+        size_t len = strlen(text);
+        if (strncmp(relative, text, len) == 0 && relative[len] == '/') {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Raise *best to the newest pattern in `list` that matches
+static void match_list(const zipignore_t* zi, const index_list_t* list, const char* relative, int* best) {
+    for (int i = list->count - 1; i >= 0 && list->items[i] > *best; i--) {
+        if (pattern_matches(&zi->patterns[list->items[i]], relative)) {
+            *best = list->items[i];
+            return;
+        }
+    }
+}
+
+// Check the patterns on every trie node along `key`, i.e. every pattern
+// whose literal prefix `key` starts with
+static void match_trie(const zipignore_t* zi, const trie_t* trie, const char* key,
+                       const char* relative, int* best) {
+    if (trie->count == 0) return;
+    
+    int node = 0;
+    match_list(zi, &trie->nodes[0].patterns, relative, best);
+    for (const char* p = key; *p && trie->nodes[node].first_child >= 0; p++) {
+        int child = trie->nodes[node].first_child;
+        while (child >= 0 && trie->nodes[child].byte != (unsigned char)*p) {
+            child = trie->nodes[child].next_sibling;
+        }
+        if (child < 0) break;
+        node = child;
+        match_list(zi, &trie->nodes[node].patterns, relative, best);
+    }
+}
+
+static void match_bucket(const zipignore_t* zi, const scope_bucket_t* bucket, const char* relative, int* best) {
+    if (relative[0] == '\0') return;
+    
+    const char* basename = strrchr(relative, '/');
+    basename = basename ? basename + 1 : relative;
+    
+    const key_slot_t* slot = table_find(&bucket->names, basename, strlen(basename));
+    if (slot) match_list(zi, &slot->values, relative, best);
+    
+    if (bucket->extensions.count > 0) {
+        for (const char* dot = strchr(basename, '.'); dot; dot = strchr(dot + 1, '.')) {
+            slot = table_find(&bucket->extensions, dot, strlen(dot));
+            if (slot) match_list(zi, &slot->values, relative, best);
+        }
+    }
+    
+    match_trie(zi, &bucket->anchored, relative, relative, best);
+    match_trie(zi, &bucket->globs, relative, relative, best);
+    if (basename != relative) {
+        match_trie(zi, &bucket->globs, basename, relative, best);
+    }
+    match_list(zi, &bucket->wildcards, relative, best);
+}
+
+// Path relative to an uncompiled pattern's scope directory, or NULL if the
+// path lies outside it
+static const char* relative_to_scope(const char* scope_dir, const char* path) {
+    size_t i = 0;
+    for (; scope_dir[i]; i++) {
+        char c = scope_dir[i] == '\\' ? '/' : scope_dir[i];
+        if (path[i] != c) return NULL;
+    }
+    if (i == 0) return path;
+    if (path[i] == '\0') return path + i;
+    return path[i] == '/' ? path + i + 1 : NULL;
+}
+
 // Helper function to load patterns from a specific .zipignore file into the context
 static int load_patterns_from_file(zipignore_t* zi, const char* zipignore_path, const char* scope_dir) {
     if (!zi || !zipignore_path || !scope_dir) {
@@ -17,8 +464,17 @@ static int load_patterns_from_file(zipignore_t* zi, const char* zipignore_path,
         return EXIT_SUCCESS; // Not an error, file just doesn't exist
     }
     
+    // Every pattern from this file shares one copy of the scope directory
+    ignore_store_t* store = get_store(zi);
+    const char* scope = store ? store_intern(store, &store->scopes, scope_dir) : NULL;
+    if (!scope) {
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+    
+    int result = EXIT_SUCCESS;
     char line[MAX_PATTERN_LENGTH];
-    while (fgets(line, sizeof(line), file) && zi->pattern_count < MAX_IGNORE_PATTERNS) {
+    while (result == EXIT_SUCCESS && fgets(line, sizeof(line), file)) {
         // Remove trailing newline and carriage return
         line[strcspn(line, "\r\n")] = 0;
         
@@ -56,70 +512,110 @@ static int load_patterns_from_file(zipignore_t* zi, const char* zipignore_path,
             continue;
         }
         
-        ignore_pattern_t* pattern = &zi->patterns[zi->pattern_count];
-        memset(pattern, 0, sizeof(ignore_pattern_t));
-        
-        // Set the scope directory for this pattern
-        strncpy(pattern->scope_dir, scope_dir, PATH_MAX - 1);
-        pattern->scope_dir[PATH_MAX - 1] = '\0';
-        
         // Check for negation pattern (starts with !)
+        bool is_negation = false;
         if (trimmed[0] == '!') {
-            pattern->is_negation = true;
+            is_negation = true;
             trimmed++; // Skip the '!' character
         }
         
         // Check if pattern is for directories only (ends with /)
+        bool is_directory = false;
         len = strlen(trimmed);
         if (len > 0 && trimmed[len - 1] == '/') {
-            pattern->is_directory = true;
+            is_directory = true;
             trimmed[len - 1] = '\0'; // Remove trailing slash
             len--;
         }
         
         // Check if pattern is anchored (starts with / or contains /)
         // A pattern with a slash (except trailing) is anchored to the .zipignore location
+        bool is_anchored;
         if (trimmed[0] == '/') {
-            pattern->is_anchored = true;
+            is_anchored = true;
             trimmed++; // Skip leading slash
             len--;
         } else {
             // Check if pattern contains a slash (other than the removed trailing one)
-            pattern->is_anchored = (strchr(trimmed, '/') != NULL);
+            is_anchored = (strchr(trimmed, '/') != NULL);
         }
         
         if (len == 0) {
             continue; // Skip empty patterns
         }
         
-        strncpy(pattern->pattern, trimmed, MAX_PATTERN_LENGTH - 1);
-        pattern->pattern[MAX_PATTERN_LENGTH - 1] = '\0';
-        zi->pattern_count++;
+        result = append_pattern(zi, scope, trimmed, len, is_directory, is_negation, is_anchored);
     }
     
     fclose(file);
     
     // Track that we loaded this file
-    if (zi->loaded_files_count < MAX_ZIPIGNORE_FILES) {
-        strncpy(zi->loaded_files[zi->loaded_files_count], zipignore_path, PATH_MAX - 1);
-        zi->loaded_files[zi->loaded_files_count][PATH_MAX - 1] = '\0';
-        zi->loaded_files_count++;
+    if (!store_intern(store, &store->loaded, zipignore_path)) {
+        result = EXIT_FAILURE;
     }
+    zi->loaded_files_count++;
     
-    return EXIT_SUCCESS;
+    compile_patterns(zi);
+    return result;
+}
+
+int zipignore_add_pattern(zipignore_t* zi, const char* scope_dir, const char* pattern,
+                          bool is_directory, bool is_negation, bool is_anchored) {
+    if (!zi || !scope_dir || !pattern) {
+        return EXIT_FAILURE;
+    }
+    
+    ignore_store_t* store = get_store(zi);
+    const char* scope = store ? store_intern(store, &store->scopes, scope_dir) : NULL;
+    if (!scope) {
+        return EXIT_FAILURE;
+    }
+    
+    int result = append_pattern(zi, scope, pattern, strlen(pattern), is_directory, is_negation, is_anchored);
+    compile_patterns(zi);
+    return result;
 }
 
 bool is_zipignore_loaded(const zipignore_t* zi, const char* file_path) {
-    if (!zi || !file_path) {
+    if (!zi || !file_path || !zi->store) {
         return false;
     }
     
-    for (int i = 0; i < zi->loaded_files_count; i++) {
-        if (strcmp(zi->loaded_files[i], file_path) == 0) {
-            return true;
+    return table_find(&zi->store->loaded, file_path, strlen(file_path)) != NULL;
+}
+
+// Load the patterns that come before any directory's own .zipignore:
+// `zipignore_file` alone when given, else the home defaults
+static void load_leading_patterns(zipignore_t* zi, const char* zipignore_file, const char* scope_dir) {
+    if (zipignore_file) {
+        if (file_exists(zipignore_file)) {
+            load_patterns_from_file(zi, zipignore_file, scope_dir);
         }
+        return;
+    }
+    
+    // Home patterns apply globally (scope is the base directory)
+    char* home_dir = get_home_directory();
+    if (home_dir) {
+        char zipignore_path[PATH_MAX];
+        snprintf(zipignore_path, PATH_MAX, "%s%c%s", home_dir, PATH_SEPARATOR, ZIPIGNORE_FILENAME);
+        if (file_exists(zipignore_path)) {
+            load_patterns_from_file(zi, zipignore_path, scope_dir);
+        }
+        free(home_dir);
+    }
+}
+
+// Then the local base directory's (can add to or override home patterns),
+// unless a specific zipignore file replaces both
+static void load_base_patterns(zipignore_t* zi, const char* base_dir, const char* zipignore_file) {
+    if (zipignore_file) return;
+    
+    char zipignore_path[PATH_MAX];
+    snprintf(zipignore_path, PATH_MAX, "%s%c%s", base_dir, PATH_SEPARATOR, ZIPIGNORE_FILENAME);
+    if (file_exists(zipignore_path)) {
+        load_patterns_from_file(zi, zipignore_path, base_dir);
     }
-    return false;
 }
 
 int load_zipignore(zipignore_t* zi, const char* base_dir, const char* zipignore_file) {
@@ -132,34 +628,49 @@ int load_zipignore(zipignore_t* zi, const char* base_dir, const char* zipignore_
     strncpy(zi->base_dir, base_dir, PATH_MAX - 1);
     zi->base_dir[PATH_MAX - 1] = '\0';
     
-    char zipignore_path[PATH_MAX];
+    // Hierarchical loading: home -> local (later patterns can override earlier ones)
+    load_leading_patterns(zi, zipignore_file, base_dir);
+    load_base_patterns(zi, base_dir, zipignore_file);
+    return EXIT_SUCCESS;
+}
+
+int parse_zipignore_rules(zipignore_t* rules, const char* zipignore_file) {
+    if (!rules) {
+        return EXIT_FAILURE;
+    }
     
-    if (zipignore_file) {
-        // If a specific zipignore file is provided, use only that
-        if (file_exists(zipignore_file)) {
-            load_patterns_from_file(zi, zipignore_file, base_dir);
+    memset(rules, 0, sizeof(zipignore_t));
+    load_leading_patterns(rules, zipignore_file, "");
+    return EXIT_SUCCESS;
+}
+
+int load_zipignore_rules(zipignore_t* zi, const char* base_dir, const zipignore_t* rules,
+                         const char* zipignore_file) {
+    if (!zi || !base_dir || !rules) {
+        return EXIT_FAILURE;
+    }
+    
+    memset(zi, 0, sizeof(zipignore_t));
+    strncpy(zi->base_dir, base_dir, PATH_MAX - 1);
+    zi->base_dir[PATH_MAX - 1] = '\0';
+    
+    if (rules->pattern_count > 0) {
+        ignore_store_t* store = get_store(zi);
+        const char* scope = store ? store_intern(store, &store->scopes, base_dir) : NULL;
+        if (!scope) {
+            return EXIT_FAILURE;
         }
-    } else {
-        // Hierarchical loading: home -> local (later patterns can override earlier ones)
-        
-        // 1. First, load from user's home directory (global defaults)
-        char* home_dir = get_home_directory();
-        if (home_dir) {
-            snprintf(zipignore_path, PATH_MAX, "%s%c%s", home_dir, PATH_SEPARATOR, ZIPIGNORE_FILENAME);
-            if (file_exists(zipignore_path)) {
-                // Home patterns apply globally (scope is base_dir)
-                load_patterns_from_file(zi, zipignore_path, base_dir);
+        for (int i = 0; i < rules->pattern_count; i++) {
+            const ignore_pattern_t* rule = &rules->patterns[i];
+            if (append_pattern(zi, scope, rule->pattern, strlen(rule->pattern), rule->is_directory,
+                               rule->is_negation, rule->is_anchored) != EXIT_SUCCESS) {
+                return EXIT_FAILURE;
             }
-            free(home_dir);
-        }
-        
-        // 2. Then, load from local base directory (can add to or override home patterns)
-        snprintf(zipignore_path, PATH_MAX, "%s%c%s", base_dir, PATH_SEPARATOR, ZIPIGNORE_FILENAME);
-        if (file_exists(zipignore_path)) {
-            load_patterns_from_file(zi, zipignore_path, base_dir);
         }
+        compile_patterns(zi);
     }
     
+    load_base_patterns(zi, base_dir, zipignore_file);
     return EXIT_SUCCESS;
 }
 
@@ -172,8 +683,8 @@ int load_nested_zipignore(zipignore_t* zi, const char* dir_path) {
     char zipignore_path[PATH_MAX];
     snprintf(zipignore_path, PATH_MAX, "%s%c%s", dir_path, PATH_SEPARATOR, ZIPIGNORE_FILENAME);
     
-    // Skip if already loaded or doesn't exist
-    if (!file_exists(zipignore_path) || is_zipignore_loaded(zi, zipignore_path)) {
+    // Skip if already loaded; a missing file is just a failed open
+    if (is_zipignore_loaded(zi, zipignore_path)) {
         return EXIT_SUCCESS;
     }
     
@@ -182,135 +693,132 @@ int load_nested_zipignore(zipignore_t* zi, const char* dir_path) {
     return load_patterns_from_file(zi, zipignore_path, dir_path);
 }
 
-bool should_ignore(const zipignore_t* zi, const char* path) {
+static bool match_ignore(const zipignore_t* zi, const char* path) {
     if (!zi || !path) {
         return false;
     }
     
-    // Safety check for path length
-    if (strlen(path) > PATH_MAX - 1) {
-        return false;
-    }
-    
-    char* normalized_path = normalize_path(path);
-    if (!normalized_path) {
-        return false;
-    }
-    
-    // Convert to forward slashes for consistent matching (gitignore uses /)
+    // Normalize into a local buffer: forward slashes (gitignore uses /) and
+    // no trailing separator
     char match_path[PATH_MAX];
-    strncpy(match_path, normalized_path, PATH_MAX - 1);
-    match_path[PATH_MAX - 1] = '\0';
-    for (char* p = match_path; *p; p++) {
-        if (*p == '\\') *p = '/';
+    size_t len = 0;
+    for (; path[len]; len++) {
+        if (len >= PATH_MAX - 1) {
+            return false;
+        }
+        match_path[len] = (path[len] == '\\') ? '/' : path[len];
     }
-    
-    // Get relative path from base directory
-    char base_dir_normalized[PATH_MAX];
-    strncpy(base_dir_normalized, zi->base_dir, PATH_MAX - 1);
-    base_dir_normalized[PATH_MAX - 1] = '\0';
-    for (char* p = base_dir_normalized; *p; p++) {
-        if (*p == '\\') *p = '/';
+    if (len > 1 && match_path[len - 1] == '/') {
+        len--;
     }
+    match_path[len] = '\0';
     
-    bool should_ignore_file = false;
+    const ignore_matcher_t* matcher = zi->matcher;
+    int compiled = matcher ? matcher->compiled_count : 0;
     
-    // Check all patterns (later patterns override earlier ones, like gitignore)
-    for (int i = 0; i < zi->pattern_count && i < MAX_IGNORE_PATTERNS; i++) {
+    // Patterns added after the last compile are the newest, so the first of
+    // them to match (from the end) decides on its own
+    for (int i = zi->pattern_count - 1; i >= compiled; i--) {
         const ignore_pattern_t* pattern = &zi->patterns[i];
+        if (pattern->pattern[0] == '\0') continue;
         
-        // Safety check for pattern length
-        if (strlen(pattern->pattern) == 0 || strlen(pattern->pattern) > MAX_PATTERN_LENGTH - 1) {
-            continue;
-        }
-        
-        // Get scope directory normalized
-        char scope_normalized[PATH_MAX];
-        strncpy(scope_normalized, pattern->scope_dir, PATH_MAX - 1);
-        scope_normalized[PATH_MAX - 1] = '\0';
-        for (char* p = scope_normalized; *p; p++) {
-            if (*p == '\\') *p = '/';
+        const char* relative = relative_to_scope(pattern->scope_dir, match_path);
+        if (relative && relative[0] != '\0' && pattern_matches(pattern, relative)) {
+            return !pattern->is_negation;
         }
-        
-        // Check if the file is within the scope of this pattern's .zipignore
-        char pattern_relative_path[PATH_MAX];
-        bool in_scope = false;
-        
-        size_t scope_len = strlen(scope_normalized);
-        if (scope_len == 0) {
-            // No scope_dir means pattern applies globally
-            in_scope = true;
-            strncpy(pattern_relative_path, match_path, PATH_MAX - 1);
-            pattern_relative_path[PATH_MAX - 1] = '\0';
-        } else if (strncmp(match_path, scope_normalized, scope_len) == 0) {
-            // File is under this pattern's scope directory
-            const char* scoped_start = match_path + scope_len;
-            if (scoped_start[0] == '\0') {
-                // Exact match (the directory itself)
-                in_scope = true;
-                pattern_relative_path[0] = '\0';
-            } else if (scoped_start[0] == '/') {
-                in_scope = true;
-                strncpy(pattern_relative_path, scoped_start + 1, PATH_MAX - 1);
-                pattern_relative_path[PATH_MAX - 1] = '\0';
-            }
-        }
-        
-        if (!in_scope) {
-            continue; // This pattern doesn't apply to this file
-        }
-        
-        // Skip empty relative path
-        if (strlen(pattern_relative_path) == 0) {
-            continue;
-        }
-        
-        // Check if pattern matches using gitignore-style matching
-        bool matches = false;
-        
-        if (pattern->is_anchored) {
-            // Anchored patterns must match from the start of the relative path
-            matches = pattern_match_gitignore(pattern->pattern, pattern_relative_path);
-        } else {
-            // Non-anchored patterns can match anywhere in the path
-            // First try matching the full path
-            matches = pattern_match_gitignore(pattern->pattern, pattern_relative_path);
-            
-            // If not matched and pattern doesn't contain /, try matching just the basename
-            if (!matches && strchr(pattern->pattern, '/') == NULL) {
-                // Get the basename
-                const char* basename = strrchr(pattern_relative_path, '/');
-                if (basename) {
-                    basename++; // Skip the slash
-                } else {
-                    basename = pattern_relative_path;
-                }
-                matches = pattern_match_gitignore(pattern->pattern, basename);
+    }
+    
+    if (!matcher) {
+        return false;
+    }
+    
+    // Later patterns override earlier ones (like gitignore): keep the
+    // highest matching index across the global scope and every scope
+    // directory that contains the path
+    int best = -1;
+    if (matcher->global_bucket >= 0) {
+        match_bucket(zi, &matcher->buckets[matcher->global_bucket], match_path, &best);
+    }
+    if (matcher->scopes.count > 0) {
+        for (size_t i = 1; i < len; i++) {
+            if (match_path[i] != '/') continue;
+            const key_slot_t* slot = table_find(&matcher->scopes, match_path, i);
+            if (slot) {
+                match_bucket(zi, &matcher->buckets[slot->values.items[0]], match_path + i + 1, &best);
             }
         }
-        
-        // For directory patterns, also check if the path is inside the matched directory
-        if (!matches && pattern->is_directory) {
-            // Try to match as a prefix (the path might be a file inside the directory)
-            size_t pattern_len = strlen(pattern->pattern);
-            if (strncmp(pattern_relative_path, pattern->pattern, pattern_len) == 0) {
-                if (pattern_relative_path[pattern_len] == '/') {
-                    matches = true;
-                }
-            }
+    }
+    
+    return best >= 0 && !zi->patterns[best].is_negation;
+}
+
+bool should_ignore(const zipignore_t* zi, const char* path) {
+    uint64_t start = metrics_start();
+    bool ignored = match_ignore(zi, path);
+    if (start) {
+        metrics_stop(METRICS_TIMER_IGNORE, start, NULL);
+        metrics_count(METRICS_IGNORE_CHECKS, 1);
+    }
+    return ignored;
+}
+
+// Whether a negation could match some path below `dir` (normalized)
+static bool negation_may_match_below(const ignore_pattern_t* pattern, const char* dir) {
+    const char* relative = relative_to_scope(pattern->scope_dir, dir);
+    if (!relative) {
+        // A .zipignore further down applies to part of the subtree
+        size_t len = strlen(dir);
+        for (size_t i = 0; i < len; i++) {
+            char c = pattern->scope_dir[i] == '\\' ? '/' : pattern->scope_dir[i];
+            if (c != dir[i]) return false;
         }
-        
-        if (matches) {
-            if (pattern->is_negation) {
-                should_ignore_file = false; // Negation overrides previous ignores
-            } else {
-                should_ignore_file = true;
-            }
+        return pattern->scope_dir[len] == '/' || pattern->scope_dir[len] == '\\';
+    }
+    
+    // Basename patterns can match at any depth; so can anything when the
+    // directory is the scope itself
+    const char* text = pattern->pattern;
+    if ((!pattern->is_anchored && strchr(text, '/') == NULL) || relative[0] == '\0') {
+        return true;
+    }
+    
+    // Paths below the directory start with "relative/": the pattern's
+    // literal prefix has to agree with that as far as both go
+    size_t literal_len = strcspn(text, "*?[");
+    size_t relative_len = strlen(relative);
+    for (size_t i = 0; i < literal_len && i <= relative_len; i++) {
+        char c = i < relative_len ? relative[i] : '/';
+        if (text[i] != c) return false;
+    }
+    return true;
+}
+
+bool zipignore_may_reinclude(const zipignore_t* zi, const char* dir_path) {
+    if (!zi || !dir_path) {
+        return false;
+    }
+    
+    char dir[PATH_MAX];
+    size_t len = 0;
+    for (; dir_path[len]; len++) {
+        if (len >= PATH_MAX - 1) {
+            return true;
         }
+        dir[len] = (dir_path[len] == '\\') ? '/' : dir_path[len];
+    }
+    if (len > 1 && dir[len - 1] == '/') {
+        len--;
     }
+    dir[len] = '\0';
     
-    free(normalized_path);
-    return should_ignore_file;
+    for (int i = 0; i < zi->pattern_count; i++) {
+        const ignore_pattern_t* pattern = &zi->patterns[i];
+        if (pattern->is_negation && pattern->pattern[0] != '\0' &&
+            negation_may_match_below(pattern, dir)) {
+            return true;
+        }
+    }
+    return false;
 }
 
 // Gitignore-style pattern matching with support for *, **, and ?
@@ -529,7 +1037,7 @@ int create_default_zipignore(void) {
     
     FILE* file = fopen(zipignore_path, "w");
     if (!file) {
-        fprintf(stderr, "Error: Cannot create %s\n", zipignore_path);
+        log_message(LOG_ERROR, "Error: Cannot create %s\n", zipignore_path);
         return EXIT_FILE_ERROR;
     }
     
@@ -552,6 +1060,9 @@ int create_default_zipignore(void) {
 
 void free_zipignore(zipignore_t* zi) {
     if (zi) {
+        free_matcher(zi->matcher);
+        free_store(zi->store);
+        free(zi->patterns);
         memset(zi, 0, sizeof(zipignore_t));
     }
 }
\ No newline at end of file
@@ -4,10 +4,29 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <errno.h>
 #include "../include/gbzip.h"
 #include "../include/utils.h"
 #include "../include/zipignore.h"
+#include "../include/archive_writer.h"
+#include "../include/compress.h"
+#include "../include/codec.h"
+#include "../include/checksum.h"
+#include "../include/input_source.h"
+#include "../include/batch_reader.h"
+#include "../include/output_file.h"
+#include "../include/entry_select.h"
+#include "../include/resources.h"
+#include "../include/metrics.h"
+#include "../include/dir_cache.h"
+#include "../include/string_pool.h"
+#include "../include/fingerprint.h"
+#include "../include/libgbzip.h"
+#include "../include/batch.h"
+#include "../include/pacer.h"
+#include "../include/logging.h"
+#include <zlib.h>
 
 // Test counters
 static int tests_run = 0;
@@ -73,16 +92,7 @@ static void remove_tree(const char* path) {
 // Helper to add a pattern directly for testing
 static void add_test_pattern(zipignore_t* zi, const char* scope_dir, const char* pattern_str,
                              bool is_directory, bool is_negation, bool is_anchored) {
-    if (zi->pattern_count >= MAX_IGNORE_PATTERNS) return;
-    
-    ignore_pattern_t* p = &zi->patterns[zi->pattern_count];
-    memset(p, 0, sizeof(ignore_pattern_t));
-    strncpy(p->scope_dir, scope_dir, PATH_MAX - 1);
-    strncpy(p->pattern, pattern_str, MAX_PATTERN_LENGTH - 1);
-    p->is_directory = is_directory;
-    p->is_negation = is_negation;
-    p->is_anchored = is_anchored;
-    zi->pattern_count++;
+    zipignore_add_pattern(zi, scope_dir, pattern_str, is_directory, is_negation, is_anchored);
 }
 
 int test_file_utils(void) {
@@ -388,6 +398,78 @@ int test_zipignore_deeply_nested(void) {
     return EXIT_SUCCESS;
 }
 
+int test_zipignore_compiled_matcher(void) {
+    printf("\n=== Testing compiled zipignore matcher ===\n");
+    
+    const char* test_dir = "/tmp/gbzip_test_matcher";
+    remove_tree(test_dir);
+    mkdir_p("/tmp/gbzip_test_matcher/src/gen");
+    
+    // Every index kind, with negations that cross from one index to another
+    create_test_file("/tmp/gbzip_test_matcher/.zipignore",
+        "*.log\n"
+        "!keep.log\n"
+        "node_modules/\n"
+        "/dist\n"
+        "tmp*\n"
+        "!tmp-keep\n"
+        "*~\n"
+        "*.tar.gz\n"
+        "docs/**/*.pdf\n"
+    );
+    create_test_file("/tmp/gbzip_test_matcher/src/.zipignore",
+        "gen/\n"
+        "!*.log\n"
+    );
+    
+    zipignore_t* zi = malloc(sizeof(zipignore_t));
+    if (!zi) return EXIT_FAILURE;
+    load_zipignore(zi, test_dir, NULL);
+    load_nested_zipignore(zi, "/tmp/gbzip_test_matcher/src");
+    
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/a/b/debug.log") == true, "Extension index");
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/a/keep.log") == false, "Later basename negates extension");
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/node_modules") == true, "Basename index");
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/node_modules/x/y.js") == true, "Directory prefix");
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/dist") == true, "Anchored literal");
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/a/dist") == false, "Anchored literal only at scope root");
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/a/tmpfile") == true, "Prefix glob on basename");
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/a/tmp-keep") == false, "Negated prefix glob");
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/notes.txt~") == true, "Leading wildcard glob");
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/pkg.tar.gz") == true, "Multi-dot extension");
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/pkg.gz") == false, "Shorter extension not matched");
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/docs/a/b/guide.pdf") == true, "Anchored ** glob");
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/src/gen/out.c") == true, "Nested scope directory pattern");
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/src/debug.log") == false, "Nested negation overrides root pattern");
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/src/") == false, "Scope directory itself not matched");
+    
+    // Pruning is only safe where no negation can reach below the directory
+    TEST_ASSERT(zipignore_may_reinclude(zi, "/tmp/gbzip_test_matcher/node_modules") == true, "Basename negation reaches every subtree");
+    
+    zipignore_t* zi2 = create_test_zipignore(test_dir);
+    if (!zi2) { free(zi); return EXIT_FAILURE; }
+    add_test_pattern(zi2, test_dir, "build", true, false, false);
+    add_test_pattern(zi2, test_dir, "build/keep", false, true, true);
+    add_test_pattern(zi2, "/tmp/gbzip_test_matcher/vendor/lib", "*.c", false, true, false);
+    TEST_ASSERT(zipignore_may_reinclude(zi2, "/tmp/gbzip_test_matcher/build") == true, "Anchored negation inside the directory");
+    TEST_ASSERT(zipignore_may_reinclude(zi2, "/tmp/gbzip_test_matcher/out") == false, "Anchored negation elsewhere");
+    TEST_ASSERT(zipignore_may_reinclude(zi2, "/tmp/gbzip_test_matcher/build-old") == false, "Similar prefix is not the same directory");
+    TEST_ASSERT(zipignore_may_reinclude(zi2, "/tmp/gbzip_test_matcher/vendor") == true, "Negation from a nested scope below");
+    TEST_ASSERT(zipignore_may_reinclude(zi2, "/tmp/gbzip_test_matcher/vendor/lib/x") == true, "Negation scope above the directory");
+    TEST_ASSERT(zipignore_may_reinclude(zi2, "/tmp/gbzip_test_matcher/docs") == false, "No negation in scope");
+    free(zi2);
+    
+    // Patterns added after loading are still honoured, newest first
+    add_test_pattern(zi, test_dir, "keep.log", false, false, false);
+    TEST_ASSERT(should_ignore(zi, "/tmp/gbzip_test_matcher/a/keep.log") == true, "Pattern added after loading wins when newest");
+    
+    free_zipignore(zi);
+    free(zi);
+    remove_tree(test_dir);
+    
+    return EXIT_SUCCESS;
+}
+
 int test_zipignore_edge_cases(void) {
     printf("\n=== Testing edge cases ===\n");
     
@@ -616,6 +698,1720 @@ int test_normalize_path(void) {
     return EXIT_SUCCESS;
 }
 
+int test_parse_size(void) {
+    printf("\n=== Testing size parsing ===\n");
+    
+    uint64_t size = 0;
+    TEST_ASSERT(parse_size("4096", &size) && size == 4096, "Plain byte count");
+    TEST_ASSERT(parse_size("256K", &size) && size == 256 * 1024, "K suffix");
+    TEST_ASSERT(parse_size("4M", &size) && size == 4 * 1024 * 1024, "M suffix");
+    TEST_ASSERT(parse_size("2GB", &size) && size == 2ULL * 1024 * 1024 * 1024, "GB suffix");
+    TEST_ASSERT(parse_size("1.5M", &size) == false, "Fractions rejected");
+    TEST_ASSERT(parse_size("M", &size) == false, "Missing number rejected");
+    TEST_ASSERT(parse_size("12X", &size) == false, "Unknown suffix rejected");
+    
+    double seconds = 0;
+    TEST_ASSERT(parse_duration("90", &seconds) && seconds == 90, "Duration in seconds");
+    TEST_ASSERT(parse_duration("15m", &seconds) && seconds == 900 && parse_duration("1.5h", &seconds) &&
+                seconds == 5400, "Minute and hour suffixes");
+    TEST_ASSERT(!parse_duration("0", &seconds) && !parse_duration("10d", &seconds) && !parse_duration("m", &seconds),
+                "Zero, unknown suffixes and missing numbers rejected");
+    
+    return EXIT_SUCCESS;
+}
+
+int test_archive_writer(void) {
+    printf("\n=== Testing archive writer ===\n");
+    
+    const char* path = "/tmp/gbzip_test_writer.zip";
+    const char* data = "hello archive";
+    size_t data_len = strlen(data);
+    
+    archive_writer_t writer;
+    TEST_ASSERT(archive_writer_open(&writer, path) == EXIT_SUCCESS, "Writer opens staging file");
+    TEST_ASSERT(archive_writer_add_directory(&writer, "dir/", 0) == EXIT_SUCCESS, "Directory entry added");
+    
+    archive_entry_info_t info = {
+        .name = "dir/a.txt",
+        .method = ARCHIVE_METHOD_STORE,
+        .crc32 = 0x1A3E0C5D,
+        .compressed_size = data_len,
+        .uncompressed_size = data_len,
+        .mtime = 0,
+        .mode = 0
+    };
+    TEST_ASSERT(archive_writer_add(&writer, &info, data) == EXIT_SUCCESS, "Stored entry added");
+    TEST_ASSERT(file_exists(path) == false, "Archive not visible before close");
+    TEST_ASSERT(archive_writer_close(&writer) == EXIT_SUCCESS, "Writer closes archive");
+    
+    unsigned char buf[512];
+    FILE* f = fopen(path, "rb");
+    TEST_ASSERT(f != NULL, "Archive exists after close");
+    if (!f) return EXIT_FAILURE;
+    size_t n = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    
+    TEST_ASSERT(n > 22 && memcmp(buf, "PK\x03\x04", 4) == 0, "Archive starts with local header");
+    const unsigned char* eocd = buf + n - 22;
+    TEST_ASSERT(memcmp(eocd, "PK\x05\x06", 4) == 0, "Archive ends with end of central directory");
+    TEST_ASSERT(eocd[10] == 2 && eocd[11] == 0, "Central directory lists both entries");
+    
+    // Permissions as fopen would give them, with the umask left alone
+    mode_t mask = umask(022);
+    umask(mask);
+    struct stat st;
+    TEST_ASSERT(stat(path, &st) == 0 && (st.st_mode & 0777) == (0666 & ~mask) && mask != 0,
+                "Archive created with the umask applied");
+    
+    // Second local header follows the directory entry (30 byte header + name)
+    const unsigned char* second = buf + 30 + strlen("dir/");
+    TEST_ASSERT(memcmp(second, "PK\x03\x04", 4) == 0, "Second local header follows directory");
+    TEST_ASSERT(memcmp(second + 30 + strlen("dir/a.txt"), data, data_len) == 0, "Stored data written verbatim");
+    unlink(path);
+    
+    // Deferred entries get CRC and sizes patched into the local header
+    TEST_ASSERT(archive_writer_open(&writer, path) == EXIT_SUCCESS, "Writer opens for deferred entry");
+    archive_entry_info_t deferred = {
+        .name = "stream.bin",
+        .method = ARCHIVE_METHOD_STORE,
+        .uncompressed_size = data_len,
+        .mtime = 0,
+        .mode = 0
+    };
+    TEST_ASSERT(archive_writer_begin_deferred_entry(&writer, &deferred) == EXIT_SUCCESS, "Deferred entry begins");
+    TEST_ASSERT(archive_writer_write(&writer, data, 5) == EXIT_SUCCESS &&
+                archive_writer_write(&writer, data + 5, data_len - 5) == EXIT_SUCCESS, "Deferred data written in pieces");
+    TEST_ASSERT(archive_writer_end_deferred_entry(&writer, 0x1A3E0C5D, data_len) == EXIT_SUCCESS, "Deferred entry ends");
+    TEST_ASSERT(archive_writer_close(&writer) == EXIT_SUCCESS, "Writer closes deferred archive");
+    
+    f = fopen(path, "rb");
+    n = f ? fread(buf, 1, sizeof(buf), f) : 0;
+    if (f) fclose(f);
+    TEST_ASSERT(n > 30 && buf[14] == 0x5D && buf[15] == 0x0C && buf[16] == 0x3E && buf[17] == 0x1A,
+                "Local header CRC patched");
+    TEST_ASSERT(buf[18] == data_len && buf[22] == data_len, "Local header sizes patched");
+    unlink(path);
+    
+    // Aborting must not create the archive
+    TEST_ASSERT(archive_writer_open(&writer, path) == EXIT_SUCCESS, "Writer reopens");
+    archive_writer_abort(&writer);
+    TEST_ASSERT(file_exists(path) == false, "Aborted archive leaves no file");
+    
+    return EXIT_SUCCESS;
+}
+
+int test_archive_writer_stream(void) {
+    printf("\n=== Testing archive writer streaming ===\n");
+    
+    const char* data = "hello archive";
+    size_t data_len = strlen(data);
+    unsigned char stub[4] = { 0x03, 0x00, 0x00, 0x00 };   // Not real deflate; the writer doesn't care
+    
+    FILE* stream = tmpfile();
+    TEST_ASSERT(stream != NULL, "Temporary stream created");
+    if (!stream) return EXIT_FAILURE;
+    
+    archive_writer_t writer;
+    TEST_ASSERT(archive_writer_open_stream(&writer, stream, "<test>") == EXIT_SUCCESS, "Writer opens a stream");
+    archive_entry_info_t info = {
+        .name = "deflated.bin",
+        .method = ARCHIVE_METHOD_DEFLATE,
+        .uncompressed_size = data_len,
+        .mtime = 0,
+        .mode = 0
+    };
+    TEST_ASSERT(archive_writer_begin_deferred_entry(&writer, &info) == EXIT_SUCCESS &&
+                archive_writer_write(&writer, stub, sizeof(stub)) == EXIT_SUCCESS &&
+                archive_writer_end_deferred_entry(&writer, 0x1A3E0C5D, data_len) == EXIT_SUCCESS,
+                "Deferred entry streamed");
+    
+    info.name = "stored.bin";
+    info.method = ARCHIVE_METHOD_STORE;
+    TEST_ASSERT(archive_writer_begin_deferred_entry(&writer, &info) == EXIT_SUCCESS &&
+                archive_writer_write(&writer, data, data_len) == EXIT_SUCCESS &&
+                archive_writer_end_deferred_entry(&writer, 0x1A3E0C5D, data_len) == EXIT_SUCCESS,
+                "Stored deferred entry streamed");
+    TEST_ASSERT(archive_writer_close(&writer) == EXIT_SUCCESS, "Streamed archive closes");
+    
+    unsigned char buf[512];
+    rewind(stream);
+    size_t n = fread(buf, 1, sizeof(buf), stream);
+    
+    // Deflated entry: bit 3 set, CRC and sizes zero, then a descriptor
+    size_t first_data = 30 + strlen("deflated.bin");
+    TEST_ASSERT(n > first_data + 20 && (buf[6] & 0x08) != 0, "Local header flags a data descriptor");
+    TEST_ASSERT(memcmp(buf + 14, "\0\0\0\0\0\0\0\0\0\0\0\0", 12) == 0, "Local header leaves CRC and sizes zero");
+    const unsigned char* descriptor = buf + first_data + sizeof(stub);
+    TEST_ASSERT(memcmp(descriptor, "PK\x07\x08", 4) == 0 && descriptor[4] == 0x5D && descriptor[7] == 0x1A &&
+                descriptor[8] == sizeof(stub) && descriptor[12] == data_len, "Descriptor follows the data");
+    
+    // Stored entry: sizes are known up front so stream readers find its end
+    const unsigned char* second = descriptor + 16;
+    TEST_ASSERT(memcmp(second, "PK\x03\x04", 4) == 0 && (second[6] & 0x08) != 0 &&
+                second[18] == data_len && second[22] == data_len, "Stored entry gives its sizes up front");
+    
+    const unsigned char* eocd = buf + n - 22;
+    TEST_ASSERT(memcmp(eocd, "PK\x05\x06", 4) == 0 && eocd[10] == 2, "Central directory follows the entries");
+    TEST_ASSERT(fputc('x', stream) != EOF, "Stream left open after close");
+    fclose(stream);
+    
+    // A stored entry cannot end short of the size its header promised
+    stream = tmpfile();
+    if (!stream) return EXIT_FAILURE;
+    TEST_ASSERT(archive_writer_open_stream(&writer, stream, "<test>") == EXIT_SUCCESS &&
+                archive_writer_begin_deferred_entry(&writer, &info) == EXIT_SUCCESS &&
+                archive_writer_write(&writer, data, 5) == EXIT_SUCCESS, "Short stored entry begins");
+    TEST_ASSERT(archive_writer_end_deferred_entry(&writer, 0, 5) != EXIT_SUCCESS, "Short stored entry rejected");
+    archive_writer_abort(&writer);
+    fclose(stream);
+    
+    return EXIT_SUCCESS;
+}
+
+static int add_stored_entry(archive_writer_t* writer, const char* name, const char* data) {
+    archive_entry_info_t info = {
+        .name = name,
+        .method = ARCHIVE_METHOD_STORE,
+        .crc32 = compress_crc32((const unsigned char*)data, strlen(data)),
+        .compressed_size = strlen(data),
+        .uncompressed_size = strlen(data),
+        .mtime = 0,
+        .mode = 0
+    };
+    return archive_writer_add(writer, &info, data);
+}
+
+static long file_length(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return -1;
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fclose(f);
+    return length;
+}
+
+int test_archive_writer_append(void) {
+    printf("\n=== Testing archive append and compaction ===\n");
+    
+    const char* path = "/tmp/gbzip_test_append.zip";
+    archive_writer_t writer;
+    TEST_ASSERT(archive_writer_open(&writer, path) == EXIT_SUCCESS &&
+                add_stored_entry(&writer, "a.txt", "first version") == EXIT_SUCCESS &&
+                add_stored_entry(&writer, "b.txt", "unchanged") == EXIT_SUCCESS &&
+                archive_writer_close(&writer) == EXIT_SUCCESS, "Base archive written");
+    
+    long original_length = file_length(path);
+    unsigned char original[512];
+    FILE* f = fopen(path, "rb");
+    size_t n = f ? fread(original, 1, sizeof(original), f) : 0;
+    if (f) fclose(f);
+    TEST_ASSERT(original_length > 0 && n == (size_t)original_length, "Base archive read back");
+    
+    // Replace one entry in place
+    TEST_ASSERT(archive_writer_open_append(&writer, path) == EXIT_SUCCESS, "Archive opens for appending");
+    TEST_ASSERT(writer.existing_count == 2, "Existing central directory loaded");
+    TEST_ASSERT(archive_writer_remove(&writer, "a.txt") == 1, "Superseded entry removed");
+    TEST_ASSERT(archive_writer_remove(&writer, "a.txt") == 0, "Entry is only removed once");
+    TEST_ASSERT(archive_writer_remove(&writer, "missing.txt") == 0, "Unknown entry not removed");
+    TEST_ASSERT(add_stored_entry(&writer, "a.txt", "second version") == EXIT_SUCCESS, "Replacement appended");
+    TEST_ASSERT(archive_writer_close(&writer) == EXIT_SUCCESS, "Appended archive closed");
+    
+    unsigned char buf[1024];
+    f = fopen(path, "rb");
+    n = f ? fread(buf, 1, sizeof(buf), f) : 0;
+    if (f) fclose(f);
+    TEST_ASSERT(n > (size_t)original_length && memcmp(buf, original, (size_t)original_length) == 0,
+                "Existing bytes left untouched");
+    const unsigned char* eocd = buf + n - 22;
+    TEST_ASSERT(memcmp(eocd, "PK\x05\x06", 4) == 0 && eocd[10] == 2, "New central directory lists live entries");
+    
+    // Reading back: superseded entry gone, replacement after the old data
+    TEST_ASSERT(archive_writer_open_append(&writer, path) == EXIT_SUCCESS, "Appended archive reopens");
+    TEST_ASSERT(writer.record_count == 2 && strcmp(writer.records[0].name, "b.txt") == 0 &&
+                strcmp(writer.records[1].name, "a.txt") == 0, "Records in original order");
+    TEST_ASSERT(writer.records[1].local_header_offset >= (uint64_t)original_length, "Replacement stored at the end");
+    
+    // A failed update leaves the archive as it was
+    long appended_length = file_length(path);
+    TEST_ASSERT(add_stored_entry(&writer, "c.txt", "discarded") == EXIT_SUCCESS, "Entry appended before abort");
+    archive_writer_abort(&writer);
+    TEST_ASSERT(file_length(path) == appended_length, "Abort truncates back to the original size");
+    
+    // Compaction drops the old entry and the old central directory
+    uint64_t reclaimed = 1;
+    TEST_ASSERT(archive_writer_compact(path, 100, &reclaimed) == EXIT_SUCCESS && reclaimed == 0,
+                "Nothing compacted below the threshold");
+    TEST_ASSERT(file_length(path) == appended_length, "Archive unchanged below the threshold");
+    TEST_ASSERT(archive_writer_compact(path, 1, &reclaimed) == EXIT_SUCCESS && reclaimed > 0,
+                "Dead space reclaimed");
+    TEST_ASSERT(file_length(path) == appended_length - (long)reclaimed, "Reclaimed bytes reported");
+    
+    TEST_ASSERT(archive_writer_open_append(&writer, path) == EXIT_SUCCESS, "Compacted archive reopens");
+    TEST_ASSERT(writer.record_count == 2 && strcmp(writer.records[1].name, "a.txt") == 0, "Both entries kept");
+    uint64_t offset = writer.records[1].local_header_offset;
+    archive_writer_abort(&writer);
+    
+    f = fopen(path, "rb");
+    n = f ? fread(buf, 1, sizeof(buf), f) : 0;
+    if (f) fclose(f);
+    const char* expected = "second version";
+    TEST_ASSERT(offset + 30 + 5 + strlen(expected) <= n && memcmp(buf + offset, "PK\x03\x04", 4) == 0 &&
+                memcmp(buf + offset + 30 + 5, expected, strlen(expected)) == 0, "Live entry data copied verbatim");
+    
+    TEST_ASSERT(archive_writer_open_append(&writer, "/tmp/gbzip_test_missing.zip") != EXIT_SUCCESS,
+                "Missing archive cannot be appended to");
+    unlink(path);
+    
+    return EXIT_SUCCESS;
+}
+
+// Concatenate compressed blocks as the streaming writer does, combining their CRCs
+static unsigned char* join_blocks(const compress_block_t* blocks, size_t count, size_t* size, uint32_t* crc) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) total += blocks[i].output_size;
+    unsigned char* joined = malloc(total > 0 ? total : 1);
+    if (!joined) return NULL;
+    
+    uLong combined = crc32(0L, Z_NULL, 0);
+    size_t pos = 0;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(joined + pos, blocks[i].output, blocks[i].output_size);
+        pos += blocks[i].output_size;
+        combined = crc32_combine(combined, blocks[i].crc32, (z_off_t)blocks[i].input_size);
+    }
+    *size = total;
+    *crc = (uint32_t)combined;
+    return joined;
+}
+
+int test_chunked_deflate(void) {
+    printf("\n=== Testing chunked parallel deflate ===\n");
+    
+    // Three and a half blocks of semi-repetitive data so matches cross block boundaries
+    size_t size = COMPRESS_BLOCK_SIZE * 3 + COMPRESS_BLOCK_SIZE / 2;
+    unsigned char* input = malloc(size);
+    TEST_ASSERT(input != NULL, "Allocated test input");
+    if (!input) return EXIT_FAILURE;
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        input[i] = (i % 4096 < 2048) ? (unsigned char)("gbzip"[i % 5]) : (unsigned char)(seed >> 24);
+    }
+    
+    // Blocks after the first are primed with the 32KB before them, and only
+    // the final one ends the stream
+    compress_block_t blocks[4];
+    memset(blocks, 0, sizeof(blocks));
+    bool all_ok = true;
+    for (size_t i = 0; i < 4; i++) {
+        size_t offset = i * COMPRESS_BLOCK_SIZE;
+        blocks[i].input = input + offset;
+        blocks[i].input_size = size - offset < COMPRESS_BLOCK_SIZE ? size - offset : COMPRESS_BLOCK_SIZE;
+        if (i > 0) {
+            blocks[i].dictionary = blocks[i].input - COMPRESS_WINDOW_SIZE;
+            blocks[i].dictionary_size = COMPRESS_WINDOW_SIZE;
+        }
+        blocks[i].last = i == 3;
+        blocks[i].level = 6;
+        if (compress_block(&blocks[i]) != 0) all_ok = false;
+    }
+    TEST_ASSERT(all_ok, "All blocks compressed");
+    
+    size_t joined_size = 0;
+    uint32_t crc = 0;
+    unsigned char* joined = all_ok ? join_blocks(blocks, 4, &joined_size, &crc) : NULL;
+    TEST_ASSERT(joined != NULL, "Blocks joined");
+    TEST_ASSERT(crc == compress_crc32(input, size), "Combined CRC matches CRC of whole input");
+    
+    // The joined output must inflate as one raw deflate stream
+    unsigned char* restored = malloc(size + 1);
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    inflateInit2(&strm, -15);
+    strm.next_in = joined;
+    strm.avail_in = joined ? (uInt)joined_size : 0;
+    strm.next_out = restored;
+    strm.avail_out = (uInt)size + 1;
+    int ret = inflate(&strm, Z_FINISH);
+    TEST_ASSERT(ret == Z_STREAM_END, "Joined blocks form a single valid deflate stream");
+    TEST_ASSERT(strm.total_out == size && memcmp(restored, input, size) == 0, "Inflated data matches input");
+    inflateEnd(&strm);
+    
+    free(restored);
+    free(joined);
+    for (size_t i = 0; i < 4; i++) free(blocks[i].output);
+    free(input);
+    
+    return EXIT_SUCCESS;
+}
+
+int test_incompressible_detection(void) {
+    printf("\n=== Testing incompressible data detection ===\n");
+    
+    TEST_ASSERT(compress_is_compressed_format("photos/IMG_0001.JPG"), "JPEG known by extension");
+    TEST_ASSERT(compress_is_compressed_format("backup.tar.gz") && compress_is_compressed_format("a/b.docx"),
+                "Archives and zip-based documents known");
+    TEST_ASSERT(!compress_is_compressed_format("src/main.c") && !compress_is_compressed_format("Makefile") &&
+                !compress_is_compressed_format("archive.zip/readme.txt"), "Other files left to deflate");
+    
+    // Pseudo-random bytes, then the same bytes repeated every 4KB
+    unsigned char* noise = malloc(COMPRESS_PROBE_SIZE);
+    unsigned char* repeated = malloc(COMPRESS_PROBE_SIZE);
+    uint32_t state = 2463534242u;
+    for (size_t i = 0; i < COMPRESS_PROBE_SIZE; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        noise[i] = (unsigned char)state;
+        repeated[i] = noise[i % 4096];
+    }
+    char text[COMPRESS_PROBE_SIZE];
+    for (size_t i = 0; i < sizeof(text); i++) text[i] = "int main(void) { return 0; }\n"[i % 29];
+    
+    TEST_ASSERT(compress_probe_incompressible(noise, COMPRESS_PROBE_SIZE), "Random data is incompressible");
+    TEST_ASSERT(!compress_probe_incompressible(repeated, COMPRESS_PROBE_SIZE),
+                "High-entropy data with repeats still compresses");
+    TEST_ASSERT(!compress_probe_incompressible((const unsigned char*)text, sizeof(text)), "Text compresses");
+    TEST_ASSERT(!compress_probe_incompressible(noise, 0), "Empty sample is not judged");
+    
+    TEST_ASSERT(strcmp(compress_decision_name(COMPRESS_DEFLATED), "deflate") == 0 &&
+                strcmp(compress_decision_name(COMPRESS_STORED_PROBE), "probe") == 0, "Decision names");
+    
+    free(noise);
+    free(repeated);
+    return EXIT_SUCCESS;
+}
+
+// Decode `size` bytes of entry data of `method` in small steps, as extraction does
+static bool codec_roundtrip_ok(uint16_t method, const unsigned char* data, size_t size,
+                               const unsigned char* expected, size_t expected_size) {
+    codec_decoder_t* decoder = codec_decoder_create(method);
+    if (!decoder) return false;
+    
+    unsigned char* decoded = malloc(expected_size + 1);
+    size_t total = 0;
+    bool finished = false;
+    bool ok = decoded != NULL;
+    while (ok) {
+        const unsigned char* input = data;
+        size_t input_size = size < 1000 ? size : 1000;
+        size_t before = input_size;
+        size_t produced = 0;
+        size_t room = expected_size + 1 - total;
+        if (codec_decode(decoder, &input, &input_size, decoded + total, room < 4096 ? room : 4096,
+                         &produced, &finished) != 0) {
+            ok = false;
+            break;
+        }
+        data += before - input_size;
+        size -= before - input_size;
+        total += produced;
+        if (produced == 0 && input_size == before) break;
+    }
+    
+    ok = ok && finished && size == 0 && total == expected_size && memcmp(decoded, expected, total) == 0;
+    free(decoded);
+    codec_decoder_free(decoder);
+    return ok;
+}
+
+int test_codecs(void) {
+    printf("\n=== Testing codecs ===\n");
+    
+    codec_id_t codec = CODEC_ZSTD;
+    TEST_ASSERT(codec_from_name("zlib", &codec) && codec == CODEC_ZLIB, "zlib codec known by name");
+    TEST_ASSERT(codec_from_name("zstd", &codec) && codec == CODEC_ZSTD && !codec_from_name("lzma", &codec),
+                "Other names looked up");
+    TEST_ASSERT(codec_available(CODEC_ZLIB) && strncmp(codec_available_names(), "zlib", 4) == 0,
+                "zlib always built");
+    TEST_ASSERT(codec_method(CODEC_LIBDEFLATE) == ARCHIVE_METHOD_DEFLATE && codec_method(CODEC_ZSTD) == 93,
+                "Codec ZIP methods");
+    TEST_ASSERT(strcmp(codec_method_name(ARCHIVE_METHOD_STORE), "store") == 0 &&
+                strcmp(codec_method_name(ARCHIVE_METHOD_DEFLATE), "deflate") == 0 &&
+                strcmp(codec_method_name(ARCHIVE_METHOD_ZSTD), "zstd") == 0, "ZIP methods named for messages");
+    
+    size_t size = 200 * 1024;
+    unsigned char* input = malloc(size);
+    for (size_t i = 0; i < size; i++) {
+        input[i] = (unsigned char)("gbzip codec round trip "[i % 23] + (i / 4096) % 3);
+    }
+    TEST_ASSERT(codec_crc32(codec_crc32(0, input, 1000), input + 1000, size - 1000) ==
+                (uint32_t)crc32(0L, input, (uInt)size), "CRC-32 continues across calls and matches zlib");
+    
+    static const codec_id_t all[] = { CODEC_ZLIB, CODEC_LIBDEFLATE, CODEC_ZSTD };
+    for (size_t c = 0; c < sizeof(all) / sizeof(all[0]); c++) {
+        if (!codec_available(all[c])) {
+            printf("  - %s not built, skipped\n", codec_name(all[c]));
+            continue;
+        }
+        
+        codec_encoder_t* encoder = codec_encoder_create(all[c], 6);
+        size_t capacity = encoder ? codec_encoder_bound(encoder, size) : 0;
+        unsigned char* output = malloc(capacity + 1);
+        bool encoded = true;
+        size_t output_size = 0;
+        
+        // The encoder is reused for a second input, as on a worker thread
+        for (int pass = 0; pass < 2 && encoder; pass++) {
+            encoded = encoded && codec_encode(encoder, input, size, output, capacity, &output_size) == 0 &&
+                      output_size < size / 4;
+        }
+        char message[128];
+        snprintf(message, sizeof(message), "%s compresses with a reused encoder", codec_name(all[c]));
+        TEST_ASSERT(encoder && encoded, message);
+        snprintf(message, sizeof(message), "%s output decodes by its ZIP method", codec_name(all[c]));
+        TEST_ASSERT(encoder && codec_roundtrip_ok(codec_encoder_method(encoder), output, output_size, input, size),
+                    message);
+        snprintf(message, sizeof(message), "%s reports output that does not fit", codec_name(all[c]));
+        TEST_ASSERT(encoder && codec_encode(encoder, input, size, output, 16, &output_size) != 0, message);
+        
+        codec_encoder_free(encoder);
+        free(output);
+    }
+    
+    TEST_ASSERT(!codec_can_decode(12) && codec_decoder_create(12) == NULL, "Unknown methods are not decoded");
+    
+    if (codec_available(CODEC_ZSTD)) {
+        // Streamed Zstandard entries are one frame per block
+        size_t half = size / 2;
+        compress_block_t blocks[2];
+        memset(blocks, 0, sizeof(blocks));
+        for (int i = 0; i < 2; i++) {
+            blocks[i].input = input + i * half;
+            blocks[i].input_size = half;
+            blocks[i].level = 6;
+            blocks[i].codec = CODEC_ZSTD;
+        }
+        unsigned char* joined = NULL;
+        size_t joined_size = 0;
+        uint32_t crc = 0;
+        bool ok = compress_block(&blocks[0]) == 0 && compress_block(&blocks[1]) == 0 &&
+                  (joined = join_blocks(blocks, 2, &joined_size, &crc)) != NULL;
+        TEST_ASSERT(ok && crc == compress_crc32(input, size), "Zstandard blocks compress with combined CRC");
+        TEST_ASSERT(ok && codec_roundtrip_ok(ARCHIVE_METHOD_ZSTD, joined, joined_size, input, size),
+                    "Concatenated Zstandard frames decode as one entry");
+        TEST_ASSERT(ok && !codec_roundtrip_ok(ARCHIVE_METHOD_ZSTD, joined, joined_size - 1, input, size),
+                    "Truncated Zstandard data is rejected");
+        free(joined);
+        free(blocks[0].output);
+        free(blocks[1].output);
+    }
+    
+    free(input);
+    return EXIT_SUCCESS;
+}
+
+int test_checksum(void) {
+    printf("\n=== Testing CRC-32 kernel ===\n");
+    printf("  - kernel: %s\n", checksum_crc32_kernel());
+    
+    size_t size = 4096 + 64;
+    unsigned char* data = malloc(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (unsigned char)((i * 2654435761u) >> 13);
+    }
+    
+    // Every length around the 16- and 64-byte folding boundaries, at every alignment
+    bool all_match = true;
+    for (size_t offset = 0; offset < 16 && all_match; offset++) {
+        for (size_t length = 0; length <= 300 && all_match; length++) {
+            all_match = checksum_crc32(0, data + offset, length) == (uint32_t)crc32(0L, data + offset, (uInt)length);
+        }
+    }
+    TEST_ASSERT(all_match, "Matches zlib for every short length and alignment");
+    TEST_ASSERT(checksum_crc32(0, data, 4096) == (uint32_t)crc32(0L, data, 4096), "Matches zlib on a 4KB block");
+    
+    uint32_t split = checksum_crc32(checksum_crc32(0, data, 77), data + 77, size - 77);
+    TEST_ASSERT(split == (uint32_t)crc32(0L, data, (uInt)size), "Continues across calls");
+    TEST_ASSERT(checksum_crc32(0x12345678, data, 0) == 0x12345678, "Empty input keeps the CRC");
+    TEST_ASSERT(checksum_crc32(0, "123456789", 9) == 0xCBF43926, "Standard check value");
+    
+    free(data);
+    return EXIT_SUCCESS;
+}
+
+int test_input_source(void) {
+    printf("\n=== Testing input source ===\n");
+    
+    const char* path = "/tmp/gbzip_test_input_source.bin";
+    size_t size = INPUT_MAP_MIN_SIZE + 12345;
+    unsigned char* data = malloc(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (unsigned char)((i * 2654435761u) >> 11);
+    }
+    FILE* f = fopen(path, "wb");
+    if (f) {
+        fwrite(data, 1, size, f);
+        fclose(f);
+    }
+    
+    // The same bytes come out window by window, mapped or read
+    unsigned char* buffer = malloc(100000);
+    for (int allow_map = 1; allow_map >= 0; allow_map--) {
+        input_source_t src;
+        bool opened = input_source_open(&src, path, allow_map) == 0;
+        TEST_ASSERT(opened && src.size == size, "Large file opened");
+        if (!opened) continue;
+        TEST_ASSERT(input_source_mapped(&src) == (allow_map != 0),
+                    allow_map ? "Large file is mapped" : "File is read when mapping is off");
+        
+        bool same = true;
+        uint64_t offset = 0;
+        size_t n = 0;
+        const unsigned char* window;
+        while ((window = input_source_next(&src, buffer, 100000, &n)) != NULL && n > 0) {
+            same = same && offset + n <= size && memcmp(window, data + offset, n) == 0;
+            offset += n;
+            input_source_release(&src, offset);
+        }
+        TEST_ASSERT(window != NULL && same && offset == size, "Windows cover the file in order");
+        
+        // Released bytes can still be read
+        window = input_source_rewind(&src) == 0 ? input_source_next(&src, buffer, 4096, &n) : NULL;
+        TEST_ASSERT(window && n == 4096 && memcmp(window, data, n) == 0, "Rewound source starts over");
+        input_source_close(&src);
+    }
+    
+    // Small files are always read
+    f = fopen(path, "wb");
+    if (f) {
+        fwrite(data, 1, 1000, f);
+        fclose(f);
+    }
+    input_source_t src;
+    TEST_ASSERT(input_source_open(&src, path, true) == 0 && !input_source_mapped(&src) && src.size == 1000,
+                "Small file is read, not mapped");
+    input_source_close(&src);
+    TEST_ASSERT(input_source_open(&src, "/tmp/gbzip_test_no_such_file", true) != 0, "Missing file fails to open");
+    
+    // Placement on disk: asked twice, the answer is the same (filesystems
+    // without FIEMAP give none), and missing files have none
+    f = fopen(path, "r+b");
+    if (f) {
+        fflush(f);
+        fsync(fileno(f));
+        fclose(f);
+    }
+    uint64_t first = 0, second = 0;
+    bool placed = input_source_disk_offset(path, &first);
+    TEST_ASSERT(placed == input_source_disk_offset(path, &second) && (!placed || first == second),
+                "Disk offset is stable");
+    TEST_ASSERT(!input_source_disk_offset("/tmp/gbzip_test_no_such_file", &first), "Missing file has no disk offset");
+    
+    unlink(path);
+    free(buffer);
+    free(data);
+    return EXIT_SUCCESS;
+}
+
+int test_batch_reader(void) {
+    printf("\n=== Testing batch reader ===\n");
+    
+    // Memory sources hand out the caller's bytes like a mapping
+    const unsigned char bytes[] = "in memory";
+    input_source_t src;
+    input_source_open_memory(&src, bytes, 9, 0100644);
+    size_t n = 0;
+    const unsigned char* window = input_source_next(&src, NULL, 4, &n);
+    TEST_ASSERT(input_source_mapped(&src) && window == bytes && n == 4, "Memory source points into memory");
+    window = input_source_next(&src, NULL, 100, &n);
+    TEST_ASSERT(window == bytes + 4 && n == 5 && input_source_rewind(&src) == 0 && src.offset == 0,
+                "Memory source ends with the data and rewinds");
+    input_source_close(&src);
+    
+    batch_reader_t* reader = batch_reader_create();
+    if (!reader) {
+        printf("  - Batched reads unavailable here, skipping\n");
+        return EXIT_SUCCESS;
+    }
+    
+    // More files than one batch holds, plus files the reader leaves alone
+    const char* dir = "/tmp/gbzip_test_batch_reader";
+    remove_tree(dir);
+    mkdir_p("/tmp/gbzip_test_batch_reader/sub");
+    enum { FILES = BATCH_READER_DEPTH + 7 };
+    static char paths[FILES + 3][PATH_MAX];
+    batch_read_t reads[FILES + 3];
+    memset(reads, 0, sizeof(reads));
+    for (int i = 0; i < FILES; i++) {
+        snprintf(paths[i], PATH_MAX, "%s/f%d.txt", dir, i);
+        char content[64];
+        snprintf(content, sizeof(content), "file %d%.*s", i, i, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
+        create_test_file(paths[i], i == 0 ? "" : content);
+        reads[i].path = paths[i];
+        reads[i].max_size = 1024;
+    }
+    snprintf(paths[FILES], PATH_MAX, "%s/sub", dir);
+    snprintf(paths[FILES + 1], PATH_MAX, "%s/missing", dir);
+    snprintf(paths[FILES + 2], PATH_MAX, "%s/f%d.txt", dir, FILES - 1);
+    for (int i = FILES; i < FILES + 3; i++) {
+        reads[i].path = paths[i];
+        reads[i].max_size = i == FILES + 2 ? 4 : 1024;
+    }
+    
+    size_t done = batch_reader_read(reader, reads, FILES + 3);
+    TEST_ASSERT(done == FILES, "Every regular file within the limit read");
+    TEST_ASSERT(reads[0].read && reads[0].size == 0 && reads[0].data == NULL, "Empty file read without a buffer");
+    
+    bool same = true;
+    for (int i = 1; i < FILES; i++) {
+        char content[64];
+        int len = snprintf(content, sizeof(content), "file %d%.*s", i, i,
+                           "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
+        same = same && reads[i].read && reads[i].size == (uint64_t)len &&
+               memcmp(reads[i].data, content, (size_t)len) == 0 && S_ISREG(reads[i].mode);
+        free(reads[i].data);
+    }
+    TEST_ASSERT(same, "Contents and modes match the files");
+    TEST_ASSERT(!reads[FILES].read && !reads[FILES + 1].read && !reads[FILES + 2].read,
+                "Directories, missing files and files over the limit are left to the caller");
+    
+    batch_reader_free(reader);
+    remove_tree(dir);
+    return EXIT_SUCCESS;
+}
+
+int test_output_file(void) {
+    printf("\n=== Testing output files ===\n");
+    
+    const char* archive_path = "/tmp/gbzip_test_output_file.zip";
+    const char* output_path = "/tmp/gbzip_test_output_file.out";
+    archive_writer_t writer;
+    TEST_ASSERT(archive_writer_open(&writer, archive_path) == EXIT_SUCCESS &&
+                add_stored_entry(&writer, "first.txt", "first entry") == EXIT_SUCCESS &&
+                add_stored_entry(&writer, "second.txt", "the second entry") == EXIT_SUCCESS &&
+                archive_writer_close(&writer) == EXIT_SUCCESS, "Archive with stored entries written");
+    
+    uint64_t* offsets = NULL;
+    size_t count = 0;
+    TEST_ASSERT(archive_read_header_offsets(archive_path, &offsets, &count) == EXIT_SUCCESS && count == 2,
+                "Local header offsets read back");
+    TEST_ASSERT(count == 2 && offsets[0] == 0 && offsets[1] == 30 + strlen("first.txt") + strlen("first entry"),
+                "Offsets are in central directory order");
+    
+    FILE* archive = fopen(archive_path, "rb");
+    uint64_t data_offset = 0;
+    TEST_ASSERT(archive && count == 2 && archive_entry_data_offset(archive, offsets[1], &data_offset) &&
+                data_offset == offsets[1] + 30 + strlen("second.txt"), "Data offset found from the local header");
+    TEST_ASSERT(archive && !archive_entry_data_offset(archive, 5, &data_offset), "No local header at a bad offset");
+    
+    FILE* output = fopen(output_path, "w+b");
+    if (archive && output && count == 2) {
+        archive_entry_data_offset(archive, offsets[1], &data_offset);
+        
+        output_file_preallocate(output, 4 * OUTPUT_PREALLOCATE_MIN_SIZE);
+        TEST_ASSERT(get_file_size(output_path) == 0, "Preallocation keeps the file size");
+        
+        fputs(">", output);
+        bool copied = output_file_copy_range(output, archive, data_offset, strlen("the second entry"));
+        fputs("<", output);
+        fflush(output);
+        char text[64] = { 0 };
+        rewind(output);
+        size_t n = fread(text, 1, sizeof(text) - 1, output);
+#ifdef OUTPUT_FILE_HAVE_COPY_RANGE
+        TEST_ASSERT(copied && n == 18 && strcmp(text, ">the second entry<") == 0, "Range copied after buffered output");
+#else
+        TEST_ASSERT(!copied && n == 2 && strcmp(text, "><") == 0, "No in-kernel copy on this platform");
+#endif
+        
+        // A range past the end of the archive leaves the output as it was
+        fseek(output, 0, SEEK_END);
+        uint64_t end = (uint64_t)get_file_size(archive_path);
+        TEST_ASSERT(!output_file_copy_range(output, archive, end - 4, 64) && get_file_size(output_path) == (off_t)n,
+                    "Short copy is undone");
+    }
+    if (output) fclose(output);
+    if (archive) fclose(archive);
+    
+    free(offsets);
+    unlink(output_path);
+    unlink(archive_path);
+    return EXIT_SUCCESS;
+}
+
+int test_entry_select(void) {
+    printf("\n=== Testing entry selection ===\n");
+    
+    entry_select_t select;
+    TEST_ASSERT(entry_select_init(&select, NULL, 0) == EXIT_SUCCESS && entry_select_match(&select, "any/file"),
+                "No selectors select everything");
+    entry_select_free(&select);
+    
+    const char* plain[] = { "etc/app.conf", "docs" };
+    TEST_ASSERT(entry_select_init(&select, plain, 2) == EXIT_SUCCESS && select.literal, "Plain paths can be looked up");
+    TEST_ASSERT(entry_select_match(&select, "etc/app.conf"), "Plain path selects its entry");
+    TEST_ASSERT(!entry_select_match(&select, "etc/app.conf.bak") && !entry_select_match(&select, "etc/other.conf"),
+                "Plain path selects nothing else");
+    TEST_ASSERT(entry_select_match(&select, "docs/") && entry_select_match(&select, "docs/a/b.md"),
+                "Plain directory name selects its subtree");
+    TEST_ASSERT(!entry_select_match(&select, "src/docs/a.md"), "Plain names are rooted");
+    entry_select_free(&select);
+    
+    const char* patterns[] = { "*.conf", "src/**/*.c", "!*.old.conf" };
+    TEST_ASSERT(entry_select_init(&select, patterns, 3) == EXIT_SUCCESS && !select.literal,
+                "Patterns need a scan");
+    TEST_ASSERT(entry_select_match(&select, "app.conf") && entry_select_match(&select, "etc/deep/app.conf"),
+                "Basename pattern matches at any depth");
+    TEST_ASSERT(entry_select_match(&select, "src/a/b/main.c") && !entry_select_match(&select, "lib/main.c"),
+                "Path pattern is anchored");
+    TEST_ASSERT(!entry_select_match(&select, "etc/app.old.conf"), "Negation excludes");
+    TEST_ASSERT(!entry_select_match(&select, "README.md"), "Unmatched entry not selected");
+    entry_select_free(&select);
+    
+    // The index that listing reads straight from the central directory
+    const char* path = "/tmp/gbzip_test_index.zip";
+    archive_writer_t writer;
+    archive_entry_info_t info = {
+        .name = "etc/app.conf",
+        .method = ARCHIVE_METHOD_STORE,
+        .crc32 = 0x12345678,
+        .compressed_size = 4,
+        .uncompressed_size = 4,
+        .mtime = 0,
+        .mode = 0
+    };
+    TEST_ASSERT(archive_writer_open(&writer, path) == EXIT_SUCCESS &&
+                archive_writer_add_directory(&writer, "etc/", 0) == EXIT_SUCCESS &&
+                archive_writer_add(&writer, &info, "data") == EXIT_SUCCESS &&
+                archive_writer_close(&writer) == EXIT_SUCCESS, "Archive for the index written");
+    
+    archive_index_t index;
+    TEST_ASSERT(archive_index_load(&index, path) == EXIT_SUCCESS && index.count == 2, "Index loaded");
+    if (index.count == 2) {
+        const archive_index_entry_t* entry = &index.entries[1];
+        TEST_ASSERT(strcmp(index.entries[0].name, "etc/") == 0 && strcmp(entry->name, "etc/app.conf") == 0,
+                    "Names in central directory order");
+        TEST_ASSERT(entry->crc32 == 0x12345678 && entry->compressed_size == 4 && entry->uncompressed_size == 4 &&
+                    entry->method == ARCHIVE_METHOD_STORE, "Entry metadata read back");
+        TEST_ASSERT(entry->local_header_offset == 30 + strlen("etc/"), "Local header offset read back");
+    }
+    archive_index_free(&index);
+    unlink(path);
+    
+    return EXIT_SUCCESS;
+}
+
+int test_resources(void) {
+    printf("\n=== Testing resource governor ===\n");
+    
+    int detected = resources_cpu_count();
+    TEST_ASSERT(detected >= 1, "At least one CPU detected");
+    TEST_ASSERT(resources_available_memory() > 0, "Available memory detected");
+    
+    resources_configure(3, 64ULL * 1024 * 1024);
+    TEST_ASSERT(resources_cpu_count() == 3, "--threads overrides detection");
+    TEST_ASSERT(resources_memory_limit() == 64ULL * 1024 * 1024, "--memory-limit recorded");
+    TEST_ASSERT(resources_available_memory() <= 64ULL * 1024 * 1024, "Available memory capped by --memory-limit");
+    resources_configure(0, 0);
+    TEST_ASSERT(resources_cpu_count() == detected && resources_memory_limit() == 0, "Overrides cleared");
+    
+    resources_budget_t budget;
+    resources_budget_init(&budget, 256, 1024);
+    TEST_ASSERT(budget.current == 256 && budget.minimum == 256, "Minimum never exceeds the base");
+    resources_budget_init(&budget, 1024, 64);
+    TEST_ASSERT(resources_budget_update(&budget) == 1024, "Budget starts at its base");
+    
+    // Whatever the pressure, the budget stays between its bounds
+    budget.next_check = 0;
+    size_t current = resources_budget_update(&budget);
+    TEST_ASSERT(current >= 64 && current <= 1024, "Budget within bounds after a pressure check");
+    
+    return EXIT_SUCCESS;
+}
+
+static int count_scanned_entry(const file_info_t* info, void* user_data) {
+    (void)info;
+    (*(size_t*)user_data)++;
+    return EXIT_SUCCESS;
+}
+
+int test_metrics(void) {
+    printf("\n=== Testing run metrics ===\n");
+    
+    metrics_init(false, false);
+    TEST_ASSERT(metrics_start() == 0, "Timers are free when metrics are off");
+    metrics_count(METRICS_BYTES_READ, 100);
+    
+    metrics_init(true, true);
+    metrics_phase_begin(METRICS_PHASE_SCAN);
+    metrics_count(METRICS_BYTES_READ, 4096);
+    metrics_count(METRICS_STAT_CALLS, 3);
+    uint64_t start = metrics_start();
+    TEST_ASSERT(start != 0, "Timer starts when metrics are on");
+    metrics_stop(METRICS_TIMER_BUSY, start, "compress");
+    metrics_sample_queue(2);
+    metrics_sample_queue(6);
+    metrics_phase_end(METRICS_PHASE_SCAN);
+    
+    char json[4096] = "";
+    FILE* out = tmpfile();
+    if (out) {
+        metrics_write_json(out);
+        rewind(out);
+        size_t n = fread(json, 1, sizeof(json) - 1, out);
+        json[n] = '\0';
+        fclose(out);
+    }
+    TEST_ASSERT(strstr(json, "\"phases\":{\"scan\":") != NULL, "Used phase reported");
+    TEST_ASSERT(strstr(json, "\"compress\":") == NULL, "Unused phase left out");
+    TEST_ASSERT(strstr(json, "\"bytes_read\":4096,") != NULL && strstr(json, "\"stat_calls\":3,") != NULL,
+                "Counters summed (nothing counted while off)");
+    TEST_ASSERT(strstr(json, "\"queue_depth_max\":6,\"queue_depth_mean\":4.00") != NULL, "Queue depth sampled");
+    TEST_ASSERT(strstr(json, "{\"role\":\"main\",\"index\":0,") != NULL && strstr(json, "\"items\":1,") != NULL,
+                "Main thread slot counts its busy item");
+    
+    const char* prom_path = "/tmp/gbzip_test_metrics.prom";
+    const char* trace_path = "/tmp/gbzip_test_trace.json";
+    TEST_ASSERT(metrics_write_prometheus(prom_path, "create") == EXIT_SUCCESS, "Prometheus textfile written");
+    TEST_ASSERT(metrics_write_trace(trace_path) == EXIT_SUCCESS, "Trace written");
+    
+    char text[8192] = "";
+    FILE* f = fopen(prom_path, "r");
+    if (f) {
+        size_t n = fread(text, 1, sizeof(text) - 1, f);
+        text[n] = '\0';
+        fclose(f);
+    }
+    TEST_ASSERT(strstr(text, "gbzip_phase_seconds{operation=\"create\",phase=\"scan\"} ") != NULL &&
+                strstr(text, "gbzip_bytes_read{operation=\"create\"} 4096\n") != NULL, "Textfile has the metrics");
+    
+    text[0] = '\0';
+    f = fopen(trace_path, "r");
+    if (f) {
+        size_t n = fread(text, 1, sizeof(text) - 1, f);
+        text[n] = '\0';
+        fclose(f);
+    }
+    TEST_ASSERT(strstr(text, "\"name\":\"compress\",\"cat\":\"gbzip\",\"ph\":\"X\"") != NULL &&
+                strstr(text, "\"name\":\"scan\"") != NULL, "Trace has work and phase spans");
+    
+    // Directory scan workers report under their own role
+    const char* scan_root = "/tmp/gbzip_test_metrics_scan";
+    remove_tree(scan_root);
+    mkdir_p("/tmp/gbzip_test_metrics_scan/a/b");
+    mkdir_p("/tmp/gbzip_test_metrics_scan/c");
+    create_test_file("/tmp/gbzip_test_metrics_scan/a/b/x.txt", "x");
+    resources_configure(4, 0);
+    size_t scanned = 0;
+    traverse_directory(scan_root, true, count_scanned_entry, &scanned);
+    resources_configure(0, 0);
+    remove_tree(scan_root);
+    json[0] = '\0';
+    out = tmpfile();
+    if (out) {
+        metrics_write_json(out);
+        rewind(out);
+        size_t n = fread(json, 1, sizeof(json) - 1, out);
+        json[n] = '\0';
+        fclose(out);
+    }
+    TEST_ASSERT(scanned == 4 && strstr(json, "{\"role\":\"scan\",\"index\":0,") != NULL &&
+                strstr(json, "\"role\":\"thread\"") == NULL, "Scan workers named in the report");
+    
+    metrics_shutdown();
+    TEST_ASSERT(!g_metrics_enabled, "Shutdown turns metrics off");
+    unlink(prom_path);
+    unlink(trace_path);
+    return EXIT_SUCCESS;
+}
+
+int test_dir_cache(void) {
+    printf("\n=== Testing directory cache ===\n");
+    
+    dir_cache_t cache;
+    dir_cache_init(&cache);
+    
+    TEST_ASSERT(dir_cache_add(&cache, "solo/dir", 8) == 1, "New directory is added");
+    TEST_ASSERT(dir_cache_add(&cache, "solo/dir/x", 8) == 0, "Duplicate prefix is not added twice");
+    TEST_ASSERT(dir_cache_contains(&cache, "solo/dir", 8), "Added directory is found");
+    TEST_ASSERT(!dir_cache_contains(&cache, "solo", 4), "Ancestor not implied by dir_cache_add");
+    
+    dir_cache_add_entry(&cache, "src/lib/deep/file.c");
+    TEST_ASSERT(dir_cache_contains(&cache, "src/lib/deep", 12), "File entry adds its parent");
+    TEST_ASSERT(dir_cache_contains(&cache, "src/lib", 7) && dir_cache_contains(&cache, "src", 3),
+                "File entry adds its ancestors");
+    TEST_ASSERT(!dir_cache_contains(&cache, "src/lib/deep/file.c", 19), "File itself is not a directory");
+    
+    dir_cache_add_entry(&cache, "src/lib/other.c");
+    dir_cache_add_entry(&cache, "docs/");
+    dir_cache_add_entry(&cache, "README.md");
+    TEST_ASSERT(dir_cache_contains(&cache, "docs", 4), "Directory entry adds itself");
+    TEST_ASSERT(cache.count == 5, "Known and top-level entries add nothing");
+    
+    // Enough entries to force the table to grow
+    char name[64];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "many/d%d/f.txt", i);
+        dir_cache_add_entry(&cache, name);
+    }
+    TEST_ASSERT(cache.count == 1006, "All directories kept across growth");
+    TEST_ASSERT(dir_cache_contains(&cache, "many/d999", 9), "Lookup works after growth");
+    
+    const char* root = "/tmp/gbzip_test_dircache";
+    remove_tree(root);
+    mkdir_p(root);
+    
+    // Deeper than the chain of directories kept open during creation
+    char deep[512] = "a";
+    for (int i = 0; i < 70; i++) strcat(deep, "/n");
+    strcat(deep, "/leaf.txt");
+    dir_cache_add_entry(&cache, deep);
+    dir_cache_add_entry(&cache, "a-b//c/file.txt");
+    
+    TEST_ASSERT(dir_cache_create_all(&cache, root) == EXIT_SUCCESS, "Skeleton created");
+    TEST_ASSERT(is_directory("/tmp/gbzip_test_dircache/src/lib/deep"), "Nested directory exists");
+    TEST_ASSERT(is_directory("/tmp/gbzip_test_dircache/many/d512"), "Sibling directory exists");
+    TEST_ASSERT(is_directory("/tmp/gbzip_test_dircache/a-b/c"), "Empty path component tolerated");
+    deep[strlen(deep) - strlen("/leaf.txt")] = '\0';
+    char deep_path[600];
+    snprintf(deep_path, sizeof(deep_path), "%s/%s", root, deep);
+    TEST_ASSERT(is_directory(deep_path), "Very deep directory exists");
+    TEST_ASSERT(dir_cache_create_all(&cache, root) == EXIT_SUCCESS, "Re-creating existing skeleton succeeds");
+    
+    dir_cache_free(&cache);
+    remove_tree(root);
+    
+    return EXIT_SUCCESS;
+}
+
+int test_string_pool(void) {
+    printf("\n=== Testing string pool ===\n");
+    
+    string_pool_t pool;
+    string_pool_init(&pool);
+    
+    char* first = string_pool_strndup(&pool, "src/main.c trailing", 10);
+    char* second = string_pool_strdup(&pool, "docs/");
+    TEST_ASSERT(first && strcmp(first, "src/main.c") == 0, "Prefix copied and terminated");
+    TEST_ASSERT(second && strcmp(second, "docs/") == 0, "Whole string copied");
+    TEST_ASSERT(pool.bytes == 17, "Bytes include terminators");
+    
+    // Larger than a block, then small strings keep filling the current block
+    size_t big_len = 200 * 1024;
+    char* text = malloc(big_len + 1);
+    memset(text, 'x', big_len);
+    text[big_len] = '\0';
+    char* big = string_pool_strdup(&pool, text);
+    char* third = string_pool_strdup(&pool, "after");
+    TEST_ASSERT(big && strlen(big) == big_len, "Oversized string stored");
+    TEST_ASSERT(third == second + strlen("docs/") + 1, "Current block still used after oversized string");
+    free(text);
+    
+    // Earlier copies survive any number of new blocks
+    char name[64];
+    for (int i = 0; i < 20000; i++) {
+        snprintf(name, sizeof(name), "many/d%d/f.txt", i);
+        string_pool_strdup(&pool, name);
+    }
+    TEST_ASSERT(strcmp(first, "src/main.c") == 0 && strcmp(third, "after") == 0,
+                "Pointers stay valid as the pool grows");
+    
+    string_pool_free(&pool);
+    TEST_ASSERT(pool.blocks == NULL && pool.bytes == 0, "Free resets the pool");
+    
+    return EXIT_SUCCESS;
+}
+
+int test_fingerprint_cache(void) {
+    printf("\n=== Testing fingerprint cache ===\n");
+    
+    // Reference XXH64 values
+    TEST_ASSERT(fingerprint_hash("", 0) == 0xEF46DB3751D8E999ULL, "Hash of empty input");
+    TEST_ASSERT(fingerprint_hash("abc", 3) == 0x44BC2CF5AD770999ULL, "Hash of short input");
+    
+    // Streaming over a file agrees with the one-shot hash and with zlib
+    const char* data_path = "/tmp/gbzip_test_fingerprint.txt";
+    char text[3000];
+    for (size_t i = 0; i < sizeof(text); i++) text[i] = (char)('a' + i % 23);
+    FILE* f = fopen(data_path, "wb");
+    if (f) {
+        fwrite(text, 1, sizeof(text), f);
+        fclose(f);
+    }
+    uint64_t hash = 0;
+    uint32_t crc = 0;
+    TEST_ASSERT(fingerprint_file(data_path, &hash, &crc) == EXIT_SUCCESS, "File fingerprinted");
+    TEST_ASSERT(hash == fingerprint_hash(text, sizeof(text)), "File hash matches buffer hash");
+    TEST_ASSERT(crc == compress_crc32((const unsigned char*)text, sizeof(text)), "File CRC matches");
+    
+    fingerprint_key_t key, again;
+    uint32_t mode = 0;
+    TEST_ASSERT(fingerprint_stat(data_path, &key, &mode) && key.size == sizeof(text) && S_ISREG(mode),
+                "File version read");
+    TEST_ASSERT(fingerprint_stat(data_path, &again, NULL) && fingerprint_key_equal(&key, &again),
+                "Same version compares equal");
+    again.mtime_ns++;
+    TEST_ASSERT(!fingerprint_key_equal(&key, &again), "Touched file is a new version");
+    
+    // Entries by path and by content
+    fingerprint_cache_t cache;
+    fingerprint_cache_init(&cache);
+    char name[64];
+    for (int i = 0; i < 3000; i++) {
+        snprintf(name, sizeof(name), "dir/file%d.txt", i);
+        fingerprint_entry_t* entry = fingerprint_cache_put(&cache, name);
+        if (!entry) break;
+        entry->key = key;
+        entry->key.inode = (uint64_t)i;
+        entry->hash = (uint64_t)i * 7919;
+        entry->hash_known = true;
+        entry->crc32 = (uint32_t)i;
+        entry->data_offset = i % 2 ? 1000 + (uint64_t)i : 0;
+        entry->seen = i % 3 != 0;
+    }
+    TEST_ASSERT(cache.count == 3000, "Entries added");
+    TEST_ASSERT(fingerprint_cache_put(&cache, "dir/file7.txt") == fingerprint_cache_find(&cache, "dir/file7.txt") &&
+                cache.count == 3000, "Existing entry returned by put");
+    TEST_ASSERT(fingerprint_cache_find(&cache, "dir/file7") == NULL, "Unknown path not found");
+    
+    const fingerprint_entry_t* source = fingerprint_cache_find_content(&cache, 7 * 7919, key.size, 7);
+    TEST_ASSERT(source && strcmp(source->path, "dir/file7.txt") == 0, "Entry found by content");
+    TEST_ASSERT(fingerprint_cache_find_content(&cache, 8 * 7919, key.size, 8) == NULL,
+                "Entry without data offset is no source");
+    TEST_ASSERT(fingerprint_cache_find_content(&cache, 7 * 7919, key.size, 8) == NULL, "CRC must match too");
+    
+    // Only seen entries survive a save and load
+    const char* archive_path = "/tmp/gbzip_test_fingerprint.zip";
+    TEST_ASSERT(fingerprint_cache_save(&cache, archive_path) == EXIT_SUCCESS, "Cache saved");
+    fingerprint_cache_free(&cache);
+    
+    fingerprint_cache_init(&cache);
+    TEST_ASSERT(fingerprint_cache_load(&cache, archive_path) == EXIT_SUCCESS && cache.count == 2000,
+                "Seen entries loaded");
+    fingerprint_entry_t* entry = fingerprint_cache_find(&cache, "dir/file7.txt");
+    TEST_ASSERT(entry && entry->hash == 7 * 7919 && entry->crc32 == 7 && entry->data_offset == 1007 &&
+                entry->key.inode == 7 && entry->key.mtime_ns == key.mtime_ns && entry->hash_known,
+                "Entry fields round-trip");
+    TEST_ASSERT(fingerprint_cache_find(&cache, "dir/file6.txt") == NULL, "Unseen entry dropped");
+    
+    fingerprint_cache_clear_offsets(&cache);
+    TEST_ASSERT(fingerprint_cache_find_content(&cache, 7 * 7919, key.size, 7) == NULL,
+                "Cleared offsets are no source");
+    fingerprint_cache_free(&cache);
+    
+    // A damaged cache is ignored
+    char cache_path[PATH_MAX];
+    snprintf(cache_path, sizeof(cache_path), "%s%s", archive_path, FINGERPRINT_CACHE_SUFFIX);
+    f = fopen(cache_path, "r+b");
+    if (f) {
+        fseek(f, -5, SEEK_END);
+        fputc('x', f);
+        fseek(f, 0, SEEK_END);
+        fputc('x', f);
+        fclose(f);
+    }
+    fingerprint_cache_init(&cache);
+    TEST_ASSERT(fingerprint_cache_load(&cache, archive_path) == EXIT_SUCCESS && cache.count == 0,
+                "Damaged cache starts empty");
+    fingerprint_cache_free(&cache);
+    unlink(cache_path);
+    
+    fingerprint_cache_init(&cache);
+    TEST_ASSERT(fingerprint_cache_load(&cache, archive_path) == EXIT_SUCCESS && cache.count == 0,
+                "Missing cache starts empty");
+    fingerprint_cache_free(&cache);
+    
+    // Archived data copied into a new entry, from a removed entry too
+    archive_writer_t writer;
+    TEST_ASSERT(archive_writer_open(&writer, archive_path) == EXIT_SUCCESS &&
+                add_stored_entry(&writer, "old.txt", "moved content") == EXIT_SUCCESS &&
+                archive_writer_close(&writer) == EXIT_SUCCESS, "Source archive written");
+    TEST_ASSERT(archive_writer_open_append(&writer, archive_path) == EXIT_SUCCESS &&
+                archive_writer_remove(&writer, "old.txt") == 1, "Source entry removed");
+    
+    uint64_t data_offset = 30 + strlen("old.txt");
+    archive_entry_info_t info = {
+        .name = "new.txt",
+        .method = ARCHIVE_METHOD_STORE,
+        .crc32 = compress_crc32((const unsigned char*)"moved content", 13),
+        .compressed_size = 13,
+        .uncompressed_size = 13
+    };
+    TEST_ASSERT(archive_writer_add_existing(&writer, &info, "old.txt", data_offset + 1) == ARCHIVE_NO_SOURCE,
+                "Wrong data offset rejected");
+    TEST_ASSERT(archive_writer_add_existing(&writer, &info, "other.txt", data_offset) == ARCHIVE_NO_SOURCE,
+                "Unknown source rejected");
+    info.crc32++;
+    TEST_ASSERT(archive_writer_add_existing(&writer, &info, "old.txt", data_offset) == ARCHIVE_NO_SOURCE,
+                "Different contents rejected");
+    info.crc32--;
+    TEST_ASSERT(archive_writer_add_existing(&writer, &info, "old.txt", data_offset) == EXIT_SUCCESS,
+                "Data copied from the removed entry");
+    uint64_t new_offset = writer.records[writer.record_count - 1].data_offset;
+    TEST_ASSERT(add_stored_entry(&writer, "after.txt", "later") == EXIT_SUCCESS &&
+                archive_writer_close(&writer) == EXIT_SUCCESS, "Archive closed after the copy");
+    
+    unsigned char buf[512];
+    f = fopen(archive_path, "rb");
+    size_t n = f ? fread(buf, 1, sizeof(buf), f) : 0;
+    if (f) fclose(f);
+    TEST_ASSERT(new_offset + 13 <= n && memcmp(buf + new_offset, "moved content", 13) == 0 &&
+                memcmp(buf + new_offset + 13, "PK\x03\x04", 4) == 0, "Copied data followed by the next entry");
+    TEST_ASSERT(memcmp(buf + n - 22, "PK\x05\x06", 4) == 0 && buf[n - 22 + 10] == 2,
+                "Central directory lists the copy and the new entry");
+    
+    unlink(archive_path);
+    unlink(data_path);
+    return EXIT_SUCCESS;
+}
+
+typedef struct {
+    char paths[16][PATH_MAX];
+    bool dirs[16];
+    off_t sizes[16];
+    int count;
+} scan_log_t;
+
+static int record_scan_entry(const file_info_t* info, void* user_data) {
+    scan_log_t* log = (scan_log_t*)user_data;
+    if (log->count >= 16) return EXIT_FAILURE;
+    strcpy(log->paths[log->count], info->path);
+    log->dirs[log->count] = info->is_directory;
+    log->sizes[log->count] = info->size;
+    log->count++;
+    return EXIT_SUCCESS;
+}
+
+static int skip_sub_entry(const file_info_t* info, void* user_data) {
+    if (info->is_directory && strcmp(get_filename(info->path), "sub") == 0) {
+        record_scan_entry(info, user_data);
+        return TRAVERSE_SKIP_SUBTREE;
+    }
+    return record_scan_entry(info, user_data);
+}
+
+int test_traverse_directory(void) {
+    printf("\n=== Testing Directory Traversal ===\n");
+    
+    const char* root = "/tmp/gbzip_test_scan";
+    remove_tree(root);
+    mkdir_p("/tmp/gbzip_test_scan/sub/deeper");
+    mkdir_p("/tmp/gbzip_test_scan/empty");
+    create_test_file("/tmp/gbzip_test_scan/b.txt", "bb");
+    create_test_file("/tmp/gbzip_test_scan/a.txt", "a");
+    create_test_file("/tmp/gbzip_test_scan/sub/c.txt", "ccc");
+    create_test_file("/tmp/gbzip_test_scan/sub/deeper/d.txt", "dddd");
+    mkfifo("/tmp/gbzip_test_scan/sub/pipe", 0644);
+    
+    // Pre-order, each directory sorted by name, special files left out
+    static scan_log_t log;
+    memset(&log, 0, sizeof(log));
+    TEST_ASSERT(traverse_directory(root, true, record_scan_entry, &log) == EXIT_SUCCESS, "Recursive traversal succeeds");
+    TEST_ASSERT(log.count == 7, "All files and directories visited once");
+    TEST_ASSERT(strcmp(log.paths[0], "/tmp/gbzip_test_scan/a.txt") == 0, "Entries sorted by name");
+    TEST_ASSERT(log.sizes[0] == 1 && !log.dirs[0], "File size from the single stat");
+    TEST_ASSERT(strcmp(log.paths[1], "/tmp/gbzip_test_scan/b.txt") == 0, "Second entry");
+    TEST_ASSERT(strcmp(log.paths[2], "/tmp/gbzip_test_scan/empty") == 0 && log.dirs[2], "Empty directory reported");
+    TEST_ASSERT(strcmp(log.paths[3], "/tmp/gbzip_test_scan/sub") == 0, "Directory before its contents");
+    TEST_ASSERT(strcmp(log.paths[4], "/tmp/gbzip_test_scan/sub/c.txt") == 0, "File inside subdirectory");
+    TEST_ASSERT(strcmp(log.paths[5], "/tmp/gbzip_test_scan/sub/deeper") == 0, "Nested directory");
+    TEST_ASSERT(strcmp(log.paths[6], "/tmp/gbzip_test_scan/sub/deeper/d.txt") == 0 && log.sizes[6] == 4, "Deepest file");
+    
+    memset(&log, 0, sizeof(log));
+    TEST_ASSERT(traverse_directory("/tmp/gbzip_test_scan/", false, record_scan_entry, &log) == EXIT_SUCCESS, "Flat traversal succeeds");
+    TEST_ASSERT(log.count == 4, "Flat traversal stays in the top directory");
+    TEST_ASSERT(strcmp(log.paths[3], "/tmp/gbzip_test_scan/sub") == 0, "No doubled separator after a trailing slash");
+    
+    // Pruned directories are reported but not descended into
+    memset(&log, 0, sizeof(log));
+    TEST_ASSERT(traverse_directory(root, true, skip_sub_entry, &log) == EXIT_SUCCESS, "Traversal with pruning succeeds");
+    TEST_ASSERT(log.count == 4, "Nothing below the pruned directory visited");
+    TEST_ASSERT(strcmp(log.paths[3], "/tmp/gbzip_test_scan/sub") == 0, "Pruned directory itself reported");
+    
+    // A callback error stops the scan
+    memset(&log, 0, sizeof(log));
+    log.count = 15;
+    TEST_ASSERT(traverse_directory(root, true, record_scan_entry, &log) == EXIT_FAILURE, "Callback failure is returned");
+    TEST_ASSERT(traverse_directory("/tmp/gbzip_test_scan/missing", true, record_scan_entry, &log) == EXIT_FAILURE, "Missing directory fails");
+    
+    remove_tree(root);
+    
+    return EXIT_SUCCESS;
+}
+
+// Tally of the events an engine reported
+typedef struct {
+    int files;
+    int ignored;
+    int completed;
+    int errors;
+    bool log_added;
+} engine_events_t;
+
+static void count_engine_event(const gbzip_event_t* event, void* user_data) {
+    engine_events_t* events = user_data;
+    switch (event->type) {
+        case GBZIP_EVENT_FILE:
+            events->files++;
+            if (event->path && strstr(event->path, ".log")) events->log_added = true;
+            break;
+        case GBZIP_EVENT_IGNORED: events->ignored++; break;
+        case GBZIP_EVENT_COMPLETE: events->completed++; break;
+        case GBZIP_EVENT_ERROR: events->errors++; break;
+        default: break;
+    }
+}
+
+// One thread's operations on its own engine
+typedef struct {
+    gbzip_engine_t* engine;
+    const char* archive;
+    const char* input;
+    bool fail_once;             // Also add a missing input once
+    int failures;               // Operations that did not return GBZIP_OK
+} engine_runner_t;
+
+static void* run_engine_operations(void* arg) {
+    engine_runner_t* runner = arg;
+    const char* inputs[] = { runner->input };
+    for (int i = 0; i < 3; i++) {
+        if (gbzip_create(runner->engine, runner->archive, inputs, 1, NULL) != GBZIP_OK) runner->failures++;
+    }
+    if (runner->fail_once) {
+        const char* missing[] = { "/tmp/gbzip_test_libgbzip/none" };
+        if (gbzip_create(runner->engine, runner->archive, missing, 1, NULL) != GBZIP_OK) runner->failures++;
+    }
+    return NULL;
+}
+
+int test_libgbzip(void) {
+    printf("\n=== Testing libgbzip engine ===\n");
+    
+    const char* dir = "/tmp/gbzip_test_libgbzip";
+    const char* ignore_path = "/tmp/gbzip_test_libgbzip.ignore";
+    const char* archive_path = "/tmp/gbzip_test_libgbzip.zip";
+    remove_tree(dir);
+    mkdir_p("/tmp/gbzip_test_libgbzip/sub");
+    create_test_file("/tmp/gbzip_test_libgbzip/a.txt", "first file, first file, first file");
+    create_test_file("/tmp/gbzip_test_libgbzip/b.log", "left out");
+    create_test_file("/tmp/gbzip_test_libgbzip/sub/c.txt", "second file");
+    create_test_file(ignore_path, "*.log\n");
+    
+    engine_events_t events;
+    memset(&events, 0, sizeof(events));
+    gbzip_config_t config = { .threads = 2, .ignore_file = ignore_path,
+                              .on_event = count_engine_event, .user_data = &events };
+    gbzip_engine_t* engine = gbzip_engine_new(&config);
+    TEST_ASSERT(engine != NULL, "Engine created with its pool and ignore rules");
+    if (!engine) return EXIT_FAILURE;
+    
+    // Two runs on the same pool and rules
+    const char* inputs[] = { dir };
+    bool same = true;
+    for (int run = 0; run < 2; run++) {
+        memset(&events, 0, sizeof(events));
+        int result = gbzip_create(engine, archive_path, inputs, 1, NULL);
+        uint64_t* offsets = NULL;
+        size_t count = 0;
+        same = same && result == GBZIP_OK &&
+               archive_read_header_offsets(archive_path, &offsets, &count) == EXIT_SUCCESS && count >= 2 &&
+               events.files >= 2 && events.ignored == 1 && events.completed == 1 && events.errors == 0 &&
+               !events.log_added;
+        free(offsets);
+    }
+    TEST_ASSERT(same, "Archives created twice, ignore rules applied, events reported");
+    
+    // Two engines at once, each reporting to its own callback
+    engine_events_t other_events;
+    memset(&events, 0, sizeof(events));
+    memset(&other_events, 0, sizeof(other_events));
+    gbzip_config_t other_config = { .threads = 2, .on_event = count_engine_event, .user_data = &other_events };
+    gbzip_engine_t* other = gbzip_engine_new(&other_config);
+    engine_runner_t runners[2] = {
+        { .engine = engine, .archive = archive_path, .input = dir },
+        { .engine = other, .archive = "/tmp/gbzip_test_libgbzip_other.zip", .input = dir, .fail_once = true }
+    };
+    pthread_t threads[2];
+    bool started = other && pthread_create(&threads[0], NULL, run_engine_operations, &runners[0]) == 0;
+    bool started_other = started && pthread_create(&threads[1], NULL, run_engine_operations, &runners[1]) == 0;
+    if (started) pthread_join(threads[0], NULL);
+    if (started_other) pthread_join(threads[1], NULL);
+    TEST_ASSERT(started_other && runners[0].failures == 0 && runners[1].failures == 1 &&
+                events.completed == 3 && events.errors == 0 && !events.log_added &&
+                other_events.completed == 3 && other_events.errors > 0,
+                "Engines run at once, events kept apart");
+    TEST_ASSERT(log_config_current() == &g_log_config && g_log_config.sink == NULL,
+                "Process logging left alone");
+    gbzip_engine_free(other);
+    unlink("/tmp/gbzip_test_libgbzip_other.zip");
+    
+    gbzip_options_t options = { .level = 12 };
+    TEST_ASSERT(gbzip_create(engine, archive_path, inputs, 1, &options) == GBZIP_INVALID_ARGS,
+                "Out-of-range level rejected");
+    
+    memset(&events, 0, sizeof(events));
+    TEST_ASSERT(gbzip_create(engine, archive_path, (const char*[]){ "/tmp/gbzip_test_libgbzip/none" }, 1,
+                             NULL) != GBZIP_OK && events.errors > 0,
+                "Errors go to the callback");
+    
+    gbzip_engine_free(engine);
+    remove_tree(dir);
+    unlink(ignore_path);
+    unlink(archive_path);
+    return EXIT_SUCCESS;
+}
+
+int test_batch(void) {
+    printf("\n=== Testing batch mode ===\n");
+    
+    batch_job_t job;
+    const char* error = NULL;
+    TEST_ASSERT(batch_parse_line(" {\"archive\": \"out/a.zip\", \"inputs\": [\"src\", \"docs/x.md\"]} ", &job, &error) &&
+                strcmp(job.archive, "out/a.zip") == 0 && job.input_count == 2 &&
+                strcmp(job.inputs[1], "docs/x.md") == 0, "Manifest line parsed");
+    batch_job_free(&job);
+    TEST_ASSERT(batch_parse_line("{\"inputs\":[\"a\\\"b\\\\c\\/d\\u00e9\\ud83d\\ude00\"],\"archive\":\"x.zip\"}", &job, &error) &&
+                job.input_count == 1 && strcmp(job.inputs[0], "a\"b\\c/d\xc3\xa9\xf0\x9f\x98\x80") == 0,
+                "Escapes and surrogate pairs decoded");
+    batch_job_free(&job);
+    TEST_ASSERT(!batch_parse_line("{\"archive\": \"a.zip\", \"inputs\": []}", &job, &error) &&
+                !batch_parse_line("{\"archive\": \"a.zip\"}", &job, &error) &&
+                !batch_parse_line("{\"archive\": \"a.zip\", \"inputs\": [\"a\"], \"level\": 9}", &job, &error) &&
+                !batch_parse_line("{\"archive\": \"a.zip\", \"inputs\": [\"a\"]} x", &job, &error) &&
+                !batch_parse_line("{\"archive\": \"a.zip\", \"inputs\": [\"a\"", &job, &error) &&
+                !batch_parse_line("{\"archive\": \"a\\u0000.zip\", \"inputs\": [\"a\"]}", &job, &error),
+                "Empty inputs, missing keys, unknown keys and trailing text rejected");
+    
+    TEST_ASSERT(batch_concurrency(100, 8, 1024) == 8, "Concurrency bounded by threads");
+    TEST_ASSERT(batch_concurrency(3, 8, 1024) == 3, "Concurrency bounded by jobs");
+    TEST_ASSERT(batch_concurrency(100, 8, 320) == 2 && batch_concurrency(100, 8, 64) == 1,
+                "Concurrency bounded by the open-file limit, never below one");
+    
+    const char* dir = "/tmp/gbzip_test_batch";
+    const char* manifest_path = "/tmp/gbzip_test_batch/jobs.jsonl";
+    remove_tree(dir);
+    mkdir_p("/tmp/gbzip_test_batch/in/one");
+    mkdir_p("/tmp/gbzip_test_batch/in/two");
+    mkdir_p("/tmp/gbzip_test_batch/out");
+    create_test_file("/tmp/gbzip_test_batch/in/one/a.txt", "first archive, first file");
+    create_test_file("/tmp/gbzip_test_batch/in/one/b.txt", "first archive, second file");
+    create_test_file("/tmp/gbzip_test_batch/in/two/c.txt", "second archive");
+    create_test_file("/tmp/gbzip_test_batch/in/d.txt", "in both archives");
+    create_test_file(manifest_path,
+                     "# archives\n"
+                     "{\"archive\": \"/tmp/gbzip_test_batch/out/1.zip\", \"inputs\": [\"/tmp/gbzip_test_batch/in/one\"]}\n"
+                     "\n"
+                     "{\"archive\": \"/tmp/gbzip_test_batch/out/2.zip\", \"inputs\": [\"/tmp/gbzip_test_batch/in/two\", "
+                     "\"/tmp/gbzip_test_batch/in/d.txt\"]}\n"
+                     "{\"archive\": \"/tmp/gbzip_test_batch/out/3.zip\", \"inputs\": [\"/tmp/gbzip_test_batch/in/d.txt\"]}\n");
+    
+    batch_manifest_t manifest;
+    TEST_ASSERT(batch_manifest_load(&manifest, manifest_path) == EXIT_SUCCESS && manifest.count == 3 &&
+                manifest.jobs[0].line == 2 && manifest.jobs[1].line == 4, "Manifest loaded, comments skipped");
+    batch_manifest_free(&manifest);
+    
+    log_config_t saved = g_log_config;
+    log_config_t log_config = {0};
+    log_config.quiet = 1;
+    log_config.output_stream = stdout;
+    init_logging(&log_config);
+    
+    options_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.operation = OP_CREATE;
+    opts.recursive = true;
+    opts.quiet = true;
+    opts.compression_level = 6;
+    opts.batch_file = manifest_path;
+    int result = run_batch(&opts);
+    
+    const char* archives[] = { "/tmp/gbzip_test_batch/out/1.zip", "/tmp/gbzip_test_batch/out/2.zip",
+                               "/tmp/gbzip_test_batch/out/3.zip" };
+    const size_t expected[] = { 2, 2, 1 };
+    bool created = result == EXIT_SUCCESS;
+    for (int i = 0; i < 3; i++) {
+        uint64_t* offsets = NULL;
+        size_t count = 0;
+        created = created && archive_read_header_offsets(archives[i], &offsets, &count) == EXIT_SUCCESS &&
+                  count >= expected[i];
+        free(offsets);
+    }
+    TEST_ASSERT(created, "Every archive of the manifest created on the shared pool");
+    
+    create_test_file(manifest_path,
+                     "{\"archive\": \"/tmp/gbzip_test_batch/out/4.zip\", \"inputs\": [\"/tmp/gbzip_test_batch/in/one\"]}\n"
+                     "{\"archive\": \"/tmp/gbzip_test_batch/out/5.zip\", \"inputs\": [\"/tmp/gbzip_test_batch/none\"]}\n");
+    TEST_ASSERT(run_batch(&opts) != EXIT_SUCCESS && file_exists("/tmp/gbzip_test_batch/out/4.zip"),
+                "A failed archive fails the batch without stopping the others");
+    
+    create_test_file(manifest_path,
+                     "{\"archive\": \"/tmp/gbzip_test_batch/out/6.zip\", \"inputs\": [\"/tmp/gbzip_test_batch/in/one\"]}\n"
+                     "{\"archive\": \"/tmp/gbzip_test_batch/out/6.zip\", \"inputs\": [\"/tmp/gbzip_test_batch/in/two\"]}\n");
+    TEST_ASSERT(run_batch(&opts) == EXIT_INVALID_ARGS && !file_exists("/tmp/gbzip_test_batch/out/6.zip"),
+                "An archive named twice rejects the manifest");
+    
+    g_log_config = saved;
+    remove_tree(dir);
+    return EXIT_SUCCESS;
+}
+
+// A timed item that took `wall` seconds, `cpu` of them computing
+static void record_paced_item(pacer_t* pacer, int level, uint64_t input, uint64_t output, double wall, double cpu) {
+    pacer_sample_t start;
+    pacer_sample(&start);
+    start.wall -= wall;
+    start.cpu -= cpu;
+    pacer_record(pacer, level, input, input, output, &start);
+}
+
+int test_pacer(void) {
+    printf("\n=== Testing adaptive level ===\n");
+    
+    const uint64_t MB = 1024 * 1024;
+    TEST_ASSERT(pacer_create(0, 0, 6) == NULL, "No pacer without a target or deadline");
+    
+    metrics_init(true, false);
+    metrics_set_pace(1000, 0);
+    
+    // 10 MB/s per thread at level 6 on 4 threads
+    pacer_t* slow_target = pacer_create(1, 0, 6);
+    pacer_t* fast_target = pacer_create(1000, 0, 6);
+    pacer_t* io_bound = pacer_create(1000, 0, 6);
+    pacer_t* late = pacer_create(0, 0.05, 9);
+    pacer_t* pacers[] = { slow_target, fast_target, io_bound, late };
+    for (int i = 0; i < 4; i++) {
+        pacer_begin(pacers[i], 100 * MB, 4);
+    }
+    TEST_ASSERT(pacer_level(slow_target) == 6 && pacer_level(late) == 9, "Starts at the run's level");
+    
+    record_paced_item(slow_target, 6, 10 * MB, 3 * MB, 1.0, 1.0);
+    record_paced_item(fast_target, 6, 10 * MB, 3 * MB, 1.0, 1.0);
+    record_paced_item(io_bound, 6, 10 * MB, 3 * MB, 1.0, 0.05);
+    record_paced_item(late, 9, 10 * MB, 3 * MB, 1.0, 1.0);
+    usleep((PACER_INTERVAL_MS + 20) * 1000);
+    
+    TEST_ASSERT(pacer_level(slow_target) == 6, "Keeps the level while the pool is fast enough");
+    TEST_ASSERT(pacer_level(fast_target) == 0, "Stores when every level falls behind");
+    TEST_ASSERT(pacer_level(io_bound) == 6, "Keeps the level when waiting on input dominates");
+    TEST_ASSERT(pacer_level(late) == 0, "Stores once the deadline has passed");
+    
+    pacer_report_t report;
+    pacer_report(io_bound, &report);
+    TEST_ASSERT(report.io_bound && report.target_mbps == 1000 && report.level_input[6] == 10 * MB &&
+                report.level_output[6] == 3 * MB && report.achieved_mbps > 0, "Report shows levels, rate and bound");
+    pacer_report(late, &report);
+    TEST_ASSERT(!report.io_bound && report.deadline == 0.05 && report.target_mbps > 1000,
+                "Deadline reported as the rate it needs");
+    
+    char json[4096] = "";
+    FILE* out = tmpfile();
+    if (out) {
+        metrics_write_json(out);
+        rewind(out);
+        size_t n = fread(json, 1, sizeof(json) - 1, out);
+        json[n] = '\0';
+        fclose(out);
+    }
+    TEST_ASSERT(strstr(json, "\"pace\":{\"target_mbps\":1000.00,") != NULL &&
+                strstr(json, "\"6\":{\"bytes_in\":31457280,\"bytes_out\":9437184}") != NULL &&
+                strstr(json, "\"9\":{\"bytes_in\":10485760,") != NULL, "Levels chosen reported in the metrics");
+    metrics_shutdown();
+    for (int i = 0; i < 4; i++) {
+        pacer_free(pacers[i]);
+    }
+    
+    // A paced run end to end
+    const char* dir = "/tmp/gbzip_test_pacer";
+    const char* archive_path = "/tmp/gbzip_test_pacer.zip";
+    remove_tree(dir);
+    mkdir_p(dir);
+    create_test_file("/tmp/gbzip_test_pacer/a.txt", "paced paced paced paced paced paced paced");
+    create_test_file("/tmp/gbzip_test_pacer/b.txt", "another file, another file, another file");
+    
+    gbzip_config_t config = { .threads = 2 };
+    gbzip_engine_t* engine = gbzip_engine_new(&config);
+    gbzip_options_t options = { .target_mbps = 50 };
+    const char* inputs[] = { dir };
+    uint64_t* offsets = NULL;
+    size_t count = 0;
+    TEST_ASSERT(engine && gbzip_create(engine, archive_path, inputs, 1, &options) == GBZIP_OK &&
+                archive_read_header_offsets(archive_path, &offsets, &count) == EXIT_SUCCESS && count >= 2,
+                "Archive created with a target rate");
+    free(offsets);
+    gbzip_options_t both = { .target_mbps = 50, .deadline = 60 };
+    TEST_ASSERT(engine && gbzip_create(engine, archive_path, inputs, 1, &both) == GBZIP_INVALID_ARGS,
+                "A target rate and a deadline together rejected");
+    
+    gbzip_engine_free(engine);
+    remove_tree(dir);
+    unlink(archive_path);
+    return EXIT_SUCCESS;
+}
+
+// Whether `path` holds exactly `size` bytes of `data`
+static bool file_has_contents(const char* path, const unsigned char* data, size_t size) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+    unsigned char* read_back = malloc(size + 1);
+    bool same = read_back && fread(read_back, 1, size + 1, file) == size && memcmp(read_back, data, size) == 0;
+    free(read_back);
+    fclose(file);
+    return same;
+}
+
+int test_extract(void) {
+    printf("\n=== Testing extraction ===\n");
+    
+    const char* dir = "/tmp/gbzip_test_extract";
+    const char* out_dir = "/tmp/gbzip_test_extract_out";
+    const char* archive_path = "/tmp/gbzip_test_extract.zip";
+    remove_tree(dir);
+    remove_tree(out_dir);
+    mkdir_p(dir);
+    mkdir_p(out_dir);
+    
+    // Large enough to be copied out of the archive by the kernel when stored
+    size_t big_size = 200 * 1024;
+    unsigned char* big = malloc(big_size);
+    if (!big) return EXIT_FAILURE;
+    for (size_t i = 0; i < big_size; i++) big[i] = (unsigned char)(i * 131 + (i >> 9));
+    FILE* file = fopen("/tmp/gbzip_test_extract/big.bin", "wb");
+    if (file) {
+        fwrite(big, 1, big_size, file);
+        fclose(file);
+    }
+    
+    gbzip_config_t config = { .threads = 4 };
+    gbzip_engine_t* engine = gbzip_engine_new(&config);
+    gbzip_options_t store = { .level = GBZIP_LEVEL_STORE, .junk_paths = true };
+    const char* inputs[] = { dir };
+    TEST_ASSERT(engine && gbzip_create(engine, archive_path, inputs, 1, &store) == GBZIP_OK &&
+                gbzip_extract(engine, archive_path, out_dir, NULL, 0) == GBZIP_OK &&
+                file_has_contents("/tmp/gbzip_test_extract_out/big.bin", big, big_size),
+                "Large stored entry extracted intact");
+    
+    // Damage one byte of its data: the copy must not pass it on silently
+    uint64_t* offsets = NULL;
+    size_t count = 0;
+    uint64_t data_offset = 0;
+    bool damaged = false;
+    if (archive_read_header_offsets(archive_path, &offsets, &count) == EXIT_SUCCESS && count == 1) {
+        FILE* archive = fopen(archive_path, "r+b");
+        if (archive && archive_entry_data_offset(archive, offsets[0], &data_offset) &&
+            fseek(archive, (long)(data_offset + big_size / 2), SEEK_SET) == 0) {
+            damaged = fputc(big[big_size / 2] ^ 0xFF, archive) != EOF;
+        }
+        if (archive) fclose(archive);
+    }
+    free(offsets);
+    TEST_ASSERT(damaged && engine && gbzip_extract(engine, archive_path, out_dir, NULL, 0) != GBZIP_OK,
+                "Corrupt stored entry reported");
+    
+    // Entries appended under one name: the last one is extracted, once
+    archive_writer_t writer;
+    bool written = archive_writer_open(&writer, archive_path) == EXIT_SUCCESS;
+    char name[32];
+    char data[32];
+    for (int i = 0; i < 24 && written; i++) {
+        snprintf(name, sizeof(name), i % 3 == 0 ? "dup.txt" : "f%d.txt", i);
+        snprintf(data, sizeof(data), "version %d", i);
+        written = add_stored_entry(&writer, name, data) == EXIT_SUCCESS;
+    }
+    written = archive_writer_close(&writer) == EXIT_SUCCESS && written;
+    remove_tree(out_dir);
+    mkdir_p(out_dir);
+    TEST_ASSERT(written && engine && gbzip_extract(engine, archive_path, out_dir, NULL, 0) == GBZIP_OK &&
+                file_has_contents("/tmp/gbzip_test_extract_out/dup.txt", (const unsigned char*)"version 21", 10) &&
+                file_has_contents("/tmp/gbzip_test_extract_out/f23.txt", (const unsigned char*)"version 23", 10),
+                "Entries sharing a name extracted as the last one");
+    
+    gbzip_engine_free(engine);
+    free(big);
+    remove_tree(dir);
+    remove_tree(out_dir);
+    unlink(archive_path);
+    return EXIT_SUCCESS;
+}
+
+// Deterministic content of the round-trip test's file number `n`
+static void fill_roundtrip_data(unsigned char* data, size_t size, int n) {
+    uint32_t seed = (uint32_t)n * 2654435761u + 1;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (i % 1024 < 700) ? (unsigned char)("roundtrip"[(i + (size_t)n) % 9]) : (unsigned char)(seed >> 24);
+    }
+}
+
+int test_create_roundtrip(void) {
+    printf("\n=== Testing create and extract round trip ===\n");
+    
+    const char* dir = "/tmp/gbzip_test_roundtrip";
+    const char* out_dir = "/tmp/gbzip_test_roundtrip_out";
+    const char* archive_path = "/tmp/gbzip_test_roundtrip.zip";
+    remove_tree(dir);
+    remove_tree(out_dir);
+    mkdir_p(dir);
+    mkdir_p(out_dir);
+    
+    // Many small files, grouped into work units by size, around one file
+    // large enough to be streamed in blocks
+    enum { SMALL_FILES = 300, FILES = SMALL_FILES + 1 };
+    size_t big_size = 17 * 1024 * 1024;
+    unsigned char* data = malloc(big_size);
+    if (!data) return EXIT_FAILURE;
+    char names[FILES][32];
+    size_t sizes[FILES];
+    uint32_t crcs[FILES];
+    char path[256];
+    bool written = true;
+    for (int i = 0; i < FILES; i++) {
+        bool big = i == SMALL_FILES / 2;
+        if (big) {
+            snprintf(names[i], sizeof(names[i]), "m_big.bin");
+        } else {
+            snprintf(names[i], sizeof(names[i]), "%c%03d.txt", i < SMALL_FILES / 2 ? 'a' : 'z', i);
+        }
+        sizes[i] = big ? big_size : (size_t)(i * 37) % 6000;
+        fill_roundtrip_data(data, sizes[i], i);
+        crcs[i] = compress_crc32(data, sizes[i]);
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        FILE* file = fopen(path, "wb");
+        written = written && file && fwrite(data, 1, sizes[i], file) == sizes[i];
+        if (file) fclose(file);
+    }
+    TEST_ASSERT(written, "Round-trip input written");
+    
+    gbzip_config_t config = { .threads = 4 };
+    gbzip_engine_t* engine = gbzip_engine_new(&config);
+    gbzip_options_t options = { .junk_paths = true };
+    const char* inputs[] = { dir };
+    TEST_ASSERT(engine && gbzip_create(engine, archive_path, inputs, 1, &options) == GBZIP_OK,
+                "Archive of small files and a streamed file created");
+    
+    // Entries come out in name order, whichever worker compressed them
+    archive_index_t index;
+    bool loaded = archive_index_load(&index, archive_path) == EXIT_SUCCESS;
+    bool ordered = loaded && index.count == FILES;
+    bool crcs_match = ordered;
+    for (size_t i = 0; ordered && i < index.count; i++) {
+        ordered = strcmp(index.entries[i].name, names[i]) == 0;
+        crcs_match = crcs_match && ordered && index.entries[i].crc32 == crcs[i] &&
+                     index.entries[i].uncompressed_size == sizes[i];
+    }
+    TEST_ASSERT(ordered, "Entries in name order");
+    TEST_ASSERT(crcs_match, "Entry CRCs and sizes match the files");
+    TEST_ASSERT(loaded && index.entries[SMALL_FILES / 2].method == ARCHIVE_METHOD_DEFLATE &&
+                index.entries[SMALL_FILES / 2].compressed_size < big_size,
+                "Streamed file deflated");
+    if (loaded) archive_index_free(&index);
+    
+    bool same = engine && gbzip_extract(engine, archive_path, out_dir, NULL, 0) == GBZIP_OK;
+    for (int i = 0; same && i < FILES; i++) {
+        fill_roundtrip_data(data, sizes[i], i);
+        snprintf(path, sizeof(path), "%s/%s", out_dir, names[i]);
+        same = file_has_contents(path, data, sizes[i]);
+    }
+    TEST_ASSERT(same, "Extracted files match the originals");
+    
+    gbzip_engine_free(engine);
+    free(data);
+    remove_tree(dir);
+    remove_tree(out_dir);
+    unlink(archive_path);
+    return EXIT_SUCCESS;
+}
+
 int main(void) {
     printf("╔══════════════════════════════════════════╗\n");
     printf("║     GBZIP Comprehensive Test Suite       ║\n");
@@ -632,12 +2428,36 @@ int main(void) {
     test_zipignore_negation();
     test_zipignore_nested_files();
     test_zipignore_deeply_nested();
+    test_zipignore_compiled_matcher();
     test_zipignore_edge_cases();
     test_zipignore_gitignore_compatibility();
     test_zipignore_load_unload();
     test_zipignore_duplicate_load_prevention();
     test_path_utilities();
     test_normalize_path();
+    test_parse_size();
+    test_archive_writer();
+    test_archive_writer_stream();
+    test_archive_writer_append();
+    test_chunked_deflate();
+    test_incompressible_detection();
+    test_codecs();
+    test_checksum();
+    test_input_source();
+    test_batch_reader();
+    test_output_file();
+    test_entry_select();
+    test_resources();
+    test_metrics();
+    test_dir_cache();
+    test_string_pool();
+    test_fingerprint_cache();
+    test_traverse_directory();
+    test_libgbzip();
+    test_extract();
+    test_create_roundtrip();
+    test_batch();
+    test_pacer();
     
     printf("\n╔══════════════════════════════════════════╗\n");
     printf("║              TEST RESULTS                ║\n");
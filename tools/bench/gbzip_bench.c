@@ -0,0 +1,920 @@
+// gbzip_bench - reproducible throughput benchmark for the gbzip binary.
+//
+// Generates seeded synthetic corpora, runs gbzip over them (create, list,
+// verify, extract, diff) at several thread counts and compression levels,
+// and writes per-phase wall time, MB/s, peak RSS and CPU utilization as
+// JSON. `compare` checks a run against a baseline and fails on regressions.
+//
+//   gbzip_bench run [options]
+//   gbzip_bench compare <baseline.json> <current.json> [--tolerance <percent>]
+
+// nftw(), futimes() and wait4() are not in C99
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+
+#ifndef PATH_MAX
+    #define PATH_MAX 4096
+#endif
+
+#ifndef GBZIP_BENCH_DEFAULT_BINARY
+    #define GBZIP_BENCH_DEFAULT_BINARY "gbzip"
+#endif
+
+// Bumped whenever corpus generation changes, so stale corpora are rebuilt
+#define CORPUS_VERSION 1
+#define CORPUS_STAMP ".gbzip_bench"
+
+#define MAX_LIST 16
+#define WRITE_CHUNK (1024 * 1024)
+#define DEFAULT_TOLERANCE 10.0       // Percent slower (or larger) that counts as a regression
+#define MIN_COMPARABLE_SECONDS 0.05  // Phases faster than this are noise
+#define MIN_COMPARABLE_RSS_KB 4096   // As are smaller changes in peak RSS
+
+// ============================================================================
+// Seeded generator
+// ============================================================================
+
+typedef struct {
+    uint64_t state;
+} rng_t;
+
+static void rng_seed(rng_t* rng, uint64_t seed) {
+    rng->state = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+// xorshift64*
+static uint64_t rng_next(rng_t* rng) {
+    uint64_t x = rng->state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng->state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t rng_range(rng_t* rng, uint64_t lo, uint64_t hi) {
+    return hi <= lo ? lo : lo + rng_next(rng) % (hi - lo + 1);
+}
+
+static const char* const WORDS[] = {
+    "the", "archive", "static", "return", "buffer", "struct", "const", "int", "while", "for",
+    "thread", "compress", "entry", "header", "offset", "size_t", "if", "else", "void", "char",
+    "memory", "window", "file", "path", "directory", "error", "result", "value", "index", "count",
+    "{", "}", "(", ")", ";", "=", "==", "->", "//", "NULL"
+};
+#define WORD_COUNT (sizeof(WORDS) / sizeof(WORDS[0]))
+
+// Source-like text: deflates to roughly a quarter of its size
+static void fill_text(rng_t* rng, unsigned char* buf, size_t len) {
+    size_t pos = 0;
+    while (pos < len) {
+        uint64_t r = rng_next(rng);
+        const char* word = WORDS[r % WORD_COUNT];
+        size_t n = strlen(word);
+        for (size_t i = 0; i < n && pos < len; i++) buf[pos++] = (unsigned char)word[i];
+        if (pos < len) buf[pos++] = (r >> 32) % 9 == 0 ? '\n' : ' ';
+    }
+}
+
+// Incompressible bytes, standing in for media and already-compressed data
+static void fill_random(rng_t* rng, unsigned char* buf, size_t len) {
+    size_t pos = 0;
+    while (pos + 8 <= len) {
+        uint64_t r = rng_next(rng);
+        memcpy(buf + pos, &r, 8);
+        pos += 8;
+    }
+    uint64_t r = rng_next(rng);
+    memcpy(buf + pos, &r, len - pos);
+}
+
+// ============================================================================
+// Corpora
+// ============================================================================
+
+typedef enum {
+    CONTENT_TEXT,
+    CONTENT_RANDOM,
+    CONTENT_BLEND,               // Alternating text and random 64KB stretches
+    CONTENT_REPEAT               // Log-like, highly repetitive
+} content_t;
+
+typedef struct {
+    const char* name;
+    const char* description;
+} corpus_info_t;
+
+static const corpus_info_t CORPORA[] = {
+    { "tiny",   "1M files of 0-1KB text" },
+    { "medium", "10k files of ~1MB, text and incompressible" },
+    { "huge",   "3 files of 10GB, half incompressible" },
+    { "mixed",  "20k-entry tree of source, media, logs and empty files" },
+};
+#define CORPUS_COUNT (sizeof(CORPORA) / sizeof(CORPORA[0]))
+
+typedef struct {
+    const char* corpus;
+    uint64_t files;
+    uint64_t bytes;
+} corpus_stats_t;
+
+static unsigned char* g_chunk;
+
+static int write_file(const char* path, rng_t* rng, uint64_t size, content_t content) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    uint64_t written = 0;
+    uint64_t stretch = 0;
+    while (written < size) {
+        size_t n = size - written < WRITE_CHUNK ? (size_t)(size - written) : WRITE_CHUNK;
+        switch (content) {
+            case CONTENT_TEXT:
+                fill_text(rng, g_chunk, n);
+                break;
+            case CONTENT_RANDOM:
+                fill_random(rng, g_chunk, n);
+                break;
+            case CONTENT_BLEND:
+                for (size_t off = 0; off < n; off += 65536, stretch++) {
+                    size_t part = n - off < 65536 ? n - off : 65536;
+                    if (stretch % 2) fill_random(rng, g_chunk + off, part);
+                    else fill_text(rng, g_chunk + off, part);
+                }
+                break;
+            case CONTENT_REPEAT:
+                for (size_t off = 0; off < n; off++) g_chunk[off] = "INFO request served\n"[off % 20];
+                break;
+        }
+
+        ssize_t w = write(fd, g_chunk, n);
+        if (w != (ssize_t)n) {
+            fprintf(stderr, "Error: Cannot write %s: %s\n", path, w < 0 ? strerror(errno) : "short write");
+            close(fd);
+            return -1;
+        }
+        written += n;
+    }
+
+    // Fixed mtimes keep archives byte-identical between runs
+    struct timeval times[2] = { { 1700000000, 0 }, { 1700000000, 0 } };
+    futimes(fd, times);
+    close(fd);
+    return 0;
+}
+
+static int make_dir(const char* path) {
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Cannot create directory %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t scaled(uint64_t count, double scale) {
+    uint64_t n = (uint64_t)((double)count * scale + 0.5);
+    return n ? n : 1;
+}
+
+// Write `files` files `size_lo`-`size_hi` bytes into directories of `per_dir`
+static int generate_flat(const char* root, rng_t* rng, uint64_t files, uint64_t per_dir,
+                         uint64_t size_lo, uint64_t size_hi, corpus_stats_t* stats) {
+    char path[PATH_MAX];
+    for (uint64_t i = 0; i < files; i++) {
+        if (i % per_dir == 0) {
+            snprintf(path, sizeof(path), "%s/d%05llu", root, (unsigned long long)(i / per_dir));
+            if (make_dir(path) != 0) return -1;
+        }
+        uint64_t size = rng_range(rng, size_lo, size_hi);
+        content_t content = size_hi > 65536 && rng_next(rng) % 4 == 0 ? CONTENT_RANDOM : CONTENT_TEXT;
+        snprintf(path, sizeof(path), "%s/d%05llu/f%07llu.%s", root, (unsigned long long)(i / per_dir),
+                 (unsigned long long)i, content == CONTENT_RANDOM ? "bin" : "txt");
+        if (write_file(path, rng, size, content) != 0) return -1;
+        stats->files++;
+        stats->bytes += size;
+    }
+    return 0;
+}
+
+static int generate_mixed(const char* root, rng_t* rng, double scale, corpus_stats_t* stats) {
+    static const char* const SOURCE_EXT[] = { "c", "h", "md", "json" };
+    static const char* const MEDIA_EXT[] = { "jpg", "png", "mp4", "zip" };
+    char path[PATH_MAX];
+    uint64_t files = scaled(20000, scale);
+
+    for (uint64_t i = 0; i < files; i++) {
+        // A tree three levels deep with uneven fan-out
+        uint64_t a = i % 7, b = (i / 7) % 13, c = (i / 91) % 29;
+        snprintf(path, sizeof(path), "%s/p%llu", root, (unsigned long long)a);
+        if (make_dir(path) != 0) return -1;
+        snprintf(path, sizeof(path), "%s/p%llu/q%llu", root, (unsigned long long)a, (unsigned long long)b);
+        if (make_dir(path) != 0) return -1;
+        snprintf(path, sizeof(path), "%s/p%llu/q%llu/r%llu", root, (unsigned long long)a, (unsigned long long)b,
+                 (unsigned long long)c);
+        if (make_dir(path) != 0) return -1;
+
+        uint64_t kind = rng_next(rng) % 100;
+        uint64_t size;
+        content_t content;
+        const char* ext;
+        if (kind < 60) {
+            size = rng_range(rng, 1024, 64 * 1024);
+            content = CONTENT_TEXT;
+            ext = SOURCE_EXT[i % 4];
+        } else if (kind < 85) {
+            size = rng_range(rng, 64 * 1024, 8 * 1024 * 1024);
+            content = CONTENT_RANDOM;
+            ext = MEDIA_EXT[i % 4];
+        } else if (kind < 95) {
+            size = rng_range(rng, 4096, 2 * 1024 * 1024);
+            content = CONTENT_REPEAT;
+            ext = "log";
+        } else {
+            size = 0;
+            content = CONTENT_TEXT;
+            ext = "keep";
+        }
+
+        size_t len = strlen(path);
+        snprintf(path + len, sizeof(path) - len, "/m%06llu.%s", (unsigned long long)i, ext);
+        if (write_file(path, rng, size, content) != 0) return -1;
+        stats->files++;
+        stats->bytes += size;
+    }
+    return 0;
+}
+
+static int remove_entry(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void)st;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+static void remove_tree(const char* path) {
+    nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+// Create the corpus under `root`, or reuse it when a previous run made it
+// from the same seed and scale
+static int prepare_corpus(const char* name, const char* root, uint64_t seed, double scale, corpus_stats_t* stats) {
+    char stamp_path[PATH_MAX];
+    char expected[128];
+    snprintf(stamp_path, sizeof(stamp_path), "%s/%s", root, CORPUS_STAMP);
+    snprintf(expected, sizeof(expected), "%d %llu %.6f", CORPUS_VERSION, (unsigned long long)seed, scale);
+
+    FILE* stamp = fopen(stamp_path, "r");
+    if (stamp) {
+        char line[128];
+        unsigned long long files = 0, bytes = 0;
+        bool reuse = fgets(line, sizeof(line), stamp) && strncmp(line, expected, strlen(expected)) == 0 &&
+                     sscanf(line + strlen(expected), " %llu %llu", &files, &bytes) == 2;
+        fclose(stamp);
+        if (reuse) {
+            stats->files = files;
+            stats->bytes = bytes;
+            return 0;
+        }
+    }
+
+    const char* description = "";
+    for (size_t i = 0; i < CORPUS_COUNT; i++) {
+        if (strcmp(CORPORA[i].name, name) == 0) description = CORPORA[i].description;
+    }
+    fprintf(stderr, "Generating %s corpus (%s, scale %g)...\n", name, description, scale);
+    remove_tree(root);
+    if (make_dir(root) != 0) return -1;
+
+    // Each corpus has its own stream, so selecting corpora doesn't change them
+    rng_t rng;
+    uint64_t mix = 0;
+    for (const char* p = name; *p; p++) mix = mix * 131 + (unsigned char)*p;
+    rng_seed(&rng, seed ^ mix);
+
+    int result;
+    if (strcmp(name, "tiny") == 0) {
+        result = generate_flat(root, &rng, scaled(1000000, scale), 1000, 0, 1024, stats);
+    } else if (strcmp(name, "medium") == 0) {
+        result = generate_flat(root, &rng, scaled(10000, scale), 100, 768 * 1024, 1280 * 1024, stats);
+    } else if (strcmp(name, "huge") == 0) {
+        char path[PATH_MAX];
+        uint64_t size = scaled(10ULL * 1024 * 1024 * 1024, scale);
+        result = 0;
+        for (int i = 0; i < 3 && result == 0; i++) {
+            snprintf(path, sizeof(path), "%s/huge%d.dat", root, i);
+            result = write_file(path, &rng, size, CONTENT_BLEND);
+            stats->files++;
+            stats->bytes += size;
+        }
+    } else {
+        result = generate_mixed(root, &rng, scale, stats);
+    }
+    if (result != 0) return result;
+
+    stamp = fopen(stamp_path, "w");
+    if (stamp) {
+        fprintf(stamp, "%s %llu %llu\n", expected, (unsigned long long)stats->files,
+                (unsigned long long)stats->bytes);
+        fclose(stamp);
+    }
+    return 0;
+}
+
+// ============================================================================
+// Running gbzip
+// ============================================================================
+
+typedef struct {
+    double wall;
+    double cpu;                  // User + system seconds
+    long peak_rss_kb;
+    int status;                  // Exit status, or 128 + signal
+} run_result_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Run argv with stdout discarded and stderr appended to `log_path`
+static int run_command(char* const argv[], const char* log_path, run_result_t* result) {
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Error: fork failed: %s\n", strerror(errno));
+        return -1;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDWR);
+        int log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+        }
+        if (log_fd >= 0) dup2(log_fd, STDERR_FILENO);
+        execvp(argv[0], argv);
+        fprintf(stderr, "Error: Cannot run %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        fprintf(stderr, "Error: wait failed: %s\n", strerror(errno));
+        return -1;
+    }
+    result->wall = now_seconds() - start;
+    result->cpu = (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1e6 +
+                  (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1e6;
+#ifdef __APPLE__
+    result->peak_rss_kb = usage.ru_maxrss / 1024;   // Bytes on macOS
+#else
+    result->peak_rss_kb = usage.ru_maxrss;          // Kilobytes on Linux
+#endif
+    result->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return 0;
+}
+
+static uint64_t g_touch_count;
+static time_t g_touch_mtime;
+
+// Move every 100th file's mtime on, so -D has changes to pick up
+static int touch_entry(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void)ftw;
+    if (type == FTW_F && S_ISREG(st->st_mode) && strcmp(path + strlen(path) - strlen(CORPUS_STAMP), CORPUS_STAMP) &&
+        g_touch_count++ % 100 == 0) {
+        struct timeval times[2] = { { 1700000000, 0 }, { g_touch_mtime, 0 } };
+        utimes(path, times);
+    }
+    return 0;
+}
+
+// Undo touch_entry so the next create sees the corpus as generated
+static int untouch_entry(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void)ftw;
+    if (type == FTW_F && S_ISREG(st->st_mode) && st->st_mtime != 1700000000) {
+        struct timeval times[2] = { { 1700000000, 0 }, { 1700000000, 0 } };
+        utimes(path, times);
+    }
+    return 0;
+}
+
+// ============================================================================
+// Benchmark run
+// ============================================================================
+
+typedef struct {
+    const char* gbzip;
+    const char* work_dir;
+    const char* out_path;
+    uint64_t seed;
+    double scale;
+    int repeat;
+    const char* corpora[MAX_LIST];
+    int corpus_count;
+    const char* phases[MAX_LIST];
+    int phase_count;
+    int threads[MAX_LIST];
+    int thread_count;
+    int levels[MAX_LIST];
+    int level_count;
+} bench_config_t;
+
+static const char* const PHASES[] = { "create", "list", "verify", "extract", "diff" };
+#define PHASE_COUNT (sizeof(PHASES) / sizeof(PHASES[0]))
+
+static int split_list(char* text, const char* items[], int max) {
+    int count = 0;
+    for (char* tok = strtok(text, ","); tok && count < max; tok = strtok(NULL, ",")) {
+        items[count++] = tok;
+    }
+    return count;
+}
+
+static int split_ints(char* text, int values[], int max, int lo, int hi) {
+    const char* items[MAX_LIST];
+    int count = split_list(text, items, max);
+    for (int i = 0; i < count; i++) {
+        char* end;
+        long v = strtol(items[i], &end, 10);
+        if (*end != '\0' || v < lo || v > hi) return -1;
+        values[i] = (int)v;
+    }
+    return count;
+}
+
+static bool in_list(const char* const items[], int count, const char* name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(items[i], name) == 0) return true;
+    }
+    return false;
+}
+
+static void json_string(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        if ((unsigned char)*s >= 0x20) fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+// Run one phase `repeat` times and keep the fastest
+static int run_phase(const bench_config_t* config, const char* phase, const char* corpus_dir,
+                     const char* archive, const char* extract_dir, int threads, int level,
+                     const char* log_path, run_result_t* best) {
+    char threads_arg[16];
+    snprintf(threads_arg, sizeof(threads_arg), "%d", threads);
+    const char* level_arg = level == 0 ? "-0" : level == 9 ? "-9" : NULL;
+
+    for (int attempt = 0; attempt < config->repeat; attempt++) {
+        char* argv[16];
+        int argc = 0;
+        argv[argc++] = (char*)config->gbzip;
+        argv[argc++] = "-q";
+        argv[argc++] = "--threads";
+        argv[argc++] = threads_arg;
+
+        if (strcmp(phase, "create") == 0) {
+            unlink(archive);
+            if (level_arg) argv[argc++] = (char*)level_arg;
+            argv[argc++] = (char*)archive;
+            argv[argc++] = (char*)corpus_dir;
+        } else if (strcmp(phase, "list") == 0) {
+            argv[argc++] = "-l";
+            argv[argc++] = (char*)archive;
+        } else if (strcmp(phase, "verify") == 0) {
+            argv[argc++] = "-t";
+            argv[argc++] = (char*)archive;
+        } else if (strcmp(phase, "extract") == 0) {
+            remove_tree(extract_dir);
+            argv[argc++] = "-f";
+            argv[argc++] = "-x";
+            argv[argc++] = "-d";
+            argv[argc++] = (char*)extract_dir;
+            argv[argc++] = (char*)archive;
+        } else {
+            // Each attempt changes the same files again, newer than last time
+            g_touch_count = 0;
+            g_touch_mtime = 1700000000 + 3600 * (attempt + 1);
+            nftw(corpus_dir, touch_entry, 64, FTW_PHYS);
+            if (level_arg) argv[argc++] = (char*)level_arg;
+            argv[argc++] = "-D";
+            argv[argc++] = (char*)archive;
+            argv[argc++] = (char*)corpus_dir;
+        }
+        argv[argc] = NULL;
+
+        run_result_t result;
+        if (run_command(argv, log_path, &result) != 0) return -1;
+        if (attempt == 0 || result.status != 0 || result.wall < best->wall) {
+            long peak = attempt == 0 ? 0 : best->peak_rss_kb;
+            *best = result;
+            if (peak > best->peak_rss_kb) best->peak_rss_kb = peak;
+        }
+        if (result.status != 0) break;
+    }
+
+    if (strcmp(phase, "diff") == 0) {
+        nftw(corpus_dir, untouch_entry, 64, FTW_PHYS);
+    }
+    return 0;
+}
+
+static int bench_run(const bench_config_t* config) {
+    if (strlen(config->work_dir) > PATH_MAX / 4) {
+        fprintf(stderr, "Error: Work directory path too long\n");
+        return EXIT_FAILURE;
+    }
+    if (make_dir(config->work_dir) != 0) return EXIT_FAILURE;
+
+    g_chunk = malloc(WRITE_CHUNK);
+    if (!g_chunk) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE* out = strcmp(config->out_path, "-") == 0 ? stdout : fopen(config->out_path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Cannot write %s: %s\n", config->out_path, strerror(errno));
+        free(g_chunk);
+        return EXIT_FAILURE;
+    }
+
+    char log_path[PATH_MAX];
+    snprintf(log_path, sizeof(log_path), "%s/gbzip.log", config->work_dir);
+
+    struct utsname host;
+    uname(&host);
+    time_t started = time(NULL);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&started));
+
+    fprintf(out, "{\n  \"gbzip_bench\": 1,\n  \"date\": \"%s\",\n  \"gbzip\": ", date);
+    json_string(out, config->gbzip);
+    fprintf(out, ",\n  \"host\": {\"system\": ");
+    json_string(out, host.sysname);
+    fprintf(out, ", \"release\": ");
+    json_string(out, host.release);
+    fprintf(out, ", \"machine\": ");
+    json_string(out, host.machine);
+    fprintf(out, ", \"cpus\": %ld},\n", sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(out, "  \"seed\": %llu,\n  \"scale\": %g,\n  \"repeat\": %d,\n  \"results\": [\n",
+            (unsigned long long)config->seed, config->scale, config->repeat);
+
+    int failures = 0;
+    bool first = true;
+    for (int c = 0; c < config->corpus_count; c++) {
+        const char* name = config->corpora[c];
+        // Half of PATH_MAX leaves room for the names generated below them
+        char corpus_dir[PATH_MAX / 2], archive[PATH_MAX / 2], extract_dir[PATH_MAX / 2];
+        snprintf(corpus_dir, sizeof(corpus_dir), "%s/corpus-%s", config->work_dir, name);
+        snprintf(archive, sizeof(archive), "%s/%s.zip", config->work_dir, name);
+        snprintf(extract_dir, sizeof(extract_dir), "%s/extract-%s", config->work_dir, name);
+
+        corpus_stats_t stats = { .corpus = name };
+        if (prepare_corpus(name, corpus_dir, config->seed, config->scale, &stats) != 0) {
+            failures++;
+            continue;
+        }
+
+        for (int t = 0; t < config->thread_count; t++) {
+            for (int l = 0; l < config->level_count; l++) {
+                int threads = config->threads[t];
+                int level = config->levels[l];
+                for (size_t p = 0; p < PHASE_COUNT; p++) {
+                    const char* phase = PHASES[p];
+                    if (!in_list(config->phases, config->phase_count, phase)) continue;
+
+                    // Every other phase needs the archive
+                    if (p > 0 && !in_list(config->phases, config->phase_count, "create") && access(archive, F_OK) != 0) {
+                        run_result_t ignored;
+                        if (run_phase(config, "create", corpus_dir, archive, extract_dir, threads, level, log_path,
+                                      &ignored) != 0) {
+                            break;
+                        }
+                    }
+
+                    run_result_t result;
+                    if (run_phase(config, phase, corpus_dir, archive, extract_dir, threads, level, log_path,
+                                  &result) != 0) {
+                        failures++;
+                        continue;
+                    }
+                    if (result.status != 0) {
+                        fprintf(stderr, "Warning: %s %s (threads %d, level %d) exited with %d; see %s\n",
+                                name, phase, threads, level, result.status, log_path);
+                        failures++;
+                    }
+
+                    struct stat st;
+                    uint64_t archive_bytes = stat(archive, &st) == 0 ? (uint64_t)st.st_size : 0;
+                    double mb_per_s = result.wall > 0 ? (double)stats.bytes / (1024.0 * 1024.0) / result.wall : 0;
+                    double cpu_util = result.wall > 0 ? result.cpu / result.wall : 0;
+
+                    fprintf(out, "%s    {\"corpus\": \"%s\", \"phase\": \"%s\", \"threads\": %d, \"level\": %d, "
+                            "\"files\": %llu, \"bytes\": %llu, \"archive_bytes\": %llu, \"wall_s\": %.4f, "
+                            "\"mb_per_s\": %.2f, \"peak_rss_kb\": %ld, \"cpu_util\": %.2f, \"status\": %d}",
+                            first ? "" : ",\n", name, phase, threads, level, (unsigned long long)stats.files,
+                            (unsigned long long)stats.bytes, (unsigned long long)archive_bytes, result.wall,
+                            mb_per_s, result.peak_rss_kb, cpu_util, result.status);
+                    fflush(out);
+                    first = false;
+
+                    fprintf(stderr, "%-6s %-7s threads %-3d level %d  %9.3fs %9.1f MB/s %8ld KB  cpu %.2f\n",
+                            name, phase, threads, level, result.wall, mb_per_s, result.peak_rss_kb, cpu_util);
+                }
+            }
+        }
+        remove_tree(extract_dir);
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) fclose(out);
+    free(g_chunk);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// ============================================================================
+// Compare
+// ============================================================================
+
+typedef struct {
+    char corpus[32];
+    char phase[16];
+    int threads;
+    int level;
+    double wall;
+    double mb_per_s;
+    long peak_rss_kb;
+    int status;
+} bench_result_t;
+
+typedef struct {
+    bench_result_t* items;
+    size_t count;
+} bench_results_t;
+
+static const char* json_field(const char* line, const char* key) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+    const char* p = strstr(line, pattern);
+    return p ? p + strlen(pattern) : NULL;
+}
+
+static bool json_text(const char* line, const char* key, char* out, size_t size) {
+    const char* p = json_field(line, key);
+    if (!p || *p != '"') return false;
+    p++;
+    size_t n = 0;
+    while (p[n] && p[n] != '"' && n + 1 < size) n++;
+    memcpy(out, p, n);
+    out[n] = '\0';
+    return true;
+}
+
+static double json_number(const char* line, const char* key) {
+    const char* p = json_field(line, key);
+    return p ? strtod(p, NULL) : 0;
+}
+
+// Results are written one object per line, which is all this reader handles
+static int load_results(const char* path, bench_results_t* results) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    results->items = NULL;
+    results->count = 0;
+    size_t capacity = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        bench_result_t r;
+        memset(&r, 0, sizeof(r));
+        if (!json_text(line, "corpus", r.corpus, sizeof(r.corpus)) ||
+            !json_text(line, "phase", r.phase, sizeof(r.phase))) {
+            continue;
+        }
+        r.threads = (int)json_number(line, "threads");
+        r.level = (int)json_number(line, "level");
+        r.wall = json_number(line, "wall_s");
+        r.mb_per_s = json_number(line, "mb_per_s");
+        r.peak_rss_kb = (long)json_number(line, "peak_rss_kb");
+        r.status = (int)json_number(line, "status");
+
+        if (results->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            bench_result_t* grown = realloc(results->items, capacity * sizeof(bench_result_t));
+            if (!grown) {
+                fclose(f);
+                free(results->items);
+                return -1;
+            }
+            results->items = grown;
+        }
+        results->items[results->count++] = r;
+    }
+    fclose(f);
+
+    if (results->count == 0) {
+        fprintf(stderr, "Error: No results in %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static const bench_result_t* find_result(const bench_results_t* results, const bench_result_t* key) {
+    for (size_t i = 0; i < results->count; i++) {
+        const bench_result_t* r = &results->items[i];
+        if (strcmp(r->corpus, key->corpus) == 0 && strcmp(r->phase, key->phase) == 0 &&
+            r->threads == key->threads && r->level == key->level) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+static int bench_compare(const char* baseline_path, const char* current_path, double tolerance) {
+    bench_results_t baseline, current;
+    if (load_results(baseline_path, &baseline) != 0) return EXIT_FAILURE;
+    if (load_results(current_path, &current) != 0) {
+        free(baseline.items);
+        return EXIT_FAILURE;
+    }
+
+    printf("%-6s %-7s %7s %5s  %10s %10s %8s  %10s %10s %8s\n", "corpus", "phase", "threads", "level",
+           "base s", "now s", "time", "base KB", "now KB", "rss");
+    int regressions = 0;
+    for (size_t i = 0; i < current.count; i++) {
+        const bench_result_t* now = &current.items[i];
+        const bench_result_t* base = find_result(&baseline, now);
+        if (!base) continue;
+
+        double time_delta = base->wall > 0 ? (now->wall - base->wall) / base->wall * 100.0 : 0;
+        double rss_delta = base->peak_rss_kb > 0 ?
+                           (double)(now->peak_rss_kb - base->peak_rss_kb) / (double)base->peak_rss_kb * 100.0 : 0;
+        bool slower = base->wall >= MIN_COMPARABLE_SECONDS && time_delta > tolerance;
+        bool larger = rss_delta > tolerance && now->peak_rss_kb - base->peak_rss_kb >= MIN_COMPARABLE_RSS_KB;
+        bool broke = now->status != 0 && base->status == 0;
+        const char* verdict = broke ? "FAILED" : slower || larger ? "REGRESSION" : "";
+        if (broke || slower || larger) regressions++;
+
+        printf("%-6s %-7s %7d %5d  %10.3f %10.3f %+7.1f%%  %10ld %10ld %+7.1f%%  %s\n", now->corpus, now->phase,
+               now->threads, now->level, base->wall, now->wall, time_delta, base->peak_rss_kb, now->peak_rss_kb,
+               rss_delta, verdict);
+    }
+
+    printf("\n%d regression%s (tolerance %.1f%%)\n", regressions, regressions == 1 ? "" : "s", tolerance);
+    free(baseline.items);
+    free(current.items);
+    return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// ============================================================================
+// Command line
+// ============================================================================
+
+static void print_usage(const char* program) {
+    printf("Usage: %s run [options]\n", program);
+    printf("       %s compare <baseline.json> <current.json> [--tolerance <percent>]\n\n", program);
+    printf("Run options:\n");
+    printf("  --gbzip <path>      gbzip binary to measure (default %s)\n", GBZIP_BENCH_DEFAULT_BINARY);
+    printf("  --work <dir>        corpora, archives and logs (default ./bench-work)\n");
+    printf("  --out <file>        JSON results, - for stdout (default bench.json)\n");
+    printf("  --corpus <list>     corpora to run (default tiny,medium,huge,mixed):\n");
+    for (size_t i = 0; i < CORPUS_COUNT; i++) {
+        printf("                        %-7s %s\n", CORPORA[i].name, CORPORA[i].description);
+    }
+    printf("  --phases <list>     create,list,verify,extract,diff (default all)\n");
+    printf("  --threads <list>    thread counts (default 1 and all CPUs)\n");
+    printf("  --levels <list>     compression levels out of 0,6,9 (default all)\n");
+    printf("  --scale <factor>    shrink file counts and huge file sizes, e.g. 0.01 (default 1)\n");
+    printf("  --seed <n>          corpus seed (default 1)\n");
+    printf("  --repeat <n>        keep the fastest of n runs per phase (default 1)\n\n");
+    printf("compare exits non-zero when a phase got slower or used more memory than the\n");
+    printf("tolerance allows (default %.0f%%), or failed where the baseline passed.\n", DEFAULT_TOLERANCE);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        print_usage(argv[0]);
+        return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (strcmp(argv[1], "compare") == 0) {
+        double tolerance = DEFAULT_TOLERANCE;
+        if (argc == 6 && strcmp(argv[4], "--tolerance") == 0) {
+            tolerance = strtod(argv[5], NULL);
+        } else if (argc != 4) {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return bench_compare(argv[2], argv[3], tolerance);
+    }
+
+    if (strcmp(argv[1], "run") != 0) {
+        fprintf(stderr, "Error: Unknown command '%s'\n", argv[1]);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    static char default_corpora[] = "tiny,medium,huge,mixed";
+    static char default_phases[] = "create,list,verify,extract,diff";
+    bench_config_t config = {
+        .gbzip = GBZIP_BENCH_DEFAULT_BINARY,
+        .work_dir = "bench-work",
+        .out_path = "bench.json",
+        .seed = 1,
+        .scale = 1.0,
+        .repeat = 1,
+        .levels = { 0, 6, 9 },
+        .level_count = 3,
+    };
+    config.corpus_count = split_list(default_corpora, config.corpora, MAX_LIST);
+    config.phase_count = split_list(default_phases, config.phases, MAX_LIST);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    config.threads[config.thread_count++] = 1;
+    if (cpus > 1) config.threads[config.thread_count++] = (int)cpus;
+
+    for (int i = 2; i < argc; i++) {
+        const char* arg = argv[i];
+        char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value) {
+            fprintf(stderr, "Error: %s requires a value\n", arg);
+            return EXIT_FAILURE;
+        }
+        i++;
+
+        bool ok = true;
+        if (strcmp(arg, "--gbzip") == 0) {
+            config.gbzip = value;
+        } else if (strcmp(arg, "--work") == 0) {
+            config.work_dir = value;
+        } else if (strcmp(arg, "--out") == 0) {
+            config.out_path = value;
+        } else if (strcmp(arg, "--corpus") == 0) {
+            config.corpus_count = split_list(value, config.corpora, MAX_LIST);
+            for (int c = 0; c < config.corpus_count; c++) {
+                bool known = false;
+                for (size_t k = 0; k < CORPUS_COUNT; k++) known = known || strcmp(CORPORA[k].name, config.corpora[c]) == 0;
+                ok = ok && known;
+            }
+        } else if (strcmp(arg, "--phases") == 0) {
+            config.phase_count = split_list(value, config.phases, MAX_LIST);
+            for (int p = 0; p < config.phase_count; p++) {
+                ok = ok && in_list(PHASES, PHASE_COUNT, config.phases[p]);
+            }
+        } else if (strcmp(arg, "--threads") == 0) {
+            config.thread_count = split_ints(value, config.threads, MAX_LIST, 1, 256);
+            ok = config.thread_count > 0;
+        } else if (strcmp(arg, "--levels") == 0) {
+            config.level_count = split_ints(value, config.levels, MAX_LIST, 0, 9);
+            ok = config.level_count > 0;
+            for (int l = 0; ok && l < config.level_count; l++) {
+                ok = config.levels[l] == 0 || config.levels[l] == 6 || config.levels[l] == 9;
+            }
+        } else if (strcmp(arg, "--scale") == 0) {
+            config.scale = strtod(value, NULL);
+            ok = config.scale > 0 && config.scale <= 1000;
+        } else if (strcmp(arg, "--seed") == 0) {
+            config.seed = strtoull(value, NULL, 10);
+        } else if (strcmp(arg, "--repeat") == 0) {
+            config.repeat = atoi(value);
+            ok = config.repeat >= 1;
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", arg);
+            return EXIT_FAILURE;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "Error: Invalid value for %s: %s\n", arg, value);
+            return EXIT_FAILURE;
+        }
+    }
+
+    return bench_run(&config);
+}